@@ -0,0 +1,2768 @@
+/* ===========================================================================
+ bench_libCsm500Dev.cpp
+ libCsm500Dev processing benchmarks
+
+ Runs the data processing paths of libCsm500Dev on synthetic frames, so no
+ sm500 hardware is needed.  Run with no arguments to execute every
+ benchmark, or name the benchmarks to run on the command line.
+
+ Jerry Volcy
+
+ Copyright (c) 2013, Micron Optics, Inc.
+=========================================================================== */
+#include <string>
+#include <iostream>
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <unistd.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/ioctl.h>
+
+#include "Csm500Dev.h"
+#include "Csm500ReplayDev.h"
+#include "Csm500Archive.h"
+#include "Csm500PeakCodec.h"
+#include "Csm500FsCodec.h"
+#include "Csm500StreamServer.h"
+#include "Csm500McastPublisher.h"
+#include "Csm500McastReceiver.h"
+#include "Csm500ShmPublisher.h"
+#include "Csm500ShmReader.h"
+#include "Csm500RegShadow.h"
+#include "Csm500LatencyStats.h"
+#include "Csm500SerialTracker.h"
+#include "Csm500RealTime.h"
+#include "sm500_capi.h"
+
+/* ===========================================================================
+Constants
+=========================================================================== */
+#define BENCH_ITERATIONS    20000     //# of frames processed per measurement
+
+
+/* ===========================================================================
+Returns a monotonic time in nano-seconds
+=========================================================================== */
+static double NowNs(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+/* ===========================================================================
+Fills Buffer with a synthetic peaks frame holding PeaksPerChannel peaks on
+every channel.  Buffer must hold sm500_peaks_format::FrameDwords DWORDs.
+=========================================================================== */
+static void MakePeaksFrame(uint32_t *Buffer, uint32_t PeaksPerChannel, uint64_t sn)
+{
+  memset(Buffer, 0, sm500_peaks_format::FrameBytes);
+  Buffer[sm500_peaks_format::SerialLoOffset32] = (uint32_t)sn;
+  Buffer[sm500_peaks_format::SerialHiOffset32] = (uint32_t)(sn >> 32);
+
+  for (uint32_t ch=0; ch<SM500_NUM_CHANNELS; ch++)
+  {
+    uint32_t *block = Buffer + sm500_peaks_format::ChannelOffset32(ch);
+
+    Buffer[sm500_peaks_format::PeakCountOffset32 + ch] = PeaksPerChannel;
+    for (uint32_t i=0; i<PeaksPerChannel; i++)
+    {
+      uint32_t pos = (uint32_t)((i + 0.5) * SM500_NUM_FS_POINTS / PeaksPerChannel * (1 << SM500_PEAK_POS_FRAC_BITS));
+      pos += rand() % 64;
+      block[i] = (pos << SM500_PEAK_POS_SHIFT) | (rand() & SM500_PEAK_AMP_MASK);
+    }
+  }
+}
+
+
+/* ===========================================================================
+The per-value decoding done by consumers before Csm500PeakDecoder existed
+=========================================================================== */
+static void DecodeByHand(const uint32_t *Buffer, const double Coef[][SM500_CAL_ORDER + 1], sm500_peaks_soa &Peaks)
+{
+  uint32_t count = 0;
+
+  for (uint32_t ch=0; ch<SM500_NUM_CHANNELS; ch++)
+  {
+    uint32_t n = Buffer[sm500_peaks_format::PeakCountOffset32 + ch];
+
+    Peaks.ChannelStart[ch] = count;
+    for (uint32_t i=0; i<n; i++)
+    {
+      uint32_t w = Buffer[sm500_peaks_format::ChannelOffset32(ch) + i];
+      double x = sm500_peak_position(w);
+      double wl = 0.0;
+
+      for (int k=SM500_CAL_ORDER; k>=0; k--)
+        wl = wl * x + Coef[ch][k];
+
+      Peaks.Channel[count] = ch;
+      Peaks.Position[count] = x;
+      Peaks.Wavelength[count] = wl;
+      Peaks.Amplitude[count] = sm500_peak_amplitude(w);
+      count++;
+    }
+  }
+  Peaks.ChannelStart[SM500_NUM_CHANNELS] = count;
+  Peaks.Count = count;
+}
+
+
+/* ===========================================================================
+Peak decoding: hand-written scalar path vs. each Csm500PeakDecoder kernel
+=========================================================================== */
+static void BenchPeakDecode(void)
+{
+  static uint32_t frame[sm500_peaks_format::FrameDwords];
+  static sm500_peaks_soa reference, peaks;
+  double coef[SM500_NUM_CHANNELS][SM500_CAL_ORDER + 1];
+  Csm500PeakDecoder decoder;
+  const uint32_t n = SM500_MAX_PEAKS_PER_CHANNEL;
+
+  for (uint32_t ch=0; ch<SM500_NUM_CHANNELS; ch++)
+  {
+    coef[ch][0] = SM500_DEFAULT_WL_START + 0.01 * ch;
+    coef[ch][1] = SM500_DEFAULT_WL_SPAN / SM500_NUM_FS_POINTS;
+    coef[ch][2] = 1e-10;
+    coef[ch][3] = -1e-15;
+    decoder.SetCalibration(ch, coef[ch]);
+  }
+  MakePeaksFrame(frame, n, 1);
+
+  printf("peak decode: %u peaks/frame\n", n * SM500_NUM_CHANNELS);
+
+  double t0 = NowNs();
+  for (int it=0; it<BENCH_ITERATIONS; it++)
+    DecodeByHand(frame, coef, reference);
+  double by_hand = (NowNs() - t0) / BENCH_ITERATIONS;
+  printf("  %-8s %9.1f ns/frame %8.1f Mpeaks/s\n", "by hand", by_hand, reference.Count * 1e3 / by_hand);
+
+  for (int level=SM500_SIMD_SCALAR; level<=SM500_SIMD_AVX2; level++)
+  {
+    decoder.SetSimdLevel((sm500_simd_level)level);
+    if (decoder.GetSimdLevel() != level) continue;    //not supported by this CPU
+
+    t0 = NowNs();
+    for (int it=0; it<BENCH_ITERATIONS; it++)
+      decoder.Decode(Csm500PeaksFrame(frame), peaks);
+    double t = (NowNs() - t0) / BENCH_ITERATIONS;
+
+    //compare against the double precision reference
+    double max_err = 0.0;
+    for (uint32_t i=0; i<peaks.Count; i++)
+    {
+      double err = peaks.Wavelength[i] - reference.Wavelength[i];
+      if (err < 0) err = -err;
+      if (err > max_err) max_err = err;
+    }
+
+    printf("  %-8s %9.1f ns/frame %8.1f Mpeaks/s  x%.1f  max err %.2g pm\n", sm500_simd_name((sm500_simd_level)level),
+           t, peaks.Count * 1e3 / t, by_hand / t, max_err * 1e3);
+  }
+}
+
+
+/* ===========================================================================
+Fills Buffer with a synthetic FS frame: a noisy floor with a few peaks per
+channel.  Buffer must hold sm500_fs_format::FrameBytes bytes.
+=========================================================================== */
+static void MakeFsFrame(void *Buffer, uint64_t sn)
+{
+  uint32_t *header = (uint32_t*)Buffer;
+
+  memset(Buffer, 0, sm500_fs_format::FrameBytes);
+  header[sm500_fs_format::SerialLoOffset32] = (uint32_t)sn;
+  header[sm500_fs_format::SerialHiOffset32] = (uint32_t)(sn >> 32);
+
+  for (uint32_t ch=0; ch<SM500_NUM_CHANNELS; ch++)
+  {
+    uint16_t *data = (uint16_t*)Buffer + sm500_fs_format::ChannelOffset16(ch);
+
+    for (uint32_t i=0; i<SM500_NUM_FS_POINTS; i++)
+    {
+      double y = 8000 + rand() % 200;
+      for (uint32_t pk=0; pk<16; pk++)
+      {
+        double d = (double)i - (pk + 0.5) * SM500_NUM_FS_POINTS / 16 - ch;
+        y += 40000.0 / (1.0 + d * d / 25.0);
+      }
+      data[i] = y > 65535 ? 65535 : (uint16_t)y;
+    }
+  }
+}
+
+
+/* ===========================================================================
+FS conditioning: scalar loop vs. each Csm500FsConditioner kernel, serially
+and across the channels in parallel
+=========================================================================== */
+static void BenchFsCondition(void)
+{
+  static uint8_t frame[sm500_fs_format::FrameBytes];
+  static sm500_fs_spectrum reference, spectrum;
+  static float lut[SM500_FS_LUT_SIZE], baseline[SM500_NUM_FS_POINTS];
+  const int iterations = BENCH_ITERATIONS / 100;
+  Csm500FsConditioner conditioner;
+  Csm500WorkerPool pool;
+
+  MakeFsFrame(frame, 1);
+  for (uint32_t i=0; i<SM500_FS_LUT_SIZE; i++)
+    lut[i] = SM500_DEFAULT_FS_DBM_OFFSET + SM500_DEFAULT_FS_DBM_SCALE * i;
+  for (uint32_t i=0; i<SM500_NUM_FS_POINTS; i++)
+    baseline[i] = 0.001f * (i % 100);
+  for (uint32_t ch=0; ch<SM500_NUM_CHANNELS; ch++)
+  {
+    conditioner.SetBaseline(ch, baseline);
+    conditioner.SetGain(ch, 1.0f + 0.1f * ch);
+  }
+  pool.Start(SM500_NUM_CHANNELS - 1);
+
+  printf("fs conditioning: %u channels x %u points\n", SM500_NUM_CHANNELS, SM500_NUM_FS_POINTS);
+
+  for (int lut_mode=0; lut_mode<2; lut_mode++)
+  {
+    for (uint32_t ch=0; ch<SM500_NUM_CHANNELS; ch++)
+    {
+      if (lut_mode)
+        conditioner.SetLut(ch, lut);
+      else
+      {
+        double coef[4] = { SM500_DEFAULT_FS_DBM_OFFSET, SM500_DEFAULT_FS_DBM_SCALE, 0.0, 0.0 };
+        conditioner.SetPolynomial(ch, coef);
+      }
+    }
+
+    //the hand-written scalar loop consumers used before
+    Csm500FsFrame fs(frame);
+    double t0 = NowNs();
+    for (int it=0; it<iterations; it++)
+      for (uint32_t ch=0; ch<SM500_NUM_CHANNELS; ch++)
+        for (uint32_t i=0; i<SM500_NUM_FS_POINTS; i++)
+        {
+          double y = lut_mode ? lut[fs.begin(ch)[i]] : SM500_DEFAULT_FS_DBM_OFFSET + SM500_DEFAULT_FS_DBM_SCALE * fs.begin(ch)[i];
+          reference.Data[ch][i] = (y - baseline[i]) * (1.0f + 0.1f * ch);
+        }
+    double by_hand = (NowNs() - t0) / iterations;
+    printf("  %-4s %-12s %9.1f us/frame\n", lut_mode ? "lut" : "poly", "by hand", by_hand * 1e-3);
+
+    for (int parallel=0; parallel<2; parallel++)
+    {
+      conditioner.SetWorkerPool(parallel ? &pool : 0);
+      for (int level=SM500_SIMD_SCALAR; level<=SM500_SIMD_AVX2; level++)
+      {
+        conditioner.SetSimdLevel((sm500_simd_level)level);
+        if (conditioner.GetSimdLevel() != level) continue;    //not supported by this CPU
+
+        t0 = NowNs();
+        for (int it=0; it<iterations; it++)
+          conditioner.Condition(fs, spectrum);
+        double t = (NowNs() - t0) / iterations;
+
+        double max_err = 0.0;
+        for (uint32_t ch=0; ch<SM500_NUM_CHANNELS; ch++)
+          for (uint32_t i=0; i<SM500_NUM_FS_POINTS; i++)
+          {
+            double err = spectrum.Data[ch][i] - reference.Data[ch][i];
+            if (err < 0) err = -err;
+            if (err > max_err) max_err = err;
+          }
+
+        string name = string(sm500_simd_name((sm500_simd_level)level)) + (parallel ? " x4" : "");
+        printf("  %-4s %-12s %9.1f us/frame  x%.1f  max err %.2g dB\n", lut_mode ? "lut" : "poly", name.c_str(),
+               t * 1e-3, by_hand / t, max_err);
+      }
+    }
+  }
+}
+
+
+/* ===========================================================================
+Software peak detection on a conditioned synthetic spectrum
+=========================================================================== */
+static void BenchPeakDetect(void)
+{
+  static uint8_t frame[sm500_fs_format::FrameBytes];
+  static sm500_fs_spectrum spectrum;
+  static sm500_peaks_soa peaks;
+  static sm500_peak_metrics metrics;
+  const int iterations = BENCH_ITERATIONS / 100;
+  Csm500FsConditioner conditioner;
+  Csm500PeakDetector detector;
+  Csm500WorkerPool pool;
+
+  MakeFsFrame(frame, 1);
+  conditioner.Condition(Csm500FsFrame(frame), spectrum);
+  pool.Start(SM500_NUM_CHANNELS - 1);
+
+  printf("peak detection: %u channels x %u points\n", SM500_NUM_CHANNELS, SM500_NUM_FS_POINTS);
+
+  for (int parallel=0; parallel<2; parallel++)
+  {
+    detector.SetWorkerPool(parallel ? &pool : 0);
+    for (int level=SM500_SIMD_SCALAR; level<=SM500_SIMD_AVX2; level++)
+    {
+      detector.SetSimdLevel((sm500_simd_level)level);
+      if (detector.GetSimdLevel() != level) continue;    //not supported by this CPU
+
+      double t0 = NowNs();
+      for (int it=0; it<iterations; it++)
+        detector.Detect(spectrum, peaks, &metrics);
+      double t = (NowNs() - t0) / iterations;
+
+      //synthetic peaks sit at (k + 0.5) * N/16 + ch
+      double max_err = 0.0;
+      for (uint32_t i=0; i<peaks.Count; i++)
+      {
+        double expected = (floor(peaks.Position[i] / (SM500_NUM_FS_POINTS / 16)) + 0.5) * SM500_NUM_FS_POINTS / 16 + peaks.Channel[i];
+        double err = fabs(peaks.Position[i] - expected);
+        if (err > max_err) max_err = err;
+      }
+
+      string name = string(sm500_simd_name((sm500_simd_level)level)) + (parallel ? " x4" : "");
+      printf("  %-12s %9.1f us/frame  %u peaks  width %.1f  max err %.3f samples\n", name.c_str(), t * 1e-3,
+             peaks.Count, peaks.Count ? metrics.Width[0] : 0.0f, max_err);
+    }
+  }
+}
+
+
+/* ===========================================================================
+Wavelength calibration: ApplyOffset() against the polynomial, the cost of
+Acquire()/Release() and of an update, models read while another thread
+updates them, and the detector's wavelengths from the FS table
+=========================================================================== */
+static std::atomic<bool> BenchCalStop;
+static uint64_t BenchCalReads, BenchCalTorn;
+
+static void* BenchCalReader(void *Arg)
+{
+  Csm500Calibration *cal = (Csm500Calibration*)Arg;
+
+  while (!BenchCalStop.load(std::memory_order_relaxed))
+  {
+    const sm500_channel_calibration *model = cal->Acquire(0);
+    const double *c = model->Coef;
+    double x = SM500_NUM_FS_POINTS - 1;
+    if ((fabs(model->Lut[0] - c[0]) > 0.01) || (fabs(model->Lut[SM500_NUM_FS_POINTS - 1] - (((c[3] * x + c[2]) * x + c[1]) * x + c[0])) > 0.01))
+      BenchCalTorn++;
+    cal->Release(0, model);
+    BenchCalReads++;
+  }
+  return 0;
+}
+
+static void BenchCalibration(void)
+{
+  const uint32_t num_offsets = 10000;
+  const double offset = 0.0001;
+  static uint8_t frame[sm500_fs_format::FrameBytes];
+  static sm500_fs_spectrum spectrum;
+  static sm500_peaks_soa peaks;
+  double coef[SM500_CAL_ORDER + 1] = { SM500_DEFAULT_WL_START, SM500_DEFAULT_WL_SPAN / SM500_NUM_FS_POINTS, 1e-10, -1e-15 };
+  double model[SM500_CAL_ORDER + 1];
+  Csm500Calibration cal;
+
+  printf("calibration: %u FS points per channel\n", SM500_NUM_FS_POINTS);
+  cal.SetModel(0, coef);
+
+  //---------- many small offsets: the table follows the polynomial ----------
+  double t0 = NowNs();
+  for (uint32_t i=0; i<num_offsets; i++)
+    cal.ApplyOffset(0, offset);
+  double t_offset = (NowNs() - t0) / num_offsets;
+
+  cal.GetModel(0, model);
+  const sm500_channel_calibration *current = cal.Acquire(0);
+  double max_err = 0.0;
+  for (uint32_t i=0; i<SM500_NUM_FS_POINTS; i++)
+  {
+    double x = i;
+    double err = fabs(current->Lut[i] - (((model[3] * x + model[2]) * x + model[1]) * x + model[0]));
+    if (err > max_err) max_err = err;
+  }
+  cal.Release(0, current);
+  double drift = model[0] - (coef[0] + num_offsets * offset);
+  printf("  ApplyOffset()      %9.1f us  %u offsets of %g nm: constant term off by %.2g pm, table vs polynomial %.2g pm: %s\n",
+         t_offset * 1e-3, num_offsets, offset, drift * 1e3, max_err * 1e3, (fabs(drift) < 1e-6) && (max_err < 1e-3) ? "ok" : "WRONG");
+
+  //---------- readers ----------
+  t0 = NowNs();
+  for (int it=0; it<BENCH_ITERATIONS * 100; it++)
+    cal.Release(0, cal.Acquire(0));
+  printf("  Acquire()+Release() %8.1f ns\n", (NowNs() - t0) / (BENCH_ITERATIONS * 100));
+
+  //---------- models read while +1/-1 nm offsets are swapped in ----------
+  pthread_t reader;
+  BenchCalStop = false;
+  BenchCalReads = 0;
+  BenchCalTorn = 0;
+  pthread_create(&reader, 0, BenchCalReader, &cal);
+  for (uint32_t i=0; i<2000; i++)
+    cal.ApplyOffset(0, (i & 1) ? -1.0 : 1.0);
+  BenchCalStop = true;
+  pthread_join(reader, 0);
+  printf("  2000 updates against a reader: %llu models read, %llu inconsistent: %s\n",
+         (unsigned long long)BenchCalReads, (unsigned long long)BenchCalTorn, BenchCalTorn ? "WRONG" : "ok");
+
+  //---------- detected peaks: wavelength from the table vs the polynomial ----------
+  Csm500FsConditioner conditioner;
+  Csm500PeakDetector detector;
+  MakeFsFrame(frame, 1);
+  conditioner.Condition(Csm500FsFrame(frame), spectrum);
+  for (uint32_t ch=0; ch<SM500_NUM_CHANNELS; ch++)
+    cal.SetModel(ch, coef);
+  detector.AttachCalibration(&cal);
+  detector.Detect(spectrum, peaks, 0);
+  max_err = 0.0;
+  for (uint32_t i=0; i<peaks.Count; i++)
+  {
+    double x = peaks.Position[i];
+    double err = fabs(peaks.Wavelength[i] - (((coef[3] * x + coef[2]) * x + coef[1]) * x + coef[0]));
+    if (err > max_err) max_err = err;
+  }
+  printf("  %u detected peaks: table vs polynomial %.2g pm: %s\n", peaks.Count, max_err * 1e3,
+         (peaks.Count > 0) && (max_err < 1e-3) ? "ok" : "WRONG");
+}
+
+
+/* ===========================================================================
+Streaming averaging of the wavelength columns: the O(window) moving average
+done by consumers before Csm500Averager existed vs. each averaging mode
+=========================================================================== */
+static void BenchAverage(void)
+{
+  const uint32_t cols = SM500_MAX_PEAKS;
+  const uint32_t window = 100;
+  const uint32_t decimation = 10;
+  static float rows[window][SM500_MAX_PEAKS];
+  static float history[window][SM500_MAX_PEAKS];
+  static double reference[SM500_MAX_PEAKS];
+  Csm500Averager averager;
+
+  for (uint32_t r=0; r<window; r++)
+    for (uint32_t i=0; i<cols; i++)
+      rows[r][i] = (float)(SM500_DEFAULT_WL_START + 0.1 * i + 0.001 * (rand() % 1000));
+
+  printf("averaging: %u columns, window %u, decimation %u\n", cols, window, decimation);
+
+  //by hand: keep the last rows and re-average them at every output
+  double t0 = NowNs();
+  for (int it=0; it<BENCH_ITERATIONS; it++)
+  {
+    memcpy(history[it % window], rows[it % window], sizeof(rows[0]));
+    if ((it + 1) % decimation == 0)
+      for (uint32_t i=0; i<cols; i++)
+      {
+        double sum = 0.0;
+        for (uint32_t r=0; r<window; r++)
+          sum += history[r][i];
+        reference[i] = sum / window;
+      }
+  }
+  double by_hand = (NowNs() - t0) / BENCH_ITERATIONS;
+  printf("  %-18s %9.1f ns/row\n", "by hand", by_hand);
+
+  for (int mode=SM500_AVG_BOXCAR; mode<=SM500_AVG_CIC; mode++)
+  {
+    for (int level=SM500_SIMD_SCALAR; level<=SM500_SIMD_AVX2; level++)
+    {
+      averager.SetSimdLevel((sm500_simd_level)level);
+      if (averager.GetSimdLevel() != level) continue;    //not supported by this CPU
+
+      if (mode == SM500_AVG_BOXCAR) averager.SetBoxcar(cols, decimation, window);
+      if (mode == SM500_AVG_EXPONENTIAL) averager.SetExponential(cols, decimation, 2.0 / (window + 1));
+      if (mode == SM500_AVG_CIC) averager.SetCic(cols, window, 3, SM500_DEFAULT_CIC_RESOLUTION);
+
+      t0 = NowNs();
+      for (int it=0; it<BENCH_ITERATIONS; it++)
+        averager.Push(rows[it % window]);
+      double t = (NowNs() - t0) / BENCH_ITERATIONS;
+
+      //the rows repeat with period window: boxcar and CIC settle to the mean of all the rows
+      double max_err = 0.0;
+      for (uint32_t i=0; (mode != SM500_AVG_EXPONENTIAL) && (i<cols); i++)
+      {
+        double err = fabs(averager.GetOutput()[i] - reference[i]);
+        if (err > max_err) max_err = err;
+      }
+
+      const char *names[] = { "boxcar", "exponential", "cic3" };
+      string name = string(names[mode]) + " " + sm500_simd_name((sm500_simd_level)level);
+      printf("  %-18s %9.1f ns/row  x%.1f", name.c_str(), t, by_hand / t);
+      if (mode != SM500_AVG_EXPONENTIAL)
+        printf("  max err %.2g pm", max_err * 1e3);
+      printf("\n");
+    }
+  }
+
+  //---------- sensor frames: a sensor dropping out keeps its column ----------
+  static sm500_sensor_frame frame;
+  averager.SetBoxcar(3, 2, 2);
+  memset(&frame, 0, sizeof(frame));
+  frame.NumSensors = 3;
+  for (uint32_t i=0; i<3; i++)
+    frame.Wavelength[i] = 1510.0f + 10.0f * i;
+  averager.Push(frame);
+  frame.Wavelength[1] = NAN;
+  frame.Status[1] = SM500_SENSOR_MISSING;
+  frame.Wavelength[2] = 1532.0f;
+  bool ok = averager.Push(frame) && (averager.GetOutput()[0] == 1510.0) && (averager.GetOutput()[1] == 1520.0) &&
+            (averager.GetOutput()[2] == 1531.0);
+  printf("  sensor frame with sensor 1 missing: %s\n", ok ? "ok" : "WRONG");
+}
+
+
+/* ===========================================================================
+Histogram accumulation of the wavelength and amplitude columns: per-value
+binning by hand vs. each Csm500Histogram kernel
+=========================================================================== */
+static void BenchHistogram(void)
+{
+  const uint32_t cols = SM500_MAX_PEAKS;
+  const uint32_t bins = 256;
+  const uint32_t rows = 64;
+  static float wl[rows][SM500_MAX_PEAKS], amp[rows][SM500_MAX_PEAKS];
+  static uint64_t reference[2][SM500_MAX_PEAKS * (bins + 2)];
+  static uint64_t counts[SM500_MAX_PEAKS * (bins + 2)];
+  const float width = 0.001f, amp_min = 10.0f, amp_max = 4095.0f;
+  Csm500Histogram histogram;
+
+  for (uint32_t r=0; r<rows; r++)
+    for (uint32_t i=0; i<cols; i++)
+    {
+      wl[r][i] = (float)(SM500_DEFAULT_WL_START + 0.1 * i + width * (rand() % (bins + 20)) - 10 * width + width / 2);
+      amp[r][i] = (float)(rand() % 4200);
+    }
+
+  printf("histogram: %u columns, %u bins\n", cols, bins);
+
+  for (int layout=SM500_HIST_FIXED; layout<=SM500_HIST_LOG; layout++)
+  {
+    //by hand: one division or logarithm per value
+    double log_ratio = log((double)amp_max / amp_min) / bins;
+    memset(reference[layout], 0, sizeof(reference[layout]));
+    double t0 = NowNs();
+    for (int it=0; it<BENCH_ITERATIONS; it++)
+      for (uint32_t i=0; i<cols; i++)
+      {
+        double t = (layout == SM500_HIST_FIXED) ? (wl[it % rows][i] - (SM500_DEFAULT_WL_START + 0.1f * i)) / width
+                                                : (amp[it % rows][i] > 0 ? log(amp[it % rows][i] / amp_min) / log_ratio : -1.0);
+        int b = (t < 0) ? 0 : (t >= bins) ? bins + 1 : (int)t + 1;
+        reference[layout][i * (bins + 2) + b]++;
+      }
+    double by_hand = (NowNs() - t0) / BENCH_ITERATIONS;
+    printf("  %-12s %9.1f ns/row\n", layout == SM500_HIST_FIXED ? "fixed hand" : "log hand", by_hand);
+
+    for (int level=SM500_SIMD_SCALAR; level<=SM500_SIMD_AVX2; level++)
+    {
+      histogram.SetSimdLevel((sm500_simd_level)level);
+      if (histogram.GetSimdLevel() != level) continue;    //not supported by this CPU
+
+      if (layout == SM500_HIST_FIXED)
+      {
+        histogram.SetFixedBins(cols, bins, 0.0f, width, 1);
+        for (uint32_t i=0; i<cols; i++)
+          histogram.SetColumnOrigin(i, SM500_DEFAULT_WL_START + 0.1f * i);
+      }
+      else
+        histogram.SetLogBins(cols, bins, amp_min, amp_max, 1);
+
+      t0 = NowNs();
+      for (int it=0; it<BENCH_ITERATIONS; it++)
+        histogram.Accumulate(0, layout == SM500_HIST_FIXED ? wl[it % rows] : amp[it % rows], cols);
+      double t = (NowNs() - t0) / BENCH_ITERATIONS;
+
+      //values on a bin edge may round differently by hand: count the disagreements
+      histogram.Snapshot(counts);
+      uint64_t moved = 0;
+      for (uint32_t i=0; i<cols * (bins + 2); i++)
+        moved += (counts[i] > reference[layout][i]) ? counts[i] - reference[layout][i] : 0;
+
+      string name = string(layout == SM500_HIST_FIXED ? "fixed " : "log ") + sm500_simd_name((sm500_simd_level)level);
+      printf("  %-12s %9.1f ns/row  x%.1f  %.3f%% binned differently\n", name.c_str(), t, by_hand / t,
+             100.0 * moved / ((double)BENCH_ITERATIONS * cols));
+    }
+  }
+}
+
+
+/* ===========================================================================
+Peak to sensor assignment: the linear scan of every window for every peak
+done by consumers before Csm500SensorMap existed vs. the merge pass
+=========================================================================== */
+static void BenchAssign(void)
+{
+  static uint32_t frame[sm500_peaks_format::FrameDwords];
+  static sm500_peaks_soa peaks;
+  static sm500_sensor_frame reference, sensors;
+  const uint32_t n = SM500_MAX_PEAKS_PER_CHANNEL;
+  const double spacing = SM500_DEFAULT_WL_SPAN / n;
+  static double low[SM500_MAX_PEAKS], high[SM500_MAX_PEAKS];
+  static uint32_t channel[SM500_MAX_PEAKS];
+  Csm500PeakDecoder decoder;
+  Csm500SensorMap map;
+  uint32_t num_sensors = 0;
+
+  //one window around every synthetic peak (peak i sits near (i + 0.5) * spacing)
+  for (uint32_t ch=0; ch<SM500_NUM_CHANNELS; ch++)
+    for (uint32_t i=0; i<n; i++)
+    {
+      channel[num_sensors] = ch;
+      low[num_sensors] = SM500_DEFAULT_WL_START + i * spacing;
+      high[num_sensors] = low[num_sensors] + spacing;
+      map.AddSensor(ch, low[num_sensors], high[num_sensors]);
+      num_sensors++;
+    }
+
+  MakePeaksFrame(frame, n, 1);
+  decoder.Decode(Csm500PeaksFrame(frame), peaks);
+
+  printf("sensor assignment: %u peaks, %u sensors\n", peaks.Count, num_sensors);
+
+  double t0 = NowNs();
+  for (int it=0; it<BENCH_ITERATIONS / 10; it++)
+    for (uint32_t s=0; s<num_sensors; s++)
+    {
+      reference.Wavelength[s] = NAN;
+      for (uint32_t i=0; i<peaks.Count; i++)
+        if ((peaks.Channel[i] == channel[s]) && (peaks.Wavelength[i] >= low[s]) && (peaks.Wavelength[i] < high[s]))
+          reference.Wavelength[s] = peaks.Wavelength[i];
+    }
+  double by_hand = (NowNs() - t0) / (BENCH_ITERATIONS / 10);
+  printf("  %-8s %9.1f ns/frame\n", "by hand", by_hand);
+
+  t0 = NowNs();
+  for (int it=0; it<BENCH_ITERATIONS; it++)
+    map.Assign(peaks, sensors);
+  double t = (NowNs() - t0) / BENCH_ITERATIONS;
+
+  uint32_t mismatches = 0;
+  for (uint32_t s=0; s<num_sensors; s++)
+    if ((sensors.Wavelength[s] != reference.Wavelength[s]) && !(isnan(sensors.Wavelength[s]) && isnan(reference.Wavelength[s])))
+      mismatches++;
+
+  printf("  %-8s %9.1f ns/frame  x%.1f  %u missing  %u extra  %u mismatches\n", "merge", t, by_hand / t,
+         sensors.Missing, sensors.Extra, mismatches);
+
+  //---------- a downward sweep with an uncalibrated (NaN) peak on channel 0 ----------
+  uint32_t first = peaks.ChannelStart[0], count = peaks.ChannelStart[1] - first;
+  reverse(peaks.Wavelength + first, peaks.Wavelength + first + count);
+  reverse(peaks.Amplitude + first, peaks.Amplitude + first + count);
+  uint32_t nan_peak = first + count / 2;
+  float lost = peaks.Wavelength[nan_peak];
+  peaks.Wavelength[nan_peak] = NAN;
+  map.Assign(peaks, sensors);
+
+  mismatches = 0;
+  for (uint32_t s=0; s<num_sensors; s++)
+  {
+    float expected = (reference.Wavelength[s] == lost) ? NAN : reference.Wavelength[s];
+    if ((sensors.Wavelength[s] != expected) && !(isnan(sensors.Wavelength[s]) && isnan(expected)))
+      mismatches++;
+  }
+  printf("  reversed channel 0 with a NaN peak: %u extra, %u mismatches %s\n", sensors.Extra, mismatches,
+         (mismatches == 0) ? "ok" : "WRONG");
+}
+
+
+/* ===========================================================================
+Engineering unit conversion: one virtual call per sensor, as consumers did
+before Csm500UnitConverter existed, vs. the grouped kernels
+=========================================================================== */
+class BenchTransfer
+{
+  public:
+    virtual ~BenchTransfer() {}
+    virtual float Convert(const float *Wavelength, const float *Value) = 0;
+};
+
+class BenchTemperature : public BenchTransfer
+{
+  public:
+    uint32_t Id; float Lambda0, T0, Sensitivity;
+    virtual float Convert(const float *Wavelength, const float * /*Value*/) { return T0 + (Wavelength[Id] - Lambda0) / Sensitivity; }
+};
+
+class BenchStrain : public BenchTransfer
+{
+  public:
+    uint32_t Id, RefId; float Lambda0, Gauge, Quad, K, T0;
+    virtual float Convert(const float *Wavelength, const float *Value)
+    {
+      float d = Wavelength[Id] - Lambda0;
+      return (Gauge + Quad * d) * d - K * (Value[RefId] - T0);
+    }
+};
+
+struct BenchConvertSetter
+{
+  Csm500UnitConverter *Converter;
+  uint32_t NumSensors;
+  bool Reference;           //sets the references, otherwise the polynomials
+};
+
+static void* BenchConvertSetters(void *Arg)
+{
+  BenchConvertSetter *a = (BenchConvertSetter*)Arg;
+  const double coef[2] = { 5.0, 0.0 };
+
+  for (uint32_t id=1; id<a->NumSensors; id++)
+    if (a->Reference)
+      a->Converter->SetTemperatureReference(id, 0, 1.0, 0.0);
+    else
+      a->Converter->SetSensor(id, SM500_SENSOR_STRAIN, 0.0, coef, 1);
+  return 0;
+}
+
+static void BenchConvert(void)
+{
+  const uint32_t num_sensors = SM500_MAX_PEAKS;
+  static sm500_sensor_frame sensors;
+  static sm500_sensor_values values;
+  static float reference[SM500_MAX_SENSORS];
+  BenchTransfer *transfer[SM500_MAX_PEAKS];
+  Csm500UnitConverter converter;
+
+  //every 4th sensor is a temperature sensor referencing the next three strain gauges
+  sensors.NumSensors = num_sensors;
+  double t0 = NowNs();
+  converter.BeginUpdate();
+  for (uint32_t id=0; id<num_sensors; id++)
+  {
+    double lambda0 = SM500_DEFAULT_WL_START + 0.15 * id;
+    sensors.Wavelength[id] = (float)(lambda0 + 0.001 * (rand() % 200));
+    if (id % 4 == 0)
+    {
+      BenchTemperature *t = new BenchTemperature;
+      double coef[2] = { 25.0, 1.0 / 0.01 };
+      t->Id = id; t->Lambda0 = lambda0; t->T0 = 25.0f; t->Sensitivity = 0.01f;
+      transfer[id] = t;
+      converter.SetSensor(id, SM500_SENSOR_TEMPERATURE, lambda0, coef, 1);
+    }
+    else
+    {
+      BenchStrain *s = new BenchStrain;
+      double coef[3] = { 0.0, 1e6 / (lambda0 * 0.78), 10.0 };
+      s->Id = id; s->RefId = id - id % 4; s->Lambda0 = lambda0; s->Gauge = coef[1]; s->Quad = coef[2]; s->K = 11.0f; s->T0 = 25.0f;
+      transfer[id] = s;
+      converter.SetSensor(id, SM500_SENSOR_STRAIN, lambda0, coef, 2);
+      converter.SetTemperatureReference(id, s->RefId, s->K, s->T0);
+    }
+  }
+  converter.EndUpdate();
+  double t_config = (NowNs() - t0) / 1e6;
+
+  t0 = NowNs();
+  converter.SetTemperatureReference(1, 0, 11.0, 25.0);    //unchanged, but compiled
+  double t_setter = (NowNs() - t0) / 1e6;
+
+  printf("unit conversion: %u sensors (1/4 temperature references), configured in %.2f ms batched, %.2f ms per unbatched setter\n",
+         num_sensors, t_config, t_setter);
+
+  t0 = NowNs();
+  for (int it=0; it<BENCH_ITERATIONS; it++)
+    for (uint32_t id=0; id<num_sensors; id++)
+      reference[id] = transfer[id]->Convert(sensors.Wavelength, reference);
+  double by_hand = (NowNs() - t0) / BENCH_ITERATIONS;
+  printf("  %-8s %9.1f ns/frame\n", "virtual", by_hand);
+
+  sm500_simd_level default_level = converter.GetSimdLevel();
+  for (int level=SM500_SIMD_SCALAR; level<=SM500_SIMD_AVX2; level++)
+  {
+    converter.SetSimdLevel((sm500_simd_level)level);
+    if (converter.GetSimdLevel() != level) continue;    //not supported by this CPU
+
+    t0 = NowNs();
+    for (int it=0; it<BENCH_ITERATIONS; it++)
+      converter.Convert(sensors, values);
+    double t = (NowNs() - t0) / BENCH_ITERATIONS;
+
+    double max_err = 0.0;
+    for (uint32_t id=0; id<num_sensors; id++)
+    {
+      double err = fabs(values.Value[id] - reference[id]);
+      if (err > max_err) max_err = err;
+    }
+
+    printf("  %-8s %9.1f ns/frame  x%.1f  max err %.3g%s\n", sm500_simd_name((sm500_simd_level)level), t, by_hand / t, max_err,
+           (level == default_level) ? "  (default)" : "");
+  }
+
+  //---------- frames holding fewer sensors than configured ----------
+  converter.SetTemperatureReference(0, num_sensors - 1, 1.0, 25.0);   //a reference beyond the frame
+  sensors.NumSensors = num_sensors / 2;
+  converter.Convert(sensors, values);
+  printf("  %u of %u sensors: %u converted, sensor 0 (reference missing) %s\n", sensors.NumSensors, num_sensors,
+         values.NumSensors, std::isnan(values.Value[0]) ? "NaN: ok" : "WRONG");
+
+  //---------- polynomials and references set concurrently: both kept ----------
+  {
+    const uint32_t num_set = 64;
+    Csm500UnitConverter shared;
+    BenchConvertSetter setters[2] = { { &shared, num_set, false }, { &shared, num_set, true } };
+    pthread_t threads[2];
+
+    for (int t=0; t<2; t++)
+      pthread_create(&threads[t], 0, BenchConvertSetters, &setters[t]);
+    for (int t=0; t<2; t++)
+      pthread_join(threads[t], 0);
+
+    sensors.NumSensors = num_set;
+    for (uint32_t id=0; id<num_set; id++)
+      sensors.Wavelength[id] = 1550.0f;
+    shared.Convert(sensors, values);
+    uint32_t lost = 0;
+    for (uint32_t id=1; id<num_set; id++)
+      if ((values.Value[id] != 5.0f - 1550.0f) || (shared.GetType(id) != SM500_SENSOR_STRAIN))
+        lost++;
+    printf("  %u sensors set from 2 threads: %u lost updates%s\n", num_set - 1, lost, lost ? "  WRONG" : ": ok");
+  }
+
+  for (uint32_t id=0; id<num_sensors; id++)
+    delete transfer[id];
+}
+
+
+/* ===========================================================================
+Rate-converted client frames: one averager per client vs. the shared
+decimation tree of Csm500Subscriptions, as 1 Hz clients are added
+=========================================================================== */
+struct BenchClient
+{
+  uint32_t Frames;
+  float Last;               //last value of the first subscribed sensor
+};
+
+static void BenchClientFrame(void *Context, const sm500_subscription_frame &Frame)
+{
+  BenchClient *client = (BenchClient*)Context;
+  client->Frames++;
+  client->Last = Frame.Value[0];
+}
+
+static void BenchSubscribe(void)
+{
+  const uint32_t num_sensors = SM500_MAX_PEAKS;
+  const uint32_t max_clients = 16;
+  const double rates[] = { 1000.0, 100.0, 10.0 };   //plus 1 Hz historians
+  static sm500_sensor_values frames[100];
+  static float columns[SM500_MAX_PEAKS];
+  uint32_t ids[SM500_MAX_PEAKS];
+
+  for (uint32_t f=0; f<100; f++)
+  {
+    frames[f].NumSensors = num_sensors;
+    frames[f].SerialNumber = f;
+    for (uint32_t id=0; id<num_sensors; id++)
+      frames[f].Value[id] = (float)(20.0 + 0.01 * (rand() % 1000));
+  }
+  for (uint32_t id=0; id<num_sensors; id++)
+    ids[id] = id;
+
+  printf("subscriptions: %u sensors, clients at 1 kHz, 100 Hz, 10 Hz + 1 Hz historians\n", num_sensors);
+
+  for (uint32_t historians=1; historians<=max_clients; historians*=4)
+  {
+    uint32_t num_clients = 3 + historians;
+    Csm500Averager *averager[3 + max_clients];
+    BenchClient clients[3 + max_clients];
+    Csm500Subscriptions subscriptions;
+    float by_hand_last = 0.0f;
+
+    //by hand: every client averages the raw frames on its own
+    for (uint32_t c=0; c<num_clients; c++)
+    {
+      uint32_t decimation = (c < 3) ? (uint32_t)(1000.0 / rates[c]) : 1000;
+      averager[c] = new Csm500Averager;
+      averager[c]->SetBoxcar(num_sensors, decimation, 0);
+    }
+
+    double t0 = NowNs();
+    for (int it=0; it<BENCH_ITERATIONS; it++)
+      for (uint32_t c=0; c<num_clients; c++)
+        if (averager[c]->Push(frames[it % 100].Value))
+        {
+          const double *out = averager[c]->GetOutput();
+          for (uint32_t id=0; id<num_sensors; id++)
+            columns[id] = (float)out[id];
+          if (c == num_clients - 1)
+            by_hand_last = columns[0];
+        }
+    double by_hand = (NowNs() - t0) / BENCH_ITERATIONS;
+
+    //shared tree
+    memset(clients, 0, sizeof(clients));
+    for (uint32_t c=0; c<num_clients; c++)
+      subscriptions.Subscribe(ids, num_sensors, (c < 3) ? rates[c] : 1.0, BenchClientFrame, &clients[c]);
+
+    t0 = NowNs();
+    for (int it=0; it<BENCH_ITERATIONS; it++)
+      subscriptions.Push(frames[it % 100]);
+    double t = (NowNs() - t0) / BENCH_ITERATIONS;
+
+    printf("  %2u clients  by hand %9.1f ns/frame  shared %9.1f ns/frame  x%.1f  1 Hz frames %u  err %.2g\n",
+           num_clients, by_hand, t, by_hand / t, clients[num_clients - 1].Frames,
+           fabs(clients[num_clients - 1].Last - by_hand_last));
+
+    for (uint32_t c=0; c<num_clients; c++)
+      delete averager[c];
+  }
+
+  //---------- rates added while running: the running averages carry on ----------
+  {
+    Csm500Subscriptions subscriptions;
+    BenchClient clients[3];
+    double sum[2] = { 0.0, 0.0 };             //frames 0..99, frames 50..99 (sensor 0)
+
+    memset(clients, 0, sizeof(clients));
+    subscriptions.Subscribe(ids, 1, 10.0, BenchClientFrame, &clients[0]);
+    for (uint32_t f=0; f<1000; f++)
+    {
+      if (f == 50)
+      {
+        subscriptions.Subscribe(ids, 1, 20.0, BenchClientFrame, &clients[1]);    //under the input
+        subscriptions.Subscribe(ids, 1, 1.0, BenchClientFrame, &clients[2]);     //under 10 Hz
+      }
+      if (f < 100)
+      {
+        sum[0] += frames[f].Value[0];
+        if (f >= 50)
+          sum[1] += frames[f].Value[0];
+      }
+      subscriptions.Push(frames[f % 100]);
+      if (f == 99)
+      {
+        bool ok = (clients[0].Frames == 1) && (fabs(clients[0].Last - sum[0] / 100) < 1e-3) &&
+                  (clients[1].Frames == 1) && (fabs(clients[1].Last - sum[1] / 50) < 1e-3);
+        printf("  10 Hz client, 20 Hz and 1 Hz added at frame 50: first frames at 100 %s\n", ok ? "ok" : "WRONG");
+      }
+    }
+    bool ok = (clients[0].Frames == 10) && (clients[1].Frames == 19) && (clients[2].Frames == 1) &&
+              (fabs(clients[2].Last - sum[0] / 100) < 1e-3) && (subscriptions.GetNumRates() == 4);
+    printf("  1000 frames: 10/19/1 frames at 10/20/1 Hz, 1 Hz average of frames 0..999 %s\n", ok ? "ok" : "WRONG");
+  }
+}
+
+
+/* ===========================================================================
+Recording 10 peaks frames per FS frame: an fwrite() per frame on the
+acquisition thread vs. Csm500Recorder::Record().  Reports the time the
+acquisition thread spends per frame (mean and worst), then reads the
+segments back and checks the footers and the record checksums.
+=========================================================================== */
+#define BENCH_REC_PATH      "/tmp/bench_sm500"
+
+static uint64_t BenchCheckSegments(const char *Path, uint64_t &Bad)
+{
+  static uint8_t buffer[sm500_fs_format::FrameBytes + 64];
+  uint64_t records = 0;
+
+  for (uint32_t seg=0; ; seg++)
+  {
+    char name[256];
+    snprintf(name, sizeof(name), "%s_%06u" SM500_REC_EXTENSION, Path, seg);
+    FILE *f = fopen(name, "rb");
+    if (!f)
+      break;
+
+    sm500_rec_footer footer;
+    fseek(f, -SM500_REC_PAGE_BYTES, SEEK_END);
+    if ((fread(&footer, sizeof(footer), 1, f) != 1) || (footer.Magic != SM500_REC_FOOTER_MAGIC) ||
+        (footer.Checksum != sm500_rec_checksum(&footer, offsetof(sm500_rec_footer, Checksum))))
+      Bad++;
+
+    uint64_t n = 0;
+    for (uint64_t offset=SM500_REC_PAGE_BYTES; offset<footer.DataEnd; n++)
+    {
+      sm500_rec_record r;
+      fseek(f, offset, SEEK_SET);
+      if ((fread(&r, sizeof(r), 1, f) != 1) || (r.Magic != SM500_REC_RECORD_MAGIC))
+        break;
+      if ((fread(buffer, r.Bytes, 1, f) != 1) || (sm500_rec_checksum(buffer, r.Bytes) != r.Checksum))
+        Bad++;
+      offset += sm500_rec_record_bytes(r.Bytes);
+    }
+    if (n != footer.NumRecords)
+      Bad++;
+    records += n;
+
+    fclose(f);
+    remove(name);
+    snprintf(name, sizeof(name), "%s_%06u" SM500_REC_INDEX_EXTENSION, Path, seg);
+    remove(name);
+  }
+  return records;
+}
+
+static void BenchRecord(void)
+{
+  const uint32_t num_fs = 400;
+  const uint32_t peaks_per_fs = 10;
+  static uint32_t peaks[sm500_peaks_format::FrameDwords];
+  static uint8_t fs[sm500_fs_format::FrameBytes];
+  Csm500Recorder recorder;
+  double worst[2] = { 0.0, 0.0 }, total[2] = { 0.0, 0.0 };
+  uint32_t frames = num_fs * (peaks_per_fs + 1);
+
+  MakePeaksFrame(peaks, 32, 0);
+  MakeFsFrame(fs, 0);
+  printf("recording: %u peaks + %u FS frames (%.0f MB) to %s\n", num_fs * peaks_per_fs, num_fs,
+         (num_fs * (sm500_fs_format::FrameBytes + peaks_per_fs * sm500_peaks_format::FrameBytes)) / 1e6, BENCH_REC_PATH);
+
+  for (int method=0; method<2; method++)
+  {
+    FILE *f = 0;
+    double t_all = NowNs();
+
+    if (method == 0)
+      f = fopen(BENCH_REC_PATH "_fwrite", "wb");
+    else
+    {
+      recorder.SetSegmentBytes(32 << 20);
+      recorder.SetDirectIo(true);
+      recorder.Start(BENCH_REC_PATH);
+    }
+
+    for (uint32_t i=0; i<frames; i++)
+    {
+      bool is_fs = (i % (peaks_per_fs + 1) == peaks_per_fs);
+      void *frame = is_fs ? (void*)fs : (void*)peaks;
+      uint32_t bytes = is_fs ? sm500_fs_format::FrameBytes : sm500_peaks_format::FrameBytes;
+
+      ((uint32_t*)frame)[sm500_header_layout::SerialLoOffset32] = i;
+
+      double t0 = NowNs();
+      if (method == 0)
+        fwrite(frame, bytes, 1, f);
+      else
+        recorder.Record(is_fs ? SM500_REC_FS : SM500_REC_PEAKS, frame, bytes);
+      double t = NowNs() - t0;
+
+      total[method] += t;
+      if (t > worst[method]) worst[method] = t;
+    }
+
+    if (method == 0)
+    {
+      fclose(f);
+      remove(BENCH_REC_PATH "_fwrite");
+    }
+    else
+      recorder.Stop();
+    t_all = NowNs() - t_all;
+
+    printf("  %-8s %9.1f ns/frame  worst %9.1f us  total %.0f MB/s\n", method ? "recorder" : "fwrite",
+           total[method] / frames, worst[method] / 1e3,
+           (num_fs * (sm500_fs_format::FrameBytes + peaks_per_fs * sm500_peaks_format::FrameBytes)) / (t_all / 1e3));
+  }
+
+  sm500_recorder_stats stats;
+  uint64_t bad = 0;
+  recorder.GetStats(stats);
+  uint64_t records = BenchCheckSegments(BENCH_REC_PATH, bad);
+  printf("  recorded %llu  dropped %llu  segments %u  read back %llu  bad %llu\n",
+         (unsigned long long)stats.Recorded, (unsigned long long)stats.Dropped, stats.Segments,
+         (unsigned long long)records, (unsigned long long)bad);
+}
+
+
+/* ===========================================================================
+Replay of a recording through Csm500ReplayDev::GetPeaks(): throughput as
+fast as possible, and the pacing error at 1x and 4x the recorded rate
+(1 kHz peaks, 100 Hz FS).  The replayed frames are checked against the
+decoding of the recorded ones.
+=========================================================================== */
+static void BenchReplay(void)
+{
+  const uint32_t num_peaks = 2000;
+  static uint32_t peaks[sm500_peaks_format::FrameDwords];
+  static uint8_t fs[sm500_fs_format::FrameBytes];
+  static sm500_peaks_soa expected, replayed;
+  Csm500Recorder recorder;
+  Csm500PeakDecoder decoder;
+
+  //---------- record ----------
+  MakePeaksFrame(peaks, 32, 0);
+  MakeFsFrame(fs, 0);
+  recorder.SetSegmentBytes(16 << 20);
+  recorder.Start(BENCH_REC_PATH);
+  for (uint32_t i=0; i<num_peaks; i++)
+  {
+    uint64_t ns = 1000000ULL * i;
+    peaks[sm500_header_layout::SerialLoOffset32] = i;
+    peaks[sm500_header_layout::TimestampOffset32] = 100 + ns / 1000000000ULL;
+    peaks[sm500_header_layout::TimestampOffset32 + 1] = ns % 1000000000ULL;
+    peaks[sm500_peaks_format::ChannelOffset32(0)] += 1 << SM500_PEAK_POS_SHIFT;
+    while (!recorder.RecordPeaks(peaks))
+      usleep(100);
+    if (i % 10 == 0)
+    {
+      memcpy(fs + sm500_header_layout::TimestampOffset32 * 4, peaks + sm500_header_layout::TimestampOffset32, 8);
+      while (!recorder.RecordFs(fs))
+        usleep(100);
+    }
+  }
+  recorder.Stop();
+  decoder.Decode(Csm500PeaksFrame(peaks), expected);    //the last frame
+
+  //---------- replay ----------
+  Csm500ReplayDev dev;
+  dev.SetPreload(true);
+  dev.Init(BENCH_REC_PATH);
+  printf("replay: %llu peaks + %llu FS frames recorded\n",
+         (unsigned long long)dev.GetNumFrames(SM500_REC_PEAKS), (unsigned long long)dev.GetNumFrames(SM500_REC_FS));
+
+  dev.SetPacing(SM500_REPLAY_FAST);
+  uint64_t order_errors = 0;
+  double t0 = NowNs();
+  for (uint32_t i=0; i<num_peaks; i++)
+  {
+    dev.GetPeaks(replayed);
+    if (replayed.SerialNumber != i)
+      order_errors++;
+  }
+  double t = (NowNs() - t0) / num_peaks;
+  bool same = (replayed.Count == expected.Count) &&
+              (memcmp(replayed.Wavelength, expected.Wavelength, expected.Count * sizeof(float)) == 0);
+  printf("  %-10s %9.1f ns/frame (%.0f frames/s)  order errors %llu  last frame %s\n", "fast", t, 1e9 / t,
+         (unsigned long long)order_errors, same ? "identical" : "DIFFERENT");
+
+  const double multipliers[] = { 1.0, 4.0 };
+  for (int m=0; m<2; m++)
+  {
+    const uint32_t frames = 200;
+    double worst = 0.0;
+
+    dev.Init(BENCH_REC_PATH);
+    dev.SetPacing(SM500_REPLAY_SCALED, multipliers[m]);
+    t0 = NowNs();
+    for (uint32_t i=0; i<frames; i++)
+    {
+      dev.GetPeaks(replayed);
+      double late = (NowNs() - t0) - i * 1e6 / multipliers[m];
+      if (fabs(late) > worst) worst = fabs(late);
+    }
+    t = NowNs() - t0;
+    printf("  x%-9.0f %9.1f ms for %u frames (expected %.1f)  worst lateness %.1f us\n", multipliers[m], t / 1e6,
+           frames, (frames - 1) / multipliers[m], worst / 1e3);
+  }
+  dev.Close();
+
+  uint64_t bad = 0;
+  BenchCheckSegments(BENCH_REC_PATH, bad);    //removes the segments
+}
+
+
+/* ===========================================================================
+Per-sensor statistics over 5 s of a 30 s recording (1 kHz peaks): reading
+the whole recording by hand vs. Csm500Archive (index + mapped blocks) with
+each kernel.  Also times opening the archive with and without the indexes.
+=========================================================================== */
+static void BenchCountFrames(void *Context, const sm500_rec_record &, const void *)
+{
+  (*(uint64_t*)Context)++;
+}
+
+static void BenchArchive(void)
+{
+  const uint32_t num_frames = 30000;
+  const uint64_t from = 100000000000ULL + 12000000000ULL, to = from + 5000000000ULL;
+  static uint32_t peaks[sm500_peaks_format::FrameDwords];
+  static uint8_t record[sizeof(sm500_rec_record) + sm500_peaks_format::FrameBytes];
+  static sm500_peaks_soa soa;
+  static sm500_sensor_frame sensors;
+  static sm500_sensor_stats stats;
+  static Csm500Archive::stats_partial reference;
+  const uint32_t n = SM500_MAX_PEAKS_PER_CHANNEL / 4;
+  Csm500Recorder recorder;
+  Csm500PeakDecoder decoder;
+  Csm500SensorMap map;
+  Csm500WorkerPool pool;
+  Csm500Archive archive;
+
+  for (uint32_t ch=0; ch<SM500_NUM_CHANNELS; ch++)
+    for (uint32_t i=0; i<n; i++)
+    {
+      double low = SM500_DEFAULT_WL_START + i * SM500_DEFAULT_WL_SPAN / n;
+      map.AddSensor(ch, low, low + SM500_DEFAULT_WL_SPAN / n);
+    }
+
+  //---------- record ----------
+  recorder.SetSegmentBytes(32 << 20);
+  recorder.Start(BENCH_REC_PATH);
+  for (uint32_t i=0; i<num_frames; i++)
+  {
+    uint64_t ns = 100000000000ULL + 1000000ULL * i;
+    MakePeaksFrame(peaks, n, i);
+    peaks[sm500_header_layout::TimestampOffset32] = ns / 1000000000ULL;
+    peaks[sm500_header_layout::TimestampOffset32 + 1] = ns % 1000000000ULL;
+    while (!recorder.RecordPeaks(peaks))
+      usleep(100);
+  }
+  recorder.Stop();
+
+  //---------- by hand: read everything, keep the range ----------
+  for (uint32_t i=0; i<map.GetNumSensors(); i++)
+  {
+    reference.Min[i] = INFINITY;
+    reference.Max[i] = -INFINITY;
+    reference.Sum[i] = reference.SumSq[i] = 0.0;
+    reference.Count[i] = 0;
+  }
+  reference.NumFrames = 0;
+
+  double t0 = NowNs();
+  for (uint32_t seg=0; ; seg++)
+  {
+    char name[256];
+    snprintf(name, sizeof(name), "%s_%06u" SM500_REC_EXTENSION, BENCH_REC_PATH, seg);
+    FILE *f = fopen(name, "rb");
+    if (!f)
+      break;
+
+    fseek(f, SM500_REC_PAGE_BYTES, SEEK_SET);
+    while (fread(record, sizeof(record), 1, f) == 1)
+    {
+      const sm500_rec_record *r = (const sm500_rec_record*)record;
+      uint64_t t = sm500_rec_time_ns(*r);
+
+      if (r->Magic != SM500_REC_RECORD_MAGIC)
+        break;
+      if ((t < from) || (t >= to))
+        continue;
+
+      decoder.Decode(Csm500PeaksFrame(r + 1), soa);
+      map.Assign(soa, sensors);
+      for (uint32_t i=0; i<sensors.NumSensors; i++)
+      {
+        float x = sensors.Wavelength[i];
+        if (x != x) continue;
+        if (x < reference.Min[i]) reference.Min[i] = x;
+        if (x > reference.Max[i]) reference.Max[i] = x;
+        reference.Sum[i] += x;
+        reference.SumSq[i] += (double)x * x;
+        reference.Count[i]++;
+      }
+      reference.NumFrames++;
+    }
+    fclose(f);
+  }
+  double by_hand = (NowNs() - t0) / 1e6;
+  printf("archive statistics: %u sensors, 5 s of a %u frame recording\n", map.GetNumSensors(), num_frames);
+  printf("  %-14s %9.2f ms  %llu frames\n", "by hand", by_hand, (unsigned long long)reference.NumFrames);
+
+  //---------- archive ----------
+  t0 = NowNs();
+  archive.Open(BENCH_REC_PATH);
+  double t_open = (NowNs() - t0) / 1e6;
+  archive.AttachSensorMap(&map);
+  pool.Start(0);
+  archive.SetWorkerPool(&pool);
+
+  uint64_t count = 0;
+  t0 = NowNs();
+  archive.GetFrames(from, to, SM500_REC_PEAKS, BenchCountFrames, &count);
+  printf("  %-14s %9.2f ms  %llu frames  (open %.2f ms)\n", "frames", (NowNs() - t0) / 1e6, (unsigned long long)count, t_open);
+
+  for (int level=SM500_SIMD_SCALAR; level<=SM500_SIMD_AVX2; level++)
+  {
+    archive.SetSimdLevel((sm500_simd_level)level);
+    if (archive.GetSimdLevel() != level) continue;    //not supported by this CPU
+
+    t0 = NowNs();
+    archive.GetSensorStats(from, to, stats);
+    double t = (NowNs() - t0) / 1e6;
+
+    double max_err = 0.0, max_rms_err = 0.0;
+    uint64_t count_errors = 0;
+    for (uint32_t i=0; i<stats.NumSensors; i++)
+    {
+      double mean = reference.Sum[i] / reference.Count[i];
+      double err = fabs(stats.Mean[i] - mean);
+      if (err > max_err) max_err = err;
+      double var = reference.SumSq[i] / reference.Count[i] - mean * mean;
+      err = fabs(stats.Rms[i] - ((var > 0.0) ? sqrt(var) : 0.0));
+      if (err > max_rms_err) max_rms_err = err;
+      if ((stats.Count[i] != reference.Count[i]) || (stats.Min[i] != reference.Min[i]) || (stats.Max[i] != reference.Max[i]))
+        count_errors++;
+    }
+
+    string name = string("stats ") + sm500_simd_name((sm500_simd_level)level);
+    printf("  %-14s %9.2f ms  x%.0f  %llu frames  mean err %.2g nm  rms dev err %.2g nm  min/max/count mismatches %llu\n",
+           name.c_str(), t, by_hand / t, (unsigned long long)stats.NumFrames, max_err, max_rms_err, (unsigned long long)count_errors);
+  }
+
+  //---------- without the index files ----------
+  archive.Close();
+  for (uint32_t seg=0; ; seg++)
+  {
+    char name[256];
+    snprintf(name, sizeof(name), "%s_%06u" SM500_REC_INDEX_EXTENSION, BENCH_REC_PATH, seg);
+    if (remove(name) != 0)
+      break;
+  }
+  t0 = NowNs();
+  archive.Open(BENCH_REC_PATH);
+  printf("  %-14s %9.2f ms (indexes rebuilt)\n", "open", (NowNs() - t0) / 1e6);
+  archive.Close();
+  pool.Stop();
+
+  uint64_t bad = 0;
+  BenchCheckSegments(BENCH_REC_PATH, bad);    //removes the segments
+}
+
+
+/* ===========================================================================
+Peak codec: compression ratio and encode/decode rates of each kernel on a
+1 kHz stream of 4 x 32 sensors drifting by a few LSBs, with amplitude and
+timestamp noise.  Decoded frames are checked bit for bit.
+=========================================================================== */
+static void BenchPeakCodec(void)
+{
+  const uint32_t num_frames = 2000, n = 32;
+  const uint32_t frame_bytes = sm500_peaks_format::FrameBytes;
+  vector<uint32_t> frames((size_t)num_frames * sm500_peaks_format::FrameDwords, 0);
+  vector<uint32_t> encoded((size_t)num_frames * SM500_PEAK_CODEC_MAX_BYTES / 4);
+  vector<uint32_t> offsets(num_frames + 1);
+  static uint32_t decoded[sm500_peaks_format::FrameDwords];
+  uint32_t pos[SM500_NUM_CHANNELS][n];
+
+  for (uint32_t ch=0; ch<SM500_NUM_CHANNELS; ch++)
+    for (uint32_t i=0; i<n; i++)
+      pos[ch][i] = (uint32_t)((i + 0.5) * SM500_NUM_FS_POINTS / n * (1 << SM500_PEAK_POS_FRAC_BITS));
+
+  for (uint32_t f=0; f<num_frames; f++)
+  {
+    uint32_t *frame = &frames[(size_t)f * sm500_peaks_format::FrameDwords];
+    uint64_t ns = 100000000000ULL + 1000000ULL * f + rand() % 2000;
+
+    frame[sm500_peaks_format::SerialLoOffset32] = f + 1;
+    frame[sm500_peaks_format::TimestampOffset32] = ns / 1000000000ULL;
+    frame[sm500_peaks_format::TimestampOffset32 + 1] = ns % 1000000000ULL;
+    for (uint32_t ch=0; ch<SM500_NUM_CHANNELS; ch++)
+    {
+      uint32_t *block = frame + sm500_peaks_format::ChannelOffset32(ch);
+      frame[sm500_peaks_format::PeakCountOffset32 + ch] = n;
+      for (uint32_t i=0; i<n; i++)
+      {
+        pos[ch][i] += rand() % 5 - 2;
+        block[i] = (pos[ch][i] << SM500_PEAK_POS_SHIFT) | (2000 + rand() % 64);
+      }
+    }
+  }
+
+  printf("peak codec: %u frames, %u peaks/frame\n", num_frames, n * SM500_NUM_CHANNELS);
+
+  for (int level=SM500_SIMD_SCALAR; level<=SM500_SIMD_AVX2; level++)
+  {
+    Csm500PeakCodec encoder, decoder;
+    encoder.SetSimdLevel((sm500_simd_level)level);
+    decoder.SetSimdLevel((sm500_simd_level)level);
+    if (encoder.GetSimdLevel() != level) continue;    //not supported by this CPU
+
+    double t0 = NowNs();
+    offsets[0] = 0;
+    for (uint32_t f=0; f<num_frames; f++)
+      offsets[f + 1] = offsets[f] + encoder.Encode(&frames[(size_t)f * sm500_peaks_format::FrameDwords], (uint8_t*)&encoded[0] + offsets[f]);
+    double t_enc = (NowNs() - t0) / num_frames;
+
+    uint64_t bad = 0;
+    for (uint32_t f=0; f<num_frames; f++)
+      if (!decoder.Decode((uint8_t*)&encoded[0] + offsets[f], offsets[f + 1] - offsets[f], decoded) ||
+          memcmp(decoded, &frames[(size_t)f * sm500_peaks_format::FrameDwords], frame_bytes))
+        bad++;
+
+    decoder.Reset();
+    t0 = NowNs();
+    for (int rep=0; rep<10; rep++)
+      for (uint32_t f=0; f<num_frames; f++)
+        decoder.Decode((uint8_t*)&encoded[0] + offsets[f], offsets[f + 1] - offsets[f], decoded);
+    double t_dec = (NowNs() - t0) / (10.0 * num_frames);
+
+    printf("  %-8s x%5.1f smaller (%u bytes/frame)  encode %6.0f ns/frame %5.2f GB/s  decode %6.0f ns/frame %5.2f GB/s  mismatches %llu\n",
+           sm500_simd_name((sm500_simd_level)level), (double)frame_bytes * num_frames / offsets[num_frames],
+           offsets[num_frames] / num_frames, t_enc, frame_bytes / t_enc, t_dec, frame_bytes / t_dec, (unsigned long long)bad);
+  }
+}
+
+
+/* ===========================================================================
+FS codec: compression ratio and encode/decode time per frame (the FS rate
+is 20 Hz: 50 ms per frame), lossless and near-lossless, serially and with
+the channels in parallel.  The synthetic spectra have a floor with about
+3.5 counts RMS of noise and 16 peaks per channel drifting slowly; at that
+noise level no lossless coder can do better than about 4.2x (16 bits over
+the ~3.8 bits/sample entropy of the noise).
+=========================================================================== */
+static void BenchFsCodec(void)
+{
+  const uint32_t num_frames = 40;
+  const uint32_t frame_bytes = sm500_fs_format::FrameBytes;
+  const uint16_t max_errors[] = { 0, 2, 4 };
+  vector<uint16_t> frames((size_t)num_frames * frame_bytes / 2, 0);
+  vector<uint32_t> encoded((size_t)num_frames * SM500_FS_CODEC_MAX_BYTES / 4);
+  vector<uint32_t> offsets(num_frames + 1);
+  vector<uint16_t> decoded(frame_bytes / 2);
+  Csm500WorkerPool pool;
+
+  for (uint32_t f=0; f<num_frames; f++)
+  {
+    uint16_t *frame = &frames[(size_t)f * frame_bytes / 2];
+    ((uint32_t*)frame)[sm500_fs_format::SerialLoOffset32] = f + 1;
+    ((uint32_t*)frame)[sm500_fs_format::TimestampOffset32 + 1] = f * 50000000;
+
+    for (uint32_t ch=0; ch<SM500_NUM_CHANNELS; ch++)
+    {
+      uint16_t *data = frame + sm500_fs_format::ChannelOffset16(ch);
+      for (uint32_t i=0; i<SM500_NUM_FS_POINTS; i++)
+      {
+        double y = 8000 + (rand() % 7 + rand() % 7 + rand() % 7 - 9);
+        for (uint32_t pk=0; pk<16; pk++)
+        {
+          double d = (double)i - (pk + 0.5) * SM500_NUM_FS_POINTS / 16 - ch - 0.05 * f * (pk % 3);
+          y += 40000.0 / (1.0 + d * d / 25.0);
+        }
+        data[i] = y > 65535 ? 65535 : (uint16_t)y;
+      }
+    }
+  }
+
+  pool.Start(0);
+  printf("fs codec: %u frames of %u bytes, %u worker threads\n", num_frames, frame_bytes, pool.GetNumThreads());
+
+  for (uint32_t m=0; m<sizeof(max_errors)/sizeof(max_errors[0]); m++)
+    for (int parallel=0; parallel<2; parallel++)
+    {
+      Csm500FsCodec encoder, decoder;
+      encoder.SetMaxError(max_errors[m]);
+      if (parallel)
+      {
+        encoder.SetWorkerPool(&pool);
+        decoder.SetWorkerPool(&pool);
+      }
+
+      double t0 = NowNs();
+      offsets[0] = 0;
+      for (uint32_t f=0; f<num_frames; f++)
+        offsets[f + 1] = offsets[f] + encoder.Encode(&frames[(size_t)f * frame_bytes / 2], (uint8_t*)&encoded[0] + offsets[f]);
+      double t_enc = (NowNs() - t0) / num_frames / 1e6;
+
+      uint64_t bad = 0;
+      int max_err = 0;
+      t0 = NowNs();
+      for (uint32_t f=0; f<num_frames; f++)
+      {
+        const uint16_t *original = &frames[(size_t)f * frame_bytes / 2];
+        if (!decoder.Decode((uint8_t*)&encoded[0] + offsets[f], offsets[f + 1] - offsets[f], &decoded[0]))
+        {
+          bad++;
+          continue;
+        }
+        for (uint32_t i=0; i<frame_bytes / 2; i++)
+        {
+          int err = abs((int)decoded[i] - (int)original[i]);
+          if (err > max_err) max_err = err;
+        }
+      }
+      double t_dec = (NowNs() - t0) / num_frames / 1e6;    //includes the check
+
+      char name[32];
+      if (max_errors[m])
+        snprintf(name, sizeof(name), "max err %u %s", max_errors[m], parallel ? "par" : "ser");
+      else
+        snprintf(name, sizeof(name), "lossless %s", parallel ? "par" : "ser");
+      printf("  %-16s x%4.1f smaller  encode %6.2f ms/frame  decode %6.2f ms/frame  max error %d  failures %llu\n",
+             name, (double)frame_bytes * num_frames / offsets[num_frames], t_enc, t_dec, max_err, (unsigned long long)bad);
+    }
+
+  pool.Stop();
+}
+
+
+/* ===========================================================================
+Streaming server: 32 loopback clients (half of them compressed) subscribed
+to the peaks, frames published at 1 kHz and 10 kHz.  Reports what the
+clients received, the time Publish() takes and the CPU used by the reactor
+thread, then checks clients that half-close after their command.
+=========================================================================== */
+struct BenchStreamClient
+{
+  int Fd;
+  bool Compressed;
+  vector<uint8_t> Buffer;
+  uint64_t Frames;
+  uint64_t Bad;                             //wrong size, or not decodable
+  uint64_t LastSn;
+  Csm500PeakCodec Decoder;
+};
+
+struct BenchStreamReader
+{
+  vector<BenchStreamClient*> Clients;
+  int EpollFd;
+  std::atomic<bool> Stop;
+};
+
+static void* BenchStreamRead(void *Arg)
+{
+  BenchStreamReader *reader = (BenchStreamReader*)Arg;
+  static uint32_t peaks[sm500_peaks_format::FrameDwords];
+  struct epoll_event events[64];
+  uint8_t buffer[1 << 16];
+
+  while (!reader->Stop)
+  {
+    int n = epoll_wait(reader->EpollFd, events, 64, 10);
+    for (int i=0; i<n; i++)
+    {
+      BenchStreamClient *client = (BenchStreamClient*)events[i].data.ptr;
+      ssize_t got;
+
+      while ((got = read(client->Fd, buffer, sizeof(buffer))) > 0)
+        client->Buffer.insert(client->Buffer.end(), buffer, buffer + got);
+
+      //---------- packets ----------
+      size_t pos = 0;
+      while (client->Buffer.size() - pos >= SM500_STREAM_HEADER_BYTES)
+      {
+        uint32_t len;
+        memcpy(&len, &client->Buffer[pos], 4);
+        if (client->Buffer.size() - pos < SM500_STREAM_HEADER_BYTES + len)
+          break;
+
+        const uint8_t *payload = &client->Buffer[pos + SM500_STREAM_HEADER_BYTES];
+        if (client->Buffer[pos + 4] == SM500_PACKET_SENSOR_DATA)
+        {
+          client->Frames++;
+          if (client->Compressed)
+          {
+            if (!client->Decoder.Decode(payload, len, peaks))
+              client->Bad++;
+            else
+            {
+              uint64_t sn = Csm500PeaksFrame(peaks).SerialNumber();
+              if (client->LastSn && (sn != client->LastSn + 1))
+                client->Bad++;
+              client->LastSn = sn;
+            }
+          }
+          else if (len != sm500_peaks_format::FrameBytes)
+            client->Bad++;
+        }
+        pos += SM500_STREAM_HEADER_BYTES + len;
+      }
+      client->Buffer.erase(client->Buffer.begin(), client->Buffer.begin() + pos);
+    }
+  }
+  return 0;
+}
+
+static int BenchStreamConnect(uint16_t Port)
+{
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(Port);
+
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if ((fd >= 0) && (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0))
+  {
+    close(fd);
+    fd = -1;
+  }
+  return fd;
+}
+
+//reads the packets of a blocking socket until EOF or 200 ms of silence
+static void BenchStreamCount(int Fd, uint32_t &Responses, uint32_t &Frames, bool &Eof)
+{
+  struct timeval tv = { 0, 200000 };
+  vector<uint8_t> data;
+  uint8_t buffer[1 << 16];
+  ssize_t got;
+
+  setsockopt(Fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  while ((got = read(Fd, buffer, sizeof(buffer))) > 0)
+    data.insert(data.end(), buffer, buffer + got);
+  Eof = (got == 0);
+
+  Responses = Frames = 0;
+  for (size_t pos=0; data.size() - pos >= SM500_STREAM_HEADER_BYTES; )
+  {
+    uint32_t len;
+    memcpy(&len, &data[pos], 4);
+    if (data.size() - pos < SM500_STREAM_HEADER_BYTES + len)
+      break;
+    if (data[pos + 4] == SM500_PACKET_SENSOR_DATA) Frames++;
+    else                                           Responses++;
+    pos += SM500_STREAM_HEADER_BYTES + len;
+  }
+}
+
+static void BenchStream(void)
+{
+  const uint32_t num_clients = 32;
+  const uint32_t rates[] = { 1000, 10000 };
+  static uint32_t frame[sm500_peaks_format::FrameDwords];
+  static BenchStreamClient clients[num_clients];   //static: the decoders are SIMD aligned
+  Csm500StreamServer server;
+  BenchStreamReader reader;
+  pthread_t thread;
+  uint64_t sn = 1;
+
+  server.Start(0);
+  reader.EpollFd = epoll_create1(0);
+  reader.Stop = false;
+
+  for (uint32_t c=0; c<num_clients; c++)
+  {
+    BenchStreamClient *client = &clients[c];
+
+    client->Fd = BenchStreamConnect(server.GetPort());
+    if (client->Fd < 0)
+    {
+      perror("connect");
+      return;
+    }
+    client->Compressed = c & 1;
+    client->Frames = client->Bad = client->LastSn = 0;
+    const char *cmd = client->Compressed ? "#StreamPeaks compressed\n" : "#StreamPeaks\n";
+    if (write(client->Fd, cmd, strlen(cmd)) < 0)
+      perror("write");
+    fcntl(client->Fd, F_SETFL, O_NONBLOCK);
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = client;
+    epoll_ctl(reader.EpollFd, EPOLL_CTL_ADD, client->Fd, &ev);
+    reader.Clients.push_back(client);
+  }
+  pthread_create(&thread, 0, BenchStreamRead, &reader);
+
+  sm500_stream_stats stats;
+  do
+  {
+    usleep(1000);
+    server.GetStats(stats);
+  } while (stats.Clients < num_clients);
+  usleep(100000);                           //let the subscriptions through
+
+  printf("streaming: %u clients (%u compressed), %u bytes/frame raw\n", num_clients, num_clients / 2, sm500_peaks_format::FrameBytes);
+
+  for (uint32_t r=0; r<sizeof(rates)/sizeof(rates[0]); r++)
+  {
+    const uint32_t num_frames = rates[r] * 2;
+    sm500_stream_stats before, after;
+    uint64_t received = 0, bad = 0;
+
+    for (uint32_t c=0; c<num_clients; c++)
+      reader.Clients[c]->Frames = reader.Clients[c]->Bad = 0;
+    server.GetStats(before);
+
+    double t0 = NowNs(), t_publish = 0.0;
+    for (uint32_t f=0; f<num_frames; f++)
+    {
+      MakePeaksFrame(frame, 32, sn++);
+      while (NowNs() - t0 < f * 1e9 / rates[r])
+        ;
+      double t1 = NowNs();
+      server.Publish(SM500_STREAM_PEAKS, frame);
+      t_publish += NowNs() - t1;
+    }
+    double seconds = (NowNs() - t0) / 1e9;
+    usleep(200000);                         //drain
+    server.GetStats(after);
+
+    for (uint32_t c=0; c<num_clients; c++)
+    {
+      received += reader.Clients[c]->Frames;
+      bad += reader.Clients[c]->Bad;
+    }
+    printf("  %5u Hz: %llu of %llu frames received, %llu dropped, %llu bad, %.1f MB/s sent, publish %.2f us/frame, "
+           "reactor %.1f%% of a core (%.2f us/frame)\n",
+           rates[r], (unsigned long long)received, (unsigned long long)num_frames * num_clients,
+           (unsigned long long)(after.Dropped - before.Dropped), (unsigned long long)bad,
+           (after.SentBytes - before.SentBytes) / seconds / 1e6, t_publish / 1e3 / num_frames,
+           (after.ReactorCpuNs - before.ReactorCpuNs) / 1e7 / seconds,
+           (after.ReactorCpuNs - before.ReactorCpuNs) / 1e3 / num_frames);
+  }
+
+  //---------- half-closed clients: commands executed, streaming kept, closed when idle ----------
+  {
+    const uint32_t num_frames = 10;
+    int streaming = BenchStreamConnect(server.GetPort());
+    int idle = BenchStreamConnect(server.GetPort());
+    uint32_t responses[2], frames[2];
+    bool eof[2];
+
+    if ((streaming < 0) || (idle < 0) || (write(streaming, "#StreamPeaks", 12) != 12) ||
+        (write(idle, "#StreamSpectra bogus\n", 21) != 21))
+      perror("half-close");
+    shutdown(streaming, SHUT_WR);           //the last line is not terminated
+    shutdown(idle, SHUT_WR);
+    usleep(100000);
+    for (uint32_t f=0; f<num_frames; f++)
+    {
+      MakePeaksFrame(frame, 32, sn++);
+      server.Publish(SM500_STREAM_PEAKS, frame);
+    }
+    BenchStreamCount(streaming, responses[0], frames[0], eof[0]);
+    BenchStreamCount(idle, responses[1], frames[1], eof[1]);
+    bool ok = (responses[0] == 1) && (frames[0] == num_frames) && !eof[0] && (responses[1] == 1) && (frames[1] == 0) && eof[1];
+    printf("  half-closed: streaming client %u response + %u/%u frames, unsubscribed client %u response then closed: %s\n",
+           responses[0], frames[0], num_frames, responses[1], ok ? "ok" : "WRONG");
+    close(streaming);
+    close(idle);
+  }
+
+  reader.Stop = true;
+  pthread_join(thread, 0);
+  server.Stop();
+  for (uint32_t c=0; c<num_clients; c++)
+  {
+    close(reader.Clients[c]->Fd);
+    reader.Clients[c]->Decoder.Reset();
+  }
+  close(reader.EpollFd);
+}
+
+
+/* ===========================================================================
+Multicast: peaks frames published to a group on the loopback interface,
+with frames left out on purpose (gaps upstream of the publisher), and
+received, checked and gap-checked by a receiver thread.
+=========================================================================== */
+#define BENCH_MCAST_GROUP   "239.255.18.99"
+#define BENCH_MCAST_PORT    18599
+
+struct BenchMcastState
+{
+  Csm500McastReceiver Receiver;
+  vector<uint32_t> Checksums;               //per S/N, 0 = not published
+  uint64_t Frames;
+  uint64_t Mismatches;
+  uint64_t GapFrames;
+  uint64_t NetworkGaps;                     //gaps with datagrams lost
+};
+
+static uint32_t BenchPeaksChecksum(const void *Frame)
+{
+  Csm500PeaksFrame frame(Frame);
+  uint32_t sum = frame.Status() ^ frame.TimestampNsec();
+  for (uint32_t ch=0; ch<SM500_NUM_CHANNELS; ch++)
+    for (Csm500PeaksFrame::const_iterator it=frame.begin(ch); it!=frame.end(ch); ++it)
+      sum = sum * 31 + *it;
+  return sum + 1;
+}
+
+static void BenchMcastGap(void *Context, const sm500_mcast_gap &Gap)
+{
+  BenchMcastState *state = (BenchMcastState*)Context;
+  state->GapFrames += Gap.NumFrames;
+  if (Gap.LostDatagrams)
+    state->NetworkGaps++;
+}
+
+static void* BenchMcastReceive(void *Arg)
+{
+  BenchMcastState *state = (BenchMcastState*)Arg;
+  try
+  {
+    for (;;)
+    {
+      Csm500PeaksFrame frame(state->Receiver.GetPeaksData());
+      uint64_t sn = frame.SerialNumber();
+      if ((sn >= state->Checksums.size()) || (BenchPeaksChecksum(frame.Raw()) != state->Checksums[sn]))
+        state->Mismatches++;
+      state->Frames++;
+    }
+  }
+  catch (int err)
+  {
+    if (err != ETIMEDOUT)
+      printf("  receiver: error %d\n", err);
+  }
+  return 0;
+}
+
+static void BenchMcast(void)
+{
+  const uint32_t num_frames = 20000;
+  const uint32_t gap_every = 1000;          //one frame left out every gap_every
+  const uint32_t peaks[] = { 4, 16, 128 };
+  static uint32_t frame[sm500_peaks_format::FrameDwords];
+  static BenchMcastState state;             //static: large
+
+  printf("multicast: %u frames, 1 left out every %u, MTU %u\n", num_frames, gap_every, SM500_DEFAULT_MCAST_MTU);
+
+  for (uint32_t p=0; p<sizeof(peaks)/sizeof(peaks[0]); p++)
+  {
+    Csm500McastPublisher publisher;
+    sm500_mcast_publisher_stats pub;
+    sm500_mcast_receiver_stats rx;
+    pthread_t thread;
+
+    state.Checksums.assign(num_frames + 1, 0);
+    state.Frames = state.Mismatches = state.GapFrames = state.NetworkGaps = 0;
+    try
+    {
+      state.Receiver.SetTimeout(500);
+      state.Receiver.SetGapCallback(BenchMcastGap, &state);
+      state.Receiver.Open(BENCH_MCAST_GROUP, BENCH_MCAST_PORT, "127.0.0.1");
+      publisher.Open(BENCH_MCAST_GROUP, BENCH_MCAST_PORT, "127.0.0.1");
+    }
+    catch (int err)
+    {
+      printf("  multicast unavailable (error %d)\n", err);
+      return;
+    }
+    pthread_create(&thread, 0, BenchMcastReceive, &state);
+
+    double publish_ns = 0;
+    uint32_t left_out = 0;
+    for (uint32_t sn=1; sn<=num_frames; sn++)
+    {
+      MakePeaksFrame(frame, peaks[p], sn);
+      frame[sm500_peaks_format::TimestampOffset32 + 1] = sn * 1000;
+      state.Checksums[sn] = BenchPeaksChecksum(frame);
+      if (sn % gap_every == 0)
+      {
+        left_out++;
+        continue;
+      }
+
+      double t0 = NowNs();
+      publisher.Publish(frame);
+      publish_ns += NowNs() - t0;
+      if (sn % 500 == 0)
+        usleep(1000);                       //let the receiver run (single core)
+    }
+    publisher.Flush();
+    pthread_join(thread, 0);
+
+    publisher.GetStats(pub);
+    state.Receiver.GetStats(rx);
+    state.Receiver.Close();
+    printf("  %3u peaks/ch: %6.1f bytes/frame on the wire (raw %u), %4.1f frames/datagram, publish %6.0f ns/frame\n",
+           peaks[p], (double)pub.Bytes / pub.Frames, sm500_peaks_format::FrameBytes, (double)pub.Frames / pub.Datagrams,
+           publish_ns / pub.Frames);
+    printf("                received %llu/%llu, %llu mismatches, gaps %llu (%llu frames, %u left out), %llu datagrams lost\n",
+           (unsigned long long)state.Frames, (unsigned long long)pub.Frames, (unsigned long long)state.Mismatches,
+           (unsigned long long)rx.Gaps, (unsigned long long)state.GapFrames, left_out,
+           (unsigned long long)rx.LostDatagrams);
+  }
+}
+
+
+/* ===========================================================================
+Shared memory ring: two reader processes (one copying, one reading in
+place) fed at 1 kHz, for the publish-to-read latency, then flooded, for the
+publisher cost and the losses of readers that cannot keep up.
+=========================================================================== */
+#define BENCH_SHM_NAME      "/sm500_bench_peaks"
+#define BENCH_SHM_FLOOD_SN  1000000         //S/N of the flood frames
+
+struct BenchShmResult
+{
+  uint64_t Frames;
+  uint64_t Lost;
+  uint64_t Sleeps;
+  uint64_t Mismatches;
+  double P50Us, P99Us, MaxUs;
+};
+
+static void BenchShmReader(bool InPlace, BenchShmResult *Result)
+{
+  Csm500ShmReader reader;
+  sm500_shm_frame_info info;
+  vector<double> latency;
+
+  memset(Result, 0, sizeof(*Result));
+  reader.Open(BENCH_SHM_NAME);
+  try
+  {
+    for (;;)
+    {
+      const void *frame = InPlace ? reader.Acquire(&info) : reader.GetData(&info);
+      struct timespec ts;
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      uint64_t sn = Csm500PeaksFrame(frame).SerialNumber();
+
+      if (sn != info.SerialNumber)
+        Result->Mismatches++;
+      if (InPlace && !reader.Release())
+        continue;
+      if (sn < BENCH_SHM_FLOOD_SN)
+        latency.push_back(((uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec - info.PublishNs) / 1e3);
+    }
+  }
+  catch (int err)
+  {
+    if (err != ENODATA)
+      printf("  reader: error %d\n", err);
+  }
+
+  sm500_shm_reader_stats stats;
+  reader.GetStats(stats);
+  Result->Frames = stats.Frames;
+  Result->Lost = stats.Lost;
+  Result->Sleeps = stats.Sleeps;
+  if (latency.size())
+  {
+    sort(latency.begin(), latency.end());
+    Result->P50Us = latency[latency.size() / 2];
+    Result->P99Us = latency[latency.size() * 99 / 100];
+    Result->MaxUs = latency.back();
+  }
+}
+
+static void BenchShm(void)
+{
+  const uint32_t paced_frames = 2000;
+  const uint32_t flood_frames = 100000;
+  static uint32_t frame[sm500_peaks_format::FrameDwords];
+  Csm500ShmPublisher publisher;
+  sm500_shm_publisher_stats stats;
+  pid_t pids[2];
+
+  //---------- results written by the children ----------
+  BenchShmResult *results = (BenchShmResult*)mmap(0, 2 * sizeof(BenchShmResult), PROT_READ | PROT_WRITE,
+                                                  MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  publisher.Open(BENCH_SHM_NAME, sm500_peaks_format::FrameBytes, SM500_DEFAULT_SHM_PEAKS_SLOTS);
+  for (int r=0; r<2; r++)
+  {
+    pids[r] = fork();
+    if (pids[r] == 0)
+    {
+      BenchShmReader(r == 1, &results[r]);
+      _exit(0);
+    }
+  }
+  do
+  {
+    usleep(1000);
+    publisher.GetStats(stats);
+  } while (stats.Readers < 2);
+
+  //---------- paced ----------
+  struct timespec next;
+  clock_gettime(CLOCK_MONOTONIC, &next);
+  MakePeaksFrame(frame, 32, 0);
+  for (uint32_t sn=1; sn<=paced_frames; sn++)
+  {
+    next.tv_nsec += 1000000;
+    if (next.tv_nsec >= 1000000000)
+    {
+      next.tv_nsec -= 1000000000;
+      next.tv_sec++;
+    }
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, 0);
+    frame[sm500_peaks_format::SerialLoOffset32] = sn;
+    publisher.Publish(frame);
+  }
+  publisher.GetStats(stats);
+  uint64_t paced_wakeups = stats.Wakeups;
+
+  //---------- flood ----------
+  double t0 = NowNs();
+  for (uint32_t f=0; f<flood_frames; f++)
+  {
+    frame[sm500_peaks_format::SerialLoOffset32] = BENCH_SHM_FLOOD_SN + f;
+    publisher.Publish(frame);
+  }
+  double publish_ns = (NowNs() - t0) / flood_frames;
+  publisher.GetStats(stats);
+
+  usleep(200000);
+  publisher.Close();
+  for (int r=0; r<2; r++)
+    waitpid(pids[r], 0, 0);
+
+  printf("shared memory ring: %u slots of %u bytes, 2 reader processes\n", SM500_DEFAULT_SHM_PEAKS_SLOTS, sm500_peaks_format::FrameBytes);
+  printf("  publish %.0f ns/frame (flood), %llu wake-ups for %u paced frames\n", publish_ns,
+         (unsigned long long)paced_wakeups, paced_frames);
+  for (int r=0; r<2; r++)
+    printf("  %-8s latency p50 %6.1f us, p99 %6.1f us, max %7.1f us; %llu frames read, %llu lost, %llu sleeps, %llu mismatches\n",
+           r ? "in place" : "copy", results[r].P50Us, results[r].P99Us, results[r].MaxUs,
+           (unsigned long long)results[r].Frames, (unsigned long long)results[r].Lost,
+           (unsigned long long)results[r].Sleeps, (unsigned long long)results[r].Mismatches);
+  munmap(results, 2 * sizeof(BenchShmResult));
+}
+
+
+/* ===========================================================================
+C interface: a recording read through sm500_read() in batches of 1 to 256
+frames (one foreign call per batch), checked for order and against
+sm500_get_latest().
+=========================================================================== */
+static void BenchCApi(void)
+{
+  const uint32_t num_peaks = 20000;
+  const uint32_t batches[] = { 1, 16, 256 };
+  static uint32_t peaks[sm500_peaks_format::FrameDwords];
+  static sm500_frame_meta meta[256];
+  static uint32_t latest[sm500_peaks_format::FrameDwords];
+  vector<uint8_t> buffer(256 * sm500_frame_bytes(SM500_CAPI_PEAKS));
+  Csm500Recorder recorder;
+
+  //---------- record ----------
+  MakePeaksFrame(peaks, 32, 0);
+  recorder.SetSegmentBytes(64 << 20);
+  recorder.Start(BENCH_REC_PATH);
+  for (uint32_t i=0; i<num_peaks; i++)
+  {
+    uint64_t ns = 1000000ULL * i;
+    peaks[sm500_header_layout::SerialLoOffset32] = i;
+    peaks[sm500_header_layout::TimestampOffset32] = 100 + ns / 1000000000ULL;
+    peaks[sm500_header_layout::TimestampOffset32 + 1] = ns % 1000000000ULL;
+    while (!recorder.RecordPeaks(peaks))
+      usleep(100);
+  }
+  recorder.Stop();
+
+  printf("C interface: %u recorded peaks frames, version %d\n", num_peaks, sm500_capi_version());
+  for (uint32_t b=0; b<sizeof(batches)/sizeof(batches[0]); b++)
+  {
+    sm500_handle *handle;
+    uint64_t calls = 0, frames = 0, order_errors = 0;
+    uint32_t n;
+    int err;
+
+    if ((err = sm500_open_replay(BENCH_REC_PATH, 0, &handle)) != 0)
+    {
+      printf("  sm500_open_replay: error %d\n", err);
+      break;
+    }
+    double t0 = NowNs();
+    while ((err = sm500_read(handle, SM500_CAPI_PEAKS, &buffer[0], buffer.size(), 1, batches[b], meta, &n)) == 0)
+    {
+      for (uint32_t i=0; i<n; i++)
+        if (meta[i].SerialNumber != frames + i)
+          order_errors++;
+      frames += n;
+      calls++;
+    }
+    double t = NowNs() - t0;
+
+    sm500_frame_meta last;
+    bool same = (sm500_get_latest(handle, SM500_CAPI_PEAKS, latest, sizeof(latest), &last) == 0) &&
+                (last.SerialNumber == num_peaks - 1) && (Csm500PeaksFrame(latest).SerialNumber() == num_peaks - 1);
+    printf("  batch %3u: %6llu calls, %6.1f ns/frame, %llu frames (ended with error %d), order errors %llu, latest %s\n",
+           batches[b], (unsigned long long)calls, t / frames, (unsigned long long)frames, err,
+           (unsigned long long)order_errors, same ? "ok" : "WRONG");
+    sm500_close(handle);
+  }
+
+  uint64_t bad = 0;
+  BenchCheckSegments(BENCH_REC_PATH, bad);    //removes the segments
+}
+
+
+/* ===========================================================================
+Failed reads: the end of a recording reached through GetPeaksData() (the
+ENODATA exception thrown and caught) and through TryGetPeaksData() (the
+status returned).
+=========================================================================== */
+static void BenchStatus(void)
+{
+  const uint32_t num_peaks = 100;
+  const uint32_t num_reads = 200000;
+  static uint32_t peaks[sm500_peaks_format::FrameDwords];
+  Csm500Recorder recorder;
+  Csm500ReplayDev dev;
+  uint64_t thrown = 0, returned = 0;
+
+  //---------- record, then read to the end ----------
+  MakePeaksFrame(peaks, 8, 0);
+  recorder.Start(BENCH_REC_PATH);
+  for (uint32_t i=0; i<num_peaks; i++)
+  {
+    peaks[sm500_header_layout::SerialLoOffset32] = i;
+    while (!recorder.RecordPeaks(peaks))
+      usleep(100);
+  }
+  recorder.Stop();
+
+  dev.SetPacing(SM500_REPLAY_FAST);
+  dev.Init(BENCH_REC_PATH);
+  while (dev.TryGetPeaksData().Ok())
+    ;
+
+  //---------- throwing ----------
+  double t0 = NowNs();
+  for (uint32_t i=0; i<num_reads; i++)
+  {
+    try
+    {
+      dev.GetPeaksData();
+    }
+    catch (int err)
+    {
+      thrown += (err == ENODATA);
+    }
+  }
+  double t_throw = NowNs() - t0;
+
+  //---------- status ----------
+  t0 = NowNs();
+  for (uint32_t i=0; i<num_reads; i++)
+    returned += (dev.TryGetPeaksData().Status == SM500_NO_DATA);
+  double t_try = NowNs() - t0;
+
+  printf("Failed reads (ENODATA), %u reads:\n", num_reads);
+  printf("  GetPeaksData (throw/catch): %8.1f ns/read, %llu ENODATA\n", t_throw / num_reads, (unsigned long long)thrown);
+  printf("  TryGetPeaksData (status):   %8.1f ns/read, %llu SM500_NO_DATA\n", t_try / num_reads, (unsigned long long)returned);
+
+  dev.Close();
+  uint64_t bad = 0;
+  BenchCheckSegments(BENCH_REC_PATH, bad);    //removes the segments
+}
+
+
+/* ===========================================================================
+Register shadow: the constant registers read from the shadow against the
+floor of the uncached path (the register read ioctl, issued on /dev/null
+so that it only costs the system call, without the MMIO read), and a
+configuration sequence staged and flushed as one batch.
+=========================================================================== */
+static void BenchRegs(void)
+{
+  const uint32_t num_reads = 1000000;
+  const uint32_t num_configs = 10000;
+  const uint32_t constants[] = { SM500_REG_HVER, SM500_REG_NFSBUF, SM500_REG_FSBUFSZ,
+                                 SM500_REG_NPKBUF, SM500_REG_PKBUFSZ, SM500_REG_TSOFST };
+  const uint32_t num_constants = sizeof(constants) / sizeof(constants[0]);
+  struct sm500_ioctl_reg_arg regs[SM500_IOC_MAX_REGS];
+  Csm500RegShadow shadow;
+  sm500_reg_shadow_stats stats;
+  uint32_t value, sum = 0;
+
+  //---------- uncached: the ioctl alone ----------
+  int fd = open("/dev/null", O_RDONLY);
+  double t0 = NowNs();
+  for (uint32_t i=0; i<num_reads; i++)
+  {
+    struct sm500_ioctl_reg_arg arg;
+    arg.reg = constants[i % num_constants];
+    arg.value = 0;
+    ioctl(fd, SM500_IOC_READ_REG32, (unsigned long)(&arg));
+    sum += arg.value;
+  }
+  double t_ioctl = NowNs() - t0;
+  close(fd);
+
+  //---------- shadow ----------
+  for (uint32_t c=0; c<num_constants; c++)
+    shadow.Fill(constants[c], 0x100 + c);
+  t0 = NowNs();
+  for (uint32_t i=0; i<num_reads; i++)
+    if (shadow.Lookup(constants[i % num_constants], value))
+      sum += value;
+  double t_shadow = NowNs() - t0;
+
+  printf("Register reads (%u constant register reads):\n", num_reads);
+  printf("  ioctl only (no MMIO): %7.1f ns/read\n", t_ioctl / num_reads);
+  printf("  shadow:               %7.1f ns/read (checksum %u)\n", t_shadow / num_reads, sum);
+
+  //---------- configurations: interrupts off, DMA off, DMA on, interrupts on, ... ----------
+  uint64_t writes = 0, flushed = 0, now = 0;
+  t0 = NowNs();
+  for (uint32_t i=0; i<num_configs; i++)
+  {
+    uint32_t dma = (i & 1) ? SM500_DMA_PK : SM500_DMA_PK + SM500_DMA_FS;
+    shadow.BeginBatch();
+    now += shadow.Write(SM500_REG_INTE, SM500_INT_CLEAR);
+    now += shadow.Write(SM500_REG_DMACR, SM500_DMA_CLEAR);
+    now += shadow.Write(SM500_REG_DMACR, dma);
+    now += shadow.Write(SM500_REG_INTE, SM500_INT_PK);
+    now += shadow.Write(SM500_REG_INTE, SM500_INT_PK + SM500_INT_FS);
+    now += shadow.Write(SM500_REG_DMACR, SM500_DMA_PK + SM500_DMA_FS);
+    writes += 6;
+    flushed += shadow.TakeDirty(regs, SM500_IOC_MAX_REGS);
+  }
+  double t_config = NowNs() - t0;
+  shadow.GetStats(stats);
+
+  printf("Configurations (%u sequences of 6 register writes):\n", num_configs);
+  printf("  %llu writes -> %llu staged, %llu flushed in %llu batches (%.2f register writes/sequence), "
+         "%llu elided, %llu immediate, %.1f ns/sequence\n",
+         (unsigned long long)writes, (unsigned long long)stats.WritesStaged, (unsigned long long)flushed,
+         (unsigned long long)stats.Batches, (double)flushed / num_configs, (unsigned long long)stats.WritesElided,
+         (unsigned long long)now, t_config / num_configs);
+}
+
+
+/* ===========================================================================
+Latency statistics: the cost of following a frame through its stages,
+the percentiles against the exact ones, concurrent recording threads
+with an exporter, a thread past SM500_LAT_MAX_THREADS, and a replayed
+decode + publish pipeline.
+=========================================================================== */
+struct BenchLatencyThread
+{
+  Csm500LatencyStats *Stats;
+  uint32_t Samples;
+  pthread_barrier_t *Hold;        //when set: recorded, then held alive until released
+  double Ns;                      //per sample
+};
+
+static void* BenchLatencyRecorder(void *Arg)
+{
+  BenchLatencyThread *t = (BenchLatencyThread*)Arg;
+
+  double t0 = NowNs();
+  for (uint32_t i=0; i<t->Samples; i++)
+    t->Stats->Record(SM500_LAT_DECODE, 1000 + (i % 5000));
+  t->Ns = (NowNs() - t0) / t->Samples;
+  if (t->Hold)
+  {
+    pthread_barrier_wait(t->Hold);    //all blocks taken
+    pthread_barrier_wait(t->Hold);    //released
+  }
+  return 0;
+}
+
+static void BenchLatency(void)
+{
+  const uint32_t num_frames = 1000000;
+  const uint32_t num_samples = 1000000;
+  const uint32_t num_threads = 4;
+  static uint32_t peaks[sm500_peaks_format::FrameDwords];
+  sm500_latency_summary sum;
+
+  //---------- cost per frame: wakeup, decode, publish, total ----------
+  {
+    Csm500LatencyStats stats;
+    sm500_latency_mark mark;
+
+    MakePeaksFrame(peaks, 8, 0);
+    double t0 = NowNs();
+    for (uint32_t i=0; i<num_frames; i++)
+    {
+      if ((i & 1023) == 0)
+      {
+        uint64_t isr = Csm500LatencyStats::NowNs() - 50000;
+        peaks[sm500_header_layout::TimestampOffset32] = isr / 1000000000ull;
+        peaks[sm500_header_layout::TimestampOffset32 + 1] = isr % 1000000000ull;
+      }
+      stats.FrameRead(peaks, mark);
+      stats.StageDone(SM500_LAT_DECODE, mark);
+      stats.StageDone(SM500_LAT_PUBLISH, mark);
+      stats.FrameDone(mark);
+    }
+    double t_frame = (NowNs() - t0) / num_frames;
+
+    t0 = NowNs();
+    for (uint32_t i=0; i<num_frames; i++)
+      stats.Record(SM500_LAT_DECODE, i & 0xFFFF);
+    double t_record = (NowNs() - t0) / num_frames;
+
+    printf("Latency statistics: %.1f ns per frame followed (4 samples, 3 clock reads), %.1f ns per Record()\n", t_frame, t_record);
+  }
+
+  //---------- FindThreadMark() (the read path) does not register the thread ----------
+  {
+    Csm500LatencyStats stats;
+    bool ok = (stats.FindThreadMark() == 0) && (stats.FindThreadMark() == 0) && stats.RegisterThread() &&
+              (stats.FindThreadMark() == &stats.ThreadMark());
+    printf("  unregistered thread skipped, registered thread found: %s\n", ok ? "ok" : "WRONG");
+  }
+
+  //---------- percentiles against the exact ones (log-normal samples) ----------
+  {
+    Csm500LatencyStats stats;
+    vector<uint64_t> exact(num_samples);
+    const double fractions[] = { 0.5, 0.99, 0.999, 0.9999 };
+
+    srand(1);
+    for (uint32_t i=0; i<num_samples; i++)
+    {
+      double u1 = (rand() + 1.0) / (RAND_MAX + 2.0), u2 = (rand() + 1.0) / (RAND_MAX + 2.0);
+      double z = sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+      exact[i] = (uint64_t)(20000.0 * exp(0.8 * z));    //~20 us median, long tail
+      stats.Record(SM500_LAT_WAKEUP, exact[i]);
+    }
+    sort(exact.begin(), exact.end());
+    stats.GetSummary(SM500_LAT_WAKEUP, sum);
+    uint64_t measured[] = { sum.P50Ns, sum.P99Ns, sum.P999Ns, sum.P9999Ns };
+
+    printf("  percentiles of %u log-normal samples (exact / histogram / error):\n", num_samples);
+    for (uint32_t p=0; p<4; p++)
+    {
+      uint64_t e = exact[(size_t)ceil(fractions[p] * num_samples) - 1];
+      printf("    p%-7g %10.1f us %10.1f us %+6.2f%%\n", fractions[p] * 100, e / 1e3, measured[p] / 1e3,
+             100.0 * ((double)measured[p] - (double)e) / e);
+    }
+  }
+
+  //---------- concurrent recorders and an exporter ----------
+  {
+    Csm500LatencyStats stats;
+    pthread_t threads[num_threads];
+    BenchLatencyThread args[num_threads];
+    uint32_t exports = 0;
+
+    double t0 = NowNs();
+    for (uint32_t t=0; t<num_threads; t++)
+    {
+      args[t].Stats = &stats;
+      args[t].Samples = num_samples / num_threads;
+      args[t].Hold = 0;
+      pthread_create(&threads[t], 0, BenchLatencyRecorder, &args[t]);
+    }
+    do
+    {
+      stats.GetSummary(SM500_LAT_DECODE, sum);
+      exports++;
+    } while (sum.Count < num_samples);
+    for (uint32_t t=0; t<num_threads; t++)
+      pthread_join(threads[t], 0);
+    double t = NowNs() - t0;
+
+    stats.GetSummary(SM500_LAT_DECODE, sum);
+    printf("  %u threads: %llu/%u samples merged (%s), %u exports meanwhile, %.1f ns/sample\n", num_threads,
+           (unsigned long long)sum.Count, num_samples, (sum.Count == num_samples) ? "ok" : "LOST", exports, t / num_samples);
+  }
+
+  //---------- a thread past SM500_LAT_MAX_THREADS: dropped, without locking ----------
+  {
+    Csm500LatencyStats stats;
+    pthread_t threads[SM500_LAT_MAX_THREADS];
+    BenchLatencyThread args[SM500_LAT_MAX_THREADS];
+    pthread_barrier_t hold;
+
+    pthread_barrier_init(&hold, 0, SM500_LAT_MAX_THREADS + 1);
+    for (uint32_t t=0; t<SM500_LAT_MAX_THREADS; t++)
+    {
+      args[t].Stats = &stats;
+      args[t].Samples = 1;
+      args[t].Hold = &hold;
+      pthread_create(&threads[t], 0, BenchLatencyRecorder, &args[t]);
+    }
+    pthread_barrier_wait(&hold);
+
+    BenchLatencyThread extra = { &stats, num_samples, 0, 0.0 };
+    pthread_t extra_thread;
+    pthread_create(&extra_thread, 0, BenchLatencyRecorder, &extra);
+    pthread_join(extra_thread, 0);
+
+    pthread_barrier_wait(&hold);
+    for (uint32_t t=0; t<SM500_LAT_MAX_THREADS; t++)
+      pthread_join(threads[t], 0);
+    pthread_barrier_destroy(&hold);
+
+    stats.GetSummary(SM500_LAT_DECODE, sum);
+    bool ok = (stats.GetDropped() == num_samples) && (sum.Count == SM500_LAT_MAX_THREADS);
+    printf("  thread %u: %llu samples dropped, %.1f ns/sample: %s\n", SM500_LAT_MAX_THREADS + 1,
+           (unsigned long long)stats.GetDropped(), extra.Ns, ok ? "ok" : "WRONG");
+  }
+
+  //---------- replayed frames: decode and publish ----------
+  {
+    const uint32_t num_peaks = 20000;
+    static sm500_peaks_soa decoded;
+    static sm500_sensor_values values;
+    Csm500Recorder recorder;
+    Csm500ReplayDev dev;
+
+    MakePeaksFrame(peaks, 32, 0);
+    recorder.SetSegmentBytes(64 << 20);
+    recorder.Start(BENCH_REC_PATH);
+    for (uint32_t i=0; i<num_peaks; i++)
+    {
+      peaks[sm500_header_layout::SerialLoOffset32] = i;
+      while (!recorder.RecordPeaks(peaks))
+        usleep(100);
+    }
+    recorder.Stop();
+
+    dev.SetPacing(SM500_REPLAY_FAST);
+    dev.Init(BENCH_REC_PATH);
+    dev.GetLatencyStats().Enable(true);
+    values.NumSensors = 32;
+    for (uint32_t i=0; i<num_peaks; i++)
+    {
+      dev.GetPeaks(decoded);
+      values.SerialNumber = i;
+      dev.Publish(values);
+    }
+    printf("  replayed pipeline, %u frames:\n", num_peaks);
+    dev.GetLatencyStats().Export(stdout);
+    dev.Close();
+
+    uint64_t bad = 0;
+    BenchCheckSegments(BENCH_REC_PATH, bad);    //removes the segments
+  }
+}
+
+
+/* ===========================================================================
+Serial numbers: the cost of the continuity check on frames in sequence,
+then a recording with a gap, a duplicate, a stale frame (after a
+CancelReads()) and a card reset replayed through Csm500ReplayDev.
+=========================================================================== */
+static uint32_t BenchSerialEvents[3];
+
+static void BenchSerialEvent(void *, const sm500_sn_event &Event)
+{
+  BenchSerialEvents[Event.Type]++;
+  printf("    %-10s expected %5llu got %5llu (%llu frames)%s\n",
+         (Event.Type == SM500_SN_GAP) ? "gap" : (Event.Type == SM500_SN_DUPLICATE) ? "duplicate" : "backwards",
+         (unsigned long long)Event.Expected, (unsigned long long)Event.SerialNumber,
+         (unsigned long long)Event.NumFrames, Event.AfterCancel ? ", after CancelReads()" : "");
+}
+
+static void BenchSerial(void)
+{
+  const uint64_t num_checks = 100000000;
+  static uint32_t peaks[sm500_peaks_format::FrameDwords];
+  vector<uint64_t> sequence;
+  size_t stale = 0;
+  Csm500SerialTracker tracker;
+  Csm500Recorder recorder;
+  Csm500ReplayDev dev;
+  sm500_sn_stats stats;
+
+  //---------- in sequence ----------
+  double t0 = NowNs();
+  for (uint64_t sn=0; sn<num_checks; sn++)
+    tracker.Check(sn);
+  double t = NowNs() - t0;
+  tracker.GetStats(stats);
+  printf("Serial numbers: %.2f ns per frame in sequence (%llu frames, %llu breaks)\n", t / num_checks,
+         (unsigned long long)stats.Frames, (unsigned long long)(stats.Gaps + stats.Duplicates + stats.Backwards));
+
+  //---------- 0..600 with 100..104 missing, 200 twice and a stale 250 after 300, then 0..399 after a reset ----------
+  for (uint64_t sn=0; sn<=600; sn++)
+  {
+    if ((sn >= 100) && (sn <= 104))
+      continue;
+    sequence.push_back(sn);
+    if (sn == 200)
+      sequence.push_back(sn);
+    if (sn == 300)
+    {
+      stale = sequence.size();
+      sequence.push_back(250);
+    }
+  }
+  for (uint64_t sn=0; sn<400; sn++)
+    sequence.push_back(sn);
+
+  MakePeaksFrame(peaks, 8, 0);
+  recorder.Start(BENCH_REC_PATH);
+  for (size_t i=0; i<sequence.size(); i++)
+  {
+    peaks[sm500_peaks_format::SerialLoOffset32] = (uint32_t)sequence[i];
+    peaks[sm500_peaks_format::SerialHiOffset32] = (uint32_t)(sequence[i] >> 32);
+    while (!recorder.RecordPeaks(peaks))
+      usleep(100);
+  }
+  recorder.Stop();
+
+  dev.SetPacing(SM500_REPLAY_FAST);
+  dev.Init(BENCH_REC_PATH);
+  dev.SetSerialCallback(BenchSerialEvent, 0);
+  memset(BenchSerialEvents, 0, sizeof(BenchSerialEvents));
+  printf("  replayed recording of %u frames:\n", (uint32_t)sequence.size());
+  for (size_t i=0; i<sequence.size(); i++)
+  {
+    if (i == stale)                         //the stale frame follows a cancel
+      dev.CancelReads();
+    if (!dev.TryGetPeaksData().Ok())
+      break;
+  }
+  dev.GetSerialStats(SM500_SN_PEAKS, stats);
+  bool ok = (stats.Gaps == 1) && (stats.MissedFrames == 5) && (stats.Duplicates == 1) && (stats.Backwards == 2) &&
+            (stats.AfterCancel == 1) && (stats.Frames == sequence.size()) && (stats.LastSerialNumber == 399) &&
+            (dev.GetDmaSerialNumber() == 399);
+  printf("  %llu frames, %llu gaps (%llu frames), %llu duplicates, %llu backwards, %llu after a cancel, last S/N %llu: %s\n",
+         (unsigned long long)stats.Frames, (unsigned long long)stats.Gaps, (unsigned long long)stats.MissedFrames,
+         (unsigned long long)stats.Duplicates, (unsigned long long)stats.Backwards, (unsigned long long)stats.AfterCancel,
+         (unsigned long long)stats.LastSerialNumber, ok ? "ok" : "WRONG");
+
+  //---------- a second pass in loop mode: the same breaks again, none at the wrap ----------
+  dev.SetLoop(true);
+  for (size_t i=0; i<sequence.size(); i++)
+    if (!dev.TryGetPeaksData().Ok())
+      break;
+  dev.GetSerialStats(SM500_SN_PEAKS, stats);
+  ok = (stats.Gaps == 2) && (stats.Duplicates == 2) && (stats.Backwards == 4) && (stats.Frames == 2 * sequence.size());
+  printf("  looped twice: %llu gaps, %llu duplicates, %llu backwards: %s\n", (unsigned long long)stats.Gaps,
+         (unsigned long long)stats.Duplicates, (unsigned long long)stats.Backwards, ok ? "ok" : "WRONG");
+  dev.Close();
+
+  uint64_t bad = 0;
+  BenchCheckSegments(BENCH_REC_PATH, bad);    //removes the segments
+
+  //---------- FS stream: every 10th S/N from 1000 to 1990, then a reset to 0..490 ----------
+  Csm500SerialTracker fs(SM500_SN_FS);
+  for (uint64_t sn=1000; sn<2000; sn+=10)
+    fs.Check(sn);
+  for (uint64_t sn=0; sn<500; sn+=10)
+    fs.Check(sn);
+  fs.GetStats(stats);
+  printf("  FS stream reset: %llu frames, %llu backwards, last S/N %llu: %s\n", (unsigned long long)stats.Frames,
+         (unsigned long long)stats.Backwards, (unsigned long long)stats.LastSerialNumber,
+         (stats.Frames == 150) && (stats.Backwards == 1) && (stats.Gaps == 0) && (stats.LastSerialNumber == 490) ? "ok" : "WRONG");
+}
+
+
+/* ===========================================================================
+Jitter: a 1 kHz acquisition loop (clock_nanosleep() standing in for the
+interrupt) reading a fresh peaks frame of a shared read-only mapping every
+period, as the DMA buffers are read, while a busy thread competes for the
+CPU.  The wakeup latency and the frame read time are compared with the
+real-time mode off and on.
+=========================================================================== */
+static std::atomic<bool> BenchJitterStop;
+
+static void* BenchJitterLoad(void *)
+{
+  volatile uint64_t n = 0;
+
+  while (!BenchJitterStop.load(std::memory_order_relaxed))
+    n++;
+  return 0;
+}
+
+static void* BenchJitterSmallStack(void *Arg)
+{
+  ((Csm500RealTime*)Arg)->PrefaultStack();
+  return 0;
+}
+
+static void BenchJitterRun(bool RealTimeMode, int Fd, size_t Bytes)
+{
+  const uint32_t num_periods = 3000;
+  const uint64_t period_ns = 1000000;
+  const size_t frame_bytes = sm500_peaks_format::FrameBytes;
+  Csm500RealTime rt;
+  sm500_rt_config config;
+  sm500_rt_status status;
+  Csm500LatencyStats stats;
+  sm500_latency_summary wakeup, read;
+  volatile uint64_t sum = 0;
+
+  //a new mapping: the pages are in the page cache, not in the page tables
+  const uint8_t *map = (const uint8_t*)mmap(0, Bytes, PROT_READ, MAP_SHARED, Fd, 0);
+  if (map == MAP_FAILED)
+  {
+    printf("  mmap: %s\n", strerror(errno));
+    return;
+  }
+
+  rt.GetConfig(config);
+  config.Enabled = RealTimeMode;
+  config.Cpu = 0;
+  rt.SetConfig(config);
+  if (RealTimeMode)
+  {
+    rt.Enter();
+    rt.Prefault(map, Bytes);
+    rt.PrefaultStack();
+  }
+  stats.Enable(true);
+  stats.ThreadMark();
+
+  struct timespec next;
+  clock_gettime(CLOCK_MONOTONIC, &next);
+  for (uint32_t i=0; i<num_periods; i++)
+  {
+    struct timespec now;
+    next.tv_nsec += period_ns;
+    if (next.tv_nsec >= 1000000000)
+    {
+      next.tv_nsec -= 1000000000;
+      next.tv_sec++;
+    }
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, 0);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t late = (int64_t)(now.tv_sec - next.tv_sec) * 1000000000 + (now.tv_nsec - next.tv_nsec);
+
+    double t0 = NowNs();
+    const uint32_t *frame = (const uint32_t*)(map + (i * frame_bytes) % Bytes);
+    for (size_t w=0; w<frame_bytes / 4; w+=64)
+      sum += frame[w];
+    stats.Record(SM500_LAT_WAKEUP, (late > 0) ? late : 0);
+    stats.Record(SM500_LAT_DECODE, (uint64_t)(NowNs() - t0));
+  }
+
+  rt.GetStatus(status);
+  rt.Leave();
+  munmap((void*)map, Bytes);
+  stats.GetSummary(SM500_LAT_WAKEUP, wakeup);
+  stats.GetSummary(SM500_LAT_DECODE, read);
+
+  if (RealTimeMode)
+    printf("  real-time mode on (pin %s, SCHED_FIFO %s, mlockall %s, %llu pages prefaulted):\n",
+           status.PinErr ? strerror(status.PinErr) : "ok", status.SchedErr ? strerror(status.SchedErr) : "ok",
+           status.LockErr ? strerror(status.LockErr) : "ok", (unsigned long long)status.PagesPrefaulted);
+  else
+    printf("  real-time mode off:\n");
+  printf("    wakeup     p50 %8.1f us  p99 %8.1f us  p99.9 %8.1f us  max %8.1f us\n",
+         wakeup.P50Ns / 1e3, wakeup.P99Ns / 1e3, wakeup.P999Ns / 1e3, wakeup.MaxNs / 1e3);
+  printf("    frame read p50 %8.1f us  p99 %8.1f us  p99.9 %8.1f us  max %8.1f us\n",
+         read.P50Ns / 1e3, read.P99Ns / 1e3, read.P999Ns / 1e3, read.MaxNs / 1e3);
+}
+
+static void BenchJitter(void)
+{
+  const char *path = "/dev/shm/bench_sm500_jitter";
+  const size_t bytes = 4096 * sm500_peaks_format::FrameBytes;   //more frames than periods: every read touches new pages
+  static uint32_t peaks[sm500_peaks_format::FrameDwords];
+  pthread_t load;
+
+  //---------- the "DMA buffers": a file in the page cache ----------
+  int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if (fd < 0)
+  {
+    printf("Jitter: %s: %s\n", path, strerror(errno));
+    return;
+  }
+  MakePeaksFrame(peaks, 32, 0);
+  for (size_t off=0; off<bytes; off+=sm500_peaks_format::FrameBytes)
+    if (write(fd, peaks, sm500_peaks_format::FrameBytes) != (ssize_t)sm500_peaks_format::FrameBytes)
+      break;
+
+  printf("Jitter: 1 kHz loop against a busy thread, %ld CPU(s)\n", sysconf(_SC_NPROCESSORS_ONLN));
+  BenchJitterStop = false;
+  pthread_create(&load, 0, BenchJitterLoad, 0);
+  BenchJitterRun(false, fd, bytes);
+  BenchJitterRun(true, fd, bytes);
+  BenchJitterStop = true;
+  pthread_join(load, 0);
+
+  close(fd);
+  unlink(path);
+
+  //---------- the same settings through Init() and Close() ----------
+  {
+    Csm500Recorder recorder;
+    Csm500ReplayDev dev;
+    sm500_rt_config config;
+    sm500_rt_status open, closed;
+
+    recorder.Start(BENCH_REC_PATH);
+    for (uint32_t i=0; i<1000; i++)
+    {
+      MakePeaksFrame(peaks, 32, i);
+      while (!recorder.RecordPeaks(peaks))
+        usleep(100);
+    }
+    recorder.Stop();
+
+    dev.GetRealTime().GetConfig(config);
+    config.Enabled = true;
+    config.Cpu = 0;
+    dev.GetRealTime().SetConfig(config);
+    dev.SetPacing(SM500_REPLAY_FAST);
+    dev.Init(BENCH_REC_PATH);
+    dev.GetRealTime().GetStatus(open);
+    dev.Close();
+    dev.GetRealTime().GetStatus(closed);
+    printf("  Csm500ReplayDev::Init(): %llu pages prefaulted, active until Close(): %s\n",
+           (unsigned long long)open.PagesPrefaulted, (open.Active && !closed.Active) ? "ok" : "WRONG");
+
+    uint64_t bad = 0;
+    BenchCheckSegments(BENCH_REC_PATH, bad);    //removes the segments
+  }
+
+  //---------- an acquisition thread with a 64 KB stack ----------
+  {
+    const size_t stack_bytes = 64 * 1024;
+    Csm500RealTime rt;
+    sm500_rt_config config;
+    sm500_rt_status status;
+    pthread_attr_t attr;
+    pthread_t thread;
+
+    rt.GetConfig(config);
+    config.Enabled = true;
+    rt.SetConfig(config);
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, stack_bytes);
+    if (pthread_create(&thread, &attr, BenchJitterSmallStack, &rt) == 0)
+    {
+      pthread_join(thread, 0);
+      rt.GetStatus(status);
+      printf("  PrefaultStack() on a 64 KB stack: %llu pages touched: %s\n", (unsigned long long)status.PagesPrefaulted,
+             (status.PagesPrefaulted * sysconf(_SC_PAGESIZE) < stack_bytes) ? "ok" : "WRONG");
+    }
+    pthread_attr_destroy(&attr);
+  }
+}
+
+
+/* ===========================================================================
+Benchmark table
+=========================================================================== */
+struct bench_entry
+{
+  const char *Name;
+  void (*Run)(void);
+};
+
+static const bench_entry Benchmarks[] =
+{
+  { "peaks", BenchPeakDecode },
+  { "fs", BenchFsCondition },
+  { "detect", BenchPeakDetect },
+  { "calib", BenchCalibration },
+  { "avg", BenchAverage },
+  { "hist", BenchHistogram },
+  { "assign", BenchAssign },
+  { "convert", BenchConvert },
+  { "subscribe", BenchSubscribe },
+  { "record", BenchRecord },
+  { "replay", BenchReplay },
+  { "archive", BenchArchive },
+  { "codec", BenchPeakCodec },
+  { "fscodec", BenchFsCodec },
+  { "stream", BenchStream },
+  { "mcast", BenchMcast },
+  { "shm", BenchShm },
+  { "capi", BenchCApi },
+  { "status", BenchStatus },
+  { "regs", BenchRegs },
+  { "latency", BenchLatency },
+  { "serial", BenchSerial },
+  { "jitter", BenchJitter },
+};
+
+
+int main(int argc, char **argv)
+{
+  int count = sizeof(Benchmarks) / sizeof(Benchmarks[0]);
+
+  for (int i=0; i<count; i++)
+  {
+    bool run = (argc < 2);
+
+    for (int a=1; a<argc; a++)
+      if (strcmp(argv[a], Benchmarks[i].Name) == 0)
+        run = true;
+
+    if (run)
+      Benchmarks[i].Run();
+  }
+
+  return 0;
+}
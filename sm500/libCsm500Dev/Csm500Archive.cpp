@@ -0,0 +1,587 @@
+/* ===========================================================================
+ Csm500Archive.cpp
+ sm500 recorded archive query class implementation
+
+ Jerry Volcy
+
+ Copyright (c) 2013, Micron Optics, Inc.
+=========================================================================== */
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <new>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "Csm500Archive.h"
+#include "Csm500PeakDecoder.h"
+#include "sm500_common.h"
+
+
+/* ===========================================================================
+Scratch frames of a statistics task
+=========================================================================== */
+struct stats_work
+{
+  sm500_peaks_soa Peaks;
+  sm500_sensor_frame Sensors;
+};
+
+
+/* ===========================================================================
+Scalar kernel: accumulates one frame of sensor wavelengths (NaN = missing)
+=========================================================================== */
+static void AccumulateScalarRange(const float *Wavelength, uint32_t Begin, uint32_t End, Csm500Archive::stats_partial &P)
+{
+  for (uint32_t i=Begin; i<End; i++)
+  {
+    float x = Wavelength[i];
+
+    if (x == x)
+    {
+      if (x < P.Min[i]) P.Min[i] = x;
+      if (x > P.Max[i]) P.Max[i] = x;
+      P.Sum[i] += x;
+      P.SumSq[i] += (double)x * x;
+      P.Count[i]++;
+    }
+  }
+}
+
+static void AccumulateScalar(const float *Wavelength, uint32_t n, Csm500Archive::stats_partial &P)
+{
+  AccumulateScalarRange(Wavelength, 0, n, P);
+}
+
+
+#ifdef SM500_HAVE_X86_SIMD
+/* ===========================================================================
+AVX2 kernel (8 sensors per iteration).  min/max return their second
+operand when the first is NaN, so missing sensors leave them unchanged;
+NaNs are zeroed before the sums and masked out of the counts.
+=========================================================================== */
+SM500_TARGET_AVX2
+static void AccumulateAvx2(const float *Wavelength, uint32_t n, Csm500Archive::stats_partial &P)
+{
+  uint32_t i = 0;
+
+  for (; i+8<=n; i+=8)
+  {
+    __m256 x = _mm256_loadu_ps(Wavelength + i);
+    __m256 valid = _mm256_cmp_ps(x, x, _CMP_ORD_Q);
+
+    _mm256_storeu_ps(P.Min + i, _mm256_min_ps(x, _mm256_loadu_ps(P.Min + i)));
+    _mm256_storeu_ps(P.Max + i, _mm256_max_ps(x, _mm256_loadu_ps(P.Max + i)));
+
+    x = _mm256_and_ps(x, valid);
+    __m256d lo = _mm256_cvtps_pd(_mm256_castps256_ps128(x));
+    __m256d hi = _mm256_cvtps_pd(_mm256_extractf128_ps(x, 1));
+    _mm256_storeu_pd(P.Sum + i, _mm256_add_pd(_mm256_loadu_pd(P.Sum + i), lo));
+    _mm256_storeu_pd(P.Sum + i + 4, _mm256_add_pd(_mm256_loadu_pd(P.Sum + i + 4), hi));
+    _mm256_storeu_pd(P.SumSq + i, _mm256_add_pd(_mm256_loadu_pd(P.SumSq + i), _mm256_mul_pd(lo, lo)));
+    _mm256_storeu_pd(P.SumSq + i + 4, _mm256_add_pd(_mm256_loadu_pd(P.SumSq + i + 4), _mm256_mul_pd(hi, hi)));
+
+    __m256i count = _mm256_loadu_si256((const __m256i*)(P.Count + i));
+    _mm256_storeu_si256((__m256i*)(P.Count + i), _mm256_sub_epi32(count, _mm256_castps_si256(valid)));
+  }
+
+  _mm256_zeroupper();    //avoid the AVX to SSE transition penalty in the tail
+  AccumulateScalarRange(Wavelength, i, n, P);
+}
+#endif
+
+
+/* ===========================================================================
+Csm500Archive constructor
+=========================================================================== */
+Csm500Archive::Csm500Archive()
+{
+  Calibration = 0;
+  SensorMap = 0;
+  Pool = 0;
+  PageBytes = sysconf(_SC_PAGESIZE);
+  TaskFromNs = 0;
+  TaskToNs = 0;
+  SetSimdLevel(sm500_detect_simd());
+}
+
+
+/* ===========================================================================
+destructor
+=========================================================================== */
+Csm500Archive::~Csm500Archive()
+{
+  Close();
+}
+
+
+/* ===========================================================================
+Opens the recording Path (Path_000000.sm500rec onwards).  Throws the errno
+of the failure if the first segment cannot be opened, and EPROTO if the
+recording does not hold frames of the format this library was built for.
+=========================================================================== */
+void Csm500Archive::Open(const char *Path)
+{
+  Close();
+
+  try
+  {
+    for (uint32_t seg=0; ; seg++)
+    {
+      char suffix[32], index_suffix[32];
+      snprintf(suffix, sizeof(suffix), "_%06u" SM500_REC_EXTENSION, seg);
+      snprintf(index_suffix, sizeof(index_suffix), "_%06u" SM500_REC_INDEX_EXTENSION, seg);
+      string name = string(Path) + suffix;
+
+      if ((seg > 0) && (access(name.c_str(), F_OK) != 0))
+        break;
+      LoadSegment(name, string(Path) + index_suffix);
+    }
+  }
+  catch (int err)
+  {
+    Close();
+    throw (err);
+  }
+}
+
+
+/* ===========================================================================
+Closes the segments
+=========================================================================== */
+void Csm500Archive::Close(void)
+{
+  for (size_t i=0; i<Segments.size(); i++)
+    close(Segments[i].Fd);
+  Segments.clear();
+}
+
+
+/* ===========================================================================
+Opens a segment and loads its index, or rebuilds the index from the
+records when the segment has none (or one that does not match).  The
+records of a segment that was not closed cleanly are checked, up to the
+first bad one.
+=========================================================================== */
+void Csm500Archive::LoadSegment(const string &Name, const string &IndexName)
+{
+  archive_segment segment;
+  struct stat st;
+
+  segment.Fd = open(Name.c_str(), O_RDONLY);
+  segment.DataEnd = 0;
+  segment.MinTimeNs = segment.MaxTimeNs = 0;
+  if (segment.Fd < 0)
+    throw errno;
+  Segments.push_back(segment);      //closed by Close() from now on
+
+  archive_segment &s = Segments.back();
+  sm500_rec_segment_header header;
+  sm500_rec_footer footer;
+
+  if ((fstat(s.Fd, &st) != 0) || (st.st_size < SM500_REC_PAGE_BYTES) ||
+      (pread(s.Fd, &header, sizeof(header), 0) != sizeof(header)) || !sm500_rec_header_valid(header))
+  {
+    SM500_DBG( cout<<Name<<": not a recording of this frame format\n"; );
+    throw EPROTO;
+  }
+
+  bool closed = (pread(s.Fd, &footer, sizeof(footer), st.st_size - SM500_REC_PAGE_BYTES) == sizeof(footer)) &&
+                sm500_rec_footer_valid(footer, st.st_size);
+  s.DataEnd = closed ? footer.DataEnd : st.st_size;
+
+  if (!closed || !LoadIndex(IndexName, s))
+  {
+    s.Index.clear();
+
+    void *map = mmap(0, s.DataEnd, PROT_READ, MAP_PRIVATE, s.Fd, 0);
+    if (map == MAP_FAILED)
+      throw errno;
+    madvise(map, s.DataEnd, MADV_SEQUENTIAL);
+
+    const uint8_t *base = (const uint8_t*)map;
+    for (uint64_t offset=SM500_REC_PAGE_BYTES; offset + sizeof(sm500_rec_record) <= s.DataEnd; )
+    {
+      const sm500_rec_record *r = (const sm500_rec_record*)(base + offset);
+      uint64_t size = sm500_rec_record_bytes(r->Bytes);
+
+      if ((r->Magic != SM500_REC_RECORD_MAGIC) || (offset + size > s.DataEnd))
+        break;
+      if (!closed && (sm500_rec_checksum(r + 1, r->Bytes) != r->Checksum))
+        break;      //torn write
+
+      Csm500Recorder::AddToIndex(s.Index, offset, *r);
+      offset += size;
+    }
+    munmap(map, s.DataEnd);
+  }
+
+  s.MinTimeNs = ~0ULL;
+  s.MaxTimeNs = 0;
+  for (size_t i=0; i<s.Index.size(); i++)
+  {
+    if (s.Index[i].MinTimeNs < s.MinTimeNs) s.MinTimeNs = s.Index[i].MinTimeNs;
+    if (s.Index[i].MaxTimeNs > s.MaxTimeNs) s.MaxTimeNs = s.Index[i].MaxTimeNs;
+  }
+}
+
+
+/* ===========================================================================
+Loads a segment index file.  Returns false if it is missing, damaged or
+does not fit the segment.
+=========================================================================== */
+bool Csm500Archive::LoadIndex(const string &IndexName, archive_segment &Segment)
+{
+  sm500_rec_index_header h;
+  FILE *f = fopen(IndexName.c_str(), "rb");
+  bool ok = false;
+
+  if (!f)
+    return false;
+
+  if ((fread(&h, sizeof(h), 1, f) == 1) && (h.Magic == SM500_REC_INDEX_MAGIC) && (h.Version == SM500_REC_VERSION))
+  {
+    Segment.Index.resize(h.NumEntries);
+    ok = (h.NumEntries == 0) || (fread(Segment.Index.data(), sizeof(sm500_rec_index_entry), h.NumEntries, f) == h.NumEntries);
+    ok = ok && (sm500_rec_checksum(Segment.Index.data(), h.NumEntries * sizeof(sm500_rec_index_entry)) == h.Checksum);
+    for (uint32_t i=0; ok && (i<h.NumEntries); i++)
+      ok = (Segment.Index[i].Offset >= SM500_REC_PAGE_BYTES) &&
+           (Segment.Index[i].Offset + Segment.Index[i].Bytes <= Segment.DataEnd);
+  }
+
+  fclose(f);
+  return ok;
+}
+
+
+/* ===========================================================================
+Settings
+=========================================================================== */
+void Csm500Archive::AttachCalibration(Csm500Calibration *Calibration)
+{
+  this->Calibration = Calibration;
+}
+
+void Csm500Archive::AttachSensorMap(Csm500SensorMap *SensorMap)
+{
+  this->SensorMap = SensorMap;
+}
+
+void Csm500Archive::SetWorkerPool(Csm500WorkerPool *Pool)
+{
+  this->Pool = Pool;
+}
+
+
+/* ===========================================================================
+Returns the number of segments, and the first and last recorded timestamps
+=========================================================================== */
+uint32_t Csm500Archive::GetNumSegments(void)
+{
+  return Segments.size();
+}
+
+void Csm500Archive::GetTimeRange(uint64_t &FirstNs, uint64_t &LastNs)
+{
+  FirstNs = ~0ULL;
+  LastNs = 0;
+  for (size_t i=0; i<Segments.size(); i++)
+  {
+    if (Segments[i].MinTimeNs < FirstNs) FirstNs = Segments[i].MinTimeNs;
+    if (Segments[i].MaxTimeNs > LastNs) LastNs = Segments[i].MaxTimeNs;
+  }
+}
+
+
+/* ===========================================================================
+Lists the runs of blocks overlapping [FromNs, ToNs), cut into tasks of at
+most MaxBytes (and at least one block)
+=========================================================================== */
+void Csm500Archive::PlanTasks(uint64_t FromNs, uint64_t ToNs, uint64_t MaxBytes, vector<archive_task> &Tasks)
+{
+  Tasks.clear();
+
+  for (uint32_t s=0; s<Segments.size(); s++)
+  {
+    const archive_segment &seg = Segments[s];
+
+    if ((seg.MaxTimeNs < FromNs) || (seg.MinTimeNs >= ToNs))
+      continue;
+
+    for (size_t i=0; i<seg.Index.size(); i++)
+    {
+      const sm500_rec_index_entry &e = seg.Index[i];
+
+      if ((e.MaxTimeNs < FromNs) || (e.MinTimeNs >= ToNs))
+        continue;
+
+      if (!Tasks.empty() && (Tasks.back().Segment == s) && (Tasks.back().End == e.Offset) &&
+          (Tasks.back().End - Tasks.back().Offset + e.Bytes <= MaxBytes))
+        Tasks.back().End += e.Bytes;
+      else
+      {
+        archive_task t = { s, e.Offset, e.Offset + e.Bytes };
+        Tasks.push_back(t);
+      }
+    }
+  }
+}
+
+
+/* ===========================================================================
+Maps the records of a task (and nothing else of the segment).  Returns the
+address of its first record.
+=========================================================================== */
+const uint8_t* Csm500Archive::MapTask(const archive_task &Task, void *&Map, size_t &MapBytes)
+{
+  uint64_t start = Task.Offset - Task.Offset % PageBytes;
+
+  MapBytes = Task.End - start;
+  Map = mmap(0, MapBytes, PROT_READ, MAP_PRIVATE | MAP_POPULATE, Segments[Task.Segment].Fd, start);
+  if (Map == MAP_FAILED)
+    throw errno;
+
+  return (const uint8_t*)Map + (Task.Offset - start);
+}
+
+
+/* ===========================================================================
+Hands every frame of type Type recorded in [FromNs, ToNs) to Callback, in
+recording order.  The frame pointers are valid during the call only.
+Returns the number of frames.
+=========================================================================== */
+uint64_t Csm500Archive::GetFrames(uint64_t FromNs, uint64_t ToNs, sm500_rec_type Type, frame_callback_t Callback, void *Context)
+{
+  vector<archive_task> tasks;
+  uint64_t count = 0;
+
+  PlanTasks(FromNs, ToNs, SM500_ARCHIVE_TASK_BYTES, tasks);
+
+  for (size_t t=0; t<tasks.size(); t++)
+  {
+    void *map;
+    size_t bytes;
+    const uint8_t *p = MapTask(tasks[t], map, bytes);
+    const uint8_t *end = p + (tasks[t].End - tasks[t].Offset);
+
+    while (p < end)
+    {
+      const sm500_rec_record *r = (const sm500_rec_record*)p;
+      uint64_t time = sm500_rec_time_ns(*r);
+
+      if ((r->Type == Type) && (time >= FromNs) && (time < ToNs))
+      {
+        Callback(Context, *r, r + 1);
+        count++;
+      }
+      p += sm500_rec_record_bytes(r->Bytes);
+    }
+    munmap(map, bytes);
+  }
+
+  return count;
+}
+
+
+/* ===========================================================================
+Computes the statistics of every sensor over the peaks frames recorded in
+[FromNs, ToNs).  Requires a sensor map.
+=========================================================================== */
+void Csm500Archive::GetSensorStats(uint64_t FromNs, uint64_t ToNs, sm500_sensor_stats &Stats)
+{
+  if (!SensorMap)
+    throw EINVAL;
+
+  const uint32_t n = SensorMap->GetNumSensors();
+
+  PlanTasks(FromNs, ToNs, SM500_ARCHIVE_TASK_BYTES, Tasks);
+  Partials.assign(Tasks.size(), (stats_partial*)0);
+  TaskErrors.assign(Tasks.size(), 0);
+  TaskFromNs = FromNs;
+  TaskToNs = ToNs;
+
+  if (Pool && (Tasks.size() > 1))
+    Pool->Run(Tasks.size(), StatsTask, this);
+  else
+    for (uint32_t t=0; t<Tasks.size(); t++)
+      RunStatsTask(t);
+
+  //---------- merge the partial sums ----------
+  int error = 0;
+  double sum[SM500_MAX_SENSORS], sum_sq[SM500_MAX_SENSORS];
+
+  Stats.NumFrames = 0;
+  Stats.NumSensors = n;
+  for (uint32_t i=0; i<n; i++)
+  {
+    Stats.Count[i] = 0;
+    Stats.Min[i] = INFINITY;
+    Stats.Max[i] = -INFINITY;
+    sum[i] = sum_sq[i] = 0.0;
+  }
+
+  for (size_t t=0; t<Tasks.size(); t++)
+  {
+    const stats_partial *p = Partials[t];
+
+    if (TaskErrors[t] && !error)
+      error = TaskErrors[t];
+    if (!p)
+      continue;
+
+    Stats.NumFrames += p->NumFrames;
+    for (uint32_t i=0; i<n; i++)
+    {
+      Stats.Count[i] += p->Count[i];
+      if (p->Min[i] < Stats.Min[i]) Stats.Min[i] = p->Min[i];
+      if (p->Max[i] > Stats.Max[i]) Stats.Max[i] = p->Max[i];
+      sum[i] += p->Sum[i];
+      sum_sq[i] += p->SumSq[i];
+    }
+    free(Partials[t]);
+    Partials[t] = 0;
+  }
+
+  for (uint32_t i=0; i<n; i++)
+  {
+    if (Stats.Count[i])
+    {
+      Stats.Mean[i] = sum[i] / Stats.Count[i];
+      double var = sum_sq[i] / Stats.Count[i] - Stats.Mean[i] * Stats.Mean[i];
+      Stats.Rms[i] = (var > 0.0) ? sqrt(var) : 0.0;    //rounding can leave a tiny negative variance
+    }
+    else
+      Stats.Min[i] = Stats.Max[i] = Stats.Mean[i] = Stats.Rms[i] = NAN;
+  }
+
+  if (error)
+    throw error;
+}
+
+
+/* ===========================================================================
+Statistics task: decodes, assigns and accumulates the peaks frames of one
+task into its own partial sums.  Errors are recorded for GetSensorStats().
+=========================================================================== */
+void Csm500Archive::StatsTask(void *Context, uint32_t Index)
+{
+  ((Csm500Archive*)Context)->RunStatsTask(Index);
+}
+
+void Csm500Archive::RunStatsTask(uint32_t Index)
+{
+  const archive_task &task = Tasks[Index];
+  stats_partial *p = 0;
+  stats_work *work = 0;
+  void *map = 0;
+  size_t map_bytes = 0;
+
+  try
+  {
+    if ((posix_memalign((void**)&p, SM500_SIMD_ALIGN, sizeof(stats_partial)) != 0) ||
+        (posix_memalign((void**)&work, SM500_SIMD_ALIGN, sizeof(stats_work)) != 0))
+      throw ENOMEM;
+
+    const uint32_t n = SensorMap->GetNumSensors();
+    for (uint32_t i=0; i<n; i++)
+    {
+      p->Min[i] = INFINITY;
+      p->Max[i] = -INFINITY;
+      p->Sum[i] = p->SumSq[i] = 0.0;
+      p->Count[i] = 0;
+    }
+    p->NumFrames = 0;
+
+    //private decoder and sensor map: both keep per-frame state
+    Csm500PeakDecoder decoder;
+    Csm500SensorMap map_copy(*SensorMap);
+    decoder.AttachCalibration(Calibration);
+    decoder.SetSimdLevel(SimdLevel);
+    map_copy.SetMissingPolicy(SM500_MISSING_NAN);
+
+    const uint8_t *r_ptr = MapTask(task, map, map_bytes);
+    const uint8_t *end = r_ptr + (task.End - task.Offset);
+    while (r_ptr < end)
+    {
+      const sm500_rec_record *r = (const sm500_rec_record*)r_ptr;
+      uint64_t time = sm500_rec_time_ns(*r);
+
+      if ((r->Type == SM500_REC_PEAKS) && (time >= TaskFromNs) && (time < TaskToNs))
+      {
+        decoder.Decode(Csm500PeaksFrame(r + 1), work->Peaks);
+        map_copy.Assign(work->Peaks, work->Sensors);
+        Kernel(work->Sensors.Wavelength, n, *p);
+        p->NumFrames++;
+      }
+      r_ptr += sm500_rec_record_bytes(r->Bytes);
+    }
+  }
+  catch (int err)
+  {
+    TaskErrors[Index] = err;
+  }
+  catch (std::bad_alloc &)
+  {
+    TaskErrors[Index] = ENOMEM;
+  }
+  catch (...)                               //on a pool thread: nothing may escape
+  {
+    TaskErrors[Index] = EIO;
+  }
+
+  if (map)
+    munmap(map, map_bytes);
+  free(work);
+  Partials[Index] = p;
+}
+
+
+/* ===========================================================================
+Forces a kernel flavor.  Requests beyond what the CPU supports are clamped
+to the best supported flavor.  There is no SSE2 flavor; the scalar kernel
+is used at that level.
+=========================================================================== */
+void Csm500Archive::SetSimdLevel(sm500_simd_level level)
+{
+  sm500_simd_level supported = sm500_detect_simd();
+
+  if (level > supported)
+    level = supported;
+
+  SimdLevel = level;
+  switch (level)
+  {
+#ifdef SM500_HAVE_X86_SIMD
+    case SM500_SIMD_AVX2:
+      Kernel = AccumulateAvx2;
+      break;
+#endif
+    default:
+      Kernel = AccumulateScalar;
+      break;
+  }
+}
+
+
+/* ===========================================================================
+Returns the kernel flavor in use
+=========================================================================== */
+sm500_simd_level Csm500Archive::GetSimdLevel(void)
+{
+  return SimdLevel;
+}
+
+
+
+/* ===========================================================================
+=========================================================================== */
+//----------  ----------
+//----------  ----------
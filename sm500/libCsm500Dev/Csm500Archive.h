@@ -0,0 +1,148 @@
+/* ===========================================================================
+ Csm500Archive.h
+ sm500 recorded archive query class definition
+
+ Time range queries over a recording (see Csm500Recorder).  Open() loads
+ the sparse index of every segment (Path_NNNNNN.sm500idx), rebuilding it
+ in memory for segments without one, so a query only maps the blocks of
+ records whose timestamps overlap the range:
+
+ - GetFrames() hands the frames of a range to a callback, in order.
+ - GetSensorStats() decodes the peaks frames of a range, assigns them to
+   the sensors (attached Csm500SensorMap) and computes the minimum,
+   maximum, mean and RMS wavelength of every sensor.  The range is split
+   in tasks of a few MB run on the worker pool, each reducing its frames
+   into partial sums (vectorized across sensors) that are merged at the
+   end.
+
+ Time ranges are [FromNs, ToNs) in recorded (driver timestamp)
+ nano-seconds.  The peaks are decoded with the attached calibration,
+ without distance compensation; sensors missing from a frame are left out
+ of their statistics.
+
+ Jerry Volcy
+
+ Copyright (c) 2013, Micron Optics, Inc.
+=========================================================================== */
+
+#ifndef CSM500ARCHIVE_H
+#define CSM500ARCHIVE_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+#include <stdint.h>
+#include "sm500_data_structures.h"
+#include "sm500_simd.h"
+#include "Csm500Recorder.h"
+#include "Csm500Calibration.h"
+#include "Csm500SensorMap.h"
+#include "Csm500WorkerPool.h"
+
+/* ===========================================================================
+Constants
+=========================================================================== */
+#define SM500_ARCHIVE_TASK_BYTES    (8 << 20)     //records per statistics task, in bytes
+
+
+/* ===========================================================================
+Per-sensor statistics over a time range
+=========================================================================== */
+struct sm500_sensor_stats
+{
+  uint64_t NumFrames;                                 //peaks frames in the range
+  uint32_t NumSensors;
+  uint64_t Count[SM500_MAX_SENSORS];                  //frames holding the sensor
+  float Min[SM500_MAX_SENSORS];                       //nm; NaN for sensors never seen
+  float Max[SM500_MAX_SENSORS];
+  double Mean[SM500_MAX_SENSORS];
+  double Rms[SM500_MAX_SENSORS];                      //nm, RMS deviation from the mean
+};
+
+
+/* ===========================================================================
+Csm500Archive class definition
+=========================================================================== */
+class Csm500Archive
+{
+  public:
+    typedef void (*frame_callback_t)(void *Context, const sm500_rec_record &Record, const void *Frame);
+
+    //partial sums of one task
+    struct stats_partial
+    {
+      float Min[SM500_MAX_SENSORS];
+      float Max[SM500_MAX_SENSORS];
+      double Sum[SM500_MAX_SENSORS];
+      double SumSq[SM500_MAX_SENSORS];
+      uint32_t Count[SM500_MAX_SENSORS];
+      uint64_t NumFrames;
+    };
+    typedef void (*kernel_t)(const float *Wavelength, uint32_t n, stats_partial &Partial);
+
+    //----------  ----------
+    Csm500Archive();                        //constructor
+    virtual ~Csm500Archive();               //destructor
+    void Open(const char *Path);            //loads the segments of the recording Path
+    void Close(void);
+    void AttachCalibration(Csm500Calibration *Calibration);  //peak decoding (0 = default calibration)
+    void AttachSensorMap(Csm500SensorMap *SensorMap);        //sensor windows, for GetSensorStats()
+    void SetWorkerPool(Csm500WorkerPool *Pool);              //runs the statistics tasks in parallel (0 = calling thread)
+    uint32_t GetNumSegments(void);
+    void GetTimeRange(uint64_t &FirstNs, uint64_t &LastNs);  //first and last recorded timestamps
+    uint64_t GetFrames(uint64_t FromNs, uint64_t ToNs, sm500_rec_type Type, frame_callback_t Callback, void *Context);
+    void GetSensorStats(uint64_t FromNs, uint64_t ToNs, sm500_sensor_stats &Stats);
+    void SetSimdLevel(sm500_simd_level level);  //forces a kernel flavor (clamped to what the CPU supports)
+    sm500_simd_level GetSimdLevel(void);        //returns the kernel flavor in use
+
+  protected:
+    struct archive_segment
+    {
+      int Fd;
+      uint64_t DataEnd;                     //end of the records
+      uint64_t MinTimeNs;
+      uint64_t MaxTimeNs;
+      vector<sm500_rec_index_entry> Index;
+    };
+
+    struct archive_task                     //a run of consecutive blocks of a segment
+    {
+      uint32_t Segment;
+      uint64_t Offset;
+      uint64_t End;
+    };
+
+    void LoadSegment(const string &Name, const string &IndexName);
+    bool LoadIndex(const string &IndexName, archive_segment &Segment);
+    void PlanTasks(uint64_t FromNs, uint64_t ToNs, uint64_t MaxBytes, vector<archive_task> &Tasks);
+    const uint8_t* MapTask(const archive_task &Task, void *&Map, size_t &MapBytes);
+    static void StatsTask(void *Context, uint32_t Index);
+    void RunStatsTask(uint32_t Index);
+
+    vector<archive_segment> Segments;
+    Csm500Calibration *Calibration;
+    Csm500SensorMap *SensorMap;
+    Csm500WorkerPool *Pool;
+    size_t PageBytes;
+    sm500_simd_level SimdLevel;
+    kernel_t Kernel;
+
+    //---------- GetSensorStats() tasks ----------
+    vector<archive_task> Tasks;
+    vector<stats_partial*> Partials;
+    vector<int> TaskErrors;
+    uint64_t TaskFromNs;
+    uint64_t TaskToNs;
+};
+
+#endif // #ifndef CSM500ARCHIVE_H
+
+
+
+/* ===========================================================================
+=========================================================================== */
+//----------  ----------
+//----------  ----------
@@ -0,0 +1,614 @@
+/* ===========================================================================
+ Csm500Averager.cpp
+ sm500 streaming averager class implementation
+
+ The per-row kernels run across the columns of one row.  Boxcar sums and
+ exponential states are kept in double: the window sum of float inputs of
+ similar magnitude is then exact, so the running sum does not drift.  The
+ output rows are computed at the decimated rate.
+
+ Jerry Volcy
+
+ Copyright (c) 2013, Micron Optics, Inc.
+=========================================================================== */
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+#include <errno.h>
+#include <string.h>
+#include <math.h>
+#include "Csm500Averager.h"
+#include "sm500_common.h"
+
+
+/* ===========================================================================
+Scalar kernels
+=========================================================================== */
+static void BoxcarScalar(const float *In, float *Old, double *Sum, uint32_t n)
+{
+  if (Old)
+  {
+    for (uint32_t i=0; i<n; i++)
+    {
+      Sum[i] = Sum[i] + (double)In[i] - (double)Old[i];
+      Old[i] = In[i];
+    }
+  }
+  else
+  {
+    for (uint32_t i=0; i<n; i++)
+      Sum[i] += (double)In[i];
+  }
+}
+
+static void ExpScalar(const float *In, double Alpha, double *y, uint32_t n)
+{
+  for (uint32_t i=0; i<n; i++)
+    y[i] += Alpha * ((double)In[i] - y[i]);
+}
+
+static inline int32_t RoundToInt(float x)
+{
+#ifdef SM500_HAVE_X86_SIMD
+  return _mm_cvtss_si32(_mm_set_ss(x));   //same rounding as the vector kernels, without the libm call
+#else
+  return (int32_t)lrintf(x);
+#endif
+}
+
+static void CicScalar(const float *In, const float *Ref, float Scale, uint64_t *Integ, uint32_t Stride, uint32_t Order, uint32_t n)
+{
+  uint64_t v[64];
+
+  //blocks of columns, one integrator stage at a time
+  for (uint32_t i=0; i<n; i+=64)
+  {
+    uint32_t m = (n - i < 64) ? n - i : 64;
+
+    for (uint32_t j=0; j<m; j++)
+      v[j] = (uint64_t)(int64_t)RoundToInt((In[i+j] - Ref[i+j]) * Scale);
+
+    for (uint32_t k=0; k<Order; k++)
+    {
+      uint64_t *stage = Integ + k * Stride + i;
+
+      for (uint32_t j=0; j<m; j++)
+      {
+        stage[j] += v[j];
+        v[j] = stage[j];
+      }
+    }
+  }
+}
+
+
+#ifdef SM500_HAVE_X86_SIMD
+/* ===========================================================================
+SSE2 kernels (4 columns per iteration)
+=========================================================================== */
+SM500_TARGET_SSE2
+static void BoxcarSse2(const float *In, float *Old, double *Sum, uint32_t n)
+{
+  uint32_t i = 0;
+
+  for (; i+4<=n; i+=4)
+  {
+    __m128 x = _mm_loadu_ps(In + i);
+    __m128d lo = _mm_add_pd(_mm_loadu_pd(Sum + i), _mm_cvtps_pd(x));
+    __m128d hi = _mm_add_pd(_mm_loadu_pd(Sum + i + 2), _mm_cvtps_pd(_mm_movehl_ps(x, x)));
+
+    if (Old)
+    {
+      __m128 old = _mm_loadu_ps(Old + i);
+      lo = _mm_sub_pd(lo, _mm_cvtps_pd(old));
+      hi = _mm_sub_pd(hi, _mm_cvtps_pd(_mm_movehl_ps(old, old)));
+      _mm_storeu_ps(Old + i, x);
+    }
+    _mm_storeu_pd(Sum + i, lo);
+    _mm_storeu_pd(Sum + i + 2, hi);
+  }
+
+  BoxcarScalar(In + i, Old ? Old + i : 0, Sum + i, n - i);
+}
+
+SM500_TARGET_SSE2
+static void ExpSse2(const float *In, double Alpha, double *y, uint32_t n)
+{
+  const __m128d a = _mm_set1_pd(Alpha);
+  uint32_t i = 0;
+
+  for (; i+4<=n; i+=4)
+  {
+    __m128 x = _mm_loadu_ps(In + i);
+    __m128d lo = _mm_loadu_pd(y + i);
+    __m128d hi = _mm_loadu_pd(y + i + 2);
+
+    lo = _mm_add_pd(lo, _mm_mul_pd(a, _mm_sub_pd(_mm_cvtps_pd(x), lo)));
+    hi = _mm_add_pd(hi, _mm_mul_pd(a, _mm_sub_pd(_mm_cvtps_pd(_mm_movehl_ps(x, x)), hi)));
+    _mm_storeu_pd(y + i, lo);
+    _mm_storeu_pd(y + i + 2, hi);
+  }
+
+  ExpScalar(In + i, Alpha, y + i, n - i);
+}
+
+
+/* ===========================================================================
+AVX2 kernels (8 columns per iteration)
+=========================================================================== */
+SM500_TARGET_AVX2
+static void BoxcarAvx2(const float *In, float *Old, double *Sum, uint32_t n)
+{
+  uint32_t i = 0;
+
+  for (; i+8<=n; i+=8)
+  {
+    __m256 x = _mm256_loadu_ps(In + i);
+    __m256d lo = _mm256_add_pd(_mm256_loadu_pd(Sum + i), _mm256_cvtps_pd(_mm256_castps256_ps128(x)));
+    __m256d hi = _mm256_add_pd(_mm256_loadu_pd(Sum + i + 4), _mm256_cvtps_pd(_mm256_extractf128_ps(x, 1)));
+
+    if (Old)
+    {
+      __m256 old = _mm256_loadu_ps(Old + i);
+      lo = _mm256_sub_pd(lo, _mm256_cvtps_pd(_mm256_castps256_ps128(old)));
+      hi = _mm256_sub_pd(hi, _mm256_cvtps_pd(_mm256_extractf128_ps(old, 1)));
+      _mm256_storeu_ps(Old + i, x);
+    }
+    _mm256_storeu_pd(Sum + i, lo);
+    _mm256_storeu_pd(Sum + i + 4, hi);
+  }
+
+  _mm256_zeroupper();    //avoid the AVX to SSE transition penalty in the tail
+  BoxcarSse2(In + i, Old ? Old + i : 0, Sum + i, n - i);
+}
+
+SM500_TARGET_AVX2
+static void ExpAvx2(const float *In, double Alpha, double *y, uint32_t n)
+{
+  const __m256d a = _mm256_set1_pd(Alpha);
+  uint32_t i = 0;
+
+  for (; i+8<=n; i+=8)
+  {
+    __m256 x = _mm256_loadu_ps(In + i);
+    __m256d lo = _mm256_loadu_pd(y + i);
+    __m256d hi = _mm256_loadu_pd(y + i + 4);
+
+    lo = _mm256_add_pd(lo, _mm256_mul_pd(a, _mm256_sub_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(x)), lo)));
+    hi = _mm256_add_pd(hi, _mm256_mul_pd(a, _mm256_sub_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(x, 1)), hi)));
+    _mm256_storeu_pd(y + i, lo);
+    _mm256_storeu_pd(y + i + 4, hi);
+  }
+
+  _mm256_zeroupper();
+  ExpSse2(In + i, Alpha, y + i, n - i);
+}
+
+SM500_TARGET_AVX2
+static void CicAvx2(const float *In, const float *Ref, float Scale, uint64_t *Integ, uint32_t Stride, uint32_t Order, uint32_t n)
+{
+  const __m256 scale = _mm256_set1_ps(Scale);
+  uint32_t i = 0;
+
+  for (; i+8<=n; i+=8)
+  {
+    __m256i q = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(In + i), _mm256_loadu_ps(Ref + i)), scale));
+    __m256i lo = _mm256_cvtepi32_epi64(_mm256_castsi256_si128(q));
+    __m256i hi = _mm256_cvtepi32_epi64(_mm256_extracti128_si256(q, 1));
+
+    for (uint32_t k=0; k<Order; k++)
+    {
+      __m256i *stage = (__m256i*)(Integ + k * Stride + i);
+
+      lo = _mm256_add_epi64(_mm256_loadu_si256(stage), lo);
+      hi = _mm256_add_epi64(_mm256_loadu_si256(stage + 1), hi);
+      _mm256_storeu_si256(stage, lo);
+      _mm256_storeu_si256(stage + 1, hi);
+    }
+  }
+
+  _mm256_zeroupper();
+  CicScalar(In + i, Ref + i, Scale, Integ + i, Stride, Order, n - i);
+}
+#endif
+
+
+/* ===========================================================================
+Csm500Averager constructor
+=========================================================================== */
+Csm500Averager::Csm500Averager()
+{
+  Sum = 0;
+  Ring = 0;
+  Ref = 0;
+  Integ = 0;
+  Comb = 0;
+  Staging = 0;
+  Output = 0;
+  SerialNumber = 0;
+  TimestampSec = 0;
+  TimestampNsec = 0;
+  Window = 1;
+  Order = 1;
+  Alpha = 1.0;
+  Resolution = SM500_DEFAULT_CIC_RESOLUTION;
+  CicGain = 1;
+
+  SetSimdLevel(sm500_detect_simd());
+  SetBoxcar(1, 1, 1);
+}
+
+
+/* ===========================================================================
+destructor
+=========================================================================== */
+Csm500Averager::~Csm500Averager()
+{
+  Free();
+}
+
+
+/* ===========================================================================
+Releases the filter state
+=========================================================================== */
+void Csm500Averager::Free(void)
+{
+  delete [] Sum;
+  delete [] Ring;
+  delete [] Ref;
+  delete [] Integ;
+  delete [] Comb;
+  delete [] Staging;
+  delete [] Output;
+
+  Sum = 0;
+  Ring = 0;
+  Ref = 0;
+  Integ = 0;
+  Comb = 0;
+  Staging = 0;
+  Output = 0;
+}
+
+
+/* ===========================================================================
+Validates the settings common to all modes.  Called by the Set*() functions
+before they change anything, so that a rejected setting leaves the averager
+as it was.
+=========================================================================== */
+void Csm500Averager::CheckShape(uint32_t NumColumns, uint32_t Decimation)
+{
+  if ((NumColumns == 0) || (NumColumns > SM500_AVG_MAX_COLUMNS) || (Decimation == 0))
+    throw EINVAL;
+}
+
+
+/* ===========================================================================
+Applies the settings common to all modes and allocates the state of Mode.
+The previous state is discarded.
+=========================================================================== */
+void Csm500Averager::Configure(sm500_avg_mode Mode, uint32_t NumColumns, uint32_t Decimation)
+{
+  Free();
+  this->Mode = Mode;
+  this->NumColumns = NumColumns;
+  this->Decimation = Decimation;
+
+  Sum = new double[NumColumns];
+  Staging = new float[NumColumns];
+  Output = new double[NumColumns];
+  memset(Staging, 0, NumColumns * sizeof(float));
+  memset(Output, 0, NumColumns * sizeof(double));
+
+  if ((Mode == SM500_AVG_BOXCAR) && (Window != Decimation))
+    Ring = new float[(size_t)Window * NumColumns];
+
+  if (Mode == SM500_AVG_CIC)
+  {
+    Ref = new float[NumColumns];
+    Integ = new uint64_t[Order * NumColumns];
+    Comb = new uint64_t[Order * NumColumns];
+  }
+
+  Reset();
+}
+
+
+/* ===========================================================================
+Configures a moving average of Window rows, output every Decimation rows.
+Window 0 averages the Decimation rows of each output.
+=========================================================================== */
+void Csm500Averager::SetBoxcar(uint32_t NumColumns, uint32_t Decimation, uint32_t Window)
+{
+  CheckShape(NumColumns, Decimation);
+  this->Window = Window ? Window : Decimation;
+  Configure(SM500_AVG_BOXCAR, NumColumns, Decimation);
+}
+
+
+/* ===========================================================================
+Configures an exponential average with smoothing factor Alpha, output every
+Decimation rows
+=========================================================================== */
+void Csm500Averager::SetExponential(uint32_t NumColumns, uint32_t Decimation, double Alpha)
+{
+  CheckShape(NumColumns, Decimation);
+  if ((Alpha <= 0.0) || (Alpha > 1.0))
+    throw EINVAL;
+
+  this->Alpha = Alpha;
+  Configure(SM500_AVG_EXPONENTIAL, NumColumns, Decimation);
+}
+
+
+/* ===========================================================================
+Configures a CIC decimator of order Order.  The input is quantized to
+Resolution; values must stay within 2^31 * Resolution of the first row.
+=========================================================================== */
+void Csm500Averager::SetCic(uint32_t NumColumns, uint32_t Decimation, uint32_t Order, double Resolution)
+{
+  CheckShape(NumColumns, Decimation);
+  if ((Order == 0) || (Order > SM500_AVG_MAX_CIC_ORDER) || (Resolution <= 0.0))
+    throw EINVAL;
+
+  if (Order * log2((double)Decimation) > SM500_AVG_CIC_GAIN_BITS)
+    throw EINVAL;
+
+  this->Order = Order;
+  this->Resolution = Resolution;
+  CicGain = 1;
+  for (uint32_t k=0; k<Order; k++)
+    CicGain *= Decimation;
+
+  Configure(SM500_AVG_CIC, NumColumns, Decimation);
+}
+
+
+/* ===========================================================================
+Restarts the filters.  The next row pushed primes them, as if that value had
+always been present.
+=========================================================================== */
+void Csm500Averager::Reset(void)
+{
+  Primed = false;
+  Phase = 0;
+  RingPos = 0;
+  OutputSerialNumber = 0;
+  OutputTimestampSec = 0;
+  OutputTimestampNsec = 0;
+
+  memset(Sum, 0, NumColumns * sizeof(double));
+  if (Integ)
+  {
+    memset(Integ, 0, Order * NumColumns * sizeof(uint64_t));
+    memset(Comb, 0, Order * NumColumns * sizeof(uint64_t));
+  }
+}
+
+
+/* ===========================================================================
+Initializes the filter state from the first row
+=========================================================================== */
+void Csm500Averager::Prime(const float *Values)
+{
+  switch (Mode)
+  {
+    case SM500_AVG_BOXCAR:
+      if (Ring)
+      {
+        for (uint32_t r=0; r<Window; r++)
+          memcpy(Ring + (size_t)r * NumColumns, Values, NumColumns * sizeof(float));
+        for (uint32_t i=0; i<NumColumns; i++)
+          Sum[i] = (double)Window * Values[i];
+      }
+      break;
+
+    case SM500_AVG_EXPONENTIAL:
+      for (uint32_t i=0; i<NumColumns; i++)
+        Sum[i] = Values[i];
+      break;
+
+    case SM500_AVG_CIC:
+      memcpy(Ref, Values, NumColumns * sizeof(float));    //the CIC input is the deviation from the first row
+      break;
+  }
+
+  Primed = true;
+}
+
+
+/* ===========================================================================
+Adds one row of NumColumns values.  Returns true when the row completes an
+output row, available through GetOutput().
+=========================================================================== */
+bool Csm500Averager::Push(const float *Values)
+{
+  if (!Primed)
+    Prime(Values);
+
+  switch (Mode)
+  {
+    case SM500_AVG_BOXCAR:
+      if (Ring)
+      {
+        BoxcarKernel(Values, Ring + (size_t)RingPos * NumColumns, Sum, NumColumns);
+        if (++RingPos == Window)
+          RingPos = 0;
+      }
+      else
+        BoxcarKernel(Values, 0, Sum, NumColumns);
+      break;
+
+    case SM500_AVG_EXPONENTIAL:
+      ExpKernel(Values, Alpha, Sum, NumColumns);
+      break;
+
+    case SM500_AVG_CIC:
+      CicKernel(Values, Ref, (float)(1.0 / Resolution), Integ, NumColumns, Order, NumColumns);
+      break;
+  }
+
+  if (++Phase < Decimation)
+    return false;
+
+  Phase = 0;
+  ComputeOutput();
+  OutputSerialNumber = SerialNumber;
+  OutputTimestampSec = TimestampSec;
+  OutputTimestampNsec = TimestampNsec;
+  return true;
+}
+
+
+/* ===========================================================================
+Adds the wavelengths of a sensor-assigned frame, sensor i feeding column i.
+A sensor without a peak (or beyond Frame.NumSensors) repeats the last value
+its column received (0 before the first).
+=========================================================================== */
+bool Csm500Averager::Push(const sm500_sensor_frame &Frame)
+{
+  uint32_t n = (Frame.NumSensors < NumColumns) ? Frame.NumSensors : NumColumns;
+
+  for (uint32_t i=0; i<n; i++)
+    if (!(Frame.Status[i] & SM500_SENSOR_MISSING))
+      Staging[i] = Frame.Wavelength[i];
+  SerialNumber = Frame.SerialNumber;
+  TimestampSec = Frame.TimestampSec;
+  TimestampNsec = Frame.TimestampNsec;
+
+  return Push(Staging);
+}
+
+
+/* ===========================================================================
+Computes the output row (at the decimated rate)
+=========================================================================== */
+void Csm500Averager::ComputeOutput(void)
+{
+  switch (Mode)
+  {
+    case SM500_AVG_BOXCAR:
+    {
+      double scale = 1.0 / Window;
+
+      for (uint32_t i=0; i<NumColumns; i++)
+        Output[i] = Sum[i] * scale;
+      if (!Ring)
+        memset(Sum, 0, NumColumns * sizeof(double));    //block average: restart the sums
+      break;
+    }
+
+    case SM500_AVG_EXPONENTIAL:
+      memcpy(Output, Sum, NumColumns * sizeof(double));
+      break;
+
+    case SM500_AVG_CIC:
+    {
+      double scale = Resolution / (double)CicGain;
+
+      for (uint32_t i=0; i<NumColumns; i++)
+      {
+        uint64_t v = Integ[(Order - 1) * NumColumns + i];
+
+        for (uint32_t k=0; k<Order; k++)
+        {
+          uint64_t *delay = Comb + k * NumColumns + i;
+          uint64_t d = v - *delay;    //modulo 2^64, undoes the integrator wrap
+
+          *delay = v;
+          v = d;
+        }
+        Output[i] = Ref[i] + (double)(int64_t)v * scale;
+      }
+      break;
+    }
+  }
+}
+
+
+/* ===========================================================================
+Accessors
+=========================================================================== */
+const double* Csm500Averager::GetOutput(void)
+{
+  return Output;
+}
+
+uint64_t Csm500Averager::GetOutputSerialNumber(void)
+{
+  return OutputSerialNumber;
+}
+
+uint32_t Csm500Averager::GetOutputTimestampSec(void)
+{
+  return OutputTimestampSec;
+}
+
+uint32_t Csm500Averager::GetOutputTimestampNsec(void)
+{
+  return OutputTimestampNsec;
+}
+
+uint32_t Csm500Averager::GetNumColumns(void)
+{
+  return NumColumns;
+}
+
+uint32_t Csm500Averager::GetDecimation(void)
+{
+  return Decimation;
+}
+
+
+/* ===========================================================================
+Forces a kernel flavor.  Requests beyond what the CPU supports are clamped
+to the best supported flavor.  The CIC kernel has no SSE2 flavor (64 bit
+sign extension needs SSE4.1) and uses the scalar kernel at that level.
+=========================================================================== */
+void Csm500Averager::SetSimdLevel(sm500_simd_level level)
+{
+  sm500_simd_level supported = sm500_detect_simd();
+
+  if (level > supported)
+    level = supported;
+
+  SimdLevel = level;
+  switch (level)
+  {
+#ifdef SM500_HAVE_X86_SIMD
+    case SM500_SIMD_AVX2:
+      BoxcarKernel = BoxcarAvx2;
+      ExpKernel = ExpAvx2;
+      CicKernel = CicAvx2;
+      break;
+    case SM500_SIMD_SSE2:
+      BoxcarKernel = BoxcarSse2;
+      ExpKernel = ExpSse2;
+      CicKernel = CicScalar;
+      break;
+#endif
+    default:
+      BoxcarKernel = BoxcarScalar;
+      ExpKernel = ExpScalar;
+      CicKernel = CicScalar;
+      break;
+  }
+}
+
+
+/* ===========================================================================
+Returns the kernel flavor in use
+=========================================================================== */
+sm500_simd_level Csm500Averager::GetSimdLevel(void)
+{
+  return SimdLevel;
+}
+
+
+
+/* ===========================================================================
+=========================================================================== */
+//----------  ----------
+//----------  ----------
@@ -0,0 +1,145 @@
+/* ===========================================================================
+ Csm500Averager.h
+ sm500 streaming averager class definition
+
+ The averager filters and decimates a stream of per-frame values, one
+ column per sensor (e.g. the Wavelength column of sm500_sensor_frame), and
+ produces one output row every Decimation input rows; a decimation of 100
+ turns a 1 kHz peaks stream into a 10 Hz stream, 1000 into a 1 Hz stream.
+ Every filter updates in O(1) per value regardless of the window length,
+ and the per-frame update runs vectorized across all the columns:
+
+  - Boxcar: running sums over the last Window values, kept in double.  The
+    value leaving the window is read back from a ring of past rows (no
+    ring is needed when Window equals Decimation: the sums restart after
+    every output).
+  - Exponential: y += Alpha * (x - y), in double, sampled every Decimation
+    rows.
+  - CIC: Order cascaded integrators at the input rate and Order combs at
+    the output rate, i.e. Order cascaded boxcars of Decimation values.  The
+    input is quantized to Resolution relative to the first value of each
+    column, and the integrators are uint64 and wrap modulo 2^64 (the combs
+    undo the wrap), so the filter is exact and never drifts.
+
+ Jerry Volcy
+
+ Copyright (c) 2013, Micron Optics, Inc.
+=========================================================================== */
+
+#ifndef CSM500AVERAGER_H
+#define CSM500AVERAGER_H
+
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+#include <stdint.h>
+#include "sm500_data_structures.h"
+#include "sm500_simd.h"
+#include "Csm500PeakDecoder.h"
+#include "Csm500SensorMap.h"
+
+/* ===========================================================================
+Constants
+=========================================================================== */
+#define SM500_AVG_MAX_COLUMNS       SM500_MAX_SENSORS
+#define SM500_AVG_MAX_CIC_ORDER     4
+#define SM500_AVG_CIC_GAIN_BITS     32    //Order * log2(Decimation) must fit the 64 bit integrators with a 32 bit input
+
+
+/* ===========================================================================
+Defaults
+=========================================================================== */
+#define SM500_DEFAULT_CIC_RESOLUTION  1e-6    //quantization step of the CIC input (1 fm for nm values)
+
+
+/* ===========================================================================
+Averaging modes
+=========================================================================== */
+enum sm500_avg_mode
+{
+  SM500_AVG_BOXCAR = 0,         //moving average over a window
+  SM500_AVG_EXPONENTIAL,        //first order IIR
+  SM500_AVG_CIC                 //cascaded integrator-comb decimator
+};
+
+
+/* ===========================================================================
+Csm500Averager class definition
+=========================================================================== */
+class Csm500Averager
+{
+  public:
+    //----------  ----------
+    Csm500Averager();                       //constructor
+    virtual ~Csm500Averager();              //destructor
+    void SetBoxcar(uint32_t NumColumns, uint32_t Decimation, uint32_t Window);      //Window 0 = Decimation
+    void SetExponential(uint32_t NumColumns, uint32_t Decimation, double Alpha);    //0 < Alpha <= 1
+    void SetCic(uint32_t NumColumns, uint32_t Decimation, uint32_t Order, double Resolution);
+    void Reset(void);                       //restarts the filters; the next row primes them
+    bool Push(const float *Values);         //adds one row of NumColumns values; returns true when an output row is ready
+    bool Push(const sm500_sensor_frame &Frame); //adds the wavelengths of sensors 0..NumColumns-1 (missing sensors repeat their last value)
+    const double* GetOutput(void);          //returns the last output row (NumColumns values)
+    uint64_t GetOutputSerialNumber(void);   //S/N and timestamp of the frame that completed the output row
+    uint32_t GetOutputTimestampSec(void);
+    uint32_t GetOutputTimestampNsec(void);
+    uint32_t GetNumColumns(void);
+    uint32_t GetDecimation(void);
+    void SetSimdLevel(sm500_simd_level level);  //forces a kernel flavor (clamped to what the CPU supports)
+    sm500_simd_level GetSimdLevel(void);        //returns the kernel flavor in use
+
+    //per-row kernels (n columns)
+    typedef void (*boxcar_kernel_t)(const float *In, float *Old, double *Sum, uint32_t n);    //Old = 0: no ring
+    typedef void (*exp_kernel_t)(const float *In, double Alpha, double *y, uint32_t n);
+    typedef void (*cic_kernel_t)(const float *In, const float *Ref, float Scale, uint64_t *Integ, uint32_t Stride, uint32_t Order, uint32_t n);
+
+  protected:
+    static void CheckShape(uint32_t NumColumns, uint32_t Decimation);
+    void Configure(sm500_avg_mode Mode, uint32_t NumColumns, uint32_t Decimation);
+    void Free(void);
+    void Prime(const float *Values);
+    void ComputeOutput(void);
+
+    sm500_avg_mode Mode;
+    uint32_t NumColumns;
+    uint32_t Decimation;
+    uint32_t Window;                        //boxcar window
+    uint32_t Order;                         //CIC order
+    double Alpha;
+    double Resolution;
+    uint64_t CicGain;                       //Decimation ^ Order
+
+    bool Primed;
+    uint32_t Phase;                         //# of rows since the last output
+    uint32_t RingPos;
+
+    double *Sum;                            //boxcar sums, or exponential state
+    float *Ring;                            //boxcar window rows (Window x NumColumns), 0 when Window == Decimation
+    float *Ref;                             //CIC quantization reference
+    uint64_t *Integ;                        //CIC integrators (Order x NumColumns)
+    uint64_t *Comb;                         //CIC comb delays (Order x NumColumns)
+    float *Staging;                         //last row pushed from a sensor frame
+    double *Output;
+
+    uint64_t SerialNumber;                  //of the last frame pushed
+    uint32_t TimestampSec;
+    uint32_t TimestampNsec;
+    uint64_t OutputSerialNumber;
+    uint32_t OutputTimestampSec;
+    uint32_t OutputTimestampNsec;
+
+    sm500_simd_level SimdLevel;
+    boxcar_kernel_t BoxcarKernel;
+    exp_kernel_t ExpKernel;
+    cic_kernel_t CicKernel;
+};
+
+#endif // #ifndef CSM500AVERAGER_H
+
+
+
+/* ===========================================================================
+=========================================================================== */
+//----------  ----------
+//----------  ----------
@@ -0,0 +1,233 @@
+/* ===========================================================================
+ Csm500Calibration.cpp
+ sm500 wavelength calibration class implementation
+
+ Jerry Volcy
+
+ Copyright (c) 2013, Micron Optics, Inc.
+=========================================================================== */
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+#include <errno.h>
+#include <string.h>
+#include <sched.h>
+#include <math.h>
+#include "Csm500Calibration.h"
+#include "sm500_common.h"
+
+static_assert(SM500_CAL_ORDER == 3, "BuildLut is written for a cubic calibration");
+
+
+/* ===========================================================================
+Csm500Calibration constructor.  Every channel starts with a nominal linear
+sweep across the FS axis.
+=========================================================================== */
+Csm500Calibration::Csm500Calibration()
+{
+  double nominal[SM500_CAL_ORDER + 1] = { SM500_DEFAULT_WL_START, SM500_DEFAULT_WL_SPAN / SM500_NUM_FS_POINTS };    //higher terms zero
+
+  for (uint32_t ch=0; ch<SM500_NUM_CHANNELS; ch++)
+  {
+    for (int s=0; s<SM500_CAL_SLOTS; s++)
+    {
+      Channel[ch].Slot[s] = new sm500_channel_calibration;
+      Channel[ch].Slot[s]->Version = 0;
+      Channel[ch].Readers[s] = 0;
+    }
+    Channel[ch].Current = 0;
+    pthread_mutex_init(&Channel[ch].WriterLock, 0);
+
+    SetModel(ch, nominal);
+  }
+}
+
+
+/* ===========================================================================
+destructor
+=========================================================================== */
+Csm500Calibration::~Csm500Calibration()
+{
+  for (uint32_t ch=0; ch<SM500_NUM_CHANNELS; ch++)
+  {
+    for (int s=0; s<SM500_CAL_SLOTS; s++)
+      delete Channel[ch].Slot[s];
+    pthread_mutex_destroy(&Channel[ch].WriterLock);
+  }
+}
+
+
+/* ===========================================================================
+Evaluates the polynomial of a model at every FS sample
+=========================================================================== */
+void Csm500Calibration::BuildLut(sm500_channel_calibration &Model)
+{
+  const double *c = Model.Coef;
+
+  for (uint32_t i=0; i<SM500_NUM_FS_POINTS; i++)
+  {
+    double x = i;
+    Model.Lut[i] = (float)(((c[3] * x + c[2]) * x + c[1]) * x + c[0]);
+  }
+
+  for (int i=0; i<=SM500_CAL_ORDER; i++)
+    Model.PeakCoef[i] = (float)c[i];
+}
+
+
+/* ===========================================================================
+Takes the writer lock of a channel and returns a slot that is neither the
+current one nor pinned by a reader.  Readers only pin a slot for the time
+it takes to process one frame, so the wait (if any) is short.
+=========================================================================== */
+int Csm500Calibration::BeginUpdate(uint32_t ch)
+{
+  if (ch >= SM500_NUM_CHANNELS)
+    throw EINVAL;
+
+  channel_slots &slots = Channel[ch];
+  pthread_mutex_lock(&slots.WriterLock);
+
+  for (;;)
+  {
+    int current = slots.Current.load();
+    for (int s=0; s<SM500_CAL_SLOTS; s++)
+      if ((s != current) && (slots.Readers[s].load() == 0))
+        return s;
+    sched_yield();
+  }
+}
+
+
+/* ===========================================================================
+Publishes a slot filled by the caller of BeginUpdate()
+=========================================================================== */
+void Csm500Calibration::EndUpdate(uint32_t ch, int Slot)
+{
+  channel_slots &slots = Channel[ch];
+
+  slots.Slot[Slot]->Version = slots.Slot[slots.Current.load()]->Version + 1;
+  slots.Current.store(Slot);
+  pthread_mutex_unlock(&slots.WriterLock);
+}
+
+
+/* ===========================================================================
+Replaces the polynomial of a channel and rebuilds its FS wavelength table.
+Coef holds SM500_CAL_ORDER+1 coefficients, constant term first.
+=========================================================================== */
+void Csm500Calibration::SetModel(uint32_t ch, const double *Coef)
+{
+  int s = BeginUpdate(ch);
+  sm500_channel_calibration &model = *Channel[ch].Slot[s];
+
+  memcpy(model.Coef, Coef, sizeof(model.Coef));
+  BuildLut(model);
+
+  EndUpdate(ch, s);
+}
+
+
+/* ===========================================================================
+Shifts every wavelength of a channel by OffsetNm.  The offset accumulates
+in the double constant term and the table is rebuilt from the polynomial,
+so that the two stay consistent however many offsets are applied.
+=========================================================================== */
+void Csm500Calibration::ApplyOffset(uint32_t ch, double OffsetNm)
+{
+  int s = BeginUpdate(ch);
+  const sm500_channel_calibration &current = *Channel[ch].Slot[Channel[ch].Current.load()];
+  sm500_channel_calibration &model = *Channel[ch].Slot[s];
+
+  memcpy(model.Coef, current.Coef, sizeof(model.Coef));
+  model.Coef[0] += OffsetNm;
+  BuildLut(model);
+
+  EndUpdate(ch, s);
+}
+
+
+/* ===========================================================================
+Returns the current polynomial of a channel
+=========================================================================== */
+void Csm500Calibration::GetModel(uint32_t ch, double *Coef)
+{
+  const sm500_channel_calibration *model = Acquire(ch);
+  memcpy(Coef, model->Coef, sizeof(model->Coef));
+  Release(ch, model);
+}
+
+
+/* ===========================================================================
+Returns the version of the current model of a channel.  The version is
+incremented by every update, so readers can detect a recalibration.
+=========================================================================== */
+uint32_t Csm500Calibration::GetVersion(uint32_t ch)
+{
+  const sm500_channel_calibration *model = Acquire(ch);
+  uint32_t version = model->Version;
+  Release(ch, model);
+  return version;
+}
+
+
+/* ===========================================================================
+Pins and returns the current model of a channel.  The model stays valid
+(and unchanged) until it is handed back to Release().
+=========================================================================== */
+const sm500_channel_calibration* Csm500Calibration::Acquire(uint32_t ch)
+{
+  channel_slots &slots = Channel[ch];
+
+  for (;;)
+  {
+    int s = slots.Current.load();
+    slots.Readers[s].fetch_add(1);
+    if (slots.Current.load() == s)
+      return slots.Slot[s];
+    slots.Readers[s].fetch_sub(1);    //an update was published in between; retry
+  }
+}
+
+
+/* ===========================================================================
+Unpins a model returned by Acquire()
+=========================================================================== */
+void Csm500Calibration::Release(uint32_t ch, const sm500_channel_calibration *Model)
+{
+  channel_slots &slots = Channel[ch];
+
+  for (int s=0; s<SM500_CAL_SLOTS; s++)
+    if (slots.Slot[s] == Model)
+    {
+      slots.Readers[s].fetch_sub(1);
+      return;
+    }
+}
+
+
+
+/* ===========================================================================
+Returns the wavelength at a fractional FS position, interpolated linearly
+between the two nearest table entries (extrapolated from the first or last
+two entries outside the FS axis)
+=========================================================================== */
+float Csm500Calibration::Wavelength(const sm500_channel_calibration &Model, float Position)
+{
+  int32_t i = (int32_t)floorf(Position);
+
+  if (i < 0)
+    i = 0;
+  if (i > SM500_NUM_FS_POINTS - 2)
+    i = SM500_NUM_FS_POINTS - 2;
+  return Model.Lut[i] + (Position - i) * (Model.Lut[i + 1] - Model.Lut[i]);
+}
+
+
+
+/* ===========================================================================
+=========================================================================== */
+//----------  ----------
+//----------  ----------
@@ -0,0 +1,112 @@
+/* ===========================================================================
+ Csm500Calibration.h
+ sm500 wavelength calibration class definition
+
+ The calibration class holds, for every channel, the polynomial that maps
+ an FS sample position to a wavelength (in nm), the same coefficients in
+ the float form used by the peak kernels, and a precomputed table giving
+ the wavelength of every FS sample.  Looking up a calibrated FS axis
+ therefore costs one table read per sample.
+
+ Each channel model lives in one of three slots.  Updates are built in a
+ slot no reader is using and then published by atomically switching the
+ channel's current slot, so acquisition never waits for a recalibration.
+ Readers pin the current model of a channel with Acquire() and unpin it
+ with Release(); the hot path cost is a pair of atomic increments.
+ Updates only touch the channel that changed.  A pure wavelength offset
+ (e.g. a reference drift with temperature) is added to the constant term,
+ in double, and the table is rebuilt from the polynomial, so repeated
+ offsets never make the table and the coefficients drift apart.
+
+ Csm500PeakDetector reads the wavelength of its (sub-sample) peak
+ positions from the table, interpolating between the two nearest FS
+ samples (Wavelength()).
+
+ Jerry Volcy
+
+ Copyright (c) 2013, Micron Optics, Inc.
+=========================================================================== */
+
+#ifndef CSM500CALIBRATION_H
+#define CSM500CALIBRATION_H
+
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+#include <stdint.h>
+#include <pthread.h>
+#include <atomic>
+#include "sm500_data_structures.h"
+#include "sm500_simd.h"
+
+/* ===========================================================================
+Constants
+=========================================================================== */
+#define SM500_CAL_ORDER             3     //order of the position-to-wavelength polynomial
+#define SM500_CAL_SLOTS             3     //model slots per channel
+
+
+/* ===========================================================================
+Defaults
+=========================================================================== */
+#define SM500_DEFAULT_WL_START      1510.0    //nm, wavelength of FS sample 0
+#define SM500_DEFAULT_WL_SPAN       80.0      //nm, span of the FS sweep
+
+
+/* ===========================================================================
+Calibration model of one channel
+=========================================================================== */
+struct sm500_channel_calibration
+{
+  uint32_t Version;                                   //incremented by every update of the channel
+  double Coef[SM500_CAL_ORDER + 1];                   //position (FS samples) to nm, constant term first
+  float PeakCoef[SM500_CAL_ORDER + 1];                //Coef, as used by the peak kernels
+  float Lut[SM500_NUM_FS_POINTS];                     //nm at every FS sample
+};
+
+
+/* ===========================================================================
+Csm500Calibration class definition
+=========================================================================== */
+class Csm500Calibration
+{
+  public:
+    //----------  ----------
+    Csm500Calibration();                    //constructor
+    virtual ~Csm500Calibration();           //destructor
+    void SetModel(uint32_t ch, const double *Coef);     //replaces a channel's polynomial (SM500_CAL_ORDER+1 coefficients)
+    void ApplyOffset(uint32_t ch, double OffsetNm);     //shifts a channel's wavelengths by OffsetNm (incremental update)
+    void GetModel(uint32_t ch, double *Coef);           //returns a channel's current polynomial
+    uint32_t GetVersion(uint32_t ch);                   //returns the version of a channel's current model
+
+    //---------- readers ----------
+    const sm500_channel_calibration* Acquire(uint32_t ch);  //pins the current model of a channel
+    void Release(uint32_t ch, const sm500_channel_calibration *Model);  //unpins a model returned by Acquire()
+    static float Wavelength(const sm500_channel_calibration &Model, float Position);  //nm at an FS position, from the table
+
+  protected:
+    int BeginUpdate(uint32_t ch);           //returns a free slot, holding the channel's writer lock
+    void EndUpdate(uint32_t ch, int Slot);  //publishes Slot and releases the writer lock
+    static void BuildLut(sm500_channel_calibration &Model);
+
+    struct channel_slots
+    {
+      sm500_channel_calibration *Slot[SM500_CAL_SLOTS];
+      std::atomic<int> Readers[SM500_CAL_SLOTS];
+      std::atomic<int> Current;
+      pthread_mutex_t WriterLock;
+    };
+
+    channel_slots Channel[SM500_NUM_CHANNELS];
+};
+
+#endif // #ifndef CSM500CALIBRATION_H
+
+
+
+/* ===========================================================================
+=========================================================================== */
+//----------  ----------
+//----------  ----------
@@ -13,6 +13,7 @@ using namespace std;
 
 #include <stdio.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <errno.h>
 #include <string>
 //#include <sys/time.h>   //for usleep()
@@ -26,6 +27,11 @@ Csm500DevCtrl constructor
 Csm500Dev::Csm500Dev()
 {
 	bOpen = false;
+	PeakDecoder.AttachCalibration(&Calibration);
+	PeakDetector.AttachCalibration(&Calibration);
+	FsConditioner.SetWorkerPool(&WorkerPool);
+	PeakDetector.SetWorkerPool(&WorkerPool);
+	DistanceCompVersion = DistanceComp.GetVersion() - 1;	//load the offsets with the first frame
 }
 
 
@@ -48,9 +54,15 @@ void Csm500Dev::Init()
 	{
 		//invoke the base class Init() function
 		Csm500DevCtrl::Init();
+		ValidateFrameLayout();
+		WorkerPool.Start(SM500_DEFAULT_WORKER_THREADS);
+		EnterRealTime();
 	}
 	catch (int err)
 	{
+		RealTime.Leave();
+		WorkerPool.Stop();
+		Csm500DevCtrl::Close();
 		bOpen = false;
     	throw (err);	//rethrow any returned error
 	}
@@ -69,9 +81,15 @@ void Csm500Dev::Init(const char* DevNode)
 	{
 		//invoke the base class Init() function
 		Csm500DevCtrl::Init(DevNode);
+		ValidateFrameLayout();
+		WorkerPool.Start(SM500_DEFAULT_WORKER_THREADS);
+		EnterRealTime();
 	}
 	catch (int err)
 	{
+		RealTime.Leave();
+		WorkerPool.Stop();
+		Csm500DevCtrl::Close();
 		bOpen = false;
    		throw (err);	//rethrow any returned error
 	}
@@ -87,14 +105,483 @@ void Csm500Dev::Close()
 {
 	if (!bOpen) return;		//dev not opened; nothing to do
 		
+	Recorder.Stop();
+	WorkerPool.Stop();
+
 	//invoke the base class Close() function
    	Csm500DevCtrl::Close();
+	RealTime.Leave();
 
 	bOpen = false;
 	
 }
 
 
+/* ===========================================================================
+Returns a pointer to the next DMAed peaks data buffer, queued for
+recording when a recording is running (and timed when the latency
+statistics are on).  This is a blocking call.
+=========================================================================== */
+const void* Csm500Dev::GetPeaksData(void)
+{
+	sm500_result<const void*> r = Csm500Dev::TryGetPeaksData();
+
+	if (!r.Ok())
+		throw r.Errno;
+	return r.Value;
+}
+
+
+/* ===========================================================================
+Returns a pointer to the next DMAed FS data buffer, queued for recording
+when a recording is running (and timed when the latency statistics are
+on).  This is a blocking call.
+=========================================================================== */
+const void* Csm500Dev::GetFsData(void)
+{
+	sm500_result<const void*> r = Csm500Dev::TryGetFsData();
+
+	if (!r.Ok())
+		throw r.Errno;
+	return r.Value;
+}
+
+
+/* ===========================================================================
+Non-throwing GetPeaksData() and GetFsData(): the status of the read is
+returned instead of thrown (see sm500_status.h)
+=========================================================================== */
+sm500_result<const void*> Csm500Dev::TryGetPeaksData(void) noexcept
+{
+	sm500_result<const void*> r = Csm500DevCtrl::TryGetPeaksData();
+
+	if (!r.Ok())
+		return r;
+	if (LatencyStats.IsEnabled())
+	{
+		sm500_latency_mark *mark = LatencyStats.FindThreadMark();	//0 on an unregistered thread
+		if (mark)
+			LatencyStats.FrameRead(r.Value, *mark);
+	}
+	if (Recorder.IsRecording())
+		Recorder.RecordPeaks(r.Value);
+	return r;
+}
+
+sm500_result<const void*> Csm500Dev::TryGetFsData(void) noexcept
+{
+	sm500_result<const void*> r = Csm500DevCtrl::TryGetFsData();
+
+	if (!r.Ok())
+		return r;
+	if (LatencyStats.IsEnabled() && LatencyStats.FindThreadMark())
+	{
+		sm500_latency_mark mark;			//the FS buffers are not followed further
+		LatencyStats.FrameRead(r.Value, mark, SM500_LAT_FS_WAKEUP);
+	}
+	if (Recorder.IsRecording())
+		Recorder.RecordFs(r.Value);
+	return r;
+}
+
+
+/* ===========================================================================
+Returns a typed view over the next DMAed peaks data buffer.
+This is a blocking call.
+=========================================================================== */
+Csm500PeaksFrame Csm500Dev::GetPeaksFrame(void)
+{
+	return Csm500PeaksFrame(GetPeaksData());
+}
+
+
+/* ===========================================================================
+Returns a typed view over the next DMAed FS data buffer.
+This is a blocking call.
+=========================================================================== */
+Csm500FsFrame Csm500Dev::GetFsFrame(void)
+{
+	return Csm500FsFrame(GetFsData());
+}
+
+
+/* ===========================================================================
+Waits for the next DMAed peaks data buffer and decodes it into Peaks.
+This is a blocking call.
+=========================================================================== */
+void Csm500Dev::GetPeaks(sm500_peaks_soa &Peaks)
+{
+	UpdateDistanceComp();
+	PeakDecoder.Decode(Csm500PeaksFrame(GetPeaksData()), Peaks);
+	if (LatencyStats.IsEnabled())
+	{
+		sm500_latency_mark *mark = LatencyStats.FindThreadMark();
+		if (mark)
+			LatencyStats.StageDone(SM500_LAT_DECODE, *mark);
+	}
+}
+
+
+/* ===========================================================================
+Decodes a peaks data buffer (as returned by GetPeaksData()) into Peaks.
+=========================================================================== */
+void Csm500Dev::DecodePeaks(const void *PeaksData, sm500_peaks_soa &Peaks)
+{
+	UpdateDistanceComp();
+	PeakDecoder.Decode(Csm500PeaksFrame(PeaksData), Peaks);
+	if (LatencyStats.IsEnabled())
+	{
+		sm500_latency_mark *mark = LatencyStats.FindThreadMark();
+		if (mark)
+			LatencyStats.StageDone(SM500_LAT_DECODE, *mark);
+	}
+}
+
+
+/* ===========================================================================
+Sets the position-to-wavelength polynomial of a channel.  Coef holds
+SM500_CAL_ORDER+1 coefficients, constant term first.  The new model takes
+effect with the next decoded frame; acquisition is not interrupted.
+=========================================================================== */
+void Csm500Dev::SetPeakCalibration(uint32_t ch, const double *Coef)
+{
+	Calibration.SetModel(ch, Coef);
+}
+
+
+/* ===========================================================================
+Returns the calibration engine (per-channel models, FS wavelength tables,
+incremental offset updates)
+=========================================================================== */
+Csm500Calibration& Csm500Dev::GetCalibration(void)
+{
+	return Calibration;
+}
+
+
+/* ===========================================================================
+Waits for the next DMAed FS data buffer and conditions it into Spectrum.
+This is a blocking call.  One thread at a time conditions FS buffers; it
+may run alongside a thread finding peaks (the worker pool they share runs
+their batches one after the other).
+=========================================================================== */
+void Csm500Dev::GetFsSpectrum(sm500_fs_spectrum &Spectrum)
+{
+	FsConditioner.Condition(Csm500FsFrame(GetFsData()), Spectrum);
+}
+
+
+/* ===========================================================================
+Conditions an FS data buffer (as returned by GetFsData()) into Spectrum.
+One thread at a time, as GetFsSpectrum().
+=========================================================================== */
+void Csm500Dev::ConditionFs(const void *FsData, sm500_fs_spectrum &Spectrum)
+{
+	FsConditioner.Condition(Csm500FsFrame(FsData), Spectrum);
+}
+
+
+/* ===========================================================================
+Returns the FS conditioner, to configure conversion, baseline and gain
+=========================================================================== */
+Csm500FsConditioner& Csm500Dev::GetFsConditioner(void)
+{
+	return FsConditioner;
+}
+
+
+/* ===========================================================================
+Finds the peaks of a conditioned FS spectrum in software.  The peaks are
+returned in the same structure as decoded hardware peaks.  Metrics may be
+0 when the width/asymmetry metrics are not needed.  One thread at a time
+finds peaks; it may run alongside a thread conditioning FS buffers.
+=========================================================================== */
+void Csm500Dev::FindPeaks(const sm500_fs_spectrum &Spectrum, sm500_peaks_soa &Peaks, sm500_peak_metrics *Metrics)
+{
+	UpdateDistanceComp();
+	PeakDetector.Detect(Spectrum, Peaks, Metrics);
+}
+
+
+/* ===========================================================================
+Returns the software peak detector, to configure thresholds and refinement
+=========================================================================== */
+Csm500PeakDetector& Csm500Dev::GetPeakDetector(void)
+{
+	return PeakDetector;
+}
+
+
+/* ===========================================================================
+Sets the one-way fibre length (m) from the interrogator to the sensors of a
+channel.  The resulting time of flight offset is removed from the peaks
+decoded or detected from the next frame on.
+=========================================================================== */
+void Csm500Dev::SetFibreLength(uint32_t ch, double Meters)
+{
+	DistanceComp.SetFibreLength(ch, Meters);
+}
+
+
+/* ===========================================================================
+Sets the sweep configuration used by the distance compensation: the FS
+sample rate during the sweep (Hz) and the sweep direction (+1/-1)
+=========================================================================== */
+void Csm500Dev::SetSweepConfig(double SampleRate, int Direction)
+{
+	DistanceComp.SetSweepConfig(SampleRate, Direction);
+}
+
+
+/* ===========================================================================
+Measures the fibre length of a channel on a reference grating of known
+wavelength.  ObservedNm is the wavelength of that grating as currently
+reported (i.e. with the current compensation applied).  The measured
+length is stored and returned.
+=========================================================================== */
+double Csm500Dev::MeasureFibreLength(uint32_t ch, double ObservedNm, double ReferenceNm)
+{
+	static_assert(SM500_CAL_ORDER == 3, "the slope below is the derivative of a cubic");
+	double cf[SM500_CAL_ORDER + 1];
+
+	Calibration.GetModel(ch, cf);
+	if (cf[1] == 0.0)
+		throw EINVAL;
+
+	//slope of the calibration (nm per sample) at the reference position
+	double x = (ReferenceNm - cf[0]) / cf[1];
+	double slope = cf[1] + (2.0 * cf[2] + 3.0 * cf[3] * x) * x;
+	if (slope == 0.0)
+		throw EINVAL;
+
+	//total (uncompensated) shift of the grating, in FS samples
+	double shift = (ObservedNm - ReferenceNm) / slope + DistanceComp.GetPositionOffset(ch);
+
+	return DistanceComp.MeasureFibreLength(ch, shift);
+}
+
+
+/* ===========================================================================
+Returns the distance compensation, to configure fibre lengths, the group
+index and the sweep
+=========================================================================== */
+Csm500DistanceComp& Csm500Dev::GetDistanceComp(void)
+{
+	return DistanceComp;
+}
+
+
+/* ===========================================================================
+Assigns the peaks of a decoded (or detected) frame to the sensors configured
+in the sensor map.  Sensors is a dense per-sensor column, indexed by the ids
+returned by GetSensorMap().AddSensor().
+=========================================================================== */
+void Csm500Dev::AssignSensors(const sm500_peaks_soa &Peaks, sm500_sensor_frame &Sensors)
+{
+	SensorMap.Assign(Peaks, Sensors);
+}
+
+
+/* ===========================================================================
+Returns the sensor map, to configure the sensor windows and the policies for
+missing and extra peaks
+=========================================================================== */
+Csm500SensorMap& Csm500Dev::GetSensorMap(void)
+{
+	return SensorMap;
+}
+
+
+/* ===========================================================================
+Converts the assigned sensor wavelengths of a frame to engineering units.
+Temperature references are converted before the sensors using them.
+=========================================================================== */
+void Csm500Dev::ConvertSensors(const sm500_sensor_frame &Sensors, sm500_sensor_values &Values)
+{
+	UnitConverter.Convert(Sensors, Values);
+}
+
+
+/* ===========================================================================
+Returns the unit converter, to configure the transfer function and the
+temperature reference of each sensor
+=========================================================================== */
+Csm500UnitConverter& Csm500Dev::GetUnitConverter(void)
+{
+	return UnitConverter;
+}
+
+
+/* ===========================================================================
+Hands a frame of converted sensor values to the subscriptions.  The
+subscribers due at this frame are called back on the calling thread.
+Ends the frame followed by the latency statistics on this thread.
+=========================================================================== */
+void Csm500Dev::Publish(const sm500_sensor_values &Values)
+{
+	Subscriptions.Push(Values);
+	if (LatencyStats.IsEnabled())
+	{
+		sm500_latency_mark *mark = LatencyStats.FindThreadMark();
+		if (mark)
+		{
+			LatencyStats.StageDone(SM500_LAT_PUBLISH, *mark);
+			LatencyStats.FrameDone(*mark);
+		}
+	}
+}
+
+
+/* ===========================================================================
+Returns the subscriptions, to register clients with their sensor sets and
+output rates
+=========================================================================== */
+Csm500Subscriptions& Csm500Dev::GetSubscriptions(void)
+{
+	return Subscriptions;
+}
+
+
+/* ===========================================================================
+Starts recording every raw buffer returned by GetPeaksData() and
+GetFsData() to Path_NNNNNN.sm500rec.  Frames the disk cannot keep up with
+are dropped rather than delaying acquisition (see GetRecorder()).
+=========================================================================== */
+void Csm500Dev::StartRecording(const char *Path)
+{
+	Recorder.Start(Path);
+}
+
+
+/* ===========================================================================
+Writes out the queued frames and closes the recording
+=========================================================================== */
+void Csm500Dev::StopRecording(void)
+{
+	Recorder.Stop();
+}
+
+
+/* ===========================================================================
+Returns the recorder, to configure segments, queue and O_DIRECT before
+StartRecording() and to read its statistics
+=========================================================================== */
+Csm500Recorder& Csm500Dev::GetRecorder(void)
+{
+	return Recorder;
+}
+
+
+/* ===========================================================================
+Returns the real-time mode settings.  SetConfig() them before Init(), which
+applies them to the calling thread (the one that will read the data);
+GetStatus() tells which of them could be applied.
+=========================================================================== */
+Csm500RealTime& Csm500Dev::GetRealTime(void)
+{
+	return RealTime;
+}
+
+
+/* ===========================================================================
+Registers the calling thread with the latency statistics (its histograms
+are allocated and zeroed here, not on the read path) and applies the
+real-time mode, when enabled, at the end of Init(): the calling thread is
+pinned and scheduled, the workers get the same priority on the other CPUs,
+the memory is locked, and the buffers and the calling thread's stack are
+faulted in.  Throws the errno of a setting that cannot be applied when the
+settings are required.
+=========================================================================== */
+void Csm500Dev::EnterRealTime(void)
+{
+	LatencyStats.RegisterThread();		//the read path records without allocating
+	if (!RealTime.IsEnabled()) return;
+
+	RealTime.Enter();
+	for (uint32_t i=0; i<WorkerPool.GetNumThreads(); i++)
+		RealTime.ApplyToThread(WorkerPool.GetThread(i));
+
+	PrefaultBuffers();
+	RealTime.PrefaultStack();
+}
+
+
+/* ===========================================================================
+Touches every page of the mapped DMA buffers
+=========================================================================== */
+void Csm500Dev::PrefaultBuffers(void)
+{
+	for (int i=0; i<NumDmaPeaksBuffers; i++)
+		if (DmaPeaksBuffer[i] != MAP_FAILED)
+			RealTime.Prefault(DmaPeaksBuffer[i], DmaPeaksBufferSize);
+	for (int i=0; i<NumDmaFsBuffers; i++)
+		if (DmaFsBuffer[i] != MAP_FAILED)
+			RealTime.Prefault(DmaFsBuffer[i], DmaFsBufferSize);
+}
+
+
+/* ===========================================================================
+Returns the latency statistics: Enable() them, then read the per-stage
+percentiles with GetSummary() or Export() at any time.  The frames are
+followed on the thread that called Init(); a thread other than that one
+reading the data calls RegisterThread() first.
+=========================================================================== */
+Csm500LatencyStats& Csm500Dev::GetLatencyStats(void)
+{
+	return LatencyStats;
+}
+
+
+/* ===========================================================================
+Loads the distance compensation offsets into the decoder and the detector
+when they have changed since the last frame.  Costs one comparison per
+frame otherwise.
+=========================================================================== */
+void Csm500Dev::UpdateDistanceComp(void)
+{
+	float offsets[SM500_NUM_CHANNELS];
+
+	if (DistanceComp.GetVersion() == DistanceCompVersion)
+		return;
+
+	//the offsets and their version are read together, under DistanceComp's lock
+	uint32_t version = DistanceComp.GetPositionOffsets(offsets);
+	for (uint32_t ch=0; ch<SM500_NUM_CHANNELS; ch++)
+	{
+		PeakDecoder.SetPositionOffset(ch, offsets[ch]);
+		PeakDetector.SetPositionOffset(ch, offsets[ch]);
+	}
+	DistanceCompVersion = version;
+}
+
+
+/* ===========================================================================
+Verifies that the buffers reported by the hardware are large enough to hold
+the frame formats described in sm500_data_structures.h and that the driver
+writes its timestamp where the header layout expects it.  Throws EPROTO on
+a mismatch.
+=========================================================================== */
+void Csm500Dev::ValidateFrameLayout(void)
+{
+	if ((uint32_t)DmaPeaksBufferSize < sm500_peaks_format::FrameBytes)
+	{
+		SM500_DBG( cout<<"Peaks buffer too small: "<<DmaPeaksBufferSize<<" < "<<sm500_peaks_format::FrameBytes<<"\n"; );
+		throw EPROTO;
+	}
+
+	if ((uint32_t)DmaFsBufferSize < sm500_fs_format::FrameBytes)
+	{
+		SM500_DBG( cout<<"FS buffer too small: "<<DmaFsBufferSize<<" < "<<sm500_fs_format::FrameBytes<<"\n"; );
+		throw EPROTO;
+	}
+
+	if ((ReadReg32(SM500_REG_TSOFST) >> 2) != sm500_header_layout::TimestampOffset32)
+	{
+		SM500_DBG( cout<<"Unexpected timestamp offset: "<<ReadReg32(SM500_REG_TSOFST)<<"\n"; );
+		throw EPROTO;
+	}
+}
+
 
 
 /* ===========================================================================
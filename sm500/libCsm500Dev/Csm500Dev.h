@@ -24,7 +24,21 @@ using namespace std;
 
 #include <stdint.h>
 #include "Csm500DevCtrl.h"
-//#include "sm500_data_structures.h"
+#include "sm500_data_structures.h"
+#include "Csm500Calibration.h"
+#include "Csm500PeakDecoder.h"
+#include "Csm500FsConditioner.h"
+#include "Csm500PeakDetector.h"
+#include "Csm500DistanceComp.h"
+#include "Csm500Averager.h"
+#include "Csm500Histogram.h"
+#include "Csm500SensorMap.h"
+#include "Csm500UnitConverter.h"
+#include "Csm500Subscriptions.h"
+#include "Csm500Recorder.h"
+#include "Csm500WorkerPool.h"
+#include "Csm500LatencyStats.h"
+#include "Csm500RealTime.h"
 
 /* ===========================================================================
 Constants
@@ -34,6 +48,7 @@ Constants
 /* ===========================================================================
 Defaults
 =========================================================================== */
+#define SM500_DEFAULT_WORKER_THREADS  (SM500_NUM_CHANNELS - 1)    //the calling thread takes the last channel
 
 
 /* ===========================================================================
@@ -48,9 +63,56 @@ class Csm500Dev:public Csm500DevCtrl
     virtual void Init();                    //intialize the driver through the default device node and start data acquisition
     virtual void Init(const char* DevNode); //initialize the driver through a non-default device node and start data acquisition
     virtual void Close();                   //stops the data acquisition process and closes the driver
+    virtual const void* GetPeaksData(void); //returns a pointer to the next DMAed peaks data buffer (recorded when recording)
+    virtual const void* GetFsData(void);    //returns a pointer to the next DMAed FS data buffer (recorded when recording)
+    virtual sm500_result<const void*> TryGetPeaksData(void) noexcept;  //GetPeaksData() returning its error
+    virtual sm500_result<const void*> TryGetFsData(void) noexcept;     //GetFsData() returning its error
+    Csm500PeaksFrame GetPeaksFrame(void);   //returns a typed view over the next DMAed peaks data buffer
+    Csm500FsFrame GetFsFrame(void);         //returns a typed view over the next DMAed FS data buffer
+    void GetPeaks(sm500_peaks_soa &Peaks);  //waits for the next peaks data buffer and decodes it
+    void DecodePeaks(const void *PeaksData, sm500_peaks_soa &Peaks);  //decodes a peaks data buffer
+    void SetPeakCalibration(uint32_t ch, const double *Coef);       //sets the position-to-wavelength polynomial of a channel
+    Csm500Calibration& GetCalibration(void);                        //per-channel wavelength calibration models and FS tables
+    void GetFsSpectrum(sm500_fs_spectrum &Spectrum);                //waits for the next FS data buffer and conditions it
+    void ConditionFs(const void *FsData, sm500_fs_spectrum &Spectrum);  //conditions an FS data buffer (one thread at a time)
+    Csm500FsConditioner& GetFsConditioner(void);                    //FS conversion, baseline and gain settings
+    void FindPeaks(const sm500_fs_spectrum &Spectrum, sm500_peaks_soa &Peaks, sm500_peak_metrics *Metrics);  //software peak detection (one thread at a time)
+    Csm500PeakDetector& GetPeakDetector(void);                      //software peak detection settings
+    void SetFibreLength(uint32_t ch, double Meters);                //sets the fibre length to the sensors of a channel
+    void SetSweepConfig(double SampleRate, int Direction);          //sets the FS sample rate (Hz) and sweep direction (+1/-1)
+    double MeasureFibreLength(uint32_t ch, double ObservedNm, double ReferenceNm);  //measures a channel's fibre length on a reference grating
+    Csm500DistanceComp& GetDistanceComp(void);                      //distance compensation settings
+    void AssignSensors(const sm500_peaks_soa &Peaks, sm500_sensor_frame &Sensors);  //maps the peaks of a frame to the configured sensors
+    Csm500SensorMap& GetSensorMap(void);                            //sensor windows and assignment policies
+    void ConvertSensors(const sm500_sensor_frame &Sensors, sm500_sensor_values &Values);  //converts assigned sensors to engineering units
+    Csm500UnitConverter& GetUnitConverter(void);                    //per-sensor transfer functions and temperature references
+    void Publish(const sm500_sensor_values &Values);                //hands a frame of sensor values to the rate subscribers
+    Csm500Subscriptions& GetSubscriptions(void);                    //per-client sensor sets and output rates
+    void StartRecording(const char *Path);                          //records every raw buffer returned to segmented files
+    void StopRecording(void);                                       //flushes and closes the recording
+    Csm500Recorder& GetRecorder(void);                              //recorder settings and statistics
+    Csm500LatencyStats& GetLatencyStats(void);                      //per-stage frame latency histograms (off by default)
+    Csm500RealTime& GetRealTime(void);                              //real-time acquisition mode settings, applied by Init() (off by default)
 
   protected:
   	bool bOpen;								//true when the device is successfully opened; false otherwise
+    virtual void ValidateFrameLayout(void); //verifies that the hardware buffers match sm500_data_structures.h
+    void UpdateDistanceComp(void);          //reloads the distance offsets when DistanceComp has changed
+    void EnterRealTime(void);               //applies the real-time mode to the calling thread and the workers
+    virtual void PrefaultBuffers(void);     //touches the pages of the data buffers
+    Csm500Calibration Calibration;          //wavelength calibration shared by the decoder and the detector
+    Csm500PeakDecoder PeakDecoder;          //peak word to wavelength decoder
+    Csm500WorkerPool WorkerPool;            //threads for per-channel processing
+    Csm500FsConditioner FsConditioner;      //raw FS to float spectra
+    Csm500PeakDetector PeakDetector;        //peaks found in software on the FS spectra
+    Csm500DistanceComp DistanceComp;        //per-channel time of flight offsets
+    Csm500SensorMap SensorMap;              //peak to sensor assignment
+    Csm500UnitConverter UnitConverter;      //sensor wavelengths to engineering units
+    Csm500Subscriptions Subscriptions;      //rate-converted sensor frames for the clients
+    Csm500Recorder Recorder;                //raw buffer recording
+    Csm500LatencyStats LatencyStats;        //read, decode and publish latencies
+    Csm500RealTime RealTime;                //pinning, SCHED_FIFO and locked memory of the acquisition thread
+    uint32_t DistanceCompVersion;           //version of the offsets loaded in the decoder and the detector
 
 
 };
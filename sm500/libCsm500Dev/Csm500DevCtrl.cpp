@@ -29,14 +29,17 @@ using namespace std;
 //#include <sys/time.h>   //for usleep()
 #include "Csm500DevCtrl.h"
 #include "sm500_common.h"
+#include "sm500_data_structures.h"
 
 
 /* ===========================================================================
 Csm500DevCtrl constructor
 =========================================================================== */
-Csm500DevCtrl::Csm500DevCtrl()
+Csm500DevCtrl::Csm500DevCtrl() : PeaksSerial(SM500_SN_PEAKS), FsSerial(SM500_SN_FS)
 {
 	bOpen = false;
+	ReadCancels = 0;
+	bRegBatchIoctl = true;
 }
 
 
@@ -55,6 +58,9 @@ starts data acquisition
 =========================================================================== */
 void Csm500DevCtrl::Init()
 {
+	RegShadow.Invalidate();
+	PeaksSerial.Reset();
+	FsSerial.Reset();
 	try
 	{
 		//invoke the base class Init() function
@@ -79,6 +85,9 @@ specified device node and start data acquisition
 =========================================================================== */
 void Csm500DevCtrl::Init(const char* DevNode)
 {
+	RegShadow.Invalidate();
+	PeaksSerial.Reset();
+	FsSerial.Reset();
 	try
 	{
 		//invoke the base class Init() function
@@ -90,6 +99,7 @@ void Csm500DevCtrl::Init(const char* DevNode)
     	throw (err);	//rethrow any returned error
 	}
 
+	bOpen = true;
 	EnableInterrupts(SM500_INT_PK + SM500_INT_FS);
 	EnableDma(SM500_DMA_PK + SM500_DMA_FS);
 }
@@ -102,6 +112,7 @@ void Csm500DevCtrl::Close()
 {
 	if (!bOpen) return;		//dev not opened; nothing to do
 	
+	RegShadow.Invalidate();		//drops any staged writes: the disables below go straight to the card
 	EnableInterrupts(SM500_INT_CLEAR);
 	EnableDma(SM500_DMA_CLEAR);
 	
@@ -140,12 +151,11 @@ This is a blocking call.
 =========================================================================== */
 const void* Csm500DevCtrl::GetPeaksData(void)
 {
-  uint16_t val;
-  
-  if ( ioctl(fd, SM500_IOC_GET_PEAKS_DATA, (unsigned long)(&val)) == -1)
-    throw errno;
-    
-  return DmaPeaksBuffer[val];
+  sm500_result<const void*> r = Csm500DevCtrl::TryGetPeaksData();
+
+  if (!r.Ok())
+    throw r.Errno;
+  return r.Value;
 }
 
 
@@ -155,12 +165,11 @@ This is a blocking call.
 =========================================================================== */
 const void* Csm500DevCtrl::GetFsData(void)
 {
-  uint16_t val;
-  
-  if ( ioctl(fd, SM500_IOC_GET_SPECTRUM, (unsigned long)(&val)) == -1)
-    throw errno;
-    
-  return DmaFsBuffer[val];
+  sm500_result<const void*> r = Csm500DevCtrl::TryGetFsData();
+
+  if (!r.Ok())
+    throw r.Errno;
+  return r.Value;
 }
 
 
@@ -197,11 +206,253 @@ cancels all read requests (releases all blocked readers)
 =========================================================================== */
 void Csm500DevCtrl::CancelReads(void)
 {
+  ReadCancels++;
+  PeaksSerial.Cancelled();
+  FsSerial.Cancelled();
   if ( ioctl(fd, SM500_IOC_CANCEL_READ) == -1 )
     throw errno;
 }
 
 
+/* ===========================================================================
+Non-throwing counterparts of GetPeaksData() and GetFsData().  A read
+released by CancelReads() returns SM500_CANCELLED: the driver wakes the
+readers up with an out-of-range peaks buffer index or a stale FS buffer,
+so the cancellation is also detected through ReadCancels.  The S/N of
+every buffer returned is checked for continuity.
+=========================================================================== */
+sm500_result<const void*> Csm500DevCtrl::TryGetPeaksData(void) noexcept
+{
+  uint16_t val;
+  uint32_t cancels = ReadCancels;
+
+  if (fd <= 0)
+    return sm500_result<const void*>::Error(EBADF);
+  if ( ioctl(fd, SM500_IOC_GET_PEAKS_DATA, (unsigned long)(&val)) == -1)
+    return sm500_result<const void*>::Error(errno);
+  if ((val >= NumDmaPeaksBuffers) || (ReadCancels != cancels))
+    return sm500_result<const void*>::Error(ECANCELED);
+
+  PeaksSerial.Check(Csm500PeaksFrame(DmaPeaksBuffer[val]).SerialNumber());
+  return sm500_result<const void*>::Success(DmaPeaksBuffer[val]);
+}
+
+sm500_result<const void*> Csm500DevCtrl::TryGetFsData(void) noexcept
+{
+  uint16_t val;
+  uint32_t cancels = ReadCancels;
+
+  if (fd <= 0)
+    return sm500_result<const void*>::Error(EBADF);
+  if ( ioctl(fd, SM500_IOC_GET_SPECTRUM, (unsigned long)(&val)) == -1)
+    return sm500_result<const void*>::Error(errno);
+  if ((val >= NumDmaFsBuffers) || (ReadCancels != cancels))
+    return sm500_result<const void*>::Error(ECANCELED);
+
+  FsSerial.Check(Csm500FsFrame(DmaFsBuffer[val]).SerialNumber());
+  return sm500_result<const void*>::Success(DmaFsBuffer[val]);
+}
+
+
+/* ===========================================================================
+Non-throwing counterparts of PeaksDataReady() and FsDataReady()
+=========================================================================== */
+sm500_result<bool> Csm500DevCtrl::TryPeaksDataReady(void) noexcept
+{
+  uint8_t val;
+
+  if (fd <= 0)
+    return sm500_result<bool>::Error(EBADF);
+  if ( ioctl(fd, SM500_IOC_PEAKS_DATA_READY, (unsigned long)(&val) ) == -1)
+    return sm500_result<bool>::Error(errno);
+  return sm500_result<bool>::Success(val != 0);
+}
+
+sm500_result<bool> Csm500DevCtrl::TryFsDataReady(void) noexcept
+{
+  uint8_t val;
+
+  if (fd <= 0)
+    return sm500_result<bool>::Error(EBADF);
+  if ( ioctl(fd, SM500_IOC_FS_DATA_READY, (unsigned long)(&val) ) == -1)
+    return sm500_result<bool>::Error(errno);
+  return sm500_result<bool>::Success(val != 0);
+}
+
+
+/* ===========================================================================
+Non-throwing counterpart of CancelReads()
+=========================================================================== */
+sm500_status Csm500DevCtrl::TryCancelReads(void) noexcept
+{
+  ReadCancels++;
+  PeaksSerial.Cancelled();
+  FsSerial.Cancelled();
+  if (fd <= 0)
+    return SM500_NOT_OPEN;
+  if ( ioctl(fd, SM500_IOC_CANCEL_READ) == -1 )
+    return sm500_status_from_errno(errno);
+  return SM500_OK;
+}
+
+
+/* ===========================================================================
+Reads a 32-bit register, from the shadow when its class allows it
+=========================================================================== */
+uint32_t Csm500DevCtrl::ReadReg32(uint32_t reg)
+{
+  uint32_t value;
+
+  if (RegShadow.Lookup(reg, value))
+    return value;
+
+  value = Csm500DriverInterface::ReadReg32(reg);
+  RegShadow.Fill(reg, value);
+  return value;
+}
+
+
+/* ===========================================================================
+Writes a register.  A 32-bit write to a write-through register is dropped
+when the register already holds the value, and staged during a batch.
+=========================================================================== */
+void Csm500DevCtrl::WriteReg32(uint32_t reg, uint32_t value)
+{
+  if (!RegShadow.Write(reg, value))
+    return;
+
+  try
+  {
+    Csm500DriverInterface::WriteReg32(reg, value);
+  }
+  catch (int)
+  {
+    RegShadow.Forget(reg);
+    throw;
+  }
+}
+
+void Csm500DevCtrl::WriteReg16(uint32_t reg, uint16_t value)
+{
+  RegShadow.Forget(reg);
+  Csm500DriverInterface::WriteReg16(reg, value);
+}
+
+void Csm500DevCtrl::WriteReg8(uint32_t reg, uint8_t value)
+{
+  RegShadow.Forget(reg);
+  Csm500DriverInterface::WriteReg8(reg, value);
+}
+
+
+/* ===========================================================================
+Register shadow controls
+=========================================================================== */
+void Csm500DevCtrl::SetRegClass(uint32_t reg, sm500_reg_class Class)
+{
+  RegShadow.SetClass(reg, Class);
+}
+
+void Csm500DevCtrl::BeginRegBatch(void)
+{
+  RegShadow.BeginBatch();
+}
+
+void Csm500DevCtrl::InvalidateRegs(void)
+{
+  RegShadow.Invalidate();
+}
+
+void Csm500DevCtrl::GetRegStats(sm500_reg_shadow_stats &Stats)
+{
+  RegShadow.GetStats(Stats);
+}
+
+
+/* ===========================================================================
+Writes the registers staged since BeginRegBatch() with one
+SM500_IOC_WRITE_REGS32 ioctl per SM500_IOC_MAX_REGS registers, in the
+order they were first written, and ends the batch.  A driver without that
+ioctl gets them one at a time.
+=========================================================================== */
+void Csm500DevCtrl::FlushRegs(void)
+{
+  struct sm500_ioctl_reg_arg regs[SM500_IOC_MAX_REGS];
+  struct sm500_ioctl_regs_arg batch;
+  uint32_t n, i = 0;
+
+  while ((n = RegShadow.TakeDirty(regs, SM500_IOC_MAX_REGS)) != 0)
+  {
+    batch.count = n;
+    batch.regs = regs;
+    try
+    {
+      if (bRegBatchIoctl)
+      {
+        if (ioctl(fd, SM500_IOC_WRITE_REGS32, (unsigned long)(&batch)) == 0)
+          continue;
+        if ((errno != EINVAL) && (errno != ENOTTY))
+          throw errno;
+        bRegBatchIoctl = false;     //older driver
+      }
+      for (i=0; i<n; i++)
+        Csm500DriverInterface::WriteReg32(regs[i].reg, regs[i].value);
+    }
+    catch (int)
+    {
+      for (uint32_t j=i; j<n; j++)  //unknown state from the failed write on
+        RegShadow.Forget(regs[j].reg);
+      throw;
+    }
+  }
+}
+
+
+/* ===========================================================================
+Sets the function called, on the reading thread, for every break in the
+S/N sequence of either stream (0 = none)
+=========================================================================== */
+void Csm500DevCtrl::SetSerialCallback(Csm500SerialTracker::sn_callback_t Callback, void *Context)
+{
+  PeaksSerial.SetCallback(Callback, Context);
+  FsSerial.SetCallback(Callback, Context);
+}
+
+
+/* ===========================================================================
+Returns the continuity statistics of a stream (SM500_SN_PEAKS or
+SM500_SN_FS) since Init()
+=========================================================================== */
+void Csm500DevCtrl::GetSerialStats(uint32_t Stream, sm500_sn_stats &Stats)
+{
+  if (Stream == SM500_SN_PEAKS)
+    PeaksSerial.GetStats(Stats);
+  else if (Stream == SM500_SN_FS)
+    FsSerial.GetStats(Stats);
+  else
+    throw EINVAL;
+}
+
+
+/* ===========================================================================
+Returns the S/N of the data set the card DMAed last, from the
+SM500_REG_DMASNHI/LO registers (the high word is read again if the low
+word rolled over in between).  Compared with the S/N of the last buffer
+read, it tells how far behind the reader is.
+=========================================================================== */
+uint64_t Csm500DevCtrl::GetDmaSerialNumber(void)
+{
+  uint32_t hi, lo;
+
+  do
+  {
+    hi = ReadReg32(SM500_REG_DMASNHI);
+    lo = ReadReg32(SM500_REG_DMASNLO);
+  } while (ReadReg32(SM500_REG_DMASNHI) != hi);
+  return ((uint64_t)hi << 32) | lo;
+}
+
+
 /* ===========================================================================
 use this to achieve a specific, non-default DMA behavior
 =========================================================================== */
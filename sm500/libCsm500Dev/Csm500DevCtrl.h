@@ -27,7 +27,11 @@
 using namespace std;
 
 #include <stdint.h>
+#include <atomic>
 #include "Csm500DriverInterface.h"
+#include "Csm500RegShadow.h"
+#include "Csm500SerialTracker.h"
+#include "sm500_status.h"
 
 /* ===========================================================================
 Constants
@@ -58,9 +62,37 @@ class Csm500DevCtrl:public Csm500DriverInterface
     virtual bool FsDataReady(void);     		//returns true if a callto GetFsData() would not block; false otherwise
     virtual void CancelReads(void);         //cancels all read requests (releases blocked readers)
 
+    //---------- non-throwing acquisition path (see sm500_status.h) ----------
+    virtual sm500_result<const void*> TryGetPeaksData(void) noexcept;  //GetPeaksData() returning its error
+    virtual sm500_result<const void*> TryGetFsData(void) noexcept;     //GetFsData() returning its error
+    virtual sm500_result<bool> TryPeaksDataReady(void) noexcept;
+    virtual sm500_result<bool> TryFsDataReady(void) noexcept;
+    virtual sm500_status TryCancelReads(void) noexcept;
+
+    //---------- registers, through the shadow (see Csm500RegShadow.h) ----------
+    virtual uint32_t ReadReg32(uint32_t reg);
+    virtual void WriteReg8(uint32_t reg, uint8_t value);
+    virtual void WriteReg16(uint32_t reg, uint16_t value);
+    virtual void WriteReg32(uint32_t reg, uint32_t value);
+    virtual void SetRegClass(uint32_t reg, sm500_reg_class Class);  //overrides the default classification of a register
+    virtual void BeginRegBatch(void);       //stages the writes to write-through registers until FlushRegs()
+    virtual void FlushRegs(void);           //writes the staged registers in one batch and ends it
+    virtual void InvalidateRegs(void);      //drops the shadow (e.g. after a soft reset)
+    virtual void GetRegStats(sm500_reg_shadow_stats &Stats);
+
+    //---------- frame serial numbers (see Csm500SerialTracker.h) ----------
+    void SetSerialCallback(Csm500SerialTracker::sn_callback_t Callback, void *Context);  //called on every gap, duplicate or S/N going backwards; must not throw
+    void GetSerialStats(uint32_t Stream, sm500_sn_stats &Stats);   //Stream: SM500_SN_PEAKS or SM500_SN_FS
+    virtual uint64_t GetDmaSerialNumber(void);  //S/N of the data set the card DMAed last (registers)
+
   protected:
   	bool bOpen;															//true when the device is successfully opened; false otherwise
     char HdlVersion[sizeof(uint32_t)+1];    //size of u32 plus string terminating character
+    std::atomic<uint32_t> ReadCancels;      //# of CancelReads() calls: a read that sees it change was cancelled
+    Csm500RegShadow RegShadow;
+    bool bRegBatchIoctl;                    //false once the driver turned SM500_IOC_WRITE_REGS32 down
+    Csm500SerialTracker PeaksSerial;        //continuity of the buffers returned
+    Csm500SerialTracker FsSerial;
     virtual void EnableDma(uint32_t DmaEnableFlag);            //use this to achieve a specific, non-default DMA behavior
     virtual void EnableInterrupts(uint32_t IntEnableFlag);     //use this to achieve a specific, non-default interrupt behavior
 
@@ -0,0 +1,190 @@
+/* ===========================================================================
+ Csm500DistanceComp.cpp
+ sm500 distance (time of flight) compensation class implementation
+
+ Jerry Volcy
+
+ Copyright (c) 2013, Micron Optics, Inc.
+=========================================================================== */
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+#include <errno.h>
+#include "Csm500DistanceComp.h"
+#include "sm500_common.h"
+
+
+/* ===========================================================================
+Csm500DistanceComp constructor
+=========================================================================== */
+Csm500DistanceComp::Csm500DistanceComp()
+{
+  SampleRate = SM500_DEFAULT_FS_SAMPLE_RATE;
+  Direction = SM500_DEFAULT_SWEEP_DIRECTION;
+  GroupIndex = SM500_DEFAULT_GROUP_INDEX;
+  Version = 0;
+  pthread_mutex_init(&Lock, 0);
+
+  for (uint32_t ch=0; ch<SM500_NUM_CHANNELS; ch++)
+    FibreLength[ch] = 0.0;
+
+  UpdateOffsets();
+}
+
+
+/* ===========================================================================
+destructor
+=========================================================================== */
+Csm500DistanceComp::~Csm500DistanceComp()
+{
+  pthread_mutex_destroy(&Lock);
+}
+
+
+/* ===========================================================================
+Recomputes the per-channel position offsets.  Called only when the sweep
+configuration, the group index or a fibre length changes, with the lock
+held.
+=========================================================================== */
+void Csm500DistanceComp::UpdateOffsets(void)
+{
+  //FS samples of shift per meter of (one-way) fibre
+  double samples_per_meter = Direction * 2.0 * GroupIndex / SM500_SPEED_OF_LIGHT * SampleRate;
+
+  for (uint32_t ch=0; ch<SM500_NUM_CHANNELS; ch++)
+    PositionOffset[ch] = (float)(FibreLength[ch] * samples_per_meter);
+
+  Version.fetch_add(1, std::memory_order_release);
+}
+
+
+/* ===========================================================================
+Sets the sweep configuration: the rate at which FS samples are taken during
+the sweep (Hz) and the sweep direction (+1 when the wavelength increases
+with the sample index, -1 otherwise)
+=========================================================================== */
+void Csm500DistanceComp::SetSweepConfig(double SampleRate, int Direction)
+{
+  if ((SampleRate <= 0.0) || ((Direction != 1) && (Direction != -1)))
+    throw EINVAL;
+
+  pthread_mutex_lock(&Lock);
+  if ((SampleRate != this->SampleRate) || (Direction != this->Direction))
+  {
+    this->SampleRate = SampleRate;
+    this->Direction = Direction;
+    UpdateOffsets();
+  }
+  pthread_mutex_unlock(&Lock);
+}
+
+
+/* ===========================================================================
+Sets the group index of the fibre
+=========================================================================== */
+void Csm500DistanceComp::SetGroupIndex(double GroupIndex)
+{
+  if (GroupIndex < 1.0)
+    throw EINVAL;
+
+  pthread_mutex_lock(&Lock);
+  this->GroupIndex = GroupIndex;
+  UpdateOffsets();
+  pthread_mutex_unlock(&Lock);
+}
+
+
+/* ===========================================================================
+Sets the one-way fibre length (m) from the interrogator to the sensors of a
+channel
+=========================================================================== */
+void Csm500DistanceComp::SetFibreLength(uint32_t ch, double Meters)
+{
+  if ((ch >= SM500_NUM_CHANNELS) || (Meters < 0.0))
+    throw EINVAL;
+
+  pthread_mutex_lock(&Lock);
+  FibreLength[ch] = Meters;
+  UpdateOffsets();
+  pthread_mutex_unlock(&Lock);
+}
+
+
+/* ===========================================================================
+Returns the one-way fibre length (m) of a channel
+=========================================================================== */
+double Csm500DistanceComp::GetFibreLength(uint32_t ch)
+{
+  if (ch >= SM500_NUM_CHANNELS)
+    throw EINVAL;
+
+  pthread_mutex_lock(&Lock);
+  double meters = FibreLength[ch];
+  pthread_mutex_unlock(&Lock);
+  return meters;
+}
+
+
+/* ===========================================================================
+Measures the fibre length of a channel from the shift (in FS samples,
+uncompensated minus expected position) of a reference grating.  The length
+is stored and returned.
+=========================================================================== */
+double Csm500DistanceComp::MeasureFibreLength(uint32_t ch, double ShiftSamples)
+{
+  pthread_mutex_lock(&Lock);
+  double meters = ShiftSamples * SM500_SPEED_OF_LIGHT / (Direction * 2.0 * GroupIndex * SampleRate);
+  pthread_mutex_unlock(&Lock);
+
+  meters = (meters < 0.0) ? 0.0 : meters;
+  SetFibreLength(ch, meters);
+  return meters;
+}
+
+
+/* ===========================================================================
+Returns the position offset of a channel, in FS samples
+=========================================================================== */
+float Csm500DistanceComp::GetPositionOffset(uint32_t ch)
+{
+  if (ch >= SM500_NUM_CHANNELS)
+    throw EINVAL;
+
+  pthread_mutex_lock(&Lock);
+  float offset = PositionOffset[ch];
+  pthread_mutex_unlock(&Lock);
+  return offset;
+}
+
+
+/* ===========================================================================
+Copies the position offsets of all the channels at once (a consistent set,
+even while they are being changed) and returns their version
+=========================================================================== */
+uint32_t Csm500DistanceComp::GetPositionOffsets(float *Offsets)
+{
+  pthread_mutex_lock(&Lock);
+  for (uint32_t ch=0; ch<SM500_NUM_CHANNELS; ch++)
+    Offsets[ch] = PositionOffset[ch];
+  uint32_t version = Version.load(std::memory_order_relaxed);
+  pthread_mutex_unlock(&Lock);
+  return version;
+}
+
+
+/* ===========================================================================
+Returns a counter incremented whenever the offsets change
+=========================================================================== */
+uint32_t Csm500DistanceComp::GetVersion(void)
+{
+  return Version.load(std::memory_order_acquire);
+}
+
+
+
+/* ===========================================================================
+=========================================================================== */
+//----------  ----------
+//----------  ----------
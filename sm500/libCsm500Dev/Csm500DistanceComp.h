@@ -0,0 +1,93 @@
+/* ===========================================================================
+ Csm500DistanceComp.h
+ sm500 distance (time of flight) compensation class definition
+
+ Light reflected by a sensor reaches the detector 2nL/c after it left the
+ laser, L being the fibre length to the sensor and n the group index of
+ the fibre.  During that time the swept laser has moved on, so the peak
+ appears later in the sweep by
+
+   shift = Direction * 2nL/c * SampleRate      (FS samples)
+
+ This class holds the fibre length of every channel (configured, or
+ measured once against a reference grating) and the sweep configuration,
+ and turns them into one position offset per channel.  The offsets are
+ only recomputed when a length or the sweep configuration changes; the
+ decoder subtracts them in the same vectorized pass that decodes the peak
+ words, so compensation costs one subtraction per peak.
+
+ The settings may change from any thread while frames are decoded: the
+ offsets are written and read (GetPositionOffsets()) under a lock, and the
+ version, published after them, tells the acquisition thread when to read
+ them again without taking the lock on every frame.
+
+ Jerry Volcy
+
+ Copyright (c) 2013, Micron Optics, Inc.
+=========================================================================== */
+
+#ifndef CSM500DISTANCECOMP_H
+#define CSM500DISTANCECOMP_H
+
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+#include <stdint.h>
+#include <pthread.h>
+#include <atomic>
+#include "sm500_data_structures.h"
+
+/* ===========================================================================
+Constants
+=========================================================================== */
+#define SM500_SPEED_OF_LIGHT          299792458.0   //m/s, in vacuum
+
+
+/* ===========================================================================
+Defaults
+=========================================================================== */
+#define SM500_DEFAULT_GROUP_INDEX     1.4682        //SMF-28 at 1550 nm
+#define SM500_DEFAULT_FS_SAMPLE_RATE  20.0e6        //FS samples per second during the sweep
+#define SM500_DEFAULT_SWEEP_DIRECTION 1             //+1: wavelength increases with the sample index
+
+
+/* ===========================================================================
+Csm500DistanceComp class definition
+=========================================================================== */
+class Csm500DistanceComp
+{
+  public:
+    //----------  ----------
+    Csm500DistanceComp();                   //constructor
+    virtual ~Csm500DistanceComp();          //destructor
+    void SetSweepConfig(double SampleRate, int Direction);  //FS sample rate (Hz) and sweep direction (+1/-1)
+    void SetGroupIndex(double GroupIndex);                  //group index of the fibre
+    void SetFibreLength(uint32_t ch, double Meters);        //one-way fibre length to the sensors of a channel
+    double GetFibreLength(uint32_t ch);
+    double MeasureFibreLength(uint32_t ch, double ShiftSamples);  //sets (and returns) the length that explains an observed shift
+    float GetPositionOffset(uint32_t ch);                   //returns the position offset (FS samples) of a channel
+    uint32_t GetPositionOffsets(float *Offsets);            //copies the SM500_NUM_CHANNELS offsets; returns their version
+    uint32_t GetVersion(void);                              //incremented whenever the offsets change
+
+  protected:
+    void UpdateOffsets(void);               //called with the lock held
+
+    double SampleRate;
+    int Direction;
+    double GroupIndex;
+    double FibreLength[SM500_NUM_CHANNELS];
+    float PositionOffset[SM500_NUM_CHANNELS];
+    std::atomic<uint32_t> Version;          //incremented after the offsets are written
+    pthread_mutex_t Lock;                   //settings and offsets
+};
+
+#endif // #ifndef CSM500DISTANCECOMP_H
+
+
+
+/* ===========================================================================
+=========================================================================== */
+//----------  ----------
+//----------  ----------
@@ -0,0 +1,526 @@
+/* ===========================================================================
+ Csm500FsCodec.cpp
+ sm500 full spectrum codec class implementation
+
+ The bit streams are written LSB first in 32-bit words.  A Rice code of
+ parameter k writes the quotient u >> k in unary (that many 0 bits, then
+ a 1) followed by the k low bits of u; a quotient of SM500_FS_CODEC_ESCAPE
+ or more is written as SM500_FS_CODEC_ESCAPE 0 bits followed by u on
+ SM500_FS_CODEC_RAW_BITS bits.  The decoder finds the unary part with a
+ count of trailing zeros.
+
+ The predictors are compiled once per predictor (templates), so the inner
+ loops do not branch on the predictor of the block.
+
+ Jerry Volcy
+
+ Copyright (c) 2013, Micron Optics, Inc.
+=========================================================================== */
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+#include <errno.h>
+#include <string.h>
+#include "Csm500FsCodec.h"
+#include "sm500_common.h"
+
+
+/* ===========================================================================
+Bit stream writer and reader
+=========================================================================== */
+struct fs_bit_writer
+{
+  uint32_t *Out;
+  uint64_t Acc;
+  uint32_t Bits;
+
+  explicit fs_bit_writer(uint32_t *Out) : Out(Out), Acc(0), Bits(0) {}
+
+  void Put(uint32_t Value, uint32_t n)      //n <= 32
+  {
+    Acc |= (uint64_t)Value << Bits;
+    Bits += n;
+    if (Bits >= 32)
+    {
+      *Out++ = (uint32_t)Acc;
+      Acc >>= 32;
+      Bits -= 32;
+    }
+  }
+
+  void PutRice(uint32_t u, uint32_t k)
+  {
+    uint32_t q = u >> k;
+
+    if (q < SM500_FS_CODEC_ESCAPE)
+    {
+      Put(1u << q, q + 1);
+      Put(u & ((1u << k) - 1), k);
+    }
+    else
+    {
+      Put(0, SM500_FS_CODEC_ESCAPE);
+      Put(u, SM500_FS_CODEC_RAW_BITS);
+    }
+  }
+
+  void Flush(void)
+  {
+    if (Bits)
+      *Out++ = (uint32_t)Acc;
+    Acc = 0;
+    Bits = 0;
+  }
+};
+
+struct fs_bit_reader
+{
+  const uint8_t *Start;
+  const uint8_t *Ptr;
+  const uint8_t *End;
+  uint64_t Acc;
+  uint32_t Bits;
+
+  fs_bit_reader(const uint8_t *In, uint32_t Bytes) : Start(In), Ptr(In), End(In + Bytes), Acc(0), Bits(0) {}
+
+  void Refill(void)                         //at least 32 bits available; zeros past the end
+  {
+    if (Bits < 32)
+    {
+      uint32_t w = 0;
+      if (Ptr + 4 <= End)
+        memcpy(&w, Ptr, 4);
+      Ptr += 4;
+      Acc |= (uint64_t)w << Bits;
+      Bits += 32;
+    }
+  }
+
+  uint32_t Get(uint32_t n)                  //n <= Bits
+  {
+    uint32_t v = (uint32_t)(Acc & ((1ULL << n) - 1));
+    Acc >>= n;
+    Bits -= n;
+    return v;
+  }
+
+  uint32_t GetRice(uint32_t k)
+  {
+    Refill();
+    uint32_t q = Acc ? __builtin_ctzll(Acc) : 64;
+
+    if (q >= SM500_FS_CODEC_ESCAPE)
+    {
+      Get(SM500_FS_CODEC_ESCAPE);
+      Refill();
+      return Get(SM500_FS_CODEC_RAW_BITS);
+    }
+    Get(q + 1);
+    Refill();
+    return (q << k) | Get(k);
+  }
+
+  bool Overrun(void)                        //true if more bits were consumed than the stream holds
+  {
+    return (uint64_t)(Ptr - Start) * 8 - Bits > (uint64_t)(End - Start) * 8;
+  }
+};
+
+
+/* ===========================================================================
+Predictors.  x: samples of the channel (decoded ones before i), p: the
+channel in the previous frame.
+=========================================================================== */
+template <int P>
+static inline int32_t PredictSample(const uint16_t *x, const uint16_t *p, uint32_t i)
+{
+  int32_t a = i ? x[i-1] : 0;
+  uint32_t next = i + 1 < SM500_NUM_FS_POINTS ? i + 1 : i;
+  int32_t y;
+
+  if (P == 0)
+    y = a;
+  else if (P == 1)
+    y = 2 * a - (i > 1 ? x[i-2] : a);
+  else if (P == 2)
+    y = i >= 4 ? (x[i-1] + x[i-2] + x[i-3] + x[i-4] + 2) >> 2 : a;
+  else if (P == 3)
+    y = p[i];
+  else if (P == 4)
+    y = a + p[i] - (i ? p[i-1] : 0);
+  else if (P == 5)
+    y = ((i ? p[i-1] : p[i]) + 2 * p[i] + p[next] + 2) >> 2;
+  else
+    y = i >= 4 ? (x[i-1] + x[i-2] + x[i-3] + x[i-4] + p[i-1] + p[i] + p[i] + p[next] + 4) >> 3 : p[i];
+
+  return y < 0 ? 0 : (y > 65535 ? 65535 : y);
+}
+
+//sum of the absolute residuals of a block, from the original samples (predictor choice)
+template <int P>
+static uint64_t BlockCost(const uint16_t *x, const uint16_t *p, uint32_t i0, uint32_t n)
+{
+  uint64_t cost = 0;
+
+  for (uint32_t i=i0; i<i0+n; i++)
+  {
+    int32_t r = (int32_t)x[i] - PredictSample<P>(x, p, i);
+    cost += r < 0 ? -r : r;
+  }
+  return cost;
+}
+
+//quantizes the residuals of a block into zig-zag codes, reconstructing the samples as the decoder will
+template <int P>
+static uint64_t QuantizeBlock(const uint16_t *x, uint16_t *Rec, const uint16_t *p, uint32_t i0, uint32_t n,
+                              int32_t Step, uint32_t *ZigZag)
+{
+  const int32_t half = Step / 2;
+  uint64_t sum = 0;
+
+  for (uint32_t i=i0; i<i0+n; i++)
+  {
+    int32_t pred = PredictSample<P>(Rec, p, i);
+    int32_t r = (int32_t)x[i] - pred;
+    int32_t q = r;
+
+    if (Step > 1)
+    {
+      q = r >= 0 ? (r + half) / Step : -((half - r) / Step);
+      int32_t v = pred + q * Step;
+      Rec[i] = v < 0 ? 0 : (v > 65535 ? 65535 : v);
+    }
+    else
+      Rec[i] = x[i];
+
+    uint32_t u = ((uint32_t)q << 1) ^ (uint32_t)(q >> 31);
+    ZigZag[i - i0] = u;
+    sum += u;
+  }
+  return sum;
+}
+
+template <int P>
+static void DecodeBlock(fs_bit_reader &Reader, uint32_t k, uint16_t *Rec, const uint16_t *p, uint32_t i0, uint32_t n, int32_t Step)
+{
+  for (uint32_t i=i0; i<i0+n; i++)
+  {
+    uint32_t u = Reader.GetRice(k);
+    int32_t q = (int32_t)((u >> 1) ^ (0 - (u & 1)));
+    int32_t v = PredictSample<P>(Rec, p, i) + q * Step;
+    Rec[i] = v < 0 ? 0 : (v > 65535 ? 65535 : v);
+  }
+}
+
+
+//---------- one instance per predictor ----------
+typedef uint64_t (*cost_t)(const uint16_t*, const uint16_t*, uint32_t, uint32_t);
+typedef uint64_t (*quantize_t)(const uint16_t*, uint16_t*, const uint16_t*, uint32_t, uint32_t, int32_t, uint32_t*);
+typedef void (*decode_t)(fs_bit_reader&, uint32_t, uint16_t*, const uint16_t*, uint32_t, uint32_t, int32_t);
+
+static const cost_t CostKernels[SM500_FS_CODEC_NUM_PREDICTORS] =
+  { BlockCost<0>, BlockCost<1>, BlockCost<2>, BlockCost<3>, BlockCost<4>, BlockCost<5>, BlockCost<6> };
+static const quantize_t QuantizeKernels[SM500_FS_CODEC_NUM_PREDICTORS] =
+  { QuantizeBlock<0>, QuantizeBlock<1>, QuantizeBlock<2>, QuantizeBlock<3>, QuantizeBlock<4>, QuantizeBlock<5>, QuantizeBlock<6> };
+static const decode_t DecodeKernels[SM500_FS_CODEC_NUM_PREDICTORS] =
+  { DecodeBlock<0>, DecodeBlock<1>, DecodeBlock<2>, DecodeBlock<3>, DecodeBlock<4>, DecodeBlock<5>, DecodeBlock<6> };
+
+
+/* ===========================================================================
+Csm500FsCodec constructor
+=========================================================================== */
+Csm500FsCodec::Csm500FsCodec()
+{
+  for (int i=0; i<2; i++)
+    Spectrum[i].assign((size_t)SM500_NUM_CHANNELS * SM500_NUM_FS_POINTS, 0);
+  Cur = &Spectrum[0][0];
+  Prev = &Spectrum[1][0];
+
+  for (uint32_t ch=0; ch<SM500_NUM_CHANNELS; ch++)
+  {
+    Stream[ch].resize(SM500_FS_CODEC_MAX_CHANNEL_BYTES / 4);
+    StreamBytes[ch] = 0;
+  }
+
+  Sequence = 0;
+  KeyframeInterval = SM500_DEFAULT_FS_CODEC_KEYFRAME_INTERVAL;
+  MaxError = 0;
+  Pool = 0;
+  Reset();
+}
+
+
+/* ===========================================================================
+destructor
+=========================================================================== */
+Csm500FsCodec::~Csm500FsCodec()
+{
+}
+
+
+/* ===========================================================================
+Sets the keyframe interval of the encoder.  0 codes the first frame (and
+the first after a Reset()) as a keyframe only.
+=========================================================================== */
+void Csm500FsCodec::SetKeyframeInterval(uint32_t Frames)
+{
+  KeyframeInterval = Frames;
+}
+
+
+/* ===========================================================================
+Sets the largest difference (counts) allowed between an original and a
+decoded sample.  0 (the default) is lossless.  Applies from the next
+encoded frame; the decoder reads it from each frame.
+=========================================================================== */
+void Csm500FsCodec::SetMaxError(uint16_t Counts)
+{
+  MaxError = Counts;
+}
+
+
+/* ===========================================================================
+Codes the channels in parallel on Pool.  Pass 0 to code them serially.
+=========================================================================== */
+void Csm500FsCodec::SetWorkerPool(Csm500WorkerPool *Pool)
+{
+  this->Pool = Pool;
+}
+
+
+/* ===========================================================================
+Forgets the previous frame.  The encoder then emits a keyframe; the
+decoder drops other frames until it receives one (e.g. after seeking).
+=========================================================================== */
+void Csm500FsCodec::Reset(void)
+{
+  bSynced = false;
+  SinceKeyframe = 0;
+}
+
+
+/* ===========================================================================
+Returns true if an encoded frame is a keyframe
+=========================================================================== */
+bool Csm500FsCodec::IsKeyframe(const void *In)
+{
+  return (((const sm500_fs_codec_header*)In)->Flags & SM500_FS_CODEC_KEYFRAME) != 0;
+}
+
+
+/* ===========================================================================
+Runs a channel task for every channel, on the pool if one is attached
+=========================================================================== */
+void Csm500FsCodec::Run(Csm500WorkerPool::task_t Task)
+{
+  if (Pool)
+    Pool->Run(SM500_NUM_CHANNELS, Task, this);
+  else
+    for (uint32_t ch=0; ch<SM500_NUM_CHANNELS; ch++)
+      Task(this, ch);
+}
+
+
+/* ===========================================================================
+The current spectrum becomes the previous one
+=========================================================================== */
+void Csm500FsCodec::Swap(void)
+{
+  uint16_t *t = Prev;
+  Prev = Cur;
+  Cur = t;
+}
+
+
+/* ===========================================================================
+Worker pool tasks
+=========================================================================== */
+void Csm500FsCodec::EncodeTask(void *Context, uint32_t ch)
+{
+  ((Csm500FsCodec*)Context)->EncodeChannel(ch);
+}
+
+void Csm500FsCodec::DecodeTask(void *Context, uint32_t ch)
+{
+  ((Csm500FsCodec*)Context)->DecodeChannel(ch);
+}
+
+
+/* ===========================================================================
+Encodes channel ch of the current frame into Stream[ch]
+=========================================================================== */
+void Csm500FsCodec::EncodeChannel(uint32_t ch)
+{
+  const uint16_t *x = TaskSamples + sm500_fs_format::ChannelOffset16(ch);
+  uint16_t *rec = Cur + ch * SM500_NUM_FS_POINTS;
+  const uint16_t *p = Prev + ch * SM500_NUM_FS_POINTS;
+  uint32_t zz[SM500_FS_CODEC_BLOCK];
+  fs_bit_writer writer(&Stream[ch][0]);
+
+  for (uint32_t i0=0; i0<SM500_NUM_FS_POINTS; i0+=SM500_FS_CODEC_BLOCK)
+  {
+    uint32_t n = SM500_NUM_FS_POINTS - i0 < SM500_FS_CODEC_BLOCK ? SM500_NUM_FS_POINTS - i0 : SM500_FS_CODEC_BLOCK;
+    uint32_t num_predictors = TaskKey ? SM500_FS_CODEC_SPATIAL_PREDICTORS : SM500_FS_CODEC_NUM_PREDICTORS;
+    uint32_t pred = 0, k = 0;
+    uint64_t best = ~0ULL;
+
+    //---------- best predictor ----------
+    for (uint32_t i=0; i<num_predictors; i++)
+    {
+      uint64_t cost = CostKernels[i](x, p, i0, n);
+      if (cost < best)
+      {
+        best = cost;
+        pred = i;
+      }
+    }
+    uint64_t sum = QuantizeKernels[pred](x, rec, p, i0, n, TaskStep, zz);
+
+    //---------- Rice parameter: smallest k with n 2^k >= sum ----------
+    while ((k < 16) && (((uint64_t)n << k) < sum))
+      k++;
+
+    writer.Put(pred | (k << 3), SM500_FS_CODEC_BLOCK_BITS);
+    for (uint32_t i=0; i<n; i++)
+      writer.PutRice(zz[i], k);
+  }
+
+  writer.Flush();
+  StreamBytes[ch] = (uint32_t)((writer.Out - &Stream[ch][0]) * sizeof(uint32_t));
+}
+
+
+/* ===========================================================================
+Decodes channel ch of the current frame into Cur and the output frame.
+Flags a malformed stream in TaskError[ch].
+=========================================================================== */
+void Csm500FsCodec::DecodeChannel(uint32_t ch)
+{
+  uint16_t *rec = Cur + ch * SM500_NUM_FS_POINTS;
+  const uint16_t *p = Prev + ch * SM500_NUM_FS_POINTS;
+  fs_bit_reader reader(TaskStreams[ch], TaskStreamBytes[ch]);
+
+  TaskError[ch] = false;
+  for (uint32_t i0=0; i0<SM500_NUM_FS_POINTS; i0+=SM500_FS_CODEC_BLOCK)
+  {
+    uint32_t n = SM500_NUM_FS_POINTS - i0 < SM500_FS_CODEC_BLOCK ? SM500_NUM_FS_POINTS - i0 : SM500_FS_CODEC_BLOCK;
+
+    reader.Refill();
+    uint32_t h = reader.Get(SM500_FS_CODEC_BLOCK_BITS);
+    uint32_t pred = h & 7, k = h >> 3;
+    if ((k > 16) || (pred >= (TaskKey ? SM500_FS_CODEC_SPATIAL_PREDICTORS : SM500_FS_CODEC_NUM_PREDICTORS)))
+    {
+      TaskError[ch] = true;
+      return;
+    }
+    DecodeKernels[pred](reader, k, rec, p, i0, n, TaskStep);
+  }
+
+  if (reader.Overrun())
+  {
+    TaskError[ch] = true;
+    return;
+  }
+  memcpy(TaskOut + sm500_fs_format::ChannelOffset16(ch), rec, SM500_NUM_FS_POINTS * sizeof(uint16_t));
+}
+
+
+/* ===========================================================================
+Encodes an FS buffer into Out (SM500_FS_CODEC_MAX_BYTES, 4-byte aligned).
+Returns the size of the encoded frame.
+=========================================================================== */
+uint32_t Csm500FsCodec::Encode(const void *FsData, void *Out)
+{
+  sm500_fs_codec_header *header = (sm500_fs_codec_header*)Out;
+  uint8_t *out = (uint8_t*)(header + 1);
+  bool key = !bSynced || (KeyframeInterval && (SinceKeyframe >= KeyframeInterval));
+
+  TaskSamples = (const uint16_t*)FsData;
+  TaskKey = key;
+  TaskStep = 2 * MaxError + 1;
+  Run(EncodeTask);
+
+  memcpy(out, FsData, SM500_FS_CODEC_HEADER_BYTES);
+  out += SM500_FS_CODEC_HEADER_BYTES;
+  for (uint32_t ch=0; ch<SM500_NUM_CHANNELS; ch++)
+  {
+    memcpy(out, &Stream[ch][0], StreamBytes[ch]);
+    out += StreamBytes[ch];
+    header->ChannelBytes[ch] = StreamBytes[ch];
+  }
+
+  header->Bytes = (uint32_t)(out - (uint8_t*)Out);
+  header->Magic = SM500_FS_CODEC_MAGIC;
+  header->Flags = key ? SM500_FS_CODEC_KEYFRAME : 0;
+  header->Sequence = Sequence++;
+  header->MaxError = MaxError;
+  header->Reserved = 0;
+
+  Swap();
+  SinceKeyframe = key ? 1 : SinceKeyframe + 1;
+  bSynced = true;
+  return header->Bytes;
+}
+
+
+/* ===========================================================================
+Decodes an encoded frame of Bytes bytes into FsData
+(sm500_fs_format::FrameBytes).  Returns false, leaving FsData alone, for a
+frame whose previous frame was not decoded: before the first keyframe,
+after Reset() or after a gap in the sequence.  Throws EPROTO for a
+malformed frame.
+=========================================================================== */
+bool Csm500FsCodec::Decode(const void *In, uint32_t Bytes, void *FsData)
+{
+  const sm500_fs_codec_header *header = (const sm500_fs_codec_header*)In;
+  const uint8_t *in = (const uint8_t*)(header + 1);
+  uint64_t expected = sizeof(sm500_fs_codec_header) + SM500_FS_CODEC_HEADER_BYTES;
+
+  if ((Bytes < expected) || (header->Magic != SM500_FS_CODEC_MAGIC) || (header->Bytes != Bytes))
+    throw EPROTO;
+  for (uint32_t ch=0; ch<SM500_NUM_CHANNELS; ch++)
+    expected += header->ChannelBytes[ch];
+  if (expected != Bytes)
+    throw EPROTO;
+
+  bool key = (header->Flags & SM500_FS_CODEC_KEYFRAME) != 0;
+  if (!key && !(bSynced && (header->Sequence == Sequence + 1)))
+  {
+    bSynced = false;
+    return false;
+  }
+
+  const uint8_t *stream = in + SM500_FS_CODEC_HEADER_BYTES;
+  for (uint32_t ch=0; ch<SM500_NUM_CHANNELS; ch++)
+  {
+    TaskStreams[ch] = stream;
+    TaskStreamBytes[ch] = header->ChannelBytes[ch];
+    stream += header->ChannelBytes[ch];
+  }
+  TaskOut = (uint16_t*)FsData;
+  TaskKey = key;
+  TaskStep = 2 * header->MaxError + 1;
+  Run(DecodeTask);
+
+  for (uint32_t ch=0; ch<SM500_NUM_CHANNELS; ch++)
+    if (TaskError[ch])
+    {
+      bSynced = false;
+      throw EPROTO;
+    }
+
+  memcpy(FsData, in, SM500_FS_CODEC_HEADER_BYTES);
+  Swap();
+  Sequence = header->Sequence;
+  bSynced = true;
+  return true;
+}
+
+
+
+/* ===========================================================================
+=========================================================================== */
+//----------  ----------
+//----------  ----------
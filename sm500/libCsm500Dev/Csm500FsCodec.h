@@ -0,0 +1,155 @@
+/* ===========================================================================
+ Csm500FsCodec.h
+ sm500 full spectrum codec class definition
+
+ Compression of FS DMA buffers, lossless or near-lossless.  Each channel
+ is coded in blocks of SM500_FS_CODEC_BLOCK samples; every block picks the
+ predictor that fits it best:
+
+   0  previous sample                     x[i-1]
+   1  linear along the wavelength axis    2 x[i-1] - x[i-2]
+   2  smoothed, along the axis            mean of x[i-4..i-1]
+   3  previous spectrum                   p[i]
+   4  previous spectrum, slope-corrected  x[i-1] + p[i] - p[i-1]
+   5  smoothed previous spectrum          (p[i-1] + 2 p[i] + p[i+1]) / 4
+   6  smoothed, both                      (x[i-4..i-1] + p[i-1] + 2 p[i] + p[i+1]) / 8
+
+ The smoothed predictors suit the noise floor (less noise in the
+ prediction), the others the peaks and the slopes.
+
+ The residuals are zig-zag coded and Rice coded with a parameter chosen per
+ block (a residual too large for its block is escaped and stored raw).
+
+ In near-lossless mode (SetMaxError()) the residuals are quantized to
+ steps of 2 MaxError + 1 counts, so that every decoded sample is within
+ MaxError of the original; set MaxError at or below the noise floor.  The
+ predictions are always made from the decoded samples, so the error does
+ not accumulate.
+
+ Keyframes do not use the previous spectrum (predictors 0 to 2 only) and
+ are emitted every KeyframeInterval frames; the decoder refuses other
+ frames until it has seen a keyframe, and again after a gap in the
+ sequence numbers.  The channels are independent bit streams: with a
+ worker pool attached, they are encoded and decoded in parallel.
+
+ Encoded frame:
+
+   sm500_fs_codec_header
+   DMA header                             copied as is
+   channel 0 .. N-1 bit streams           ChannelBytes[] bytes each
+
+ An instance encodes or decodes a single stream.
+
+ Jerry Volcy
+
+ Copyright (c) 2013, Micron Optics, Inc.
+=========================================================================== */
+
+#ifndef CSM500FSCODEC_H
+#define CSM500FSCODEC_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+#include <stdint.h>
+#include "sm500_data_structures.h"
+#include "Csm500WorkerPool.h"
+
+/* ===========================================================================
+Constants
+=========================================================================== */
+#define SM500_FS_CODEC_MAGIC          0x4346      //"FC"
+#define SM500_FS_CODEC_KEYFRAME       0x0001      //flag: no prediction from the previous spectrum
+#define SM500_FS_CODEC_BLOCK          256         //samples per predictor/Rice parameter choice
+#define SM500_FS_CODEC_NUM_BLOCKS     ((SM500_NUM_FS_POINTS + SM500_FS_CODEC_BLOCK - 1) / SM500_FS_CODEC_BLOCK)
+#define SM500_FS_CODEC_NUM_PREDICTORS 7
+#define SM500_FS_CODEC_SPATIAL_PREDICTORS 3       //predictors 0..2 do not use the previous spectrum
+#define SM500_FS_CODEC_BLOCK_BITS     8           //block header: predictor (3 bits), Rice parameter (5 bits)
+#define SM500_FS_CODEC_ESCAPE         24          //quotient that escapes a residual
+#define SM500_FS_CODEC_RAW_BITS       17          //escaped residual (zig-zag coded, up to 2 x 65535)
+#define SM500_FS_CODEC_HEADER_BYTES   (sm500_fs_format::DataOffset16 * 2)   //DMA header
+#define SM500_FS_CODEC_MAX_CHANNEL_BYTES  \
+  (((SM500_NUM_FS_POINTS * (SM500_FS_CODEC_ESCAPE + SM500_FS_CODEC_RAW_BITS) + SM500_FS_CODEC_NUM_BLOCKS * SM500_FS_CODEC_BLOCK_BITS) / 32 + 1) * 4)
+#define SM500_FS_CODEC_MAX_BYTES      \
+  (sizeof(sm500_fs_codec_header) + SM500_FS_CODEC_HEADER_BYTES + SM500_NUM_CHANNELS * SM500_FS_CODEC_MAX_CHANNEL_BYTES)
+
+
+/* ===========================================================================
+Defaults
+=========================================================================== */
+#define SM500_DEFAULT_FS_CODEC_KEYFRAME_INTERVAL   20      //frames (1 s at 20 Hz)
+
+
+/* ===========================================================================
+Encoded frame header
+=========================================================================== */
+struct sm500_fs_codec_header
+{
+  uint32_t Bytes;                 //encoded frame size, this header included
+  uint16_t Magic;                 //SM500_FS_CODEC_MAGIC
+  uint16_t Flags;                 //SM500_FS_CODEC_KEYFRAME
+  uint32_t Sequence;              //frame counter of the encoder
+  uint16_t MaxError;              //0 = lossless
+  uint16_t Reserved;
+  uint32_t ChannelBytes[SM500_NUM_CHANNELS];  //size of each channel's bit stream (multiple of 4)
+};
+
+
+/* ===========================================================================
+Csm500FsCodec class definition
+=========================================================================== */
+class Csm500FsCodec
+{
+  public:
+    //----------  ----------
+    Csm500FsCodec();                        //constructor
+    virtual ~Csm500FsCodec();               //destructor
+    void SetKeyframeInterval(uint32_t Frames);  //a keyframe every Frames frames (0 = first frame only)
+    void SetMaxError(uint16_t Counts);      //near-lossless error bound (0 = lossless)
+    void SetWorkerPool(Csm500WorkerPool *Pool);  //codes the channels in parallel on Pool (0 = serially)
+    void Reset(void);                       //forgets the previous frame: the next frame is (or must be) a keyframe
+    uint32_t Encode(const void *FsData, void *Out);  //encodes an FS buffer; Out holds SM500_FS_CODEC_MAX_BYTES; returns the size
+    bool Decode(const void *In, uint32_t Bytes, void *FsData);  //decodes a frame; false until a keyframe arrives
+    static bool IsKeyframe(const void *In);
+
+  protected:
+    static void EncodeTask(void *Context, uint32_t ch);
+    static void DecodeTask(void *Context, uint32_t ch);
+    void EncodeChannel(uint32_t ch);
+    void DecodeChannel(uint32_t ch);
+    void Run(Csm500WorkerPool::task_t Task);
+    void Swap(void);                        //the current spectrum becomes the previous one
+
+    vector<uint16_t> Spectrum[2];           //decoded samples of the current and previous frames
+    uint16_t *Cur;
+    uint16_t *Prev;
+    vector<uint32_t> Stream[SM500_NUM_CHANNELS];  //encoder: the channels' bit streams
+    uint32_t StreamBytes[SM500_NUM_CHANNELS];
+    bool bSynced;                           //previous frame valid
+    uint32_t Sequence;                      //of the next frame (encoder) or of the last frame (decoder)
+    uint32_t KeyframeInterval;
+    uint32_t SinceKeyframe;                 //frames encoded since the last keyframe
+    uint16_t MaxError;
+    Csm500WorkerPool *Pool;
+
+    //---------- frame being coded (channel tasks) ----------
+    const uint16_t *TaskSamples;            //FS samples of the frame being encoded
+    const uint8_t *TaskStreams[SM500_NUM_CHANNELS];  //decoder: the channels' bit streams
+    uint32_t TaskStreamBytes[SM500_NUM_CHANNELS];
+    uint16_t *TaskOut;                      //decoder: FS samples of the output frame
+    bool TaskKey;
+    uint32_t TaskStep;                      //quantization step (2 MaxError + 1)
+    bool TaskError[SM500_NUM_CHANNELS];     //decoder: malformed channel stream
+};
+
+#endif // #ifndef CSM500FSCODEC_H
+
+
+
+/* ===========================================================================
+=========================================================================== */
+//----------  ----------
+//----------  ----------
@@ -0,0 +1,333 @@
+/* ===========================================================================
+ Csm500FsConditioner.cpp
+ sm500 full spectrum conditioning class implementation
+
+ Jerry Volcy
+
+ Copyright (c) 2013, Micron Optics, Inc.
+=========================================================================== */
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+#include <errno.h>
+#include <string.h>
+#include "Csm500FsConditioner.h"
+#include "sm500_common.h"
+
+
+/* ===========================================================================
+Scalar kernels
+=========================================================================== */
+static void PolyScalar(const uint16_t *In, uint32_t n, const Csm500FsConditioner::channel_config &Config, float *Out)
+{
+  const float *c = Config.Coef;
+  const float *baseline = Config.Baseline;
+  const float gain = Config.Gain;
+
+  for (uint32_t i=0; i<n; i++)
+  {
+    float x = (float)In[i];
+    float y = ((c[3] * x + c[2]) * x + c[1]) * x + c[0];
+    Out[i] = (y - baseline[i]) * gain;
+  }
+}
+
+static void LutScalar(const uint16_t *In, uint32_t n, const Csm500FsConditioner::channel_config &Config, float *Out)
+{
+  const float *lut = Config.Lut;
+  const float *baseline = Config.Baseline;
+  const float gain = Config.Gain;
+
+  for (uint32_t i=0; i<n; i++)
+    Out[i] = (lut[In[i]] - baseline[i]) * gain;
+}
+
+
+#ifdef SM500_HAVE_X86_SIMD
+/* ===========================================================================
+SSE2 polynomial kernel (8 samples per iteration)
+=========================================================================== */
+SM500_TARGET_SSE2
+static inline __m128 PolySse2Step(__m128 x, const __m128 *c)
+{
+  __m128 y = _mm_add_ps(_mm_mul_ps(c[3], x), c[2]);
+  y = _mm_add_ps(_mm_mul_ps(y, x), c[1]);
+  return _mm_add_ps(_mm_mul_ps(y, x), c[0]);
+}
+
+SM500_TARGET_SSE2
+static void PolySse2(const uint16_t *In, uint32_t n, const Csm500FsConditioner::channel_config &Config, float *Out)
+{
+  const __m128 c[4] = { _mm_set1_ps(Config.Coef[0]), _mm_set1_ps(Config.Coef[1]),
+                        _mm_set1_ps(Config.Coef[2]), _mm_set1_ps(Config.Coef[3]) };
+  const __m128 gain = _mm_set1_ps(Config.Gain);
+  const __m128i zero = _mm_setzero_si128();
+  const float *baseline = Config.Baseline;
+  uint32_t i = 0;
+
+  for (; i+8<=n; i+=8)
+  {
+    __m128i raw = _mm_loadu_si128((const __m128i*)(In + i));
+    __m128 lo = _mm_cvtepi32_ps(_mm_unpacklo_epi16(raw, zero));
+    __m128 hi = _mm_cvtepi32_ps(_mm_unpackhi_epi16(raw, zero));
+
+    _mm_storeu_ps(Out + i, _mm_mul_ps(_mm_sub_ps(PolySse2Step(lo, c), _mm_loadu_ps(baseline + i)), gain));
+    _mm_storeu_ps(Out + i + 4, _mm_mul_ps(_mm_sub_ps(PolySse2Step(hi, c), _mm_loadu_ps(baseline + i + 4)), gain));
+  }
+
+  Csm500FsConditioner::channel_config tail = Config;
+  tail.Baseline += i;
+  PolyScalar(In + i, n - i, tail, Out + i);
+}
+
+
+/* ===========================================================================
+AVX2 kernels (16 samples per iteration)
+=========================================================================== */
+SM500_TARGET_AVX2
+static inline __m256 PolyAvx2Step(__m256 x, const __m256 *c)
+{
+  __m256 y = _mm256_add_ps(_mm256_mul_ps(c[3], x), c[2]);
+  y = _mm256_add_ps(_mm256_mul_ps(y, x), c[1]);
+  return _mm256_add_ps(_mm256_mul_ps(y, x), c[0]);
+}
+
+SM500_TARGET_AVX2
+static void PolyAvx2(const uint16_t *In, uint32_t n, const Csm500FsConditioner::channel_config &Config, float *Out)
+{
+  const __m256 c[4] = { _mm256_set1_ps(Config.Coef[0]), _mm256_set1_ps(Config.Coef[1]),
+                        _mm256_set1_ps(Config.Coef[2]), _mm256_set1_ps(Config.Coef[3]) };
+  const __m256 gain = _mm256_set1_ps(Config.Gain);
+  const float *baseline = Config.Baseline;
+  uint32_t i = 0;
+
+  for (; i+16<=n; i+=16)
+  {
+    __m256 lo = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(In + i))));
+    __m256 hi = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(In + i + 8))));
+
+    _mm256_storeu_ps(Out + i, _mm256_mul_ps(_mm256_sub_ps(PolyAvx2Step(lo, c), _mm256_loadu_ps(baseline + i)), gain));
+    _mm256_storeu_ps(Out + i + 8, _mm256_mul_ps(_mm256_sub_ps(PolyAvx2Step(hi, c), _mm256_loadu_ps(baseline + i + 8)), gain));
+  }
+
+  _mm256_zeroupper();    //avoid the AVX to SSE transition penalty in the tail
+  Csm500FsConditioner::channel_config tail = Config;
+  tail.Baseline += i;
+  PolyScalar(In + i, n - i, tail, Out + i);
+}
+
+SM500_TARGET_AVX2
+static void LutAvx2(const uint16_t *In, uint32_t n, const Csm500FsConditioner::channel_config &Config, float *Out)
+{
+  const __m256 gain = _mm256_set1_ps(Config.Gain);
+  const float *lut = Config.Lut;
+  const float *baseline = Config.Baseline;
+  uint32_t i = 0;
+
+  for (; i+8<=n; i+=8)
+  {
+    __m256i idx = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(In + i)));
+    __m256 y = _mm256_i32gather_ps(lut, idx, sizeof(float));
+    _mm256_storeu_ps(Out + i, _mm256_mul_ps(_mm256_sub_ps(y, _mm256_loadu_ps(baseline + i)), gain));
+  }
+
+  _mm256_zeroupper();    //avoid the AVX to SSE transition penalty in the tail
+  Csm500FsConditioner::channel_config tail = Config;
+  tail.Baseline += i;
+  LutScalar(In + i, n - i, tail, Out + i);
+}
+#endif
+
+
+/* ===========================================================================
+Csm500FsConditioner constructor
+=========================================================================== */
+Csm500FsConditioner::Csm500FsConditioner()
+{
+  double nominal[4] = { SM500_DEFAULT_FS_DBM_OFFSET, SM500_DEFAULT_FS_DBM_SCALE, 0.0, 0.0 };
+
+  for (uint32_t ch=0; ch<SM500_NUM_CHANNELS; ch++)
+  {
+    Config[ch].Lut = 0;
+    Config[ch].Baseline = new float[SM500_NUM_FS_POINTS];
+    SetPolynomial(ch, nominal);
+    SetBaseline(ch, 0);
+    SetGain(ch, 1.0f);
+  }
+
+  Pool = 0;
+  TaskFrame = 0;
+  TaskSpectrum = 0;
+  SetSimdLevel(sm500_detect_simd());
+}
+
+
+/* ===========================================================================
+destructor
+=========================================================================== */
+Csm500FsConditioner::~Csm500FsConditioner()
+{
+  for (uint32_t ch=0; ch<SM500_NUM_CHANNELS; ch++)
+  {
+    delete [] Config[ch].Lut;
+    delete [] Config[ch].Baseline;
+  }
+}
+
+
+/* ===========================================================================
+Selects polynomial conversion for a channel.  Coef holds 4 coefficients,
+constant term first.
+=========================================================================== */
+void Csm500FsConditioner::SetPolynomial(uint32_t ch, const double *Coef)
+{
+  if (ch >= SM500_NUM_CHANNELS)
+    throw EINVAL;
+
+  for (int i=0; i<4; i++)
+    Config[ch].Coef[i] = (float)Coef[i];
+  Config[ch].Mode = SM500_FS_POLYNOMIAL;
+}
+
+
+/* ===========================================================================
+Selects LUT conversion for a channel.  Lut holds SM500_FS_LUT_SIZE entries
+and is copied.
+=========================================================================== */
+void Csm500FsConditioner::SetLut(uint32_t ch, const float *Lut)
+{
+  if ((ch >= SM500_NUM_CHANNELS) || (Lut == 0))
+    throw EINVAL;
+
+  if (Config[ch].Lut == 0)
+    Config[ch].Lut = new float[SM500_FS_LUT_SIZE];
+
+  memcpy(Config[ch].Lut, Lut, SM500_FS_LUT_SIZE * sizeof(float));
+  Config[ch].Mode = SM500_FS_LUT;
+}
+
+
+/* ===========================================================================
+Sets the baseline subtracted from a channel (SM500_NUM_FS_POINTS entries,
+copied).  Passing 0 clears the baseline.
+=========================================================================== */
+void Csm500FsConditioner::SetBaseline(uint32_t ch, const float *Baseline)
+{
+  if (ch >= SM500_NUM_CHANNELS)
+    throw EINVAL;
+
+  if (Baseline)
+    memcpy(Config[ch].Baseline, Baseline, SM500_NUM_FS_POINTS * sizeof(float));
+  else
+    memset(Config[ch].Baseline, 0, SM500_NUM_FS_POINTS * sizeof(float));
+}
+
+
+/* ===========================================================================
+Sets the gain applied to a channel after baseline subtraction
+=========================================================================== */
+void Csm500FsConditioner::SetGain(uint32_t ch, float Gain)
+{
+  if (ch >= SM500_NUM_CHANNELS)
+    throw EINVAL;
+
+  Config[ch].Gain = Gain;
+}
+
+
+/* ===========================================================================
+Forces a kernel flavor.  Requests beyond what the CPU supports are clamped
+to the best supported flavor.
+=========================================================================== */
+void Csm500FsConditioner::SetSimdLevel(sm500_simd_level level)
+{
+  sm500_simd_level supported = sm500_detect_simd();
+
+  if (level > supported)
+    level = supported;
+
+  SimdLevel = level;
+  switch (level)
+  {
+#ifdef SM500_HAVE_X86_SIMD
+    case SM500_SIMD_AVX2: PolyKernel = PolyAvx2; LutKernel = LutAvx2; break;
+    case SM500_SIMD_SSE2: PolyKernel = PolySse2; LutKernel = LutScalar; break;    //no SSE2 gather
+#endif
+    default:              PolyKernel = PolyScalar; LutKernel = LutScalar; break;
+  }
+}
+
+
+/* ===========================================================================
+Returns the kernel flavor in use
+=========================================================================== */
+sm500_simd_level Csm500FsConditioner::GetSimdLevel(void)
+{
+  return SimdLevel;
+}
+
+
+/* ===========================================================================
+Processes the channels in parallel on Pool.  Pass 0 to process them
+serially on the calling thread.
+=========================================================================== */
+void Csm500FsConditioner::SetWorkerPool(Csm500WorkerPool *Pool)
+{
+  this->Pool = Pool;
+}
+
+
+/* ===========================================================================
+Conditions one channel of an FS frame into Out (SM500_NUM_FS_POINTS floats)
+=========================================================================== */
+void Csm500FsConditioner::ConditionChannel(const Csm500FsFrame &Frame, uint32_t ch, float *Out)
+{
+  const channel_config &config = Config[ch];
+
+  if (config.Mode == SM500_FS_LUT)
+    LutKernel(Frame.begin(ch), Frame.NumPoints(), config, Out);
+  else
+    PolyKernel(Frame.begin(ch), Frame.NumPoints(), config, Out);
+}
+
+
+/* ===========================================================================
+Worker pool task: conditions channel ch of the current frame
+=========================================================================== */
+void Csm500FsConditioner::ChannelTask(void *Context, uint32_t ch)
+{
+  Csm500FsConditioner *self = (Csm500FsConditioner*)Context;
+  self->ConditionChannel(*self->TaskFrame, ch, self->TaskSpectrum->Data[ch]);
+}
+
+
+/* ===========================================================================
+Conditions every channel of an FS frame into Spectrum
+=========================================================================== */
+void Csm500FsConditioner::Condition(const Csm500FsFrame &Frame, sm500_fs_spectrum &Spectrum)
+{
+  Spectrum.SerialNumber = Frame.SerialNumber();
+  Spectrum.TimestampSec = Frame.TimestampSec();
+  Spectrum.TimestampNsec = Frame.TimestampNsec();
+
+  if (Pool)
+  {
+    TaskFrame = &Frame;
+    TaskSpectrum = &Spectrum;
+    Pool->Run(SM500_NUM_CHANNELS, ChannelTask, this);
+  }
+  else
+  {
+    for (uint32_t ch=0; ch<SM500_NUM_CHANNELS; ch++)
+      ConditionChannel(Frame, ch, Spectrum.Data[ch]);
+  }
+}
+
+
+
+/* ===========================================================================
+=========================================================================== */
+//----------  ----------
+//----------  ----------
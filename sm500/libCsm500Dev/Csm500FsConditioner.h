@@ -0,0 +1,122 @@
+/* ===========================================================================
+ Csm500FsConditioner.h
+ sm500 full spectrum conditioning class definition
+
+ The FS conditioner converts the raw 16-bit samples of an FS buffer into
+ float spectra.  For every sample of a channel it performs, in a single
+ streaming pass:
+
+   out[i] = (Convert(raw[i]) - Baseline[i]) * Gain
+
+ where Convert() is either a 3rd order polynomial in the raw value or a
+ 65536 entry lookup table (both normally yield dBm), Baseline[] is a
+ per-point dark/baseline spectrum and Gain is a per-channel factor.  The
+ channels are independent and are processed in parallel when a worker
+ pool is attached.
+
+ Jerry Volcy
+
+ Copyright (c) 2013, Micron Optics, Inc.
+=========================================================================== */
+
+#ifndef CSM500FSCONDITIONER_H
+#define CSM500FSCONDITIONER_H
+
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+#include <stdint.h>
+#include "sm500_data_structures.h"
+#include "sm500_simd.h"
+#include "Csm500WorkerPool.h"
+
+/* ===========================================================================
+Constants
+=========================================================================== */
+#define SM500_FS_LUT_SIZE       65536   //one entry per raw sample value
+
+
+/* ===========================================================================
+Defaults
+=========================================================================== */
+#define SM500_DEFAULT_FS_DBM_OFFSET   -80.0             //dBm at raw = 0
+#define SM500_DEFAULT_FS_DBM_SCALE    (80.0 / 65535.0)  //dB per raw count
+
+
+/* ===========================================================================
+Raw sample conversion modes
+=========================================================================== */
+enum sm500_fs_conversion
+{
+  SM500_FS_POLYNOMIAL = 0,    //Coef[0] + Coef[1]*raw + Coef[2]*raw^2 + Coef[3]*raw^3
+  SM500_FS_LUT                //Lut[raw]
+};
+
+
+/* ===========================================================================
+A conditioned FS frame
+=========================================================================== */
+struct sm500_fs_spectrum
+{
+  uint64_t SerialNumber;      //data set S/N
+  uint32_t TimestampSec;      //driver timestamp
+  uint32_t TimestampNsec;
+  float Data[SM500_NUM_CHANNELS][SM500_NUM_FS_POINTS] SM500_ALIGN(SM500_SIMD_ALIGN);
+};
+
+
+/* ===========================================================================
+Csm500FsConditioner class definition
+=========================================================================== */
+class Csm500FsConditioner
+{
+  public:
+    //----------  ----------
+    Csm500FsConditioner();                  //constructor
+    virtual ~Csm500FsConditioner();         //destructor
+    void SetPolynomial(uint32_t ch, const double *Coef);  //selects polynomial conversion (4 coefficients, c0 first)
+    void SetLut(uint32_t ch, const float *Lut);           //selects LUT conversion (SM500_FS_LUT_SIZE entries, copied)
+    void SetBaseline(uint32_t ch, const float *Baseline); //sets the SM500_NUM_FS_POINTS baseline (0 clears it)
+    void SetGain(uint32_t ch, float Gain);                //sets the per-channel gain
+    void SetSimdLevel(sm500_simd_level level);            //forces a kernel flavor (clamped to what the CPU supports)
+    sm500_simd_level GetSimdLevel(void);                  //returns the kernel flavor in use
+    void SetWorkerPool(Csm500WorkerPool *Pool);           //processes the channels in parallel on Pool (0 = serially)
+    void Condition(const Csm500FsFrame &Frame, sm500_fs_spectrum &Spectrum);          //conditions all channels
+    void ConditionChannel(const Csm500FsFrame &Frame, uint32_t ch, float *Out);       //conditions one channel
+
+    //per-channel conversion settings, as seen by the kernels
+    struct channel_config
+    {
+      sm500_fs_conversion Mode;
+      float Coef[4];
+      float *Lut;             //SM500_FS_LUT_SIZE entries, allocated on the first SetLut()
+      float *Baseline;        //SM500_NUM_FS_POINTS entries
+      float Gain;
+    };
+
+    typedef void (*kernel_t)(const uint16_t *In, uint32_t n, const channel_config &Config, float *Out);
+
+  protected:
+    static void ChannelTask(void *Context, uint32_t ch);
+
+    channel_config Config[SM500_NUM_CHANNELS];
+    sm500_simd_level SimdLevel;
+    kernel_t PolyKernel;
+    kernel_t LutKernel;
+    Csm500WorkerPool *Pool;
+
+    //the frame being conditioned by Condition(), for the worker tasks
+    const Csm500FsFrame *TaskFrame;
+    sm500_fs_spectrum *TaskSpectrum;
+};
+
+#endif // #ifndef CSM500FSCONDITIONER_H
+
+
+
+/* ===========================================================================
+=========================================================================== */
+//----------  ----------
+//----------  ----------
@@ -0,0 +1,477 @@
+/* ===========================================================================
+ Csm500Histogram.cpp
+ sm500 histogram accumulator class implementation
+
+ Jerry Volcy
+
+ Copyright (c) 2013, Micron Optics, Inc.
+=========================================================================== */
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+#include <errno.h>
+#include <string.h>
+#include <math.h>
+#include "Csm500Histogram.h"
+#include "sm500_common.h"
+
+
+/* ===========================================================================
+Scalar kernel
+=========================================================================== */
+static void BinScalar(const float *In, const float *Origin, uint32_t n, const Csm500Histogram::bin_config &Config, uint32_t *Bin)
+{
+  if (Config.Bins == SM500_HIST_FIXED)
+  {
+    const float top = (float)Config.NumBins;
+
+    //clamped to [-1, NumBins] first, so that truncating t + 1 floors it
+    for (uint32_t i=0; i<n; i++)
+    {
+      float t = (In[i] - Origin[i]) * Config.InvWidth;
+
+      if (!(t >= -1.0f)) t = -1.0f;     //underflow, or NaN
+      if (t > top) t = top;             //overflow
+      Bin[i] = (uint32_t)(int32_t)(t + 1.0f);
+    }
+  }
+  else
+  {
+    for (uint32_t i=0; i<n; i++)
+    {
+      int32_t bits;
+      memcpy(&bits, In + i, sizeof(bits));
+      int32_t key = (bits >> Config.KeyShift) - Config.KeyBase;
+      uint32_t b;
+
+      if (key < 0)
+        b = 0;                          //below Min, negative or zero
+      else if ((uint32_t)key >= Config.TableSize)
+        b = Config.NumBins + 1;         //above Max, or NaN
+      else
+      {
+        b = Config.Table[key];
+        b += (In[i] >= Config.EdgeAbove[b]);
+      }
+      Bin[i] = b;
+    }
+  }
+}
+
+
+#ifdef SM500_HAVE_X86_SIMD
+/* ===========================================================================
+AVX2 kernel (8 values per iteration)
+=========================================================================== */
+SM500_TARGET_AVX2
+static void BinAvx2(const float *In, const float *Origin, uint32_t n, const Csm500Histogram::bin_config &Config, uint32_t *Bin)
+{
+  uint32_t i = 0;
+
+  if (Config.Bins == SM500_HIST_FIXED)
+  {
+    const __m256 inv = _mm256_set1_ps(Config.InvWidth);
+    const __m256 lo = _mm256_set1_ps(-1.0f);
+    const __m256 hi = _mm256_set1_ps((float)Config.NumBins);
+    const __m256 one = _mm256_set1_ps(1.0f);
+
+    for (; i+8<=n; i+=8)
+    {
+      __m256 t = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(In + i), _mm256_loadu_ps(Origin + i)), inv);
+      t = _mm256_min_ps(_mm256_max_ps(t, lo), hi);    //max() returns lo for NaN
+      _mm256_storeu_si256((__m256i*)(Bin + i), _mm256_cvttps_epi32(_mm256_add_ps(t, one)));
+    }
+  }
+  else
+  {
+    const __m128i shift = _mm_cvtsi32_si128(Config.KeyShift);
+    const __m256i base = _mm256_set1_epi32(Config.KeyBase);
+    const __m256i last = _mm256_set1_epi32(Config.TableSize - 1);
+    const __m256i overflow = _mm256_set1_epi32(Config.NumBins + 1);
+    const __m256i zero = _mm256_setzero_si256();
+
+    for (; i+8<=n; i+=8)
+    {
+      __m256 x = _mm256_loadu_ps(In + i);
+      __m256i key = _mm256_sub_epi32(_mm256_sra_epi32(_mm256_castps_si256(x), shift), base);
+      __m256i under = _mm256_cmpgt_epi32(zero, key);
+      __m256i over = _mm256_cmpgt_epi32(key, last);
+
+      key = _mm256_min_epi32(_mm256_max_epi32(key, zero), last);
+      __m256i b = _mm256_i32gather_epi32((const int*)Config.Table, key, 4);
+      __m256 edge = _mm256_i32gather_ps(Config.EdgeAbove, b, 4);
+      b = _mm256_sub_epi32(b, _mm256_castps_si256(_mm256_cmp_ps(x, edge, _CMP_GE_OQ)));
+      b = _mm256_andnot_si256(under, b);
+      b = _mm256_blendv_epi8(b, overflow, over);
+      _mm256_storeu_si256((__m256i*)(Bin + i), b);
+    }
+  }
+
+  _mm256_zeroupper();    //avoid the AVX to SSE transition penalty in the tail
+  BinScalar(In + i, Origin + i, n - i, Config, Bin + i);
+}
+#endif
+
+
+/* ===========================================================================
+Csm500Histogram constructor
+=========================================================================== */
+Csm500Histogram::Csm500Histogram()
+{
+  NumColumns = 0;
+  NumPartials = 0;
+  Origin = 0;
+  Table = 0;
+  EdgeAbove = 0;
+  WindowBase = 0;
+  for (uint32_t p=0; p<SM500_HIST_MAX_PARTIALS; p++)
+  {
+    Counts[p] = 0;
+    Bin[p] = 0;
+  }
+  Quantity = SM500_HIST_WAVELENGTH;
+
+  SetSimdLevel(sm500_detect_simd());
+  SetFixedBins(1, 1, 0.0f, 1.0f, 1);
+}
+
+
+/* ===========================================================================
+destructor
+=========================================================================== */
+Csm500Histogram::~Csm500Histogram()
+{
+  Free();
+}
+
+
+/* ===========================================================================
+Releases the counts and the bin tables
+=========================================================================== */
+void Csm500Histogram::Free(void)
+{
+  for (uint32_t p=0; p<SM500_HIST_MAX_PARTIALS; p++)
+  {
+    delete [] Counts[p];
+    delete [] Bin[p];
+    Counts[p] = 0;
+    Bin[p] = 0;
+  }
+  delete [] Origin;
+  delete [] Table;
+  delete [] EdgeAbove;
+  delete [] WindowBase;
+
+  Origin = 0;
+  Table = 0;
+  EdgeAbove = 0;
+  WindowBase = 0;
+}
+
+
+/* ===========================================================================
+Validates the shape of the histograms and allocates zeroed counts
+=========================================================================== */
+void Csm500Histogram::Allocate(uint32_t NumColumns, uint32_t NumBins, uint32_t NumPartials)
+{
+  if ((NumColumns == 0) || (NumColumns > SM500_HIST_MAX_COLUMNS) || (NumBins == 0) || (NumBins > SM500_HIST_MAX_BINS))
+    throw EINVAL;
+
+  if ((NumPartials == 0) || (NumPartials > SM500_HIST_MAX_PARTIALS))
+    throw EINVAL;
+
+  Free();
+  this->NumColumns = NumColumns;
+  this->NumPartials = NumPartials;
+  RowSize = NumBins + 2;
+  Config.NumBins = NumBins;
+
+  size_t size = (size_t)NumColumns * RowSize;
+  for (uint32_t p=0; p<NumPartials; p++)
+  {
+    Counts[p] = new std::atomic<uint64_t>[size];
+    Bin[p] = new uint32_t[NumColumns];
+  }
+  WindowBase = new uint64_t[size];
+  Origin = new float[NumColumns];
+  Clear();
+}
+
+
+/* ===========================================================================
+Configures NumBins bins of width Width per column, starting at Min (see
+SetColumnOrigin() to start each column elsewhere).  NumPartials is the
+number of threads that may accumulate concurrently.  Clears the counts.
+=========================================================================== */
+void Csm500Histogram::SetFixedBins(uint32_t NumColumns, uint32_t NumBins, float Min, float Width, uint32_t NumPartials)
+{
+  if (!(Width > 0.0f))
+    throw EINVAL;
+
+  Allocate(NumColumns, NumBins, NumPartials);
+  this->Width = Width;
+  Config.Bins = SM500_HIST_FIXED;
+  Config.InvWidth = 1.0f / Width;
+  Config.Table = 0;
+  Config.EdgeAbove = 0;
+  for (uint32_t i=0; i<NumColumns; i++)
+    Origin[i] = Min;
+}
+
+
+/* ===========================================================================
+Configures NumBins log-spaced bins between Min and Max, common to all the
+columns.  NumPartials is the number of threads that may accumulate
+concurrently.  Clears the counts.
+=========================================================================== */
+void Csm500Histogram::SetLogBins(uint32_t NumColumns, uint32_t NumBins, float Min, float Max, uint32_t NumPartials)
+{
+  if (!(Min > 0.0f) || !(Max > Min) || isinf(Max))
+    throw EINVAL;
+
+  //table cells must be narrower than the narrowest (first) bin, with a
+  //factor 2 margin for the rounding of the edges to float
+  double ratio = pow((double)Max / Min, 1.0 / (NumBins ? NumBins : 1));
+  int cell_bits = (int)ceil(-log2(ratio - 1.0)) + 1;
+  if (cell_bits < 0) cell_bits = 0;
+  if (cell_bits > 23)
+    throw EINVAL;   //bins narrower than the float resolution
+
+  int32_t min_bits, max_bits;
+  memcpy(&min_bits, &Min, sizeof(min_bits));
+  memcpy(&max_bits, &Max, sizeof(max_bits));
+  uint32_t shift = 23 - cell_bits;
+  uint32_t table_size = (uint32_t)((max_bits >> shift) - (min_bits >> shift) + 1);
+  if (table_size > SM500_HIST_MAX_LOG_TABLE)
+    throw EINVAL;
+
+  Allocate(NumColumns, NumBins, NumPartials);
+  Table = new uint32_t[table_size];
+  EdgeAbove = new float[NumBins + 2];
+
+  //bin b covers [EdgeAbove[b-1], EdgeAbove[b])
+  for (uint32_t b=0; b<NumBins; b++)
+    EdgeAbove[b] = (float)(Min * pow(ratio, (double)b));
+  EdgeAbove[NumBins] = Max;
+  EdgeAbove[NumBins + 1] = INFINITY;
+
+  //bin of the lower bound of each cell: # of edges at or below it
+  uint32_t b = 0;
+  for (uint32_t c=0; c<table_size; c++)
+  {
+    int32_t bits = ((min_bits >> shift) + (int32_t)c) << shift;
+    float v;
+    memcpy(&v, &bits, sizeof(v));
+    while ((b <= NumBins) && (EdgeAbove[b] <= v))
+      b++;
+    Table[c] = b;
+  }
+
+  Config.Bins = SM500_HIST_LOG;
+  Config.KeyBase = min_bits >> shift;
+  Config.KeyShift = shift;
+  Config.TableSize = table_size;
+  Config.Table = Table;
+  Config.EdgeAbove = EdgeAbove;
+  for (uint32_t i=0; i<NumColumns; i++)
+    Origin[i] = Min;
+}
+
+
+/* ===========================================================================
+Sets the first bin edge of a column (fixed bins).  Not concurrent with
+accumulation.
+=========================================================================== */
+void Csm500Histogram::SetColumnOrigin(uint32_t Column, float Min)
+{
+  if ((Column >= NumColumns) || (Config.Bins != SM500_HIST_FIXED))
+    throw EINVAL;
+
+  Origin[Column] = Min;
+}
+
+
+/* ===========================================================================
+Selects the peak value binned by Accumulate(Partial, Peaks)
+=========================================================================== */
+void Csm500Histogram::SetQuantity(sm500_hist_quantity Quantity)
+{
+  this->Quantity = Quantity;
+}
+
+
+/* ===========================================================================
+Zeroes all the counts.  Must not run concurrently with accumulation.
+=========================================================================== */
+void Csm500Histogram::Clear(void)
+{
+  size_t size = (size_t)NumColumns * RowSize;
+
+  for (uint32_t p=0; p<NumPartials; p++)
+    for (size_t i=0; i<size; i++)
+      Counts[p][i].store(0, std::memory_order_relaxed);
+  memset(WindowBase, 0, size * sizeof(uint64_t));
+}
+
+
+/* ===========================================================================
+Returns bin edge Edge of a column: the lower edge of bin Edge+1, or the
+upper edge of the last bin for Edge = NumBins
+=========================================================================== */
+float Csm500Histogram::GetBinEdge(uint32_t Column, uint32_t Edge)
+{
+  if ((Column >= NumColumns) || (Edge > Config.NumBins))
+    throw EINVAL;
+
+  if (Config.Bins == SM500_HIST_FIXED)
+    return Origin[Column] + Edge * Width;
+  return EdgeAbove[Edge];
+}
+
+
+/* ===========================================================================
+Accessors
+=========================================================================== */
+uint32_t Csm500Histogram::GetNumColumns(void)
+{
+  return NumColumns;
+}
+
+uint32_t Csm500Histogram::GetNumBins(void)
+{
+  return Config.NumBins;
+}
+
+uint32_t Csm500Histogram::GetRowSize(void)
+{
+  return RowSize;
+}
+
+
+/* ===========================================================================
+Bins the values of columns 0..n-1 into the partial histograms of Partial.
+A given Partial must only be used by one thread at a time.  Each count has
+a single writer, so it is updated with a plain load and store; the atomic
+type only keeps snapshots from reading torn values.
+=========================================================================== */
+void Csm500Histogram::Accumulate(uint32_t Partial, const float *Values, uint32_t n)
+{
+  if (Partial >= NumPartials)
+    throw EINVAL;
+
+  if (n > NumColumns)
+    n = NumColumns;
+
+  std::atomic<uint64_t> *counts = Counts[Partial];
+  uint32_t *bin = Bin[Partial];
+
+  Kernel(Values, Origin, n, Config, bin);
+  for (uint32_t i=0; i<n; i++)
+  {
+    std::atomic<uint64_t> &c = counts[i * RowSize + bin[i]];
+    c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  }
+}
+
+
+/* ===========================================================================
+Bins the wavelengths or amplitudes (see SetQuantity()) of a frame, peak i
+feeding column i
+=========================================================================== */
+void Csm500Histogram::Accumulate(uint32_t Partial, const sm500_peaks_soa &Peaks)
+{
+  const float *values = (Quantity == SM500_HIST_AMPLITUDE) ? Peaks.Amplitude : Peaks.Wavelength;
+
+  Accumulate(Partial, values, Peaks.Count);
+}
+
+
+/* ===========================================================================
+Sums the partial histograms into Counts
+=========================================================================== */
+void Csm500Histogram::Sum(uint64_t *Counts)
+{
+  size_t size = (size_t)NumColumns * RowSize;
+
+  memset(Counts, 0, size * sizeof(uint64_t));
+  for (uint32_t p=0; p<NumPartials; p++)
+  {
+    const std::atomic<uint64_t> *counts = this->Counts[p];
+
+    for (size_t i=0; i<size; i++)
+      Counts[i] += counts[i].load(std::memory_order_relaxed);
+  }
+}
+
+
+/* ===========================================================================
+Returns the counts accumulated since the last Clear(), NumColumns x RowSize
+values (bin 0: underflow, bin NumBins+1: overflow).  Accumulation goes on
+while the snapshot is taken; the rows being binned at that time may or may
+not be included.
+=========================================================================== */
+void Csm500Histogram::Snapshot(uint64_t *Counts)
+{
+  Sum(Counts);
+}
+
+
+/* ===========================================================================
+Returns the counts accumulated since the previous call, NumColumns x
+RowSize values.  Calling it periodically yields histograms over windows of
+that period.  Must be called from a single thread.
+=========================================================================== */
+void Csm500Histogram::SnapshotWindow(uint64_t *Counts)
+{
+  size_t size = (size_t)NumColumns * RowSize;
+
+  Sum(Counts);
+  for (size_t i=0; i<size; i++)
+  {
+    uint64_t total = Counts[i];
+
+    Counts[i] = total - WindowBase[i];
+    WindowBase[i] = total;
+  }
+}
+
+
+/* ===========================================================================
+Forces a kernel flavor.  Requests beyond what the CPU supports are clamped
+to the best supported flavor.  There is no SSE2 flavor (log bins need
+gathers); the scalar kernel is used at that level.
+=========================================================================== */
+void Csm500Histogram::SetSimdLevel(sm500_simd_level level)
+{
+  sm500_simd_level supported = sm500_detect_simd();
+
+  if (level > supported)
+    level = supported;
+
+  SimdLevel = level;
+  switch (level)
+  {
+#ifdef SM500_HAVE_X86_SIMD
+    case SM500_SIMD_AVX2: Kernel = BinAvx2; break;
+#endif
+    default:              Kernel = BinScalar; break;
+  }
+}
+
+
+/* ===========================================================================
+Returns the kernel flavor in use
+=========================================================================== */
+sm500_simd_level Csm500Histogram::GetSimdLevel(void)
+{
+  return SimdLevel;
+}
+
+
+
+/* ===========================================================================
+=========================================================================== */
+//----------  ----------
+//----------  ----------
@@ -0,0 +1,143 @@
+/* ===========================================================================
+ Csm500Histogram.h
+ sm500 histogram accumulator class definition
+
+ The histogram accumulator bins a stream of per-frame values, one histogram
+ per column (i.e. per sensor: peak i of sm500_peaks_soa feeds column i),
+ for sensor health monitoring and drift detection.  Bins are either
+ fixed-width, starting at a per-column origin (useful for wavelengths), or
+ log-spaced between a common Min and Max (useful for amplitudes).  Every
+ histogram has an underflow bin (0) and an overflow bin (NumBins + 1).
+
+ Bin indices are computed for a whole row at once by a vectorized kernel.
+ Log-spaced bins are looked up without evaluating a logarithm: the upper
+ bits of the float value index a table giving the bin of the lower bound of
+ each table cell, and the cells are made narrow enough to hold at most one
+ bin edge, so a single comparison with the next edge completes the lookup.
+
+ Each accumulating thread owns a partial histogram (its Partial index), so
+ accumulation needs no locking and no atomic read-modify-write.  Snapshots
+ sum the partials while accumulation goes on; Window snapshots return the
+ counts accumulated since the previous window snapshot.
+
+ Jerry Volcy
+
+ Copyright (c) 2013, Micron Optics, Inc.
+=========================================================================== */
+
+#ifndef CSM500HISTOGRAM_H
+#define CSM500HISTOGRAM_H
+
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+#include <stdint.h>
+#include <atomic>
+#include "sm500_data_structures.h"
+#include "sm500_simd.h"
+#include "Csm500PeakDecoder.h"
+
+/* ===========================================================================
+Constants
+=========================================================================== */
+#define SM500_HIST_MAX_COLUMNS      SM500_MAX_PEAKS
+#define SM500_HIST_MAX_BINS         65536
+#define SM500_HIST_MAX_PARTIALS     16        //# of threads that may accumulate concurrently
+#define SM500_HIST_MAX_LOG_TABLE    (1 << 20) //# of cells of the log bin lookup table
+
+
+/* ===========================================================================
+Bin layouts and binned quantities
+=========================================================================== */
+enum sm500_hist_bins
+{
+  SM500_HIST_FIXED = 0,         //fixed-width bins from a per-column origin
+  SM500_HIST_LOG                //log-spaced bins between Min and Max
+};
+
+enum sm500_hist_quantity
+{
+  SM500_HIST_WAVELENGTH = 0,    //binned by Accumulate(Partial, Peaks)
+  SM500_HIST_AMPLITUDE
+};
+
+
+/* ===========================================================================
+Csm500Histogram class definition
+=========================================================================== */
+class Csm500Histogram
+{
+  public:
+    //----------  ----------
+    Csm500Histogram();                      //constructor
+    virtual ~Csm500Histogram();             //destructor
+    void SetFixedBins(uint32_t NumColumns, uint32_t NumBins, float Min, float Width, uint32_t NumPartials);
+    void SetLogBins(uint32_t NumColumns, uint32_t NumBins, float Min, float Max, uint32_t NumPartials);
+    void SetColumnOrigin(uint32_t Column, float Min);       //first bin edge of a column (fixed bins)
+    void SetQuantity(sm500_hist_quantity Quantity);         //peak value binned by Accumulate(Partial, Peaks)
+    void Clear(void);                                       //zeroes all counts; not concurrent with accumulation
+    float GetBinEdge(uint32_t Column, uint32_t Edge);       //lower edge of bin Edge+1 (Edge = NumBins: upper edge of the last bin)
+    uint32_t GetNumColumns(void);
+    uint32_t GetNumBins(void);
+    uint32_t GetRowSize(void);                              //NumBins + 2: counts per column in a snapshot
+
+    //---------- accumulation (one thread per Partial) ----------
+    void Accumulate(uint32_t Partial, const float *Values, uint32_t n);  //bins the values of columns 0..n-1
+    void Accumulate(uint32_t Partial, const sm500_peaks_soa &Peaks);     //bins one frame of peaks
+
+    //---------- snapshots (concurrent with accumulation) ----------
+    void Snapshot(uint64_t *Counts);        //NumColumns x RowSize counts since the last Clear()
+    void SnapshotWindow(uint64_t *Counts);  //counts since the previous SnapshotWindow() (single caller)
+
+    void SetSimdLevel(sm500_simd_level level);  //forces a kernel flavor (clamped to what the CPU supports)
+    sm500_simd_level GetSimdLevel(void);        //returns the kernel flavor in use
+
+    //bin lookup parameters, shared with the kernels
+    struct bin_config
+    {
+      sm500_hist_bins Bins;
+      uint32_t NumBins;
+      float InvWidth;                       //fixed bins
+      int32_t KeyBase;                      //log bins: table cell of Min
+      uint32_t KeyShift;                    //log bins: float bits to table cell
+      uint32_t TableSize;
+      const uint32_t *Table;                //log bins: bin of the lower bound of each cell
+      const float *EdgeAbove;               //log bins: upper edge of each bin (NumBins + 2 entries)
+    };
+
+    //one row: n values in, bin numbers (0..NumBins+1) out
+    typedef void (*kernel_t)(const float *In, const float *Origin, uint32_t n, const bin_config &Config, uint32_t *Bin);
+
+  protected:
+    void Allocate(uint32_t NumColumns, uint32_t NumBins, uint32_t NumPartials);
+    void Free(void);
+    void Sum(uint64_t *Counts);
+
+    bin_config Config;
+    uint32_t NumColumns;
+    uint32_t NumPartials;
+    uint32_t RowSize;
+    float Width;                            //fixed bins
+    float *Origin;                          //fixed bins: first edge of each column
+    uint32_t *Table;                        //log bins
+    float *EdgeAbove;                       //log bins
+    sm500_hist_quantity Quantity;
+
+    std::atomic<uint64_t> *Counts[SM500_HIST_MAX_PARTIALS];  //NumColumns x RowSize, written by a single thread each
+    uint32_t *Bin[SM500_HIST_MAX_PARTIALS];                  //per-partial scratch row
+    uint64_t *WindowBase;                                    //counts at the previous SnapshotWindow()
+
+    sm500_simd_level SimdLevel;
+    kernel_t Kernel;
+};
+
+#endif // #ifndef CSM500HISTOGRAM_H
+
+
+
+/* ===========================================================================
+=========================================================================== */
+//----------  ----------
+//----------  ----------
@@ -0,0 +1,459 @@
+/* ===========================================================================
+ Csm500LatencyStats.cpp
+ sm500 per-frame latency statistics class implementation
+
+ Jerry Volcy
+
+ Copyright (c) 2013, Micron Optics, Inc.
+=========================================================================== */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <new>
+
+using namespace std;
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include "Csm500LatencyStats.h"
+#include "sm500_data_structures.h"
+
+
+/* ===========================================================================
+Thread block cache: the block of the calling thread in the instance it
+last recorded into.  Block is 0 when that instance had no block left for
+the thread, which then counts its samples as dropped without locking.
+=========================================================================== */
+static std::atomic<uint64_t> NextId(1);
+
+struct lat_thread_cache
+{
+  uint64_t Id;
+  void *Block;
+};
+static thread_local lat_thread_cache ThreadCache = { 0, 0 };
+static thread_local sm500_latency_mark OverflowMark = { 0, 0 };  //ThreadMark() of the threads without a block
+
+
+/* ===========================================================================
+Csm500LatencyStats constructor
+=========================================================================== */
+Csm500LatencyStats::Csm500LatencyStats()
+{
+  Enabled = false;
+  Id = NextId++;
+  pthread_mutex_init(&Lock, 0);
+  for (uint32_t t=0; t<SM500_LAT_MAX_THREADS; t++)
+    Threads[t] = 0;
+  NumThreads = 0;
+  Dropped = 0;
+}
+
+
+/* ===========================================================================
+destructor
+=========================================================================== */
+Csm500LatencyStats::~Csm500LatencyStats()
+{
+  for (uint32_t t=0; t<NumThreads; t++)
+    delete Threads[t].load();
+  pthread_mutex_destroy(&Lock);
+}
+
+
+/* ===========================================================================
+Turns the recording on or off
+=========================================================================== */
+void Csm500LatencyStats::Enable(bool On)
+{
+  Enabled = On;
+}
+
+
+/* ===========================================================================
+Returns CLOCK_REALTIME (the clock of the driver's timestamps) in ns
+=========================================================================== */
+uint64_t Csm500LatencyStats::NowNs(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+/* ===========================================================================
+Histogram bins: exact up to 2*SM500_LAT_SUB_BINS ns, then
+SM500_LAT_SUB_BINS bins per power of 2.  Values past 2^(SM500_LAT_MAX_MSB+1)
+ns land in the last bin.
+=========================================================================== */
+uint32_t Csm500LatencyStats::BinIndex(uint64_t Ns)
+{
+  if (Ns < 2 * SM500_LAT_SUB_BINS)
+    return (uint32_t)Ns;
+
+  uint32_t msb = 63 - __builtin_clzll(Ns);
+  if (msb > SM500_LAT_MAX_MSB)
+    return SM500_LAT_NUM_BINS - 1;
+  return 2 * SM500_LAT_SUB_BINS + (msb - SM500_LAT_SUB_BITS - 1) * SM500_LAT_SUB_BINS +
+         (uint32_t)((Ns >> (msb - SM500_LAT_SUB_BITS)) & (SM500_LAT_SUB_BINS - 1));
+}
+
+uint64_t Csm500LatencyStats::BinUpperNs(uint32_t Index)
+{
+  if (Index < 2 * SM500_LAT_SUB_BINS)
+    return Index;
+
+  uint32_t msb = SM500_LAT_SUB_BITS + 1 + (Index - 2 * SM500_LAT_SUB_BINS) / SM500_LAT_SUB_BINS;
+  uint64_t sub = (Index - 2 * SM500_LAT_SUB_BINS) % SM500_LAT_SUB_BINS;
+  uint32_t shift = msb - SM500_LAT_SUB_BITS;
+  return ((SM500_LAT_SUB_BINS + sub) << shift) + (1ull << shift) - 1;
+}
+
+const char* Csm500LatencyStats::StageName(sm500_lat_stage Stage)
+{
+  switch (Stage)
+  {
+    case SM500_LAT_WAKEUP:    return "wakeup";
+    case SM500_LAT_FS_WAKEUP: return "fs_wakeup";
+    case SM500_LAT_DECODE:    return "decode";
+    case SM500_LAT_PUBLISH:   return "publish";
+    case SM500_LAT_TOTAL:     return "total";
+    default:                  return "?";
+  }
+}
+
+
+/* ===========================================================================
+Returns the histograms of the calling thread, 0 when it has none yet.
+Neither locks nor allocates: the blocks are published with a release store
+before NumThreads is raised, and stay until the destructor.
+=========================================================================== */
+Csm500LatencyStats::thread_block* Csm500LatencyStats::FindThreadBlock(void)
+{
+  if (ThreadCache.Id == Id)
+    return (thread_block*)ThreadCache.Block;
+
+  pthread_t self = pthread_self();
+  uint32_t threads = NumThreads.load(std::memory_order_acquire);
+  for (uint32_t t=0; t<threads; t++)
+  {
+    thread_block *block = Threads[t].load(std::memory_order_acquire);
+    if (block && pthread_equal(block->Owner, self))
+    {
+      ThreadCache.Id = Id;
+      ThreadCache.Block = block;
+      return block;
+    }
+  }
+  return 0;
+}
+
+
+/* ===========================================================================
+Returns the histograms of the calling thread, allocated on its first
+sample (0 past SM500_LAT_MAX_THREADS threads).  The lock is only taken
+on the first sample of a thread: a thread refused a block is cached as
+such and not retried.
+=========================================================================== */
+Csm500LatencyStats::thread_block* Csm500LatencyStats::GetThreadBlock(void)
+{
+  if (ThreadCache.Id == Id)                 //a block, or 0 when refused
+    return (thread_block*)ThreadCache.Block;
+
+  thread_block *block = FindThreadBlock();
+  if (block)
+    return block;
+
+  //---------- a new block (first sample) ----------
+  pthread_t self = pthread_self();
+  pthread_mutex_lock(&Lock);
+  for (uint32_t t=0; (t<NumThreads) && !block; t++)
+    if (pthread_equal(Threads[t].load()->Owner, self))
+      block = Threads[t];
+  if (!block && (NumThreads < SM500_LAT_MAX_THREADS))
+  {
+    block = new (std::nothrow) thread_block;
+    if (block)
+    {
+      for (uint32_t s=0; s<SM500_LAT_NUM_STAGES; s++)
+      {
+        stage_histogram &h = block->Stages[s];
+        for (uint32_t b=0; b<SM500_LAT_NUM_BINS; b++)
+          h.Counts[b].store(0, std::memory_order_relaxed);
+        h.Count = 0;
+        h.SumNs = 0;
+        h.MinNs = UINT64_MAX;
+        h.MaxNs = 0;
+      }
+      block->Owner = self;
+      block->Mark.IsrNs = 0;
+      block->Mark.LastNs = 0;
+      Threads[NumThreads].store(block, std::memory_order_release);
+      NumThreads++;
+    }
+  }
+  pthread_mutex_unlock(&Lock);
+
+  ThreadCache.Id = Id;
+  ThreadCache.Block = block;
+  return block;
+}
+
+
+/* ===========================================================================
+Allocates the calling thread's histograms, so that its samples neither lock
+nor allocate.  Returns false past SM500_LAT_MAX_THREADS threads.
+=========================================================================== */
+bool Csm500LatencyStats::RegisterThread(void)
+{
+  return GetThreadBlock() != 0;
+}
+
+
+/* ===========================================================================
+Records a sample of Ns into Stage.  The counters are only written by their
+thread, so plain (relaxed) loads and stores are enough; the exporting
+threads read them with relaxed loads.
+=========================================================================== */
+void Csm500LatencyStats::Record(sm500_lat_stage Stage, uint64_t Ns)
+{
+  thread_block *block = GetThreadBlock();
+
+  if (!block)
+  {
+    Dropped++;
+    return;
+  }
+
+  stage_histogram &h = block->Stages[Stage];
+  std::atomic<uint64_t> &bin = h.Counts[BinIndex(Ns)];
+  bin.store(bin.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  h.SumNs.store(h.SumNs.load(std::memory_order_relaxed) + Ns, std::memory_order_relaxed);
+  if (Ns < h.MinNs.load(std::memory_order_relaxed))
+    h.MinNs.store(Ns, std::memory_order_relaxed);
+  if (Ns > h.MaxNs.load(std::memory_order_relaxed))
+    h.MaxNs.store(Ns, std::memory_order_relaxed);
+  h.Count.store(h.Count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+
+/* ===========================================================================
+A frame was just read: records its wakeup latency (ISR timestamp to now)
+into Stage and starts following it with Mark.  A timestamp ahead of the
+clock (the clock was stepped) is recorded as 0, a frame without timestamp
+not at all.
+=========================================================================== */
+void Csm500LatencyStats::FrameRead(const void *Frame, sm500_latency_mark &Mark, sm500_lat_stage Stage)
+{
+  Csm500PeaksFrame header(Frame);           //the header is common to both streams
+  uint64_t isr = (uint64_t)header.TimestampSec() * 1000000000ull + header.TimestampNsec();
+  uint64_t now = NowNs();
+
+  if (isr)
+    Record(Stage, (now > isr) ? now - isr : 0);
+  Mark.IsrNs = isr ? isr : now;             //no timestamp: the total starts at the read
+  Mark.LastNs = now;
+}
+
+
+/* ===========================================================================
+Starts following a frame whose ISR timestamp is meaningless (a replayed
+frame): the stages are timed from now and SM500_LAT_TOTAL measures from
+the read
+=========================================================================== */
+void Csm500LatencyStats::FrameStart(sm500_latency_mark &Mark)
+{
+  Mark.LastNs = NowNs();
+  Mark.IsrNs = Mark.LastNs;
+}
+
+
+/* ===========================================================================
+Records the time since the end of the last stage of the frame followed by
+Mark (nothing when no frame is followed)
+=========================================================================== */
+void Csm500LatencyStats::StageDone(sm500_lat_stage Stage, sm500_latency_mark &Mark)
+{
+  if (!Mark.IsrNs)
+    return;
+
+  uint64_t now = NowNs();
+  Record(Stage, (now > Mark.LastNs) ? now - Mark.LastNs : 0);
+  Mark.LastNs = now;
+}
+
+
+/* ===========================================================================
+Records SM500_LAT_TOTAL for the frame followed by Mark, up to the end of
+its last stage, and stops following it
+=========================================================================== */
+void Csm500LatencyStats::FrameDone(sm500_latency_mark &Mark)
+{
+  if (!Mark.IsrNs)
+    return;
+
+  Record(SM500_LAT_TOTAL, (Mark.LastNs > Mark.IsrNs) ? Mark.LastNs - Mark.IsrNs : 0);
+  Mark.IsrNs = 0;
+}
+
+
+/* ===========================================================================
+Returns a mark owned by the calling thread, for the stages run on one
+thread
+=========================================================================== */
+sm500_latency_mark& Csm500LatencyStats::ThreadMark(void)
+{
+  thread_block *block = GetThreadBlock();
+
+  return block ? block->Mark : OverflowMark;
+}
+
+sm500_latency_mark* Csm500LatencyStats::FindThreadMark(void)
+{
+  thread_block *block = FindThreadBlock();
+
+  return block ? &block->Mark : 0;
+}
+
+
+/* ===========================================================================
+Merges the histograms of Stage of all the threads
+=========================================================================== */
+void Csm500LatencyStats::Merge(sm500_lat_stage Stage, vector<uint64_t> &Counts, uint64_t &Count, uint64_t &SumNs, uint64_t &MinNs, uint64_t &MaxNs)
+{
+  uint32_t threads = NumThreads.load(std::memory_order_acquire);
+
+  Counts.assign(SM500_LAT_NUM_BINS, 0);
+  Count = 0;
+  SumNs = 0;
+  MinNs = UINT64_MAX;
+  MaxNs = 0;
+  for (uint32_t t=0; t<threads; t++)
+  {
+    thread_block *block = Threads[t].load(std::memory_order_acquire);
+    if (!block)
+      continue;
+
+    stage_histogram &h = block->Stages[Stage];
+    for (uint32_t b=0; b<SM500_LAT_NUM_BINS; b++)
+      Counts[b] += h.Counts[b].load(std::memory_order_relaxed);
+    Count += h.Count.load(std::memory_order_relaxed);
+    SumNs += h.SumNs.load(std::memory_order_relaxed);
+    uint64_t min = h.MinNs.load(std::memory_order_relaxed);
+    uint64_t max = h.MaxNs.load(std::memory_order_relaxed);
+    if (min < MinNs)
+      MinNs = min;
+    if (max > MaxNs)
+      MaxNs = max;
+  }
+}
+
+
+/* ===========================================================================
+Returns the merged histogram counts of Stage (bin i holds the samples up
+to BinUpperNs(i))
+=========================================================================== */
+void Csm500LatencyStats::GetHistogram(sm500_lat_stage Stage, vector<uint64_t> &Counts)
+{
+  uint64_t count, sum, min, max;
+
+  Merge(Stage, Counts, count, sum, min, max);
+}
+
+
+/* ===========================================================================
+Returns the count, extremes, mean and percentiles of Stage.  The
+percentiles are the upper bounds of their bins (within 3%).
+=========================================================================== */
+void Csm500LatencyStats::GetSummary(sm500_lat_stage Stage, sm500_latency_summary &Summary)
+{
+  static const double fractions[] = { 0.5, 0.9, 0.99, 0.999, 0.9999 };
+  uint64_t *percentiles[] = { &Summary.P50Ns, &Summary.P90Ns, &Summary.P99Ns, &Summary.P999Ns, &Summary.P9999Ns };
+  vector<uint64_t> counts;
+  uint64_t sum;
+
+  memset(&Summary, 0, sizeof(Summary));
+  Merge(Stage, counts, Summary.Count, sum, Summary.MinNs, Summary.MaxNs);
+
+  uint64_t total = 0;                       //the bins, not Count: they may be a sample apart
+  for (uint32_t b=0; b<SM500_LAT_NUM_BINS; b++)
+    total += counts[b];
+  if (total == 0)
+  {
+    Summary.MinNs = 0;
+    return;
+  }
+  Summary.MeanNs = (double)sum / (Summary.Count ? Summary.Count : total);
+
+  uint64_t cumulative = 0;
+  uint32_t p = 0, n = sizeof(fractions) / sizeof(fractions[0]);
+  for (uint32_t b=0; (b<SM500_LAT_NUM_BINS) && (p<n); b++)
+  {
+    cumulative += counts[b];
+    while ((p < n) && (cumulative >= (uint64_t)(fractions[p] * total + 0.999999)))
+    {
+      uint64_t upper = BinUpperNs(b);
+      *percentiles[p++] = (upper < Summary.MaxNs) ? upper : Summary.MaxNs;
+    }
+  }
+}
+
+
+/* ===========================================================================
+Writes one line per stage: count, min, mean, percentiles and max, in us
+=========================================================================== */
+void Csm500LatencyStats::Export(FILE *File)
+{
+  fprintf(File, "%-10s %10s %9s %9s %9s %9s %9s %9s %9s %9s (us)\n",
+          "stage", "count", "min", "mean", "p50", "p90", "p99", "p99.9", "p99.99", "max");
+  for (uint32_t s=0; s<SM500_LAT_NUM_STAGES; s++)
+  {
+    sm500_latency_summary sum;
+
+    GetSummary((sm500_lat_stage)s, sum);
+    fprintf(File, "%-10s %10llu %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f\n",
+            StageName((sm500_lat_stage)s), (unsigned long long)sum.Count, sum.MinNs / 1e3, sum.MeanNs / 1e3,
+            sum.P50Ns / 1e3, sum.P90Ns / 1e3, sum.P99Ns / 1e3, sum.P999Ns / 1e3, sum.P9999Ns / 1e3, sum.MaxNs / 1e3);
+  }
+  if (Dropped)
+    fprintf(File, "%llu samples dropped (more than %d threads)\n", (unsigned long long)Dropped.load(), SM500_LAT_MAX_THREADS);
+}
+
+
+/* ===========================================================================
+Clears the histograms.  The threads keep recording: a sample recorded
+while its histogram is cleared may be lost.
+=========================================================================== */
+void Csm500LatencyStats::Reset(void)
+{
+  uint32_t threads = NumThreads.load(std::memory_order_acquire);
+
+  for (uint32_t t=0; t<threads; t++)
+  {
+    thread_block *block = Threads[t].load(std::memory_order_acquire);
+    if (!block)
+      continue;
+
+    for (uint32_t s=0; s<SM500_LAT_NUM_STAGES; s++)
+    {
+      stage_histogram &h = block->Stages[s];
+      for (uint32_t b=0; b<SM500_LAT_NUM_BINS; b++)
+        h.Counts[b].store(0, std::memory_order_relaxed);
+      h.Count.store(0, std::memory_order_relaxed);
+      h.SumNs.store(0, std::memory_order_relaxed);
+      h.MinNs.store(UINT64_MAX, std::memory_order_relaxed);
+      h.MaxNs.store(0, std::memory_order_relaxed);
+    }
+  }
+  Dropped = 0;
+}
+
+
+
+/* ===========================================================================
+=========================================================================== */
+//----------  ----------
+//----------  ----------
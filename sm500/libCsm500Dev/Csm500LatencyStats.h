@@ -0,0 +1,169 @@
+/* ===========================================================================
+ Csm500LatencyStats.h
+ sm500 per-frame latency statistics class definition
+
+ Where a frame spends its time, from the interrupt to the subscribers, in
+ one histogram per stage:
+
+   SM500_LAT_WAKEUP     ISR timestamp (written by the driver in the frame
+                        header) to the return of the read ioctl
+   SM500_LAT_FS_WAKEUP  the same for the FS buffers
+   SM500_LAT_DECODE     read return to the end of the decode
+   SM500_LAT_PUBLISH    end of the decode to the return of Publish() (the
+                        subscriber callbacks, network sends included)
+   SM500_LAT_TOTAL      ISR timestamp to the return of Publish()
+
+ The driver stamps the frames with the wall clock, so every stage is
+ measured on CLOCK_REALTIME.  A frame is followed through its stages with
+ an sm500_latency_mark: FrameRead() starts it, StageDone() ends a stage
+ and FrameDone() the frame.  Csm500Dev keeps one mark per thread (see
+ ThreadMark()); a pipeline passing frames between threads carries its own.
+
+ The histograms are log-linear (HDR): exact below 64 ns, then 32 bins per
+ power of 2, i.e. within 3%, up to about 36 minutes.  Each thread records
+ into histograms of its own, without locks or atomic read-modify-writes,
+ so recording costs a clock read and a few increments and can stay on in
+ production.  GetSummary(), GetHistogram() and Export() merge the threads'
+ histograms on demand, from any thread.
+
+ A thread's histograms are allocated (under a lock) by RegisterThread() or
+ by its first sample; after that, finding them takes no lock.  Csm500Dev
+ registers the thread calling Init() and only records on threads that are
+ registered (FindThreadMark()), so its read path never locks or allocates;
+ another thread reading the data calls RegisterThread() first.
+
+ Jerry Volcy
+
+ Copyright (c) 2013, Micron Optics, Inc.
+=========================================================================== */
+
+#ifndef CSM500LATENCYSTATS_H
+#define CSM500LATENCYSTATS_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+#include <stdint.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <atomic>
+
+/* ===========================================================================
+Constants
+=========================================================================== */
+#define SM500_LAT_SUB_BITS      5                                 //32 bins per power of 2
+#define SM500_LAT_SUB_BINS      (1 << SM500_LAT_SUB_BITS)
+#define SM500_LAT_MAX_MSB       40                                //largest power of 2 tracked, in ns
+#define SM500_LAT_NUM_BINS      (2 * SM500_LAT_SUB_BINS + (SM500_LAT_MAX_MSB - SM500_LAT_SUB_BITS) * SM500_LAT_SUB_BINS)
+#define SM500_LAT_MAX_THREADS   64                                //threads recording into one Csm500LatencyStats
+
+enum sm500_lat_stage
+{
+  SM500_LAT_WAKEUP = 0,
+  SM500_LAT_FS_WAKEUP,
+  SM500_LAT_DECODE,
+  SM500_LAT_PUBLISH,
+  SM500_LAT_TOTAL,
+  SM500_LAT_NUM_STAGES
+};
+
+
+/* ===========================================================================
+A frame followed through the stages
+=========================================================================== */
+struct sm500_latency_mark
+{
+  uint64_t IsrNs;                 //ISR timestamp of the frame; 0 = no frame followed
+  uint64_t LastNs;                //end of the last stage
+};
+
+
+/* ===========================================================================
+Per stage summary
+=========================================================================== */
+struct sm500_latency_summary
+{
+  uint64_t Count;
+  uint64_t MinNs;
+  uint64_t MaxNs;
+  double MeanNs;
+  uint64_t P50Ns;
+  uint64_t P90Ns;
+  uint64_t P99Ns;
+  uint64_t P999Ns;
+  uint64_t P9999Ns;
+};
+
+
+/* ===========================================================================
+Csm500LatencyStats class definition
+=========================================================================== */
+class Csm500LatencyStats
+{
+  public:
+    Csm500LatencyStats();                   //constructor
+    virtual ~Csm500LatencyStats();          //destructor
+    void Enable(bool On);                   //off by default
+    bool IsEnabled(void) const { return Enabled.load(std::memory_order_relaxed); }
+    static uint64_t NowNs(void);            //CLOCK_REALTIME, in ns
+
+    //---------- recording (any thread) ----------
+    void Record(sm500_lat_stage Stage, uint64_t Ns);
+    void FrameRead(const void *Frame, sm500_latency_mark &Mark, sm500_lat_stage Stage = SM500_LAT_WAKEUP);  //records the wakeup, starts following the frame
+    void FrameStart(sm500_latency_mark &Mark);                          //starts following a frame without ISR timestamp (e.g. replayed)
+    void StageDone(sm500_lat_stage Stage, sm500_latency_mark &Mark);   //records the time since the last stage
+    void FrameDone(sm500_latency_mark &Mark);                           //records SM500_LAT_TOTAL up to the last stage, stops following the frame
+    sm500_latency_mark& ThreadMark(void);   //a mark of the calling thread's own (allocates its histograms on first use)
+    sm500_latency_mark* FindThreadMark(void);   //the same without allocating: 0 when the thread is not registered
+    bool RegisterThread(void);              //allocates the calling thread's histograms ahead of its first sample
+
+    //---------- export (any thread) ----------
+    void GetSummary(sm500_lat_stage Stage, sm500_latency_summary &Summary);
+    void GetHistogram(sm500_lat_stage Stage, vector<uint64_t> &Counts);  //SM500_LAT_NUM_BINS merged counts
+    void Export(FILE *File);                //one line of percentiles per stage
+    void Reset(void);                       //counts recorded meanwhile may be lost
+    uint64_t GetDropped(void) const { return Dropped.load(); }   //samples of threads beyond SM500_LAT_MAX_THREADS
+    static uint32_t BinIndex(uint64_t Ns);
+    static uint64_t BinUpperNs(uint32_t Index);   //largest value of a bin
+    static const char* StageName(sm500_lat_stage Stage);
+
+  protected:
+    struct stage_histogram
+    {
+      std::atomic<uint64_t> Counts[SM500_LAT_NUM_BINS];
+      std::atomic<uint64_t> Count;
+      std::atomic<uint64_t> SumNs;
+      std::atomic<uint64_t> MinNs;
+      std::atomic<uint64_t> MaxNs;
+    };
+
+    struct thread_block                     //written by one thread only
+    {
+      stage_histogram Stages[SM500_LAT_NUM_STAGES];
+      sm500_latency_mark Mark;
+      pthread_t Owner;
+    };
+
+    thread_block* FindThreadBlock(void);    //no lock, no allocation
+    thread_block* GetThreadBlock(void);     //allocates the block on first use
+    void Merge(sm500_lat_stage Stage, vector<uint64_t> &Counts, uint64_t &Count, uint64_t &SumNs, uint64_t &MinNs, uint64_t &MaxNs);
+
+    std::atomic<bool> Enabled;
+    uint64_t Id;                            //tells the instances apart in the threads' caches
+    pthread_mutex_t Lock;                   //thread block allocation
+    std::atomic<thread_block*> Threads[SM500_LAT_MAX_THREADS];
+    std::atomic<uint32_t> NumThreads;
+    std::atomic<uint64_t> Dropped;
+};
+
+#endif // #ifndef CSM500LATENCYSTATS_H
+
+
+
+/* ===========================================================================
+=========================================================================== */
+//----------  ----------
+//----------  ----------
@@ -0,0 +1,253 @@
+/* ===========================================================================
+ Csm500McastPublisher.cpp
+ sm500 UDP multicast peaks publisher class implementation
+
+ Publish() appends the frame to the datagram being filled and sends the
+ datagram when the next frame might not fit, so a datagram goes out as
+ soon as it is full rather than when the next frame arrives.  Sending
+ never blocks for long and never fails the caller: a datagram the socket
+ refuses is counted and the receivers report it as a gap.
+
+ Jerry Volcy
+
+ Copyright (c) 2013, Micron Optics, Inc.
+=========================================================================== */
+
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "Csm500McastPublisher.h"
+#include "sm500_common.h"
+
+
+/* ===========================================================================
+Csm500McastPublisher constructor
+=========================================================================== */
+Csm500McastPublisher::Csm500McastPublisher()
+{
+  Fd = -1;
+  memset(&Dest, 0, sizeof(Dest));
+  Mtu = SM500_DEFAULT_MCAST_MTU;
+  MaxBatch = SM500_DEFAULT_MCAST_MAX_BATCH;
+  Ttl = SM500_DEFAULT_MCAST_TTL;
+  Source = 0;
+  Sequence = 0;
+  DatagramBytes = sizeof(sm500_mcast_header);
+  DatagramFrames = 0;
+  FirstSerialNumber = 0;
+  memset(&Stats, 0, sizeof(Stats));
+}
+
+
+/* ===========================================================================
+destructor
+=========================================================================== */
+Csm500McastPublisher::~Csm500McastPublisher()
+{
+  Close();
+}
+
+
+/* ===========================================================================
+Sets the largest datagram, in bytes, IP and UDP headers included (the MTU
+of the network)
+=========================================================================== */
+void Csm500McastPublisher::SetMtu(uint32_t Bytes)
+{
+  if ((Bytes < SM500_MCAST_MIN_MTU) || (Bytes > SM500_MCAST_MAX_MTU))
+    throw EINVAL;
+  Flush();
+  Mtu = Bytes;
+}
+
+
+/* ===========================================================================
+Sets the maximum # of frames per datagram, i.e. the latency added by the
+batching (1 sends every frame on its own)
+=========================================================================== */
+void Csm500McastPublisher::SetMaxBatch(uint32_t Frames)
+{
+  if ((Frames == 0) || (Frames > SM500_MCAST_MAX_BATCH))
+    throw EINVAL;
+  Flush();
+  MaxBatch = Frames;
+}
+
+
+/* ===========================================================================
+Sets the multicast TTL (1 keeps the datagrams on the local subnet)
+=========================================================================== */
+void Csm500McastPublisher::SetTtl(uint32_t Hops)
+{
+  Ttl = Hops;
+}
+
+
+/* ===========================================================================
+Opens the socket.  Group is the multicast address, Interface the address
+of the interface to send through (0 = as routed).
+=========================================================================== */
+void Csm500McastPublisher::Open(const char *Group, uint16_t Port, const char *Interface)
+{
+  struct in_addr ifaddr;
+  unsigned char ttl = (unsigned char)(Ttl > 255 ? 255 : Ttl);
+  struct timespec ts;
+  int err;
+
+  Close();
+
+  memset(&Dest, 0, sizeof(Dest));
+  Dest.sin_family = AF_INET;
+  Dest.sin_port = htons(Port);
+  if ((inet_pton(AF_INET, Group, &Dest.sin_addr) != 1) || !IN_MULTICAST(ntohl(Dest.sin_addr.s_addr)))
+    throw EINVAL;
+  if (Interface && (inet_pton(AF_INET, Interface, &ifaddr) != 1))
+    throw EINVAL;
+
+  Fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  if (Fd < 0)
+    throw errno;
+  if ((setsockopt(Fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) != 0) ||
+      (Interface && (setsockopt(Fd, IPPROTO_IP, IP_MULTICAST_IF, &ifaddr, sizeof(ifaddr)) != 0)))
+  {
+    err = errno;
+    close(Fd);
+    Fd = -1;
+    throw err;
+  }
+
+  //---------- a new source id: the receivers resynchronize instead of reporting a gap ----------
+  clock_gettime(CLOCK_REALTIME, &ts);
+  Source = (uint32_t)(ts.tv_nsec ^ (ts.tv_sec << 20) ^ getpid());
+  Sequence = 0;
+  DatagramBytes = sizeof(sm500_mcast_header);
+  DatagramFrames = 0;
+  memset(&Stats, 0, sizeof(Stats));
+}
+
+
+/* ===========================================================================
+Sends the pending frames and closes the socket
+=========================================================================== */
+void Csm500McastPublisher::Close(void)
+{
+  if (Fd < 0)
+    return;
+  Flush();
+  close(Fd);
+  Fd = -1;
+}
+
+
+/* ===========================================================================
+Adds a peaks DMA buffer to the datagram being filled.  Only the header
+fields the receivers rebuild (S/N, status, timestamp, peak counts) and the
+valid peaks are sent.
+=========================================================================== */
+void Csm500McastPublisher::Publish(const void *PeaksData)
+{
+  if (Fd < 0)
+    throw EINVAL;
+
+  Csm500PeaksFrame frame(PeaksData);
+  uint64_t sn = frame.SerialNumber();
+  uint32_t num_peaks = 0;
+  for (uint32_t ch=0; ch<SM500_NUM_CHANNELS; ch++)
+    num_peaks += frame.NumPeaks(ch);
+  uint32_t bytes = sizeof(sm500_mcast_frame) + num_peaks * sizeof(uint32_t);
+
+  //---------- the frame must fit, and its S/N be an offset from the first frame's ----------
+  if (DatagramFrames && ((DatagramBytes + bytes > Mtu - SM500_MCAST_IP_UDP_BYTES) ||
+                         (sn < FirstSerialNumber) || (sn - FirstSerialNumber > 0xFFFFFFFFull)))
+    Send();
+
+  if (DatagramFrames == 0)
+    FirstSerialNumber = sn;
+
+  sm500_mcast_frame *rec = (sm500_mcast_frame*)(Datagram + DatagramBytes);
+  rec->SerialOffset = (uint32_t)(sn - FirstSerialNumber);
+  rec->Status = frame.Status();
+  rec->TimestampSec = frame.TimestampSec();
+  rec->TimestampNsec = frame.TimestampNsec();
+
+  uint32_t *out = (uint32_t*)(rec + 1);
+  for (uint32_t ch=0; ch<SM500_NUM_CHANNELS; ch++)
+  {
+    uint32_t n = frame.NumPeaks(ch);
+    rec->NumPeaks[ch] = (uint8_t)n;
+    memcpy(out, frame.begin(ch), n * sizeof(uint32_t));
+    out += n;
+  }
+  DatagramBytes += bytes;
+  DatagramFrames++;
+  Stats.Frames++;
+
+  //---------- send now if the next frame (assumed the same size) would not fit ----------
+  if ((DatagramFrames >= MaxBatch) || (DatagramBytes + bytes > Mtu - SM500_MCAST_IP_UDP_BYTES))
+    Send();
+}
+
+
+/* ===========================================================================
+Sends the pending frames
+=========================================================================== */
+void Csm500McastPublisher::Flush(void)
+{
+  if (DatagramFrames)
+    Send();
+}
+
+
+/* ===========================================================================
+Returns the publisher statistics
+=========================================================================== */
+void Csm500McastPublisher::GetStats(sm500_mcast_publisher_stats &Stats)
+{
+  Stats = this->Stats;
+}
+
+
+/* ===========================================================================
+Stamps and sends the datagram being filled
+=========================================================================== */
+void Csm500McastPublisher::Send(void)
+{
+  sm500_mcast_header *hdr = (sm500_mcast_header*)Datagram;
+  hdr->Magic = SM500_MCAST_MAGIC;
+  hdr->Version = SM500_MCAST_VERSION;
+  hdr->Frames = (uint8_t)DatagramFrames;
+  hdr->Source = Source;
+  hdr->Sequence = Sequence++;
+  hdr->Reserved = 0;
+  hdr->SerialNumber = FirstSerialNumber;
+
+  if (sendto(Fd, Datagram, DatagramBytes, 0, (struct sockaddr*)&Dest, sizeof(Dest)) == (ssize_t)DatagramBytes)
+  {
+    Stats.Datagrams++;
+    Stats.Bytes += DatagramBytes;
+  }
+  else
+    Stats.SendErrors++;
+
+  DatagramBytes = sizeof(sm500_mcast_header);
+  DatagramFrames = 0;
+}
+
+
+
+/* ===========================================================================
+=========================================================================== */
+//----------  ----------
+//----------  ----------
@@ -0,0 +1,150 @@
+/* ===========================================================================
+ Csm500McastPublisher.h
+ sm500 UDP multicast peaks publisher class definition
+
+ Sends the peaks frames to a multicast group: every receiver on the
+ network gets the full stream from a single send, so adding a subscriber
+ costs the interrogator nothing.  See Csm500McastReceiver for the
+ receiving side.
+
+ Only the valid peaks are sent.  Frames are batched into datagrams of at
+ most Mtu bytes (IP and UDP headers included) until the next frame would
+ not fit or MaxBatch frames are pending; a frame larger than the MTU on
+ its own is sent alone (and fragmented by IP).  Datagram layout, in host
+ (little endian) byte order:
+
+   sm500_mcast_header               datagram counter, S/N of the first frame
+   frame 0 .. Frames-1:
+     sm500_mcast_frame              S/N (relative), status, timestamp, counts
+     peak words                     NumPeaks[0] + .. + NumPeaks[N-1] words
+
+ The serial numbers are the hardware's (SM500_REG_DMASNLO/HI, copied to
+ the DMA header), so the receivers can tell frames lost on the network
+ from frames never published.
+
+ Jerry Volcy
+
+ Copyright (c) 2013, Micron Optics, Inc.
+=========================================================================== */
+
+#ifndef CSM500MCASTPUBLISHER_H
+#define CSM500MCASTPUBLISHER_H
+
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+#include <stdint.h>
+#include <netinet/in.h>
+#include "sm500_data_structures.h"
+
+/* ===========================================================================
+Constants
+=========================================================================== */
+#define SM500_MCAST_MAGIC             0x4D50      //"PM"
+#define SM500_MCAST_VERSION           1
+#define SM500_MCAST_IP_UDP_BYTES      28          //IPv4 and UDP headers
+#define SM500_MCAST_MIN_MTU           576
+#define SM500_MCAST_MAX_MTU           9000        //jumbo frames
+#define SM500_MCAST_MAX_BATCH         255         //frames per datagram (uint8_t Frames)
+#define SM500_MCAST_MAX_FRAME_BYTES   \
+  (sizeof(sm500_mcast_frame) + SM500_NUM_CHANNELS * SM500_MAX_PEAKS_PER_CHANNEL * sizeof(uint32_t))
+#define SM500_MCAST_MAX_DATAGRAM      \
+  (sizeof(sm500_mcast_header) + SM500_MCAST_MAX_FRAME_BYTES > SM500_MCAST_MAX_MTU - SM500_MCAST_IP_UDP_BYTES ? \
+   sizeof(sm500_mcast_header) + SM500_MCAST_MAX_FRAME_BYTES : SM500_MCAST_MAX_MTU - SM500_MCAST_IP_UDP_BYTES)
+
+
+/* ===========================================================================
+Defaults
+=========================================================================== */
+#define SM500_DEFAULT_MCAST_GROUP     "239.255.18.53"
+#define SM500_DEFAULT_MCAST_PORT      1855
+#define SM500_DEFAULT_MCAST_MTU       1500
+#define SM500_DEFAULT_MCAST_MAX_BATCH 10          //frames (10 ms at 1 kHz)
+#define SM500_DEFAULT_MCAST_TTL       1           //do not leave the subnet
+
+
+/* ===========================================================================
+Datagram layout
+=========================================================================== */
+struct sm500_mcast_header
+{
+  uint16_t Magic;                 //SM500_MCAST_MAGIC
+  uint8_t Version;                //SM500_MCAST_VERSION
+  uint8_t Frames;                 //# of frames in the datagram
+  uint32_t Source;                //random id of the publisher (changes when it restarts)
+  uint32_t Sequence;              //datagram counter of the publisher
+  uint32_t Reserved;
+  uint64_t SerialNumber;          //hardware S/N of the first frame
+};
+
+struct sm500_mcast_frame
+{
+  uint32_t SerialOffset;          //S/N - sm500_mcast_header::SerialNumber
+  uint32_t Status;
+  uint32_t TimestampSec;
+  uint32_t TimestampNsec;
+  uint8_t NumPeaks[SM500_NUM_CHANNELS];
+};
+
+
+/* ===========================================================================
+Publisher statistics
+=========================================================================== */
+struct sm500_mcast_publisher_stats
+{
+  uint64_t Frames;                //frames published
+  uint64_t Datagrams;             //datagrams sent
+  uint64_t Bytes;                 //UDP payload bytes sent
+  uint64_t SendErrors;            //datagrams the socket refused (lost)
+};
+
+
+/* ===========================================================================
+Csm500McastPublisher class definition
+=========================================================================== */
+class Csm500McastPublisher
+{
+  public:
+    //----------  ----------
+    Csm500McastPublisher();                 //constructor
+    virtual ~Csm500McastPublisher();        //destructor
+    void SetMtu(uint32_t Bytes);            //largest datagram, IP and UDP headers included
+    void SetMaxBatch(uint32_t Frames);      //frames held back at most before sending
+    void SetTtl(uint32_t Hops);             //multicast TTL (applies to the next Open())
+    void Open(const char *Group = SM500_DEFAULT_MCAST_GROUP, uint16_t Port = SM500_DEFAULT_MCAST_PORT,
+              const char *Interface = 0);   //sends to Group:Port through Interface (address; 0 = default route)
+    void Close(void);                       //sends what is pending and closes the socket
+    void Publish(const void *PeaksData);    //batches a peaks DMA buffer (e.g. from Csm500Dev::GetPeaksData())
+    void Flush(void);                       //sends the pending frames now
+    void GetStats(sm500_mcast_publisher_stats &Stats);
+
+  protected:
+    void Send(void);
+
+    int Fd;
+    struct sockaddr_in Dest;
+    uint32_t Mtu;
+    uint32_t MaxBatch;
+    uint32_t Ttl;
+    uint32_t Source;
+    uint32_t Sequence;
+
+    //---------- datagram being filled ----------
+    uint8_t Datagram[SM500_MCAST_MAX_DATAGRAM];
+    uint32_t DatagramBytes;
+    uint32_t DatagramFrames;
+    uint64_t FirstSerialNumber;
+
+    sm500_mcast_publisher_stats Stats;
+};
+
+#endif // #ifndef CSM500MCASTPUBLISHER_H
+
+
+
+/* ===========================================================================
+=========================================================================== */
+//----------  ----------
+//----------  ----------
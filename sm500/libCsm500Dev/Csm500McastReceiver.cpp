@@ -0,0 +1,395 @@
+/* ===========================================================================
+ Csm500McastReceiver.cpp
+ sm500 UDP multicast peaks receiver class implementation
+
+ Datagrams are received in batches (recvmmsg()) and their frames handed
+ out one per GetPeaksData() call, so a datagram of N frames costs a
+ fraction of a system call per frame.  The datagram counter catches the
+ datagrams lost or reordered on the network; the S/N of the frames
+ catches every gap in the stream, wherever it comes from.
+
+ Jerry Volcy
+
+ Copyright (c) 2013, Micron Optics, Inc.
+=========================================================================== */
+
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "Csm500McastReceiver.h"
+#include "sm500_common.h"
+
+
+/* ===========================================================================
+Csm500McastReceiver constructor
+=========================================================================== */
+Csm500McastReceiver::Csm500McastReceiver()
+{
+  Fd = -1;
+  EventFd = -1;
+  ReceiveBuffer = SM500_DEFAULT_MCAST_RCVBUF;
+  Timeout = -1;
+  GapCallback = 0;
+  GapContext = 0;
+  NumReceived = 0;
+  NextIndex = 0;
+  Cursor = End = 0;
+  FramesLeft = 0;
+  DatagramSerialNumber = 0;
+  bSynced = false;
+  bSourceKnown = false;
+  Source = 0;
+  NextSequence = 0;
+  PendingLost = 0;
+  LastSerialNumber = 0;
+  memset(Frame, 0, sizeof(Frame));
+  memset(FrameCounts, 0, sizeof(FrameCounts));
+  memset(&Stats, 0, sizeof(Stats));
+}
+
+
+/* ===========================================================================
+destructor
+=========================================================================== */
+Csm500McastReceiver::~Csm500McastReceiver()
+{
+  Close();
+}
+
+
+/* ===========================================================================
+Sets the socket receive buffer, in bytes: the burst the receiver can fall
+behind by without losing datagrams
+=========================================================================== */
+void Csm500McastReceiver::SetReceiveBuffer(uint32_t Bytes)
+{
+  ReceiveBuffer = Bytes;
+}
+
+
+/* ===========================================================================
+Sets how long GetPeaksData() waits for a frame before throwing ETIMEDOUT
+(-1 = forever)
+=========================================================================== */
+void Csm500McastReceiver::SetTimeout(int Milliseconds)
+{
+  Timeout = Milliseconds;
+}
+
+
+/* ===========================================================================
+Sets the function called for every gap (0 = none)
+=========================================================================== */
+void Csm500McastReceiver::SetGapCallback(gap_callback_t Callback, void *Context)
+{
+  GapCallback = Callback;
+  GapContext = Context;
+}
+
+
+/* ===========================================================================
+Joins the multicast group Group on the interface of address Interface
+(0 = as routed) and listens on Port.  Several receivers can listen to the
+same group and port on a host.
+=========================================================================== */
+void Csm500McastReceiver::Open(const char *Group, uint16_t Port, const char *Interface)
+{
+  struct sockaddr_in addr;
+  struct ip_mreq mreq;
+  int one = 1, err;
+  int rcvbuf = (int)ReceiveBuffer;
+
+  Close();
+
+  memset(&addr, 0, sizeof(addr));
+  memset(&mreq, 0, sizeof(mreq));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(Port);
+  if ((inet_pton(AF_INET, Group, &addr.sin_addr) != 1) || !IN_MULTICAST(ntohl(addr.sin_addr.s_addr)))
+    throw EINVAL;
+  mreq.imr_multiaddr = addr.sin_addr;
+  mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+  if (Interface && (inet_pton(AF_INET, Interface, &mreq.imr_interface) != 1))
+    throw EINVAL;
+
+  Fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  EventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if ((Fd < 0) || (EventFd < 0))
+    goto fail;
+
+  //---------- bound to the group address: datagrams of other groups on Port are not received ----------
+  setsockopt(Fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  setsockopt(Fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+  if ((bind(Fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) ||
+      (setsockopt(Fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) != 0))
+    goto fail;
+
+  Buffers.resize(SM500_MCAST_RECV_BATCH * SM500_MCAST_MAX_DATAGRAM);
+  NumReceived = NextIndex = 0;
+  FramesLeft = 0;
+  bSynced = false;
+  bSourceKnown = false;
+  PendingLost = 0;
+  memset(&Stats, 0, sizeof(Stats));
+  return;
+
+fail:
+  err = errno;
+  if (Fd >= 0) close(Fd);
+  if (EventFd >= 0) close(EventFd);
+  Fd = EventFd = -1;
+  throw err;
+}
+
+
+/* ===========================================================================
+Leaves the group and closes the socket
+=========================================================================== */
+void Csm500McastReceiver::Close(void)
+{
+  if (Fd >= 0)
+    close(Fd);                              //leaves the group
+  if (EventFd >= 0)
+    close(EventFd);
+  Fd = EventFd = -1;
+}
+
+
+/* ===========================================================================
+Waits for the next frame and returns it as a peaks DMA buffer.  The buffer
+is valid until the next call.  Throws ETIMEDOUT when no frame arrived
+within the timeout, ECANCELED when released by CancelReads().
+=========================================================================== */
+const void* Csm500McastReceiver::GetPeaksData(void)
+{
+  if (Fd < 0)
+    throw EINVAL;
+
+  for (;;)
+  {
+    while (FramesLeft)
+    {
+      const sm500_mcast_frame *rec = (const sm500_mcast_frame*)Cursor;
+      uint32_t num_peaks = 0;
+
+      //---------- the record must fit in the datagram ----------
+      if (Cursor + sizeof(sm500_mcast_frame) > End)
+        break;
+      for (uint32_t ch=0; ch<SM500_NUM_CHANNELS; ch++)
+        num_peaks += rec->NumPeaks[ch] < SM500_MAX_PEAKS_PER_CHANNEL ? rec->NumPeaks[ch] : SM500_MAX_PEAKS_PER_CHANNEL;
+      uint32_t bytes = sizeof(sm500_mcast_frame) + num_peaks * sizeof(uint32_t);
+      if (Cursor + bytes > End)
+        break;
+
+      //---------- continuity ----------
+      uint64_t sn = DatagramSerialNumber + rec->SerialOffset;
+      if (bSynced && (sn != LastSerialNumber + 1))
+      {
+        if (sn > LastSerialNumber)
+        {
+          sm500_mcast_gap gap;
+          gap.FirstSerialNumber = LastSerialNumber + 1;
+          gap.NumFrames = sn - LastSerialNumber - 1;
+          gap.LostDatagrams = PendingLost;
+          Stats.Gaps++;
+          Stats.MissedFrames += gap.NumFrames;
+          if (GapCallback)
+            GapCallback(GapContext, gap);
+        }
+        else
+          Stats.Resyncs++;
+      }
+      bSynced = true;
+      PendingLost = 0;
+      LastSerialNumber = sn;
+
+      Rebuild(rec, sn);
+      Cursor += bytes;
+      FramesLeft--;
+      Stats.Frames++;
+      return Frame;
+    }
+    if (FramesLeft)                         //truncated record
+    {
+      Stats.Malformed++;
+      FramesLeft = 0;
+    }
+
+    if (!NextDatagram())
+      Receive();
+  }
+}
+
+
+/* ===========================================================================
+Releases the thread blocked in GetPeaksData() (or the next one to call
+it): it throws ECANCELED
+=========================================================================== */
+void Csm500McastReceiver::CancelReads(void)
+{
+  uint64_t one = 1;
+  if (EventFd >= 0)
+    if (write(EventFd, &one, sizeof(one)) < 0) {}
+}
+
+
+/* ===========================================================================
+Returns the receiver statistics
+=========================================================================== */
+void Csm500McastReceiver::GetStats(sm500_mcast_receiver_stats &Stats)
+{
+  Stats = this->Stats;
+}
+
+
+/* ===========================================================================
+Moves to the next valid, in sequence datagram of the received batch.
+Returns false when the batch is used up.
+=========================================================================== */
+bool Csm500McastReceiver::NextDatagram(void)
+{
+  while (NextIndex < NumReceived)
+  {
+    const uint8_t *data = &Buffers[NextIndex * SM500_MCAST_MAX_DATAGRAM];
+    uint32_t len = Lengths[NextIndex++];
+    const sm500_mcast_header *hdr = (const sm500_mcast_header*)data;
+
+    if ((len < sizeof(sm500_mcast_header)) || (hdr->Magic != SM500_MCAST_MAGIC) ||
+        (hdr->Version != SM500_MCAST_VERSION) || (hdr->Frames == 0))
+    {
+      Stats.Malformed++;
+      continue;
+    }
+
+    //---------- a new publisher (or a restarted one) ----------
+    if (!bSourceKnown || (hdr->Source != Source))
+    {
+      if (bSourceKnown)
+        Stats.Resyncs++;
+      bSourceKnown = true;
+      Source = hdr->Source;
+      NextSequence = hdr->Sequence;
+      bSynced = false;
+      PendingLost = 0;
+    }
+
+    int32_t ahead = (int32_t)(hdr->Sequence - NextSequence);
+    if (ahead < 0)
+    {
+      Stats.Late++;
+      continue;
+    }
+    PendingLost += ahead;
+    Stats.LostDatagrams += ahead;
+    NextSequence = hdr->Sequence + 1;
+
+    Cursor = data + sizeof(sm500_mcast_header);
+    End = data + len;
+    FramesLeft = hdr->Frames;
+    DatagramSerialNumber = hdr->SerialNumber;
+    Stats.Datagrams++;
+    return true;
+  }
+  return false;
+}
+
+
+/* ===========================================================================
+Waits for datagrams and receives as many as are queued (up to a batch)
+=========================================================================== */
+void Csm500McastReceiver::Receive(void)
+{
+  struct mmsghdr msgs[SM500_MCAST_RECV_BATCH];
+  struct iovec iov[SM500_MCAST_RECV_BATCH];
+  struct pollfd fds[2];
+
+  NumReceived = NextIndex = 0;
+
+  fds[0].fd = Fd;
+  fds[0].events = POLLIN;
+  fds[1].fd = EventFd;
+  fds[1].events = POLLIN;
+  int n = poll(fds, 2, Timeout);
+  if (n < 0)
+  {
+    if (errno == EINTR)
+      return;
+    throw errno;
+  }
+  if (n == 0)
+    throw ETIMEDOUT;
+  if (fds[1].revents & POLLIN)
+  {
+    uint64_t count;
+    if (read(EventFd, &count, sizeof(count)) < 0) {}
+    throw ECANCELED;
+  }
+
+  memset(msgs, 0, sizeof(msgs));
+  for (uint32_t i=0; i<SM500_MCAST_RECV_BATCH; i++)
+  {
+    iov[i].iov_base = &Buffers[i * SM500_MCAST_MAX_DATAGRAM];
+    iov[i].iov_len = SM500_MCAST_MAX_DATAGRAM;
+    msgs[i].msg_hdr.msg_iov = &iov[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+  n = recvmmsg(Fd, msgs, SM500_MCAST_RECV_BATCH, MSG_DONTWAIT, 0);
+  if (n < 0)
+  {
+    if ((errno == EAGAIN) || (errno == EINTR))
+      return;
+    throw errno;
+  }
+  for (int i=0; i<n; i++)
+    Lengths[i] = (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) ? 0 : msgs[i].msg_len;   //truncated: malformed
+  NumReceived = n;
+}
+
+
+/* ===========================================================================
+Writes a frame record into the DMA buffer layout.  Only the peak words a
+previous frame left beyond the new counts are cleared.
+=========================================================================== */
+void Csm500McastReceiver::Rebuild(const sm500_mcast_frame *Rec, uint64_t SerialNumber)
+{
+  const uint32_t *peaks = (const uint32_t*)(Rec + 1);
+
+  Frame[sm500_peaks_format::SerialLoOffset32] = (uint32_t)SerialNumber;
+  Frame[sm500_peaks_format::SerialHiOffset32] = (uint32_t)(SerialNumber >> 32);
+  Frame[sm500_peaks_format::StatusOffset32] = Rec->Status;
+  Frame[sm500_peaks_format::TimestampOffset32] = Rec->TimestampSec;
+  Frame[sm500_peaks_format::TimestampOffset32 + 1] = Rec->TimestampNsec;
+
+  for (uint32_t ch=0; ch<SM500_NUM_CHANNELS; ch++)
+  {
+    uint32_t n = Rec->NumPeaks[ch] < SM500_MAX_PEAKS_PER_CHANNEL ? Rec->NumPeaks[ch] : SM500_MAX_PEAKS_PER_CHANNEL;
+    uint32_t *out = Frame + sm500_peaks_format::ChannelOffset32(ch);
+
+    Frame[sm500_peaks_format::PeakCountOffset32 + ch] = n;
+    memcpy(out, peaks, n * sizeof(uint32_t));
+    if (FrameCounts[ch] > n)
+      memset(out + n, 0, (FrameCounts[ch] - n) * sizeof(uint32_t));
+    FrameCounts[ch] = (uint8_t)n;
+    peaks += n;
+  }
+}
+
+
+
+/* ===========================================================================
+=========================================================================== */
+//----------  ----------
+//----------  ----------
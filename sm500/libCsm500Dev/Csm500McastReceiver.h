@@ -0,0 +1,145 @@
+/* ===========================================================================
+ Csm500McastReceiver.h
+ sm500 UDP multicast peaks receiver class definition
+
+ Joins the group of a Csm500McastPublisher and rebuilds its frames as
+ peaks DMA buffers: GetPeaksData() returns them one at a time, in the
+ layout of sm500_data_structures.h, so Csm500PeaksFrame and the peak
+ decoding code work on them unchanged.  Only the fields the publisher
+ sends are rebuilt (S/N, status, peak counts, timestamp and the valid
+ peaks); the rest of the buffer reads as zero.
+
+ Gaps are detected on the hardware serial numbers: a frame whose S/N is
+ not the previous one plus one is reported (statistics, and the gap
+ callback if set) along with the # of datagrams lost on the network since
+ the previous frame.  A gap with no datagram lost was already in the
+ stream the publisher was fed (e.g. frames dropped by the driver).
+ Datagrams arriving late or twice are discarded.  A publisher restart, or
+ an S/N going backwards, resynchronizes the receiver without a gap.
+
+ The callback runs on the thread calling GetPeaksData().
+
+ Jerry Volcy
+
+ Copyright (c) 2013, Micron Optics, Inc.
+=========================================================================== */
+
+#ifndef CSM500MCASTRECEIVER_H
+#define CSM500MCASTRECEIVER_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+#include <stdint.h>
+#include "sm500_data_structures.h"
+#include "Csm500McastPublisher.h"
+
+/* ===========================================================================
+Constants
+=========================================================================== */
+#define SM500_MCAST_RECV_BATCH        32          //datagrams per recvmmsg()
+
+
+/* ===========================================================================
+Defaults
+=========================================================================== */
+#define SM500_DEFAULT_MCAST_RCVBUF    (4 << 20)   //socket receive buffer, bytes
+
+
+/* ===========================================================================
+Gap report
+=========================================================================== */
+struct sm500_mcast_gap
+{
+  uint64_t FirstSerialNumber;     //first missing frame
+  uint64_t NumFrames;             //# of missing frames
+  uint32_t LostDatagrams;         //datagrams lost on the network (0: the frames were never published)
+};
+
+
+/* ===========================================================================
+Receiver statistics
+=========================================================================== */
+struct sm500_mcast_receiver_stats
+{
+  uint64_t Frames;                //frames returned
+  uint64_t Datagrams;             //datagrams accepted
+  uint64_t LostDatagrams;         //datagram counter gaps
+  uint64_t Gaps;                  //S/N gaps reported
+  uint64_t MissedFrames;          //frames missing in those gaps
+  uint64_t Late;                  //datagrams discarded as late or duplicate
+  uint64_t Malformed;             //datagrams that are not from a publisher
+  uint64_t Resyncs;               //publisher restarts and S/N going backwards
+};
+
+
+/* ===========================================================================
+Csm500McastReceiver class definition
+=========================================================================== */
+class Csm500McastReceiver
+{
+  public:
+    typedef void (*gap_callback_t)(void *Context, const sm500_mcast_gap &Gap);
+
+    //----------  ----------
+    Csm500McastReceiver();                  //constructor
+    virtual ~Csm500McastReceiver();         //destructor
+    void SetReceiveBuffer(uint32_t Bytes);  //socket receive buffer (applies to the next Open())
+    void SetTimeout(int Milliseconds);      //GetPeaksData() throws ETIMEDOUT after waiting that long (-1 = forever)
+    void SetGapCallback(gap_callback_t Callback, void *Context);
+    void Open(const char *Group = SM500_DEFAULT_MCAST_GROUP, uint16_t Port = SM500_DEFAULT_MCAST_PORT,
+              const char *Interface = 0);   //joins Group on Interface (address; 0 = as routed) and listens on Port
+    void Close(void);
+    const void* GetPeaksData(void);         //waits for the next frame and returns it as a peaks DMA buffer
+    void CancelReads(void);                 //releases a blocked (or the next) GetPeaksData(): it throws ECANCELED
+    void GetStats(sm500_mcast_receiver_stats &Stats);
+
+  protected:
+    bool NextDatagram(void);                //false when the received batch is used up
+    void Receive(void);                     //waits for and receives a batch of datagrams
+    void Rebuild(const sm500_mcast_frame *Rec, uint64_t SerialNumber);
+
+    int Fd;
+    int EventFd;                            //written by CancelReads()
+    uint32_t ReceiveBuffer;
+    int Timeout;
+    gap_callback_t GapCallback;
+    void *GapContext;
+
+    //---------- received batch ----------
+    vector<uint8_t> Buffers;                //SM500_MCAST_RECV_BATCH datagrams of SM500_MCAST_MAX_DATAGRAM bytes
+    uint32_t Lengths[SM500_MCAST_RECV_BATCH];
+    uint32_t NumReceived;
+    uint32_t NextIndex;                     //next datagram of the batch
+
+    //---------- datagram being read ----------
+    const uint8_t *Cursor;                  //next frame record
+    const uint8_t *End;
+    uint32_t FramesLeft;
+    uint64_t DatagramSerialNumber;
+
+    //---------- continuity ----------
+    bool bSynced;                           //a frame was returned since the last resync
+    bool bSourceKnown;
+    uint32_t Source;
+    uint32_t NextSequence;
+    uint32_t PendingLost;                   //datagrams lost since the last frame returned
+    uint64_t LastSerialNumber;
+
+    uint32_t Frame[sm500_peaks_format::FrameDwords];   //rebuilt DMA buffer
+    uint8_t FrameCounts[SM500_NUM_CHANNELS];            //peaks held in Frame (the rest is zero)
+
+    sm500_mcast_receiver_stats Stats;
+};
+
+#endif // #ifndef CSM500MCASTRECEIVER_H
+
+
+
+/* ===========================================================================
+=========================================================================== */
+//----------  ----------
+//----------  ----------
@@ -0,0 +1,448 @@
+/* ===========================================================================
+ Csm500PeakCodec.cpp
+ sm500 peaks frame codec class implementation
+
+ The kernels work on one block of 32 values.  Packing subtracts the
+ prediction, zig-zag codes the difference, ORs the block together to find
+ its width and extracts the bit planes with movemask (bit j of every lane
+ shifted into the sign bit).  Unpacking broadcasts each plane, isolates
+ the bit of every lane and ORs it back into place, then undoes the zig-zag
+ and adds the prediction.  All flavors produce the same planes.
+
+ Jerry Volcy
+
+ Copyright (c) 2013, Micron Optics, Inc.
+=========================================================================== */
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+#include <errno.h>
+#include <string.h>
+#include "Csm500PeakCodec.h"
+#include "sm500_common.h"
+
+static const uint32_t Zero[SM500_PEAK_CODEC_NUM_SLOTS] SM500_ALIGN(SM500_SIMD_ALIGN) = { 0 };
+
+
+/* ===========================================================================
+Scalar kernels
+=========================================================================== */
+static uint32_t PackScalar(const uint32_t *In, const uint32_t *Pred, uint32_t *Planes)
+{
+  uint32_t zz[SM500_PEAK_CODEC_BLOCK];
+  uint32_t all = 0, width = 0;
+
+  for (uint32_t i=0; i<SM500_PEAK_CODEC_BLOCK; i++)
+  {
+    uint32_t d = In[i] - Pred[i];
+    zz[i] = (d << 1) ^ (uint32_t)((int32_t)d >> 31);
+    all |= zz[i];
+  }
+  if (all)
+    width = 32 - __builtin_clz(all);
+
+  for (uint32_t j=0; j<width; j++)
+  {
+    uint32_t w = 0;
+    for (uint32_t i=0; i<SM500_PEAK_CODEC_BLOCK; i++)
+      w |= ((zz[i] >> j) & 1) << i;
+    Planes[j] = w;
+  }
+  return width;
+}
+
+static void UnpackScalar(const uint32_t *Planes, uint32_t Width, const uint32_t *Pred, uint32_t *Out)
+{
+  for (uint32_t i=0; i<SM500_PEAK_CODEC_BLOCK; i++)
+  {
+    uint32_t zz = 0;
+    for (uint32_t j=0; j<Width; j++)
+      zz |= ((Planes[j] >> i) & 1) << j;
+    Out[i] = Pred[i] + ((zz >> 1) ^ (0 - (zz & 1)));
+  }
+}
+
+
+#ifdef SM500_HAVE_X86_SIMD
+/* ===========================================================================
+SSE2 kernels (8 vectors of 4 values)
+=========================================================================== */
+SM500_TARGET_SSE2
+static uint32_t PackSse2(const uint32_t *In, const uint32_t *Pred, uint32_t *Planes)
+{
+  __m128i zz[8];
+  __m128i all = _mm_setzero_si128();
+  uint32_t width = 0;
+
+  for (int k=0; k<8; k++)
+  {
+    __m128i d = _mm_sub_epi32(_mm_loadu_si128((const __m128i*)(In + 4*k)), _mm_loadu_si128((const __m128i*)(Pred + 4*k)));
+    zz[k] = _mm_xor_si128(_mm_slli_epi32(d, 1), _mm_srai_epi32(d, 31));
+    all = _mm_or_si128(all, zz[k]);
+  }
+  all = _mm_or_si128(all, _mm_shuffle_epi32(all, _MM_SHUFFLE(1, 0, 3, 2)));
+  all = _mm_or_si128(all, _mm_shuffle_epi32(all, _MM_SHUFFLE(2, 3, 0, 1)));
+  uint32_t a = (uint32_t)_mm_cvtsi128_si32(all);
+  if (a)
+    width = 32 - __builtin_clz(a);
+
+  for (uint32_t j=0; j<width; j++)
+  {
+    __m128i shift = _mm_cvtsi32_si128(31 - j);
+    uint32_t w = 0;
+    for (int k=0; k<8; k++)
+      w |= (uint32_t)_mm_movemask_ps(_mm_castsi128_ps(_mm_sll_epi32(zz[k], shift))) << (4*k);
+    Planes[j] = w;
+  }
+  return width;
+}
+
+SM500_TARGET_SSE2
+static void UnpackSse2(const uint32_t *Planes, uint32_t Width, const uint32_t *Pred, uint32_t *Out)
+{
+  const __m128i one = _mm_set1_epi32(1);
+  __m128i zz[8], lane[8];
+
+  for (int k=0; k<8; k++)
+  {
+    lane[k] = _mm_setr_epi32(1 << (4*k), 1 << (4*k + 1), 1 << (4*k + 2), (int)(1u << (4*k + 3)));
+    zz[k] = _mm_setzero_si128();
+  }
+
+  for (uint32_t j=0; j<Width; j++)
+  {
+    __m128i plane = _mm_set1_epi32((int)Planes[j]);
+    __m128i bit = _mm_sll_epi32(one, _mm_cvtsi32_si128(j));
+    for (int k=0; k<8; k++)
+    {
+      __m128i set = _mm_cmpeq_epi32(_mm_and_si128(plane, lane[k]), lane[k]);
+      zz[k] = _mm_or_si128(zz[k], _mm_and_si128(set, bit));
+    }
+  }
+
+  for (int k=0; k<8; k++)
+  {
+    __m128i d = _mm_xor_si128(_mm_srli_epi32(zz[k], 1), _mm_sub_epi32(_mm_setzero_si128(), _mm_and_si128(zz[k], one)));
+    _mm_storeu_si128((__m128i*)(Out + 4*k), _mm_add_epi32(_mm_loadu_si128((const __m128i*)(Pred + 4*k)), d));
+  }
+}
+
+
+/* ===========================================================================
+AVX2 kernels (4 vectors of 8 values)
+=========================================================================== */
+SM500_TARGET_AVX2
+static uint32_t PackAvx2(const uint32_t *In, const uint32_t *Pred, uint32_t *Planes)
+{
+  __m256i zz[4];
+  __m256i all = _mm256_setzero_si256();
+  uint32_t width = 0;
+
+  for (int k=0; k<4; k++)
+  {
+    __m256i d = _mm256_sub_epi32(_mm256_loadu_si256((const __m256i*)(In + 8*k)), _mm256_loadu_si256((const __m256i*)(Pred + 8*k)));
+    zz[k] = _mm256_xor_si256(_mm256_slli_epi32(d, 1), _mm256_srai_epi32(d, 31));
+    all = _mm256_or_si256(all, zz[k]);
+  }
+  __m128i a4 = _mm_or_si128(_mm256_castsi256_si128(all), _mm256_extracti128_si256(all, 1));
+  a4 = _mm_or_si128(a4, _mm_shuffle_epi32(a4, _MM_SHUFFLE(1, 0, 3, 2)));
+  a4 = _mm_or_si128(a4, _mm_shuffle_epi32(a4, _MM_SHUFFLE(2, 3, 0, 1)));
+  uint32_t a = (uint32_t)_mm_cvtsi128_si32(a4);
+  if (a)
+    width = 32 - __builtin_clz(a);
+
+  for (uint32_t j=0; j<width; j++)
+  {
+    __m128i shift = _mm_cvtsi32_si128(31 - j);
+    uint32_t w = 0;
+    for (int k=0; k<4; k++)
+      w |= (uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_sll_epi32(zz[k], shift))) << (8*k);
+    Planes[j] = w;
+  }
+
+  _mm256_zeroupper();
+  return width;
+}
+
+SM500_TARGET_AVX2
+static void UnpackAvx2(const uint32_t *Planes, uint32_t Width, const uint32_t *Pred, uint32_t *Out)
+{
+  const __m256i one = _mm256_set1_epi32(1);
+  __m256i zz[4], lane[4];
+
+  for (int k=0; k<4; k++)
+  {
+    lane[k] = _mm256_setr_epi32(8*k, 8*k + 1, 8*k + 2, 8*k + 3, 8*k + 4, 8*k + 5, 8*k + 6, 8*k + 7);
+    zz[k] = _mm256_setzero_si256();
+  }
+
+  for (uint32_t j=0; j<Width; j++)
+  {
+    __m256i plane = _mm256_set1_epi32((int)Planes[j]);
+    __m128i shift = _mm_cvtsi32_si128(j);
+    for (int k=0; k<4; k++)
+    {
+      __m256i bit = _mm256_and_si256(_mm256_srlv_epi32(plane, lane[k]), one);
+      zz[k] = _mm256_or_si256(zz[k], _mm256_sll_epi32(bit, shift));
+    }
+  }
+
+  for (int k=0; k<4; k++)
+  {
+    __m256i d = _mm256_xor_si256(_mm256_srli_epi32(zz[k], 1), _mm256_sub_epi32(_mm256_setzero_si256(), _mm256_and_si256(zz[k], one)));
+    _mm256_storeu_si256((__m256i*)(Out + 8*k), _mm256_add_epi32(_mm256_loadu_si256((const __m256i*)(Pred + 8*k)), d));
+  }
+
+  _mm256_zeroupper();
+}
+#endif
+
+
+/* ===========================================================================
+Csm500PeakCodec constructor
+=========================================================================== */
+Csm500PeakCodec::Csm500PeakCodec()
+{
+  memset(State, 0, sizeof(State));
+  Cur = &State[0];
+  Prev = &State[1];
+  Prev2 = &State[2];
+  Sequence = 0;
+  KeyframeInterval = SM500_DEFAULT_PEAK_CODEC_KEYFRAME_INTERVAL;
+  Reset();
+  SetSimdLevel(sm500_detect_simd());
+}
+
+
+/* ===========================================================================
+destructor
+=========================================================================== */
+Csm500PeakCodec::~Csm500PeakCodec()
+{
+}
+
+
+/* ===========================================================================
+Sets the keyframe interval of the encoder.  0 codes the first frame (and
+the first after a Reset()) as a keyframe only.
+=========================================================================== */
+void Csm500PeakCodec::SetKeyframeInterval(uint32_t Frames)
+{
+  KeyframeInterval = Frames;
+}
+
+
+/* ===========================================================================
+Forgets the previous frames.  The encoder then emits a keyframe; the
+decoder drops delta frames until it receives one (e.g. after seeking).
+=========================================================================== */
+void Csm500PeakCodec::Reset(void)
+{
+  bSynced = false;
+  SinceKeyframe = 0;
+}
+
+
+/* ===========================================================================
+Forces a kernel flavor.  Requests beyond what the CPU supports are clamped
+to the best supported flavor.
+=========================================================================== */
+void Csm500PeakCodec::SetSimdLevel(sm500_simd_level level)
+{
+  sm500_simd_level supported = sm500_detect_simd();
+
+  if (level > supported)
+    level = supported;
+
+  SimdLevel = level;
+  switch (level)
+  {
+#ifdef SM500_HAVE_X86_SIMD
+    case SM500_SIMD_AVX2: Pack = PackAvx2; Unpack = UnpackAvx2; break;
+    case SM500_SIMD_SSE2: Pack = PackSse2; Unpack = UnpackSse2; break;
+#endif
+    default:              Pack = PackScalar; Unpack = UnpackScalar; break;
+  }
+}
+
+
+/* ===========================================================================
+Returns the kernel flavor in use
+=========================================================================== */
+sm500_simd_level Csm500PeakCodec::GetSimdLevel(void)
+{
+  return SimdLevel;
+}
+
+
+/* ===========================================================================
+Returns true if an encoded frame is a keyframe
+=========================================================================== */
+bool Csm500PeakCodec::IsKeyframe(const void *In)
+{
+  return (((const sm500_peak_codec_header*)In)->Flags & SM500_PEAK_CODEC_KEYFRAME) != 0;
+}
+
+
+/* ===========================================================================
+Header prediction: 2*previous - the one before (wraps like the counters
+do).  Right after a keyframe both are the keyframe, which predicts no
+change.
+=========================================================================== */
+void Csm500PeakCodec::PredictHeader(bool Key)
+{
+  if (Key)
+    memset(PredHeader, 0, sizeof(PredHeader));
+  else
+    for (uint32_t i=0; i<SM500_DMA_HEADER_DWORDS; i++)
+      PredHeader[i] = 2 * Prev->Header[i] - Prev2->Header[i];
+}
+
+
+/* ===========================================================================
+The current frame becomes the previous one (and, for a keyframe, the one
+before as well); the current frame moves to the buffer left free.
+=========================================================================== */
+void Csm500PeakCodec::Rotate(bool Key)
+{
+  Prev2 = Key ? Cur : Prev;
+  Prev = Cur;
+  for (int i=0; i<3; i++)
+    if ((&State[i] != Prev) && (&State[i] != Prev2))
+    {
+      Cur = &State[i];
+      break;
+    }
+}
+
+
+/* ===========================================================================
+Encodes a peaks buffer into Out (SM500_PEAK_CODEC_MAX_BYTES, 4-byte
+aligned).  Returns the size of the encoded frame.
+=========================================================================== */
+uint32_t Csm500PeakCodec::Encode(const void *PeaksData, void *Out)
+{
+  const uint32_t *in = (const uint32_t*)PeaksData;
+  const uint32_t *peaks = in + sm500_peaks_format::DataOffset32;
+  sm500_peak_codec_header *header = (sm500_peak_codec_header*)Out;
+  uint8_t *width = (uint8_t*)(header + 1);
+  uint32_t *planes = (uint32_t*)(width + SM500_PEAK_CODEC_BLOCKS);
+  bool key = !bSynced || (KeyframeInterval && (SinceKeyframe >= KeyframeInterval));
+  uint32_t b = 0;
+
+  //---------- split ----------
+  memcpy(Cur->Header, in, sizeof(Cur->Header));
+  for (uint32_t i=0; i<SM500_PEAK_CODEC_NUM_SLOTS; i++)
+  {
+    Cur->Position[i] = peaks[i] >> SM500_PEAK_POS_SHIFT;
+    Cur->Amplitude[i] = peaks[i] & SM500_PEAK_AMP_MASK;
+  }
+
+  //---------- pack ----------
+  PredictHeader(key);
+  const uint32_t *pred_pos = key ? Zero : Prev->Position;
+  const uint32_t *pred_amp = key ? Zero : Prev->Amplitude;
+
+  for (uint32_t i=0; i<SM500_DMA_HEADER_DWORDS; i+=SM500_PEAK_CODEC_BLOCK, b++)
+  {
+    width[b] = Pack(Cur->Header + i, PredHeader + i, planes);
+    planes += width[b];
+  }
+  for (uint32_t i=0; i<SM500_PEAK_CODEC_NUM_SLOTS; i+=SM500_PEAK_CODEC_BLOCK, b++)
+  {
+    width[b] = Pack(Cur->Position + i, pred_pos + i, planes);
+    planes += width[b];
+  }
+  for (uint32_t i=0; i<SM500_PEAK_CODEC_NUM_SLOTS; i+=SM500_PEAK_CODEC_BLOCK, b++)
+  {
+    width[b] = Pack(Cur->Amplitude + i, pred_amp + i, planes);
+    planes += width[b];
+  }
+
+  header->Bytes = (uint32_t)((uint8_t*)planes - (uint8_t*)Out);
+  header->Magic = SM500_PEAK_CODEC_MAGIC;
+  header->Flags = key ? SM500_PEAK_CODEC_KEYFRAME : 0;
+  header->Sequence = Sequence++;
+
+  Rotate(key);
+  SinceKeyframe = key ? 1 : SinceKeyframe + 1;
+  bSynced = true;
+  return header->Bytes;
+}
+
+
+/* ===========================================================================
+Decodes an encoded frame of Bytes bytes (4-byte aligned) into PeaksData
+(sm500_peaks_format::FrameBytes).  Returns false, leaving PeaksData alone,
+for a delta frame whose reference frame was not decoded: before the first
+keyframe, after Reset() or after a gap in the sequence.  Throws EPROTO for
+a malformed frame.
+=========================================================================== */
+bool Csm500PeakCodec::Decode(const void *In, uint32_t Bytes, void *PeaksData)
+{
+  const sm500_peak_codec_header *header = (const sm500_peak_codec_header*)In;
+  const uint8_t *width = (const uint8_t*)(header + 1);
+  const uint32_t *planes = (const uint32_t*)(width + SM500_PEAK_CODEC_BLOCKS);
+  uint32_t *out = (uint32_t*)PeaksData;
+  uint32_t *peaks = out + sm500_peaks_format::DataOffset32;
+  uint64_t expected = sizeof(sm500_peak_codec_header) + SM500_PEAK_CODEC_BLOCKS;
+  uint32_t b = 0;
+
+  if ((Bytes < expected) || (header->Magic != SM500_PEAK_CODEC_MAGIC) || (header->Bytes != Bytes))
+    throw EPROTO;
+  for (uint32_t i=0; i<SM500_PEAK_CODEC_BLOCKS; i++)
+  {
+    if (width[i] > 32)
+      throw EPROTO;
+    expected += width[i] * sizeof(uint32_t);
+  }
+  if (expected != Bytes)
+    throw EPROTO;
+
+  bool key = (header->Flags & SM500_PEAK_CODEC_KEYFRAME) != 0;
+  if (!key && !(bSynced && (header->Sequence == Sequence + 1)))
+  {
+    bSynced = false;
+    return false;
+  }
+
+  //---------- unpack ----------
+  PredictHeader(key);
+  const uint32_t *pred_pos = key ? Zero : Prev->Position;
+  const uint32_t *pred_amp = key ? Zero : Prev->Amplitude;
+
+  for (uint32_t i=0; i<SM500_DMA_HEADER_DWORDS; i+=SM500_PEAK_CODEC_BLOCK, b++)
+  {
+    Unpack(planes, width[b], PredHeader + i, Cur->Header + i);
+    planes += width[b];
+  }
+  for (uint32_t i=0; i<SM500_PEAK_CODEC_NUM_SLOTS; i+=SM500_PEAK_CODEC_BLOCK, b++)
+  {
+    Unpack(planes, width[b], pred_pos + i, Cur->Position + i);
+    planes += width[b];
+  }
+  for (uint32_t i=0; i<SM500_PEAK_CODEC_NUM_SLOTS; i+=SM500_PEAK_CODEC_BLOCK, b++)
+  {
+    Unpack(planes, width[b], pred_amp + i, Cur->Amplitude + i);
+    planes += width[b];
+  }
+
+  //---------- merge ----------
+  memcpy(out, Cur->Header, sizeof(Cur->Header));
+  for (uint32_t i=0; i<SM500_PEAK_CODEC_NUM_SLOTS; i++)
+    peaks[i] = (Cur->Position[i] << SM500_PEAK_POS_SHIFT) | (Cur->Amplitude[i] & SM500_PEAK_AMP_MASK);
+
+  Rotate(key);
+  Sequence = header->Sequence;
+  bSynced = true;
+  return true;
+}
+
+
+
+/* ===========================================================================
+=========================================================================== */
+//----------  ----------
+//----------  ----------
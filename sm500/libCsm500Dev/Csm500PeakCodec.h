@@ -0,0 +1,139 @@
+/* ===========================================================================
+ Csm500PeakCodec.h
+ sm500 peaks frame codec class definition
+
+ Lossless compression of peaks DMA buffers.  From one frame to the next the
+ same sensors move by a few pm, so each word is coded as the difference
+ from a prediction made from the previous frames:
+
+ - header words: linear prediction from the two previous frames (the S/N
+   and the timestamp advance by a near constant step)
+ - peak words: the position and the amplitude fields separately, each
+   predicted by the same channel and slot of the previous frame
+
+ The differences are zig-zag coded (small magnitudes, either sign, become
+ small unsigned values) and bit-packed in blocks of 32: a block of width b
+ is stored as b 32-bit bit planes, plane j holding bit j of the 32 values.
+ The planes are built and expanded with SIMD kernels (AVX2 or SSE2, with a
+ scalar fallback); the format does not depend on the kernel.
+
+ A keyframe is coded against zero and needs no previous frame, so a stream
+ can be entered at any keyframe.  The encoder emits one every
+ KeyframeInterval frames; the decoder refuses delta frames until it has
+ seen a keyframe, and again after a frame went missing (sequence numbers
+ not consecutive).
+
+ Encoded frame:
+
+   sm500_peak_codec_header
+   uint8_t  Width[SM500_PEAK_CODEC_BLOCKS]     bits per value of each block
+   uint32_t Planes[]                           the blocks' bit planes
+
+ The decoded frame is bit for bit the frame that was encoded, including the
+ unused peak slots.  An instance encodes or decodes a single stream.
+
+ Jerry Volcy
+
+ Copyright (c) 2013, Micron Optics, Inc.
+=========================================================================== */
+
+#ifndef CSM500PEAKCODEC_H
+#define CSM500PEAKCODEC_H
+
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+#include <stdint.h>
+#include "sm500_data_structures.h"
+#include "sm500_simd.h"
+
+/* ===========================================================================
+Constants
+=========================================================================== */
+#define SM500_PEAK_CODEC_MAGIC        0x4350      //"PC"
+#define SM500_PEAK_CODEC_KEYFRAME     0x0001      //flag: coded against zero
+#define SM500_PEAK_CODEC_BLOCK        32          //values per bit-packed block
+#define SM500_PEAK_CODEC_NUM_SLOTS    (SM500_NUM_CHANNELS * SM500_MAX_PEAKS_PER_CHANNEL)
+#define SM500_PEAK_CODEC_BLOCKS       ((SM500_DMA_HEADER_DWORDS + 2 * SM500_PEAK_CODEC_NUM_SLOTS) / SM500_PEAK_CODEC_BLOCK)
+#define SM500_PEAK_CODEC_MAX_BYTES    (sizeof(sm500_peak_codec_header) + SM500_PEAK_CODEC_BLOCKS * (1 + 32 * 4))
+
+static_assert(SM500_DMA_HEADER_DWORDS % SM500_PEAK_CODEC_BLOCK == 0, "header must be a whole # of blocks");
+static_assert(SM500_PEAK_CODEC_NUM_SLOTS % SM500_PEAK_CODEC_BLOCK == 0, "peak slots must be a whole # of blocks");
+static_assert(SM500_PEAK_CODEC_BLOCKS % 4 == 0, "the bit planes must stay 4-byte aligned");
+
+
+/* ===========================================================================
+Defaults
+=========================================================================== */
+#define SM500_DEFAULT_PEAK_CODEC_KEYFRAME_INTERVAL   1000    //frames (1 s at 1 kHz)
+
+
+/* ===========================================================================
+Encoded frame header
+=========================================================================== */
+struct sm500_peak_codec_header
+{
+  uint32_t Bytes;                 //encoded frame size, this header included
+  uint16_t Magic;                 //SM500_PEAK_CODEC_MAGIC
+  uint16_t Flags;                 //SM500_PEAK_CODEC_KEYFRAME
+  uint32_t Sequence;              //frame counter of the encoder
+};
+
+
+/* ===========================================================================
+Csm500PeakCodec class definition
+=========================================================================== */
+class Csm500PeakCodec
+{
+  public:
+    //----------  ----------
+    Csm500PeakCodec();                      //constructor
+    virtual ~Csm500PeakCodec();             //destructor
+    void SetKeyframeInterval(uint32_t Frames);  //a keyframe every Frames frames (0 = first frame only)
+    void Reset(void);                       //forgets the previous frames: the next frame is (or must be) a keyframe
+    uint32_t Encode(const void *PeaksData, void *Out);  //encodes a peaks buffer; Out holds SM500_PEAK_CODEC_MAX_BYTES; returns the size
+    bool Decode(const void *In, uint32_t Bytes, void *PeaksData);  //decodes a frame; false until a keyframe arrives
+    static bool IsKeyframe(const void *In);
+    void SetSimdLevel(sm500_simd_level level);  //forces a kernel flavor (clamped to what the CPU supports)
+    sm500_simd_level GetSimdLevel(void);        //returns the kernel flavor in use
+
+    //one block: 32 values less their prediction, zig-zag coded; returns the width and writes that many planes
+    typedef uint32_t (*pack_kernel_t)(const uint32_t *In, const uint32_t *Pred, uint32_t *Planes);
+    //one block: Width planes in, prediction added back
+    typedef void (*unpack_kernel_t)(const uint32_t *Planes, uint32_t Width, const uint32_t *Pred, uint32_t *Out);
+
+  protected:
+    struct codec_state                      //a frame, split in streams
+    {
+      uint32_t Header[SM500_DMA_HEADER_DWORDS] SM500_ALIGN(SM500_SIMD_ALIGN);
+      uint32_t Position[SM500_PEAK_CODEC_NUM_SLOTS] SM500_ALIGN(SM500_SIMD_ALIGN);
+      uint32_t Amplitude[SM500_PEAK_CODEC_NUM_SLOTS] SM500_ALIGN(SM500_SIMD_ALIGN);
+    };
+
+    void PredictHeader(bool Key);           //fills PredHeader from the previous frames
+    void Rotate(bool Key);                  //the current frame becomes the previous one
+
+    codec_state State[3];                   //current, previous and the one before
+    codec_state *Cur;
+    codec_state *Prev;
+    codec_state *Prev2;
+    uint32_t PredHeader[SM500_DMA_HEADER_DWORDS] SM500_ALIGN(SM500_SIMD_ALIGN);
+    bool bSynced;                           //previous frames valid
+    uint32_t Sequence;                      //of the next frame (encoder) or of the last frame (decoder)
+    uint32_t KeyframeInterval;
+    uint32_t SinceKeyframe;                 //frames encoded since the last keyframe
+    sm500_simd_level SimdLevel;
+    pack_kernel_t Pack;
+    unpack_kernel_t Unpack;
+};
+
+#endif // #ifndef CSM500PEAKCODEC_H
+
+
+
+/* ===========================================================================
+=========================================================================== */
+//----------  ----------
+//----------  ----------
@@ -0,0 +1,261 @@
+/* ===========================================================================
+ Csm500PeakDecoder.cpp
+ sm500 peak word decoder class implementation
+
+ Each kernel decodes one channel block.  The position is the upper 20 bits
+ of the peak word (20.4 fixed point) less the channel's distance
+ compensation offset, the amplitude the lower 12 bits, and the wavelength
+ is the calibration polynomial evaluated at the position with Horner's
+ rule.  All flavors perform the same float operations in the same order,
+ so they produce identical results.
+
+ Jerry Volcy
+
+ Copyright (c) 2013, Micron Optics, Inc.
+=========================================================================== */
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+#include <errno.h>
+#include <string.h>
+#include "Csm500PeakDecoder.h"
+#include "sm500_common.h"
+
+//the kernels evaluate the cubic unrolled; loop Horner's rule before raising the order
+static_assert(SM500_CAL_ORDER == 3, "the decode kernels are written for a cubic calibration");
+
+
+/* ===========================================================================
+Scalar kernel
+=========================================================================== */
+static void DecodeScalar(const uint32_t *In, uint32_t n, const float *Coef, float Offset,
+                         float *Position, float *Wavelength, float *Amplitude)
+{
+  const float scale = 1.0f / (1 << SM500_PEAK_POS_FRAC_BITS);
+
+  for (uint32_t i=0; i<n; i++)
+  {
+    float x = (float)(int32_t)(In[i] >> SM500_PEAK_POS_SHIFT) * scale - Offset;
+    float wl = Coef[3];
+    wl = wl * x + Coef[2];
+    wl = wl * x + Coef[1];
+    wl = wl * x + Coef[0];
+
+    Position[i] = x;
+    Wavelength[i] = wl;
+    Amplitude[i] = (float)(int32_t)(In[i] & SM500_PEAK_AMP_MASK);
+  }
+}
+
+
+#ifdef SM500_HAVE_X86_SIMD
+/* ===========================================================================
+SSE2 kernel (4 peaks per iteration)
+=========================================================================== */
+SM500_TARGET_SSE2
+static void DecodeSse2(const uint32_t *In, uint32_t n, const float *Coef, float Offset,
+                       float *Position, float *Wavelength, float *Amplitude)
+{
+  const __m128 scale = _mm_set1_ps(1.0f / (1 << SM500_PEAK_POS_FRAC_BITS));
+  const __m128i amp_mask = _mm_set1_epi32(SM500_PEAK_AMP_MASK);
+  const __m128 offset = _mm_set1_ps(Offset);
+  const __m128 c0 = _mm_set1_ps(Coef[0]);
+  const __m128 c1 = _mm_set1_ps(Coef[1]);
+  const __m128 c2 = _mm_set1_ps(Coef[2]);
+  const __m128 c3 = _mm_set1_ps(Coef[3]);
+  uint32_t i = 0;
+
+  for (; i+4<=n; i+=4)
+  {
+    __m128i w = _mm_loadu_si128((const __m128i*)(In + i));
+    __m128 x = _mm_sub_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(w, SM500_PEAK_POS_SHIFT)), scale), offset);
+    __m128 wl = c3;
+    wl = _mm_add_ps(_mm_mul_ps(wl, x), c2);
+    wl = _mm_add_ps(_mm_mul_ps(wl, x), c1);
+    wl = _mm_add_ps(_mm_mul_ps(wl, x), c0);
+
+    _mm_storeu_ps(Position + i, x);
+    _mm_storeu_ps(Wavelength + i, wl);
+    _mm_storeu_ps(Amplitude + i, _mm_cvtepi32_ps(_mm_and_si128(w, amp_mask)));
+  }
+
+  DecodeScalar(In + i, n - i, Coef, Offset, Position + i, Wavelength + i, Amplitude + i);
+}
+
+
+/* ===========================================================================
+AVX2 kernel (8 peaks per iteration)
+=========================================================================== */
+SM500_TARGET_AVX2
+static void DecodeAvx2(const uint32_t *In, uint32_t n, const float *Coef, float Offset,
+                       float *Position, float *Wavelength, float *Amplitude)
+{
+  const __m256 scale = _mm256_set1_ps(1.0f / (1 << SM500_PEAK_POS_FRAC_BITS));
+  const __m256i amp_mask = _mm256_set1_epi32(SM500_PEAK_AMP_MASK);
+  const __m256 offset = _mm256_set1_ps(Offset);
+  const __m256 c0 = _mm256_set1_ps(Coef[0]);
+  const __m256 c1 = _mm256_set1_ps(Coef[1]);
+  const __m256 c2 = _mm256_set1_ps(Coef[2]);
+  const __m256 c3 = _mm256_set1_ps(Coef[3]);
+  uint32_t i = 0;
+
+  for (; i+8<=n; i+=8)
+  {
+    __m256i w = _mm256_loadu_si256((const __m256i*)(In + i));
+    __m256 x = _mm256_sub_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(w, SM500_PEAK_POS_SHIFT)), scale), offset);
+    __m256 wl = c3;
+    wl = _mm256_add_ps(_mm256_mul_ps(wl, x), c2);
+    wl = _mm256_add_ps(_mm256_mul_ps(wl, x), c1);
+    wl = _mm256_add_ps(_mm256_mul_ps(wl, x), c0);
+
+    _mm256_storeu_ps(Position + i, x);
+    _mm256_storeu_ps(Wavelength + i, wl);
+    _mm256_storeu_ps(Amplitude + i, _mm256_cvtepi32_ps(_mm256_and_si256(w, amp_mask)));
+  }
+
+  _mm256_zeroupper();    //avoid the AVX to SSE transition penalty in the tail
+  DecodeSse2(In + i, n - i, Coef, Offset, Position + i, Wavelength + i, Amplitude + i);
+}
+#endif
+
+
+/* ===========================================================================
+Csm500PeakDecoder constructor
+=========================================================================== */
+Csm500PeakDecoder::Csm500PeakDecoder()
+{
+  //nominal calibration: a linear sweep across the FS axis
+  double nominal[SM500_CAL_ORDER + 1] = { SM500_DEFAULT_WL_START, SM500_DEFAULT_WL_SPAN / SM500_NUM_FS_POINTS };    //higher terms zero
+
+  for (uint32_t ch=0; ch<SM500_NUM_CHANNELS; ch++)
+    SetCalibration(ch, nominal);
+
+  for (uint32_t ch=0; ch<SM500_NUM_CHANNELS; ch++)
+    PositionOffset[ch] = 0.0f;
+
+  Calibration = 0;
+  SetSimdLevel(sm500_detect_simd());
+}
+
+
+/* ===========================================================================
+destructor
+=========================================================================== */
+Csm500PeakDecoder::~Csm500PeakDecoder()
+{
+}
+
+
+/* ===========================================================================
+Sets the position-to-wavelength polynomial of a channel.  Coef must hold
+SM500_CAL_ORDER+1 coefficients, constant term first.
+=========================================================================== */
+void Csm500PeakDecoder::SetCalibration(uint32_t ch, const double *Coef)
+{
+  if (ch >= SM500_NUM_CHANNELS)
+    throw EINVAL;
+
+  for (int i=0; i<=SM500_CAL_ORDER; i++)
+    this->Coef[ch][i] = (float)Coef[i];
+}
+
+
+/* ===========================================================================
+Sets the position offset (FS samples) subtracted from every decoded peak
+position of a channel; see Csm500DistanceComp
+=========================================================================== */
+void Csm500PeakDecoder::SetPositionOffset(uint32_t ch, float Offset)
+{
+  if (ch >= SM500_NUM_CHANNELS)
+    throw EINVAL;
+
+  PositionOffset[ch] = Offset;
+}
+
+
+/* ===========================================================================
+Attaches a calibration engine.  While attached, every frame is decoded with
+the models current in Calibration at that time.  Pass 0 to go back to the
+coefficients set through SetCalibration().
+=========================================================================== */
+void Csm500PeakDecoder::AttachCalibration(Csm500Calibration *Calibration)
+{
+  this->Calibration = Calibration;
+}
+
+
+/* ===========================================================================
+Forces a kernel flavor.  Requests beyond what the CPU supports are clamped
+to the best supported flavor.
+=========================================================================== */
+void Csm500PeakDecoder::SetSimdLevel(sm500_simd_level level)
+{
+  sm500_simd_level supported = sm500_detect_simd();
+
+  if (level > supported)
+    level = supported;
+
+  SimdLevel = level;
+  switch (level)
+  {
+#ifdef SM500_HAVE_X86_SIMD
+    case SM500_SIMD_AVX2: Kernel = DecodeAvx2; break;
+    case SM500_SIMD_SSE2: Kernel = DecodeSse2; break;
+#endif
+    default:              Kernel = DecodeScalar; break;
+  }
+}
+
+
+/* ===========================================================================
+Returns the kernel flavor in use
+=========================================================================== */
+sm500_simd_level Csm500PeakDecoder::GetSimdLevel(void)
+{
+  return SimdLevel;
+}
+
+
+/* ===========================================================================
+Decodes a whole peaks frame into Peaks.  The channels are laid out one
+after the other in the output arrays.
+=========================================================================== */
+void Csm500PeakDecoder::Decode(const Csm500PeaksFrame &Frame, sm500_peaks_soa &Peaks)
+{
+  uint32_t count = 0;
+
+  Peaks.SerialNumber = Frame.SerialNumber();
+  Peaks.TimestampSec = Frame.TimestampSec();
+  Peaks.TimestampNsec = Frame.TimestampNsec();
+
+  for (uint32_t ch=0; ch<SM500_NUM_CHANNELS; ch++)
+  {
+    uint32_t n = Frame.NumPeaks(ch);
+
+    Peaks.ChannelStart[ch] = count;
+    if (Calibration)
+    {
+      const sm500_channel_calibration *model = Calibration->Acquire(ch);
+      Kernel(Frame.begin(ch), n, model->PeakCoef, PositionOffset[ch],
+             Peaks.Position + count, Peaks.Wavelength + count, Peaks.Amplitude + count);
+      Calibration->Release(ch, model);
+    }
+    else
+      Kernel(Frame.begin(ch), n, Coef[ch], PositionOffset[ch],
+             Peaks.Position + count, Peaks.Wavelength + count, Peaks.Amplitude + count);
+    memset(Peaks.Channel + count, ch, n);
+    count += n;
+  }
+
+  Peaks.ChannelStart[SM500_NUM_CHANNELS] = count;
+  Peaks.Count = count;
+}
+
+
+
+/* ===========================================================================
+=========================================================================== */
+//----------  ----------
+//----------  ----------
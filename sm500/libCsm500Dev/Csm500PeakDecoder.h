@@ -0,0 +1,92 @@
+/* ===========================================================================
+ Csm500PeakDecoder.h
+ sm500 peak word decoder class definition
+
+ The peak decoder turns the raw peak words of a DMAed peaks buffer into a
+ structure-of-arrays of channel, position, wavelength and amplitude.  The
+ wavelength calibration polynomial and the distance compensation offset of
+ each channel are applied in the same pass.  The
+ coefficients are either set directly or taken from an attached
+ Csm500Calibration, which is sampled once per channel per frame.  The work
+ is done by a vectorized kernel (AVX2 or SSE2, with a scalar fallback)
+ selected at construction time.
+
+ Jerry Volcy
+
+ Copyright (c) 2013, Micron Optics, Inc.
+=========================================================================== */
+
+#ifndef CSM500PEAKDECODER_H
+#define CSM500PEAKDECODER_H
+
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+#include <stdint.h>
+#include "sm500_data_structures.h"
+#include "sm500_simd.h"
+#include "Csm500Calibration.h"
+
+/* ===========================================================================
+Constants
+=========================================================================== */
+#define SM500_MAX_PEAKS       (SM500_NUM_CHANNELS * SM500_MAX_PEAKS_PER_CHANNEL)
+
+
+/* ===========================================================================
+Decoded peaks, structure-of-arrays.  The peaks of channel ch occupy
+indices [ChannelStart[ch], ChannelStart[ch+1]).
+=========================================================================== */
+struct sm500_peaks_soa
+{
+  uint64_t SerialNumber;                              //data set S/N
+  uint32_t TimestampSec;                              //driver timestamp
+  uint32_t TimestampNsec;
+  uint32_t Count;                                     //total # of peaks
+  uint32_t ChannelStart[SM500_NUM_CHANNELS + 1];      //first peak of each channel
+
+  uint8_t Channel[SM500_MAX_PEAKS] SM500_ALIGN(SM500_SIMD_ALIGN);
+  float Position[SM500_MAX_PEAKS] SM500_ALIGN(SM500_SIMD_ALIGN);    //FS samples
+  float Wavelength[SM500_MAX_PEAKS] SM500_ALIGN(SM500_SIMD_ALIGN);  //nm
+  float Amplitude[SM500_MAX_PEAKS] SM500_ALIGN(SM500_SIMD_ALIGN);   //raw counts
+};
+
+
+/* ===========================================================================
+Csm500PeakDecoder class definition
+=========================================================================== */
+class Csm500PeakDecoder
+{
+  public:
+    //----------  ----------
+    Csm500PeakDecoder();                    //constructor
+    virtual ~Csm500PeakDecoder();           //destructor
+    void SetCalibration(uint32_t ch, const double *Coef);   //sets the SM500_CAL_ORDER+1 coefficients of a channel (c0 first)
+    void AttachCalibration(Csm500Calibration *Calibration); //takes the coefficients from Calibration at every frame (0 = use SetCalibration())
+    void SetPositionOffset(uint32_t ch, float Offset);      //sets the position offset (FS samples) subtracted from a channel's peaks
+    void SetSimdLevel(sm500_simd_level level);              //forces a kernel flavor (clamped to what the CPU supports)
+    sm500_simd_level GetSimdLevel(void);                    //returns the kernel flavor in use
+    void Decode(const Csm500PeaksFrame &Frame, sm500_peaks_soa &Peaks);  //decodes a whole frame
+
+    //one channel block: n peak words in, positions (less Offset), wavelengths and amplitudes out
+    typedef void (*kernel_t)(const uint32_t *In, uint32_t n, const float *Coef, float Offset,
+                             float *Position, float *Wavelength, float *Amplitude);
+
+  protected:
+    float Coef[SM500_NUM_CHANNELS][SM500_CAL_ORDER + 1];
+    float PositionOffset[SM500_NUM_CHANNELS];
+    Csm500Calibration *Calibration;
+    sm500_simd_level SimdLevel;
+    kernel_t Kernel;
+};
+
+#endif // #ifndef CSM500PEAKDECODER_H
+
+
+
+/* ===========================================================================
+=========================================================================== */
+//----------  ----------
+//----------  ----------
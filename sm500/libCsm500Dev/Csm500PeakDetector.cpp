@@ -0,0 +1,477 @@
+/* ===========================================================================
+ Csm500PeakDetector.cpp
+ sm500 software peak detection class implementation
+
+ Jerry Volcy
+
+ Copyright (c) 2013, Micron Optics, Inc.
+=========================================================================== */
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+#include <errno.h>
+#include <string.h>
+#include <math.h>
+#include "Csm500PeakDetector.h"
+#include "sm500_common.h"
+
+static_assert(SM500_CAL_ORDER == 3, "the fallback wavelength in FindPeaks is written for a cubic calibration");
+
+
+/* ===========================================================================
+Scalar candidate search
+=========================================================================== */
+static uint32_t CandidatesScalar(const float *y, uint32_t n, const float *Threshold, uint32_t *Candidates)
+{
+  uint32_t count = 0;
+
+  for (uint32_t i=1; i+1<n; i++)
+  {
+    float thr = Threshold[i / SM500_DETECT_FLOOR_BLOCK];
+    if ((y[i] > y[i-1]) && (y[i] >= y[i+1]) && (y[i] > thr))
+      Candidates[count++] = i;
+  }
+  return count;
+}
+
+
+#ifdef SM500_HAVE_X86_SIMD
+/* ===========================================================================
+SSE2 candidate search (4 samples per iteration, one block at a time)
+=========================================================================== */
+SM500_TARGET_SSE2
+static uint32_t CandidatesSse2(const float *y, uint32_t n, const float *Threshold, uint32_t *Candidates)
+{
+  uint32_t count = 0;
+
+  for (uint32_t start=0; start<n; start+=SM500_DETECT_FLOOR_BLOCK)
+  {
+    uint32_t i = start ? start : 1;
+    uint32_t end = start + SM500_DETECT_FLOOR_BLOCK;
+    if (end > n - 1) end = n - 1;
+    float thr_s = Threshold[start / SM500_DETECT_FLOOR_BLOCK];
+    __m128 thr = _mm_set1_ps(thr_s);
+
+    for (; i+4<=end; i+=4)
+    {
+      __m128 c = _mm_loadu_ps(y + i);
+      __m128 m = _mm_and_ps(_mm_and_ps(_mm_cmpgt_ps(c, _mm_loadu_ps(y + i - 1)),
+                                       _mm_cmpge_ps(c, _mm_loadu_ps(y + i + 1))),
+                            _mm_cmpgt_ps(c, thr));
+      uint32_t mask = _mm_movemask_ps(m);
+      while (mask)
+      {
+        Candidates[count++] = i + __builtin_ctz(mask);
+        mask &= mask - 1;
+      }
+    }
+
+    for (; i<end; i++)
+      if ((y[i] > y[i-1]) && (y[i] >= y[i+1]) && (y[i] > thr_s))
+        Candidates[count++] = i;
+  }
+  return count;
+}
+
+
+/* ===========================================================================
+AVX2 candidate search (8 samples per iteration, one block at a time)
+=========================================================================== */
+SM500_TARGET_AVX2
+static uint32_t CandidatesAvx2(const float *y, uint32_t n, const float *Threshold, uint32_t *Candidates)
+{
+  uint32_t count = 0;
+
+  for (uint32_t start=0; start<n; start+=SM500_DETECT_FLOOR_BLOCK)
+  {
+    uint32_t i = start ? start : 1;
+    uint32_t end = start + SM500_DETECT_FLOOR_BLOCK;
+    if (end > n - 1) end = n - 1;
+    float thr_s = Threshold[start / SM500_DETECT_FLOOR_BLOCK];
+    __m256 thr = _mm256_set1_ps(thr_s);
+
+    for (; i+8<=end; i+=8)
+    {
+      __m256 c = _mm256_loadu_ps(y + i);
+      __m256 m = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(c, _mm256_loadu_ps(y + i - 1), _CMP_GT_OQ),
+                                             _mm256_cmp_ps(c, _mm256_loadu_ps(y + i + 1), _CMP_GE_OQ)),
+                               _mm256_cmp_ps(c, thr, _CMP_GT_OQ));
+      uint32_t mask = _mm256_movemask_ps(m);
+      while (mask)
+      {
+        Candidates[count++] = i + __builtin_ctz(mask);
+        mask &= mask - 1;
+      }
+    }
+
+    for (; i<end; i++)
+      if ((y[i] > y[i-1]) && (y[i] >= y[i+1]) && (y[i] > thr_s))
+        Candidates[count++] = i;
+  }
+  _mm256_zeroupper();
+  return count;
+}
+#endif
+
+
+/* ===========================================================================
+Returns the position (fractional sample) where y crosses Level between
+samples i and i+1
+=========================================================================== */
+static inline float Crossing(const float *y, int32_t i, float Level)
+{
+  float d = y[i+1] - y[i];
+  return (d != 0.0f) ? i + (Level - y[i]) / d : (float)i;
+}
+
+
+/* ===========================================================================
+dB to linear power
+=========================================================================== */
+static inline float DbToLinear(float Db)
+{
+  return powf(10.0f, 0.1f * Db);
+}
+
+
+/* ===========================================================================
+Csm500PeakDetector constructor
+=========================================================================== */
+Csm500PeakDetector::Csm500PeakDetector()
+{
+  double nominal[SM500_CAL_ORDER + 1] = { SM500_DEFAULT_WL_START, SM500_DEFAULT_WL_SPAN / SM500_NUM_FS_POINTS };    //higher terms zero
+
+  for (uint32_t ch=0; ch<SM500_NUM_CHANNELS; ch++)
+  {
+    SetCalibration(ch, nominal);
+    PositionOffset[ch] = 0.0f;
+    Threshold[ch] = new float[SM500_DETECT_NUM_BLOCKS];
+    Candidates[ch] = new uint32_t[SM500_NUM_FS_POINTS];
+    Found[ch] = 0;
+  }
+
+  ThresholdDb = SM500_DEFAULT_DETECT_THRESHOLD_DB;
+  MinSeparation = SM500_DEFAULT_DETECT_SEPARATION;
+  WidthDb = SM500_DEFAULT_DETECT_WIDTH_DB;
+  Refinement = SM500_REFINE_GAUSSIAN;
+  Calibration = 0;
+  Pool = 0;
+  TaskSpectrum = 0;
+  TaskPeaks = 0;
+  TaskMetrics = 0;
+  SetSimdLevel(sm500_detect_simd());
+}
+
+
+/* ===========================================================================
+destructor
+=========================================================================== */
+Csm500PeakDetector::~Csm500PeakDetector()
+{
+  for (uint32_t ch=0; ch<SM500_NUM_CHANNELS; ch++)
+  {
+    delete [] Threshold[ch];
+    delete [] Candidates[ch];
+  }
+}
+
+
+/* ===========================================================================
+Sets the position-to-wavelength polynomial of a channel.  Coef holds
+SM500_CAL_ORDER+1 coefficients, constant term first.
+=========================================================================== */
+void Csm500PeakDetector::SetCalibration(uint32_t ch, const double *Coef)
+{
+  if (ch >= SM500_NUM_CHANNELS)
+    throw EINVAL;
+
+  for (int i=0; i<=SM500_CAL_ORDER; i++)
+    this->Coef[ch][i] = Coef[i];
+}
+
+
+/* ===========================================================================
+Attaches a calibration engine.  While attached, peak positions are converted
+with the FS tables of the models current in Calibration at the time of
+detection.  Pass 0 to go back to the coefficients set through
+SetCalibration().
+=========================================================================== */
+void Csm500PeakDetector::AttachCalibration(Csm500Calibration *Calibration)
+{
+  this->Calibration = Calibration;
+}
+
+
+/* ===========================================================================
+Sets the position offset (FS samples) subtracted from every peak position
+of a channel before the wavelength conversion; see Csm500DistanceComp
+=========================================================================== */
+void Csm500PeakDetector::SetPositionOffset(uint32_t ch, float Offset)
+{
+  if (ch >= SM500_NUM_CHANNELS)
+    throw EINVAL;
+
+  PositionOffset[ch] = Offset;
+}
+
+
+/* ===========================================================================
+Detection parameters
+=========================================================================== */
+void Csm500PeakDetector::SetThreshold(float ThresholdDb)
+{
+  this->ThresholdDb = ThresholdDb;
+}
+
+void Csm500PeakDetector::SetMinSeparation(uint32_t Samples)
+{
+  MinSeparation = Samples;
+}
+
+void Csm500PeakDetector::SetWidthLevel(float WidthDb)
+{
+  if (WidthDb <= 0.0f)
+    throw EINVAL;
+
+  this->WidthDb = WidthDb;
+}
+
+void Csm500PeakDetector::SetRefinement(sm500_peak_refinement Method)
+{
+  Refinement = Method;
+}
+
+
+/* ===========================================================================
+Forces a kernel flavor.  Requests beyond what the CPU supports are clamped
+to the best supported flavor.
+=========================================================================== */
+void Csm500PeakDetector::SetSimdLevel(sm500_simd_level level)
+{
+  sm500_simd_level supported = sm500_detect_simd();
+
+  if (level > supported)
+    level = supported;
+
+  SimdLevel = level;
+  switch (level)
+  {
+#ifdef SM500_HAVE_X86_SIMD
+    case SM500_SIMD_AVX2: Kernel = CandidatesAvx2; break;
+    case SM500_SIMD_SSE2: Kernel = CandidatesSse2; break;
+#endif
+    default:              Kernel = CandidatesScalar; break;
+  }
+}
+
+
+/* ===========================================================================
+Returns the kernel flavor in use
+=========================================================================== */
+sm500_simd_level Csm500PeakDetector::GetSimdLevel(void)
+{
+  return SimdLevel;
+}
+
+
+/* ===========================================================================
+Processes the channels in parallel on Pool.  Pass 0 to process them
+serially on the calling thread.
+=========================================================================== */
+void Csm500PeakDetector::SetWorkerPool(Csm500WorkerPool *Pool)
+{
+  this->Pool = Pool;
+}
+
+
+/* ===========================================================================
+Detects the peaks of one channel.  The peaks are written at index Slot of
+the Peaks/Metrics arrays (at most SM500_MAX_PEAKS_PER_CHANNEL of them).
+Returns the # of peaks found.
+=========================================================================== */
+uint32_t Csm500PeakDetector::DetectChannel(uint32_t ch, const float *y, uint32_t Slot,
+                                           sm500_peaks_soa &Peaks, sm500_peak_metrics *Metrics)
+{
+  const int32_t n = SM500_NUM_FS_POINTS;
+  const int32_t sep = MinSeparation;
+  float *threshold = Threshold[ch];
+  float block_min[SM500_DETECT_NUM_BLOCKS];
+  uint32_t found = 0;
+
+  //---------- adaptive threshold ----------
+  for (uint32_t b=0; b<SM500_DETECT_NUM_BLOCKS; b++)
+  {
+    uint32_t start = b * SM500_DETECT_FLOOR_BLOCK;
+    uint32_t end = start + SM500_DETECT_FLOOR_BLOCK;
+    if (end > (uint32_t)n) end = n;
+
+    float m = y[start];
+    for (uint32_t i=start+1; i<end; i++)
+      m = (y[i] < m) ? y[i] : m;
+    block_min[b] = m;
+  }
+  for (uint32_t b=0; b<SM500_DETECT_NUM_BLOCKS; b++)
+  {
+    float m = block_min[b];
+    if ((b > 0) && (block_min[b-1] < m)) m = block_min[b-1];
+    if ((b+1 < SM500_DETECT_NUM_BLOCKS) && (block_min[b+1] < m)) m = block_min[b+1];
+    threshold[b] = m + ThresholdDb;
+  }
+
+  //---------- local maxima ----------
+  uint32_t num_candidates = Kernel(y, n, threshold, Candidates[ch]);
+
+  const sm500_channel_calibration *model = Calibration ? Calibration->Acquire(ch) : 0;
+  const double *cf = Coef[ch];
+
+  for (uint32_t k=0; (k<num_candidates) && (found<SM500_MAX_PEAKS_PER_CHANNEL); k++)
+  {
+    int32_t c = Candidates[ch][k];
+    bool is_max = true;
+
+    //---------- non-maximum suppression ----------
+    int32_t lo = (c - sep < 0) ? 0 : c - sep;
+    int32_t hi = (c + sep > n - 1) ? n - 1 : c + sep;
+    for (int32_t i=lo; (i<=hi) && is_max; i++)
+      if ((i < c) ? (y[i] >= y[c]) : (y[i] > y[c]))
+        is_max = false;
+    if (!is_max) continue;
+
+    //---------- sub-sample refinement ----------
+    float a = y[c-1], b = y[c], d = y[c+1];
+    float pos = (float)c;
+    float level = b;
+
+    if (Refinement == SM500_REFINE_PARABOLIC)
+    {
+      float pa = DbToLinear(a), pb = DbToLinear(b), pd = DbToLinear(d);
+      float den = pa - 2.0f * pb + pd;
+      if (den < 0.0f)
+      {
+        float delta = 0.5f * (pa - pd) / den;
+        pos = c + delta;
+        level = 10.0f * log10f(pb - 0.25f * (pa - pd) * delta);
+      }
+    }
+    else
+    {
+      float den = a - 2.0f * b + d;
+      if (den < 0.0f)
+      {
+        float delta = 0.5f * (a - d) / den;
+        pos = c + delta;
+        level = b - 0.25f * (a - d) * delta;
+      }
+    }
+
+    //---------- width ----------
+    float edge = level - WidthDb;
+    int32_t l = c, r = c;
+    while ((l > 0) && (y[l-1] > edge)) l--;
+    while ((r < n - 1) && (y[r+1] > edge)) r++;
+    float left = (l > 0) ? Crossing(y, l - 1, edge) : 0.0f;
+    float right = (r < n - 1) ? Crossing(y, r, edge) : (float)(n - 1);
+
+    if (Refinement == SM500_REFINE_CENTROID)
+    {
+      float sum = 0.0f, moment = 0.0f;
+      for (int32_t i=l; i<=r; i++)
+      {
+        float p = DbToLinear(y[i]);
+        sum += p;
+        moment += p * i;
+      }
+      pos = moment / sum;
+    }
+
+    //---------- emit ----------
+    uint32_t idx = Slot + found;
+
+    float x = pos - PositionOffset[ch];
+
+    Peaks.Position[idx] = x;
+    Peaks.Wavelength[idx] = model ? Csm500Calibration::Wavelength(*model, x) : (float)(((cf[3] * x + cf[2]) * x + cf[1]) * x + cf[0]);
+    Peaks.Amplitude[idx] = level;
+    if (Metrics)
+    {
+      float width = right - left;
+      Metrics->Width[idx] = width;
+      Metrics->Asymmetry[idx] = (width > 0.0f) ? ((right - pos) - (pos - left)) / width : 0.0f;
+    }
+    found++;
+  }
+
+  if (model)
+    Calibration->Release(ch, model);
+  return found;
+}
+
+
+/* ===========================================================================
+Worker pool task: detects the peaks of channel ch of the current spectrum
+=========================================================================== */
+void Csm500PeakDetector::ChannelTask(void *Context, uint32_t ch)
+{
+  Csm500PeakDetector *self = (Csm500PeakDetector*)Context;
+
+  self->Found[ch] = self->DetectChannel(ch, self->TaskSpectrum->Data[ch], ch * SM500_MAX_PEAKS_PER_CHANNEL,
+                                        *self->TaskPeaks, self->TaskMetrics);
+}
+
+
+/* ===========================================================================
+Detects the peaks on every channel of Spectrum.  Metrics may be 0 when the
+shape metrics are not needed.
+=========================================================================== */
+void Csm500PeakDetector::Detect(const sm500_fs_spectrum &Spectrum, sm500_peaks_soa &Peaks, sm500_peak_metrics *Metrics)
+{
+  uint32_t count = 0;
+
+  //each channel writes into its own fixed slot...
+  TaskSpectrum = &Spectrum;
+  TaskPeaks = &Peaks;
+  TaskMetrics = Metrics;
+  if (Pool)
+    Pool->Run(SM500_NUM_CHANNELS, ChannelTask, this);
+  else
+    for (uint32_t ch=0; ch<SM500_NUM_CHANNELS; ch++)
+      ChannelTask(this, ch);
+
+  //...and the slots are then packed like decoded hardware peaks
+  Peaks.SerialNumber = Spectrum.SerialNumber;
+  Peaks.TimestampSec = Spectrum.TimestampSec;
+  Peaks.TimestampNsec = Spectrum.TimestampNsec;
+
+  for (uint32_t ch=0; ch<SM500_NUM_CHANNELS; ch++)
+  {
+    uint32_t slot = ch * SM500_MAX_PEAKS_PER_CHANNEL;
+    uint32_t n = Found[ch];
+
+    if (slot != count)
+    {
+      memmove(Peaks.Position + count, Peaks.Position + slot, n * sizeof(float));
+      memmove(Peaks.Wavelength + count, Peaks.Wavelength + slot, n * sizeof(float));
+      memmove(Peaks.Amplitude + count, Peaks.Amplitude + slot, n * sizeof(float));
+      if (Metrics)
+      {
+        memmove(Metrics->Width + count, Metrics->Width + slot, n * sizeof(float));
+        memmove(Metrics->Asymmetry + count, Metrics->Asymmetry + slot, n * sizeof(float));
+      }
+    }
+    memset(Peaks.Channel + count, ch, n);
+    Peaks.ChannelStart[ch] = count;
+    count += n;
+  }
+
+  Peaks.ChannelStart[SM500_NUM_CHANNELS] = count;
+  Peaks.Count = count;
+}
+
+
+
+/* ===========================================================================
+=========================================================================== */
+//----------  ----------
+//----------  ----------
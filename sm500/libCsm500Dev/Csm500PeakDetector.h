@@ -0,0 +1,141 @@
+/* ===========================================================================
+ Csm500PeakDetector.h
+ sm500 software peak detection class definition
+
+ The peak detector finds peaks in conditioned FS spectra (see
+ Csm500FsConditioner; values are expected in dB).  Each channel is
+ processed independently, on its own worker thread when a pool is
+ attached:
+
+  1. Adaptive threshold: the noise floor is the minimum of each block of
+     SM500_DETECT_FLOOR_BLOCK samples, taken over the block and its two
+     neighbours.  Candidates must rise ThresholdDb above it.
+  2. Local maximum search (vectorized): y[i-1] < y[i] >= y[i+1] and above
+     the threshold, followed by suppression of any candidate that is not
+     the maximum within MinSeparation samples.
+  3. Sub-sample refinement of each peak by a 3-point parabola on the
+     linear power, a 3-point parabola on the dB values (a Gaussian fit),
+     or the power-weighted centroid over the -3 dB width.
+  4. Width (-3 dB, with linear interpolation of the edges) and asymmetry
+     metrics.
+
+ Positions are reported less the channel's distance compensation offset,
+ like decoded hardware peaks.
+
+ Results are emitted in the same sm500_peaks_soa structure as decoded
+ hardware peaks; Amplitude holds the peak level in dB.
+
+ Jerry Volcy
+
+ Copyright (c) 2013, Micron Optics, Inc.
+=========================================================================== */
+
+#ifndef CSM500PEAKDETECTOR_H
+#define CSM500PEAKDETECTOR_H
+
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+#include <stdint.h>
+#include "sm500_data_structures.h"
+#include "sm500_simd.h"
+#include "Csm500PeakDecoder.h"
+#include "Csm500FsConditioner.h"
+#include "Csm500WorkerPool.h"
+
+/* ===========================================================================
+Constants
+=========================================================================== */
+#define SM500_DETECT_FLOOR_BLOCK    256     //# of samples per noise floor block
+#define SM500_DETECT_NUM_BLOCKS     ((SM500_NUM_FS_POINTS + SM500_DETECT_FLOOR_BLOCK - 1) / SM500_DETECT_FLOOR_BLOCK)
+
+
+/* ===========================================================================
+Defaults
+=========================================================================== */
+#define SM500_DEFAULT_DETECT_THRESHOLD_DB   6.0f    //dB above the local noise floor
+#define SM500_DEFAULT_DETECT_SEPARATION     8       //samples
+#define SM500_DEFAULT_DETECT_WIDTH_DB       3.0f    //level below the peak at which the width is measured
+
+
+/* ===========================================================================
+Sub-sample refinement methods
+=========================================================================== */
+enum sm500_peak_refinement
+{
+  SM500_REFINE_PARABOLIC = 0,   //3-point parabola on linear power
+  SM500_REFINE_GAUSSIAN,        //3-point parabola on dB (Gaussian in linear power)
+  SM500_REFINE_CENTROID         //power-weighted centroid over the peak width
+};
+
+
+/* ===========================================================================
+Per-peak shape metrics, indexed like sm500_peaks_soa
+=========================================================================== */
+struct sm500_peak_metrics
+{
+  float Width[SM500_MAX_PEAKS] SM500_ALIGN(SM500_SIMD_ALIGN);       //FS samples, at WidthDb below the peak
+  float Asymmetry[SM500_MAX_PEAKS] SM500_ALIGN(SM500_SIMD_ALIGN);   //(right - left half width) / width
+};
+
+
+/* ===========================================================================
+Csm500PeakDetector class definition
+=========================================================================== */
+class Csm500PeakDetector
+{
+  public:
+    //----------  ----------
+    Csm500PeakDetector();                   //constructor
+    virtual ~Csm500PeakDetector();          //destructor
+    void SetCalibration(uint32_t ch, const double *Coef);   //sets the position-to-wavelength polynomial of a channel
+    void AttachCalibration(Csm500Calibration *Calibration); //takes the FS tables from Calibration at every frame (0 = use SetCalibration())
+    void SetPositionOffset(uint32_t ch, float Offset);      //sets the position offset (FS samples) subtracted from a channel's peaks
+    void SetThreshold(float ThresholdDb);                   //sets the detection threshold above the noise floor
+    void SetMinSeparation(uint32_t Samples);                //sets the minimum distance between two peaks
+    void SetWidthLevel(float WidthDb);                      //sets the level below the peak at which the width is measured
+    void SetRefinement(sm500_peak_refinement Method);       //sets the sub-sample refinement method
+    void SetSimdLevel(sm500_simd_level level);              //forces a kernel flavor (clamped to what the CPU supports)
+    sm500_simd_level GetSimdLevel(void);                    //returns the kernel flavor in use
+    void SetWorkerPool(Csm500WorkerPool *Pool);             //processes the channels in parallel on Pool (0 = serially)
+    void Detect(const sm500_fs_spectrum &Spectrum, sm500_peaks_soa &Peaks, sm500_peak_metrics *Metrics);  //detects peaks on all channels
+
+    //candidate search: writes the indices of the local maxima of y above Threshold[i / SM500_DETECT_FLOOR_BLOCK]
+    typedef uint32_t (*kernel_t)(const float *y, uint32_t n, const float *Threshold, uint32_t *Candidates);
+
+  protected:
+    static void ChannelTask(void *Context, uint32_t ch);
+    uint32_t DetectChannel(uint32_t ch, const float *y, uint32_t Slot, sm500_peaks_soa &Peaks, sm500_peak_metrics *Metrics);
+
+    double Coef[SM500_NUM_CHANNELS][SM500_CAL_ORDER + 1];
+    float PositionOffset[SM500_NUM_CHANNELS];
+    Csm500Calibration *Calibration;
+    float ThresholdDb;
+    uint32_t MinSeparation;
+    float WidthDb;
+    sm500_peak_refinement Refinement;
+    sm500_simd_level SimdLevel;
+    kernel_t Kernel;
+    Csm500WorkerPool *Pool;
+
+    //per-channel scratch space
+    float *Threshold[SM500_NUM_CHANNELS];         //SM500_DETECT_NUM_BLOCKS entries
+    uint32_t *Candidates[SM500_NUM_CHANNELS];     //SM500_NUM_FS_POINTS entries
+    uint32_t Found[SM500_NUM_CHANNELS];           //# of peaks found on each channel
+
+    //the spectrum being processed by Detect(), for the worker tasks
+    const sm500_fs_spectrum *TaskSpectrum;
+    sm500_peaks_soa *TaskPeaks;
+    sm500_peak_metrics *TaskMetrics;
+};
+
+#endif // #ifndef CSM500PEAKDETECTOR_H
+
+
+
+/* ===========================================================================
+=========================================================================== */
+//----------  ----------
+//----------  ----------
@@ -0,0 +1,296 @@
+/* ===========================================================================
+ Csm500RealTime.cpp
+ sm500 real-time acquisition mode class implementation
+
+ Jerry Volcy
+
+ Copyright (c) 2013, Micron Optics, Inc.
+=========================================================================== */
+
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <alloca.h>
+#include <sys/mman.h>
+#include "Csm500RealTime.h"
+#include "sm500_common.h"
+
+
+/* ===========================================================================
+Csm500RealTime constructor
+=========================================================================== */
+Csm500RealTime::Csm500RealTime()
+{
+  Config.Enabled = false;
+  Config.Cpu = SM500_RT_NO_CPU;
+  Config.Priority = SM500_RT_DEFAULT_PRIORITY;
+  Config.LockMemory = true;
+  Config.Prefault = true;
+  Config.Required = false;
+  memset(&Status, 0, sizeof(Status));
+  Thread = pthread_self();
+  CPU_ZERO(&SavedCpus);
+  SavedPolicy = SCHED_OTHER;
+  memset(&SavedParam, 0, sizeof(SavedParam));
+  bPinned = false;
+  bScheduled = false;
+  bLocked = false;
+
+  long page = sysconf(_SC_PAGESIZE);
+  PageBytes = (page > 0) ? (size_t)page : 4096;
+}
+
+
+/* ===========================================================================
+destructor
+=========================================================================== */
+Csm500RealTime::~Csm500RealTime()
+{
+  Leave();
+}
+
+
+/* ===========================================================================
+Settings and status
+=========================================================================== */
+void Csm500RealTime::SetConfig(const sm500_rt_config &Config)
+{
+  this->Config = Config;
+}
+
+void Csm500RealTime::GetConfig(sm500_rt_config &Config)
+{
+  Config = this->Config;
+}
+
+void Csm500RealTime::GetStatus(sm500_rt_status &Status)
+{
+  Status = this->Status;
+}
+
+
+/* ===========================================================================
+Records the errno of a setting that could not be applied; throws it when
+the settings are required
+=========================================================================== */
+void Csm500RealTime::Fail(int &Err, int Code)
+{
+  if (Err == 0)
+    Err = Code;
+  SM500_DBG( cout<<"real-time mode: "<<strerror(Code)<<"\n"; );
+  if (Config.Required)
+    throw Code;
+}
+
+
+/* ===========================================================================
+Returns the memory locked by the process (VmLck of /proc/self/status), 0
+when it cannot be read
+=========================================================================== */
+uint64_t Csm500RealTime::LockedBytes(void)
+{
+  FILE *f = fopen("/proc/self/status", "r");
+  char line[128];
+  unsigned long long kb = 0;
+
+  if (f == 0)
+    return 0;
+  while (fgets(line, sizeof(line), f) != 0)
+    if (sscanf(line, "VmLck: %llu", &kb) == 1)
+      break;
+  fclose(f);
+  return (uint64_t)kb * 1024;
+}
+
+
+/* ===========================================================================
+Pins the calling thread (the acquisition thread) to Config.Cpu, switches it
+to SCHED_FIFO and locks the memory.  Its previous affinity and policy are
+kept for Leave().  When the application had already locked memory, the
+lock is left for the application to undo.
+=========================================================================== */
+void Csm500RealTime::Enter(void)
+{
+  int err;
+
+  Leave();
+  memset(&Status, 0, sizeof(Status));
+  Status.Active = true;
+  Thread = pthread_self();
+
+  //---------- CPU ----------
+  if (Config.Cpu != SM500_RT_NO_CPU)
+  {
+    cpu_set_t cpus;
+
+    CPU_ZERO(&cpus);
+    if ((Config.Cpu < 0) || (Config.Cpu >= CPU_SETSIZE))
+      Fail(Status.PinErr, EINVAL);
+    else
+    {
+      CPU_SET(Config.Cpu, &cpus);
+      pthread_getaffinity_np(Thread, sizeof(SavedCpus), &SavedCpus);
+      err = pthread_setaffinity_np(Thread, sizeof(cpus), &cpus);
+      if (err)
+        Fail(Status.PinErr, err);
+      else
+        bPinned = true;
+    }
+  }
+
+  //---------- scheduling ----------
+  if (Config.Priority > 0)
+  {
+    struct sched_param param;
+
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = Config.Priority;
+    pthread_getschedparam(Thread, &SavedPolicy, &SavedParam);
+    err = pthread_setschedparam(Thread, SCHED_FIFO, &param);
+    if (err)
+      Fail(Status.SchedErr, err);
+    else
+      bScheduled = true;
+  }
+
+  //---------- memory ----------
+  if (Config.LockMemory)
+  {
+    bool locked = (LockedBytes() > 0);
+
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+      Fail(Status.LockErr, errno);
+    else
+      bLocked = !locked;
+  }
+}
+
+
+/* ===========================================================================
+Gives a worker thread the priority of the acquisition thread, on the CPUs
+other than the acquisition thread's (when it is pinned and there are some)
+=========================================================================== */
+void Csm500RealTime::ApplyToThread(pthread_t Thread)
+{
+  int err;
+
+  if (bPinned)
+  {
+    cpu_set_t cpus;
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (cores > 1)
+    {
+      CPU_ZERO(&cpus);
+      for (long c=0; (c<cores) && (c<CPU_SETSIZE); c++)
+        if (c != Config.Cpu)
+          CPU_SET(c, &cpus);
+      err = pthread_setaffinity_np(Thread, sizeof(cpus), &cpus);
+      if (err)
+        Fail(Status.PinErr, err);
+    }
+  }
+
+  if (Config.Priority > 0)
+  {
+    struct sched_param param;
+
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = Config.Priority;
+    err = pthread_setschedparam(Thread, SCHED_FIFO, &param);
+    if (err)
+      Fail(Status.SchedErr, err);
+  }
+}
+
+
+/* ===========================================================================
+Reads one byte of every page of a buffer, so that its page table entries
+are in place before the first frame
+=========================================================================== */
+void Csm500RealTime::Prefault(const void *Data, size_t Bytes)
+{
+  const volatile uint8_t *p = (const volatile uint8_t*)Data;
+  uint64_t pages = 0;
+
+  if (!Config.Prefault || (Data == 0))
+    return;
+
+  for (size_t i=0; i<Bytes; i+=PageBytes, pages++)
+    (void)p[i];
+  if (Bytes > 0)
+    (void)p[Bytes - 1];
+  Status.PagesPrefaulted += pages;
+}
+
+
+/* ===========================================================================
+Touches the calling thread's stack below the calling frame: up to
+SM500_RT_STACK_PREFAULT bytes, less what the thread's stack size leaves
+(SM500_RT_STACK_RESERVE bytes are kept untouched at its end)
+=========================================================================== */
+void __attribute__((noinline)) Csm500RealTime::PrefaultStack(void)
+{
+  pthread_attr_t attr;
+  void *low;
+  size_t size;
+  size_t bytes = SM500_RT_STACK_PREFAULT;
+  uintptr_t here = (uintptr_t)__builtin_frame_address(0);
+
+  if (!Config.Prefault)
+    return;
+
+  //---------- room left on the stack ----------
+  if (pthread_getattr_np(pthread_self(), &attr) != 0)
+    return;
+  int err = pthread_attr_getstack(&attr, &low, &size);
+  pthread_attr_destroy(&attr);
+  if (err || (here < (uintptr_t)low) || (here - (uintptr_t)low > size))
+    return;
+  size_t left = here - (uintptr_t)low;
+  if (left <= SM500_RT_STACK_RESERVE + PageBytes)
+    return;
+  if (bytes > left - SM500_RT_STACK_RESERVE - PageBytes)
+    bytes = left - SM500_RT_STACK_RESERVE - PageBytes;
+
+  volatile uint8_t *stack = (volatile uint8_t*)alloca(bytes);
+  for (size_t i=0; i<bytes; i+=PageBytes)
+    stack[i] = 0;
+  Status.PagesPrefaulted += bytes / PageBytes;
+}
+
+
+/* ===========================================================================
+Unlocks the memory (when Enter() locked it) and gives the acquisition
+thread its affinity and policy back.  They can only be restored from the acquisition thread itself
+(it may have exited by now); from any other thread they are left as they are.
+=========================================================================== */
+void Csm500RealTime::Leave(void)
+{
+  bool same = pthread_equal(Thread, pthread_self());
+
+  if (bLocked)
+    munlockall();
+  if (bScheduled && same)
+    pthread_setschedparam(Thread, SavedPolicy, &SavedParam);
+  if (bPinned && same)
+    pthread_setaffinity_np(Thread, sizeof(SavedCpus), &SavedCpus);
+
+  bLocked = false;
+  bScheduled = false;
+  bPinned = false;
+  Status.Active = false;
+}
+
+
+
+/* ===========================================================================
+=========================================================================== */
+//----------  ----------
+//----------  ----------
@@ -0,0 +1,126 @@
+/* ===========================================================================
+ Csm500RealTime.h
+ sm500 real-time acquisition mode class definition
+
+ Opt-in settings applied by Csm500Dev::Init() to the thread acquiring the
+ data (the thread calling Init()) so that it wakes up on time even when the
+ machine is busy:
+
+   - pinned to one CPU (the other CPUs are left to the worker threads)
+   - SCHED_FIFO at a configurable priority, worker threads included
+   - mlockall(MCL_CURRENT | MCL_FUTURE): nothing mapped is paged out, and
+     what is mapped later (recorder queues, ...) is faulted in at once
+   - the DMA buffers (or the replayed recording), the acquisition thread's
+     stack and its latency histograms touched once at Init(), so that the
+     first frames do not take page faults; the other pools are faulted in
+     by mlockall()
+
+ SCHED_FIFO and mlockall() need privileges (CAP_SYS_NICE, CAP_IPC_LOCK or
+ the RLIMIT_RTPRIO/RLIMIT_MEMLOCK limits).  By default a setting that
+ cannot be applied is only reported in the status; with Required set,
+ Init() fails with its errno.  Close() undoes the settings.  munlockall()
+ is process-wide, so when some memory was already locked before Init()
+ (by the application) Close() leaves the memory locked.
+
+ The stack is touched from the calling frame down to SM500_RT_STACK_PREFAULT
+ bytes, never closer than SM500_RT_STACK_RESERVE bytes to the end of the
+ thread's stack (threads created with a small stack are touched less).
+
+ Jerry Volcy
+
+ Copyright (c) 2013, Micron Optics, Inc.
+=========================================================================== */
+
+#ifndef CSM500REALTIME_H
+#define CSM500REALTIME_H
+
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <sched.h>
+
+/* ===========================================================================
+Constants
+=========================================================================== */
+#define SM500_RT_NO_CPU             -1              //the acquisition thread is not pinned
+#define SM500_RT_DEFAULT_PRIORITY   80              //SCHED_FIFO priority (1 to 99)
+#define SM500_RT_STACK_PREFAULT     (256 * 1024)    //bytes of the acquisition thread's stack touched at Init() (at most)
+#define SM500_RT_STACK_RESERVE      (16 * 1024)     //bytes left untouched at the end of its stack
+
+
+/* ===========================================================================
+Settings
+=========================================================================== */
+struct sm500_rt_config
+{
+  bool Enabled;                   //off by default
+  int Cpu;                        //CPU of the acquisition thread; SM500_RT_NO_CPU = not pinned
+  int Priority;                   //SCHED_FIFO priority; 0 = the scheduling policy is left alone
+  bool LockMemory;                //mlockall()
+  bool Prefault;                  //touches the buffers and pools at Init()
+  bool Required;                  //a setting that cannot be applied fails Init()
+};
+
+
+/* ===========================================================================
+What was applied (0 = applied or not asked for, else the errno)
+=========================================================================== */
+struct sm500_rt_status
+{
+  bool Active;                    //between Init() and Close()
+  int PinErr;
+  int SchedErr;                   //acquisition or worker threads
+  int LockErr;
+  uint64_t PagesPrefaulted;
+};
+
+
+/* ===========================================================================
+Csm500RealTime class definition
+=========================================================================== */
+class Csm500RealTime
+{
+  public:
+    Csm500RealTime();                       //constructor: disabled
+    virtual ~Csm500RealTime();              //destructor
+    void SetConfig(const sm500_rt_config &Config);  //taken into account by the next Init()
+    void GetConfig(sm500_rt_config &Config);
+    void GetStatus(sm500_rt_status &Status);
+    bool IsEnabled(void) const { return Config.Enabled; }
+
+    //---------- used by Init() and Close() ----------
+    void Enter(void);                       //pins, schedules and locks the calling thread (throws when Required)
+    void ApplyToThread(pthread_t Thread);   //SCHED_FIFO and the CPUs left over, for a worker thread (throws when Required)
+    void Prefault(const void *Data, size_t Bytes);  //reads one byte per page
+    void PrefaultStack(void);               //touches up to SM500_RT_STACK_PREFAULT bytes of the calling thread's stack
+    void Leave(void);                       //restores the acquisition thread and unlocks the memory (unless it was locked before)
+
+  protected:
+    void Fail(int &Err, int Code);          //records Code, throws it when Required
+    static uint64_t LockedBytes(void);      //VmLck of the process
+
+    sm500_rt_config Config;
+    sm500_rt_status Status;
+    pthread_t Thread;                       //the acquisition thread
+    cpu_set_t SavedCpus;                    //its settings before Enter()
+    int SavedPolicy;
+    struct sched_param SavedParam;
+    bool bPinned;
+    bool bScheduled;
+    bool bLocked;                           //mlockall() to be undone by Leave()
+    size_t PageBytes;
+};
+
+#endif // #ifndef CSM500REALTIME_H
+
+
+
+/* ===========================================================================
+=========================================================================== */
+//----------  ----------
+//----------  ----------
@@ -0,0 +1,622 @@
+/* ===========================================================================
+ Csm500Recorder.cpp
+ sm500 raw frame recorder class implementation
+
+ The ring is a multi-producer, single-consumer byte queue.  A producer
+ reserves the room for its record with one compare-and-swap on Reserved,
+ copies the frame, then publishes the record by storing its magic last.
+ The writer consumes the records in order, waiting on a reserved record
+ until its magic is published, zeroes the consumed bytes (so stale data is
+ never taken for a magic) and hands the room back through Released.
+ A record that does not fit before the end of the ring is preceded by a
+ skip marker and starts at the ring start.
+
+ Jerry Volcy
+
+ Copyright (c) 2013, Micron Optics, Inc.
+=========================================================================== */
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sched.h>
+#include "Csm500Recorder.h"
+#include "sm500_common.h"
+
+
+/* ===========================================================================
+Returns a monotonic time in milli-seconds
+=========================================================================== */
+static uint64_t NowMs(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+
+/* ===========================================================================
+Csm500Recorder constructor
+=========================================================================== */
+Csm500Recorder::Csm500Recorder()
+{
+  SegmentBytes = SM500_DEFAULT_REC_SEGMENT_BYTES;
+  QueueBytes = SM500_DEFAULT_REC_QUEUE_BYTES;
+  DirectIo = false;
+  FlushMs = SM500_DEFAULT_REC_FLUSH_MS;
+
+  Queue = 0;
+  Reserved = 0;
+  Released = 0;
+  Producers = 0;
+  bRecording = false;
+  bStop = false;
+
+  Tail = 0;
+  Staging = 0;
+  Fill = 0;
+  FileOffset = 0;
+  Fd = -1;
+  Segment = 0;
+  memset(&Footer, 0, sizeof(Footer));
+
+  Recorded = 0;
+  RecordedBytes = 0;
+  Dropped = 0;
+  Segments = 0;
+  Error = 0;
+}
+
+
+/* ===========================================================================
+destructor
+=========================================================================== */
+Csm500Recorder::~Csm500Recorder()
+{
+  Stop();
+}
+
+
+/* ===========================================================================
+Settings.  They apply to the next Start().
+=========================================================================== */
+void Csm500Recorder::SetSegmentBytes(uint64_t Bytes)
+{
+  if ((Bytes < 4 * (uint64_t)SM500_REC_BATCH_BYTES) || (Bytes % SM500_REC_PAGE_BYTES))
+    throw EINVAL;
+
+  SegmentBytes = Bytes;
+}
+
+void Csm500Recorder::SetQueueBytes(uint64_t Bytes)
+{
+  if ((Bytes < 4 * (uint64_t)SM500_REC_MAX_FRAME_BYTES) || (Bytes & (Bytes - 1)))
+    throw EINVAL;
+
+  QueueBytes = Bytes;
+}
+
+void Csm500Recorder::SetDirectIo(bool Enable)
+{
+  DirectIo = Enable;
+}
+
+void Csm500Recorder::SetFlushInterval(uint32_t Ms)
+{
+  FlushMs = Ms;
+}
+
+
+/* ===========================================================================
+Opens the first segment, Path_000000.sm500rec, and starts the writer
+thread.  Throws the errno of the failure if the segment cannot be created.
+=========================================================================== */
+void Csm500Recorder::Start(const char *Path)
+{
+  Stop();
+
+  if ((posix_memalign((void**)&Queue, SM500_REC_PAGE_BYTES, QueueBytes) != 0) ||
+      (posix_memalign((void**)&Staging, SM500_REC_PAGE_BYTES, SM500_REC_BATCH_BYTES) != 0))
+  {
+    free(Queue);
+    Queue = 0;
+    throw ENOMEM;
+  }
+  memset(Queue, 0, QueueBytes);
+
+  this->Path = Path;
+  Reserved = 0;
+  Released = 0;
+  Tail = 0;
+  Segment = 0;
+  Recorded = 0;
+  RecordedBytes = 0;
+  Dropped = 0;
+  Segments = 0;
+  Error = 0;
+
+  if (!OpenSegment())
+  {
+    int err = Error;
+    free(Queue);
+    free(Staging);
+    Queue = 0;
+    Staging = 0;
+    throw err;
+  }
+
+  bStop = false;
+  if (pthread_create(&Thread, 0, ThreadEntry, this) != 0)
+  {
+    CloseSegment();
+    free(Queue);
+    free(Staging);
+    Queue = 0;
+    Staging = 0;
+    throw EAGAIN;
+  }
+  bRecording = true;
+}
+
+
+/* ===========================================================================
+Stops recording: waits for the Record() calls in flight, lets the writer
+write what is queued and close the segment, and joins it
+=========================================================================== */
+void Csm500Recorder::Stop(void)
+{
+  if (!bRecording)
+    return;
+
+  bRecording = false;
+  while (Producers != 0)
+    sched_yield();
+
+  bStop = true;
+  pthread_join(Thread, 0);
+
+  free(Queue);
+  free(Staging);
+  Queue = 0;
+  Staging = 0;
+}
+
+
+/* ===========================================================================
+Returns true between Start() and Stop()
+=========================================================================== */
+bool Csm500Recorder::IsRecording(void)
+{
+  return bRecording.load(std::memory_order_relaxed);
+}
+
+
+/* ===========================================================================
+Queues a frame for writing.  Never blocks: returns false (and counts the
+frame as dropped) when the ring has no room.  Returns false without
+counting when not recording.  The frame must start with the DMA header.
+=========================================================================== */
+bool Csm500Recorder::Record(sm500_rec_type Type, const void *Frame, uint32_t Bytes)
+{
+  if ((Bytes < SM500_DMA_HEADER_DWORDS * sizeof(uint32_t)) || (Bytes > SM500_REC_MAX_FRAME_BYTES) || (Bytes % 4))
+    throw EINVAL;
+
+  Producers++;
+  if (!bRecording)
+  {
+    Producers--;
+    return false;
+  }
+
+  //---------- reserve ----------
+  const uint64_t size = sm500_rec_record_bytes(Bytes);
+  uint64_t head = Reserved.load(std::memory_order_relaxed);
+  uint64_t pad;
+
+  do
+  {
+    uint64_t pos = head & (QueueBytes - 1);
+
+    pad = (pos + size > QueueBytes) ? QueueBytes - pos : 0;
+    if (head + pad + size - Released.load(std::memory_order_acquire) > QueueBytes)
+    {
+      Dropped++;
+      Producers--;
+      return false;
+    }
+  } while (!Reserved.compare_exchange_weak(head, head + pad + size, std::memory_order_relaxed));
+
+  //---------- copy and publish ----------
+  uint8_t *p = Queue + (head & (QueueBytes - 1));
+  if (pad)
+  {
+    __atomic_store_n((uint32_t*)p, SM500_REC_SKIP_MAGIC, __ATOMIC_RELEASE);
+    p = Queue;
+  }
+
+  const uint32_t *header = (const uint32_t*)Frame;
+  sm500_rec_record *r = (sm500_rec_record*)p;
+  r->Type = Type;
+  r->Flags = 0;
+  r->Bytes = Bytes;
+  r->Checksum = 0;
+  r->SerialNumber = ((uint64_t)header[sm500_header_layout::SerialHiOffset32] << 32) | header[sm500_header_layout::SerialLoOffset32];
+  r->TimestampSec = header[sm500_header_layout::TimestampOffset32];
+  r->TimestampNsec = header[sm500_header_layout::TimestampOffset32 + 1];
+  memcpy(r + 1, Frame, Bytes);
+  __atomic_store_n(&r->Magic, SM500_REC_RECORD_MAGIC, __ATOMIC_RELEASE);
+
+  Producers--;
+  return true;
+}
+
+
+/* ===========================================================================
+Queues a peaks / FS DMA buffer
+=========================================================================== */
+bool Csm500Recorder::RecordPeaks(const void *PeaksData)
+{
+  return Record(SM500_REC_PEAKS, PeaksData, sm500_peaks_format::FrameBytes);
+}
+
+bool Csm500Recorder::RecordFs(const void *FsData)
+{
+  return Record(SM500_REC_FS, FsData, sm500_fs_format::FrameBytes);
+}
+
+
+/* ===========================================================================
+Returns the recorder statistics
+=========================================================================== */
+void Csm500Recorder::GetStats(sm500_recorder_stats &Stats)
+{
+  Stats.Recorded = Recorded;
+  Stats.RecordedBytes = RecordedBytes;
+  Stats.Dropped = Dropped;
+  Stats.Segments = Segments;
+  Stats.Error = Error;
+}
+
+
+/* ===========================================================================
+Writer thread
+=========================================================================== */
+void* Csm500Recorder::ThreadEntry(void *Arg)
+{
+  ((Csm500Recorder*)Arg)->WriterLoop();
+  return 0;
+}
+
+void Csm500Recorder::WriterLoop(void)
+{
+  uint64_t last_flush = NowMs();
+  bool flushed = true;
+
+  while (true)
+  {
+    bool stop = bStop.load(std::memory_order_acquire);   //read before draining: nothing is queued after bStop
+
+    if (Drain())
+    {
+      flushed = false;
+      continue;
+    }
+    if (stop)
+      break;
+
+    //idle: flush the partial page now and then, so a crash loses little
+    uint64_t now = NowMs();
+    if (!flushed && (now - last_flush >= FlushMs))
+    {
+      WriteOut(true);
+      flushed = true;
+      last_flush = now;
+    }
+    usleep(SM500_REC_POLL_US);
+  }
+
+  CloseSegment();
+}
+
+
+/* ===========================================================================
+Moves the published records from the ring to the staging buffer.  Returns
+true if any record was consumed.
+=========================================================================== */
+bool Csm500Recorder::Drain(void)
+{
+  bool any = false;
+
+  while (true)
+  {
+    uint64_t pos = Tail & (QueueBytes - 1);
+    uint32_t *magic = (uint32_t*)(Queue + pos);
+    uint32_t m = __atomic_load_n(magic, __ATOMIC_ACQUIRE);
+    uint64_t size;
+
+    if (m == 0)
+      break;      //empty, or the next record is not published yet
+
+    if (m == SM500_REC_SKIP_MAGIC)
+      size = QueueBytes - pos;
+    else
+    {
+      const sm500_rec_record *r = (const sm500_rec_record*)magic;
+      size = sm500_rec_record_bytes(r->Bytes);
+      Append(r);
+    }
+
+    memset(magic, 0, size);
+    Tail += size;
+    Released.store(Tail, std::memory_order_release);
+    any = true;
+  }
+
+  return any;
+}
+
+
+/* ===========================================================================
+Appends a record to the staging buffer, opening a new segment when it
+would not fit in the current one, and writing the staging buffer out when
+it is full.  The checksum is computed here, off the acquisition threads.
+=========================================================================== */
+void Csm500Recorder::Append(const sm500_rec_record *Record)
+{
+  const uint32_t size = sm500_rec_record_bytes(Record->Bytes);
+
+  if (Fd < 0)
+  {
+    Dropped++;    //failed segment
+    return;
+  }
+
+  if (FileOffset + Fill + size > SegmentBytes - SM500_REC_PAGE_BYTES)
+  {
+    CloseSegment();
+    if (!OpenSegment())
+    {
+      Dropped++;
+      return;
+    }
+  }
+  if (Fill + size > SM500_REC_BATCH_BYTES)
+    WriteOut(false);
+
+  sm500_rec_record *r = (sm500_rec_record*)(Staging + Fill);
+  memcpy(r, Record, size);
+  r->Checksum = sm500_rec_checksum(r + 1, r->Bytes);
+  AddToIndex(Index, FileOffset + Fill, *r);
+  Fill += size;
+
+  if (Footer.NumRecords == 0)
+  {
+    Footer.FirstSerialNumber = r->SerialNumber;
+    Footer.FirstTimestampSec = r->TimestampSec;
+    Footer.FirstTimestampNsec = r->TimestampNsec;
+  }
+  Footer.LastSerialNumber = r->SerialNumber;
+  Footer.LastTimestampSec = r->TimestampSec;
+  Footer.LastTimestampNsec = r->TimestampNsec;
+  Footer.NumRecords++;
+
+  Recorded++;
+  RecordedBytes += r->Bytes;
+}
+
+
+/* ===========================================================================
+Writes the whole pages of the staging buffer and keeps the remainder.  With
+Partial, the last partial page is also written, zero-padded; it is written
+again once more records have been staged.
+=========================================================================== */
+void Csm500Recorder::WriteOut(bool Partial)
+{
+  uint32_t whole = Fill & ~(SM500_REC_PAGE_BYTES - 1);
+  uint32_t bytes = whole;
+
+  if (Fd < 0)
+    return;
+
+  if (Partial && (Fill > whole))
+  {
+    bytes = (Fill + SM500_REC_PAGE_BYTES - 1) & ~(SM500_REC_PAGE_BYTES - 1);
+    memset(Staging + Fill, 0, bytes - Fill);
+  }
+
+  for (uint32_t done=0; done<bytes; )
+  {
+    ssize_t n = pwrite(Fd, Staging + done, bytes - done, FileOffset + done);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      Fail(errno);
+      return;
+    }
+    done += n;
+  }
+
+  if (whole)
+  {
+    memmove(Staging, Staging + whole, Fill - whole);
+    FileOffset += whole;
+    Fill -= whole;
+  }
+}
+
+
+/* ===========================================================================
+Creates and preallocates the next segment, and stages its header.  Returns
+false (with Error set) on failure.
+=========================================================================== */
+bool Csm500Recorder::OpenSegment(void)
+{
+  char suffix[32];
+  int flags = O_WRONLY | O_CREAT | O_TRUNC;
+
+  snprintf(suffix, sizeof(suffix), "_%06u" SM500_REC_EXTENSION, Segment);
+  string name = Path + suffix;
+
+  Fd = -1;
+  if (DirectIo)
+    Fd = open(name.c_str(), flags | O_DIRECT, 0644);
+  if (Fd < 0)
+    Fd = open(name.c_str(), flags, 0644);   //no O_DIRECT on this file system
+  if (Fd < 0)
+  {
+    Fail(errno);
+    return false;
+  }
+
+  //preallocation is best effort: without it the file simply grows
+  if ((fallocate(Fd, 0, 0, SegmentBytes) != 0) && (errno == ENOSPC))
+  {
+    Fail(errno);
+    return false;
+  }
+
+  memset(Staging, 0, SM500_REC_PAGE_BYTES);
+  sm500_rec_segment_header *h = (sm500_rec_segment_header*)Staging;
+  h->Magic = SM500_REC_SEGMENT_MAGIC;
+  h->Version = SM500_REC_VERSION;
+  h->PageBytes = SM500_REC_PAGE_BYTES;
+  h->Segment = Segment;
+  h->NumChannels = SM500_NUM_CHANNELS;
+  h->PeaksFrameBytes = sm500_peaks_format::FrameBytes;
+  h->FsFrameBytes = sm500_fs_format::FrameBytes;
+  h->SegmentBytes = SegmentBytes;
+  Fill = SM500_REC_PAGE_BYTES;
+  FileOffset = 0;
+
+  memset(&Footer, 0, sizeof(Footer));
+  Index.clear();
+  Segment++;
+  Segments++;
+  return true;
+}
+
+
+/* ===========================================================================
+Writes out the staged records and the footer, releases the unused
+preallocated space and syncs the segment
+=========================================================================== */
+void Csm500Recorder::CloseSegment(void)
+{
+  if (Fd < 0)
+    return;
+
+  WriteOut(true);
+  if (Fd < 0)
+    return;
+
+  Footer.Magic = SM500_REC_FOOTER_MAGIC;
+  Footer.Version = SM500_REC_VERSION;
+  Footer.DataEnd = FileOffset + ((Fill + SM500_REC_PAGE_BYTES - 1) & ~(SM500_REC_PAGE_BYTES - 1));
+  Footer.Dropped = Dropped;
+  Footer.Checksum = sm500_rec_checksum(&Footer, offsetof(sm500_rec_footer, Checksum));
+
+  memset(Staging, 0, SM500_REC_PAGE_BYTES);
+  memcpy(Staging, &Footer, sizeof(Footer));
+  if ((pwrite(Fd, Staging, SM500_REC_PAGE_BYTES, Footer.DataEnd) != SM500_REC_PAGE_BYTES) ||
+      (ftruncate(Fd, Footer.DataEnd + SM500_REC_PAGE_BYTES) != 0) ||
+      (fdatasync(Fd) != 0))
+  {
+    Fail(errno);
+    return;
+  }
+
+  close(Fd);
+  Fd = -1;
+  Fill = 0;
+  WriteIndex();
+}
+
+
+/* ===========================================================================
+Adds a record (at file offset Offset) to a segment index: to the last
+block, or to a new block once the last one holds
+SM500_REC_INDEX_BLOCK_BYTES
+=========================================================================== */
+void Csm500Recorder::AddToIndex(vector<sm500_rec_index_entry> &Index, uint64_t Offset, const sm500_rec_record &Record)
+{
+  uint64_t t = sm500_rec_time_ns(Record);
+  uint32_t size = sm500_rec_record_bytes(Record.Bytes);
+
+  if (Index.empty() || (Index.back().Bytes + size > SM500_REC_INDEX_BLOCK_BYTES))
+  {
+    sm500_rec_index_entry e;
+    e.Offset = Offset;
+    e.NumRecords = 0;
+    e.Bytes = 0;
+    e.MinTimeNs = e.MaxTimeNs = t;
+    Index.push_back(e);
+  }
+
+  sm500_rec_index_entry &e = Index.back();
+  e.NumRecords++;
+  e.Bytes += size;
+  if (t < e.MinTimeNs) e.MinTimeNs = t;
+  if (t > e.MaxTimeNs) e.MaxTimeNs = t;
+}
+
+
+/* ===========================================================================
+Writes the index of the segment just closed next to it.  The index is only
+an accelerator: a missing one is rebuilt by the readers, so failures are
+not reported.
+=========================================================================== */
+void Csm500Recorder::WriteIndex(void)
+{
+  char suffix[32];
+  sm500_rec_index_header h;
+
+  snprintf(suffix, sizeof(suffix), "_%06u" SM500_REC_INDEX_EXTENSION, Segment - 1);
+  string name = Path + suffix;
+
+  h.Magic = SM500_REC_INDEX_MAGIC;
+  h.Version = SM500_REC_VERSION;
+  h.NumEntries = Index.size();
+  h.Checksum = sm500_rec_checksum(Index.data(), Index.size() * sizeof(sm500_rec_index_entry));
+
+  FILE *f = fopen(name.c_str(), "wb");
+  if (!f)
+    return;
+  bool ok = (fwrite(&h, sizeof(h), 1, f) == 1) &&
+            (Index.empty() || (fwrite(Index.data(), sizeof(sm500_rec_index_entry), Index.size(), f) == Index.size()));
+  if ((fclose(f) != 0) || !ok)
+    remove(name.c_str());
+}
+
+
+/* ===========================================================================
+Records the first write error and closes the segment.  The frames that
+follow are counted as dropped.
+=========================================================================== */
+void Csm500Recorder::Fail(int Error)
+{
+  int none = 0;
+
+  this->Error.compare_exchange_strong(none, Error);
+  if (Fd >= 0)
+    close(Fd);
+  Fd = -1;
+  Fill = 0;
+}
+
+
+
+/* ===========================================================================
+=========================================================================== */
+//----------  ----------
+//----------  ----------
@@ -0,0 +1,286 @@
+/* ===========================================================================
+ Csm500Recorder.h
+ sm500 raw frame recorder class definition
+
+ The recorder appends raw DMA buffers (as returned by GetPeaksData() and
+ GetFsData()) to segmented log files, without ever holding up the
+ acquisition threads:
+
+ - Record() copies the buffer into a lock-free byte ring and returns.
+   Several acquisition threads (peaks and FS) may record concurrently.
+   When the ring is full the frame is dropped and counted; the caller
+   never waits for the disk.
+ - A writer thread drains the ring into a page-aligned staging buffer and
+   writes it out in large batches of whole pages (optionally O_DIRECT).
+   A partial last page is flushed periodically and rewritten as it fills.
+ - Each segment is preallocated (fallocate) and closed with a footer once
+   full or when recording stops.
+
+ Segment file layout (Path_NNNNNN.sm500rec):
+
+   page 0        sm500_rec_segment_header
+   pages 1..     records: sm500_rec_record + frame bytes (padded to 8),
+                 back to back; a zero magic ends the records
+   last page     sm500_rec_footer (segments closed cleanly only)
+
+ A segment without footer (the process or the machine died) is read up to
+ the first record whose magic or checksum is wrong.
+
+ Each closed segment gets a sparse index, Path_NNNNNN.sm500idx: the
+ records are grouped in blocks of about SM500_REC_INDEX_BLOCK_BYTES, and
+ the index holds the offset and the timestamp range of every block, so a
+ time range is located without reading the segment (see Csm500Archive).
+
+ Use one recorder per card.
+
+ Jerry Volcy
+
+ Copyright (c) 2013, Micron Optics, Inc.
+=========================================================================== */
+
+#ifndef CSM500RECORDER_H
+#define CSM500RECORDER_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <atomic>
+#include "sm500_data_structures.h"
+
+/* ===========================================================================
+Constants
+=========================================================================== */
+#define SM500_REC_PAGE_BYTES        4096
+#define SM500_REC_VERSION           1
+#define SM500_REC_SEGMENT_MAGIC     0x52354D53    //"SM5R"
+#define SM500_REC_RECORD_MAGIC      0x44524352    //"RCRD"
+#define SM500_REC_SKIP_MAGIC        0x50494B53    //"SKIP" (ring only: wraps to the ring start)
+#define SM500_REC_FOOTER_MAGIC      0x544F4F46    //"FOOT"
+#define SM500_REC_INDEX_MAGIC       0x49354D53    //"SM5I"
+#define SM500_REC_EXTENSION         ".sm500rec"
+#define SM500_REC_INDEX_EXTENSION   ".sm500idx"
+#define SM500_REC_INDEX_BLOCK_BYTES (1 << 20)     //records per index entry, in bytes
+#define SM500_REC_MAX_FRAME_BYTES   (1 << 20)
+#define SM500_REC_BATCH_BYTES       (4 << 20)     //staging buffer: largest single write
+#define SM500_REC_POLL_US           500           //writer thread sleep when the ring is empty
+
+
+/* ===========================================================================
+Defaults
+=========================================================================== */
+#define SM500_DEFAULT_REC_SEGMENT_BYTES   (1ULL << 30)
+#define SM500_DEFAULT_REC_QUEUE_BYTES     (64 << 20)
+#define SM500_DEFAULT_REC_FLUSH_MS        100     //partial page flush interval
+
+
+/* ===========================================================================
+Record types
+=========================================================================== */
+enum sm500_rec_type
+{
+  SM500_REC_PEAKS = 1,          //peaks DMA buffer
+  SM500_REC_FS = 2              //FS DMA buffer
+};
+
+
+/* ===========================================================================
+File structures
+=========================================================================== */
+struct sm500_rec_segment_header
+{
+  uint32_t Magic;                 //SM500_REC_SEGMENT_MAGIC
+  uint32_t Version;
+  uint32_t PageBytes;
+  uint32_t Segment;               //index in the recording, from 0
+  uint32_t NumChannels;           //format of the recorded frames
+  uint32_t PeaksFrameBytes;
+  uint32_t FsFrameBytes;
+  uint32_t Reserved;
+  uint64_t SegmentBytes;          //preallocated size
+};
+
+struct sm500_rec_record
+{
+  uint32_t Magic;                 //SM500_REC_RECORD_MAGIC
+  uint16_t Type;                  //sm500_rec_type
+  uint16_t Flags;
+  uint32_t Bytes;                 //frame size; the frame follows, padded to 8 bytes
+  uint32_t Checksum;              //sm500_rec_checksum() of the frame
+  uint64_t SerialNumber;          //from the frame header
+  uint32_t TimestampSec;
+  uint32_t TimestampNsec;
+};
+static_assert(sizeof(sm500_rec_record) == 32, "record header must stay 8-byte aligned");
+
+struct sm500_rec_footer
+{
+  uint32_t Magic;                 //SM500_REC_FOOTER_MAGIC
+  uint32_t Version;
+  uint64_t DataEnd;               //file offset of the end of the records (= footer offset)
+  uint64_t NumRecords;
+  uint64_t FirstSerialNumber;
+  uint64_t LastSerialNumber;
+  uint32_t FirstTimestampSec;
+  uint32_t FirstTimestampNsec;
+  uint32_t LastTimestampSec;
+  uint32_t LastTimestampNsec;
+  uint64_t Dropped;               //frames dropped since the recording started
+  uint32_t Reserved;
+  uint32_t Checksum;              //sm500_rec_checksum() of the fields above
+};
+
+struct sm500_rec_index_header
+{
+  uint32_t Magic;                 //SM500_REC_INDEX_MAGIC
+  uint32_t Version;
+  uint32_t NumEntries;            //the entries follow
+  uint32_t Checksum;              //sm500_rec_checksum() of the entries
+};
+
+struct sm500_rec_index_entry
+{
+  uint64_t Offset;                //file offset of the first record of the block
+  uint32_t NumRecords;
+  uint32_t Bytes;                 //size of the block's records
+  uint64_t MinTimeNs;             //timestamp range of the block's records
+  uint64_t MaxTimeNs;
+};
+
+
+/* ===========================================================================
+Record checksum (Fletcher style, over 32-bit words; Bytes multiple of 4)
+=========================================================================== */
+static inline uint32_t sm500_rec_checksum(const void *Data, uint32_t Bytes)
+{
+  const uint32_t *w = (const uint32_t*)Data;
+  uint64_t a = Bytes, b = 0;
+
+  for (uint32_t i=0; i<Bytes/4; i++)
+  {
+    a += w[i];
+    b += a;
+  }
+  return (uint32_t)(a ^ (a >> 32) ^ b ^ (b >> 32));
+}
+
+static inline uint64_t sm500_rec_record_bytes(uint32_t FrameBytes)
+{
+  return sizeof(sm500_rec_record) + ((FrameBytes + 7) & ~7u);
+}
+
+static inline uint64_t sm500_rec_time_ns(const sm500_rec_record &Record)
+{
+  return (uint64_t)Record.TimestampSec * 1000000000ULL + Record.TimestampNsec;
+}
+
+//true if a segment holds frames of the format this library was built for
+static inline bool sm500_rec_header_valid(const sm500_rec_segment_header &Header)
+{
+  return (Header.Magic == SM500_REC_SEGMENT_MAGIC) && (Header.Version == SM500_REC_VERSION) &&
+         (Header.PageBytes == SM500_REC_PAGE_BYTES) && (Header.NumChannels == SM500_NUM_CHANNELS) &&
+         (Header.PeaksFrameBytes == sm500_peaks_format::FrameBytes) && (Header.FsFrameBytes == sm500_fs_format::FrameBytes);
+}
+
+//true if the last page of a segment of FileBytes bytes is a valid footer (the segment was closed cleanly)
+static inline bool sm500_rec_footer_valid(const sm500_rec_footer &Footer, uint64_t FileBytes)
+{
+  return (FileBytes >= 2 * SM500_REC_PAGE_BYTES) && (Footer.Magic == SM500_REC_FOOTER_MAGIC) &&
+         (Footer.Checksum == sm500_rec_checksum(&Footer, offsetof(sm500_rec_footer, Checksum))) &&
+         (Footer.DataEnd == FileBytes - SM500_REC_PAGE_BYTES);
+}
+
+
+/* ===========================================================================
+Recorder statistics
+=========================================================================== */
+struct sm500_recorder_stats
+{
+  uint64_t Recorded;              //frames written to the segments
+  uint64_t RecordedBytes;
+  uint64_t Dropped;               //frames dropped (ring full or write error)
+  uint32_t Segments;              //segments opened
+  int Error;                      //errno of the first write error (recording stopped); 0 otherwise
+};
+
+
+/* ===========================================================================
+Csm500Recorder class definition
+=========================================================================== */
+class Csm500Recorder
+{
+  public:
+    //----------  ----------
+    Csm500Recorder();                       //constructor
+    virtual ~Csm500Recorder();              //destructor
+    void SetSegmentBytes(uint64_t Bytes);   //preallocated size of a segment (applies to the next Start())
+    void SetQueueBytes(uint64_t Bytes);     //size of the ring between Record() and the writer (power of 2)
+    void SetDirectIo(bool Enable);          //writes with O_DIRECT where the file system supports it
+    void SetFlushInterval(uint32_t Ms);     //partial page flush interval
+    void Start(const char *Path);           //opens Path_000000.sm500rec and starts the writer thread
+    void Stop(void);                        //writes what is queued, closes the segment and joins the writer
+    bool IsRecording(void);
+    bool Record(sm500_rec_type Type, const void *Frame, uint32_t Bytes);  //queues a frame; false if not recorded
+    bool RecordPeaks(const void *PeaksData);  //queues a peaks DMA buffer
+    bool RecordFs(const void *FsData);        //queues an FS DMA buffer
+    void GetStats(sm500_recorder_stats &Stats);
+    static void AddToIndex(vector<sm500_rec_index_entry> &Index, uint64_t Offset, const sm500_rec_record &Record);  //adds a record to a segment index
+
+  protected:
+    static void* ThreadEntry(void *Arg);
+    void WriterLoop(void);
+    bool Drain(void);                       //moves the committed records to the staging buffer
+    void Append(const sm500_rec_record *Record);
+    void WriteOut(bool Partial);            //writes the whole pages staged (and the partial one)
+    bool OpenSegment(void);
+    void CloseSegment(void);
+    void WriteIndex(void);
+    void Fail(int Error);
+
+    //---------- settings ----------
+    uint64_t SegmentBytes;
+    uint64_t QueueBytes;
+    bool DirectIo;
+    uint32_t FlushMs;
+
+    //---------- ring (producers and writer) ----------
+    uint8_t *Queue;
+    std::atomic<uint64_t> Reserved;         //bytes reserved by the producers
+    std::atomic<uint64_t> Released;         //bytes consumed by the writer
+    std::atomic<uint32_t> Producers;        //Record() calls in flight
+    std::atomic<bool> bRecording;
+    std::atomic<bool> bStop;
+
+    //---------- writer ----------
+    pthread_t Thread;
+    string Path;
+    uint64_t Tail;                          //writer position in the ring
+    uint8_t *Staging;                       //page-aligned, SM500_REC_BATCH_BYTES
+    uint32_t Fill;                          //bytes staged
+    uint64_t FileOffset;                    //file offset of Staging[0] (page-aligned)
+    int Fd;
+    uint32_t Segment;
+    sm500_rec_footer Footer;                //of the open segment
+    vector<sm500_rec_index_entry> Index;    //of the open segment
+
+    //---------- statistics ----------
+    std::atomic<uint64_t> Recorded;
+    std::atomic<uint64_t> RecordedBytes;
+    std::atomic<uint64_t> Dropped;
+    std::atomic<uint32_t> Segments;
+    std::atomic<int> Error;
+};
+
+#endif // #ifndef CSM500RECORDER_H
+
+
+
+/* ===========================================================================
+=========================================================================== */
+//----------  ----------
+//----------  ----------
@@ -0,0 +1,271 @@
+/* ===========================================================================
+ Csm500RegShadow.cpp
+ sm500 register shadow class implementation
+
+ Jerry Volcy
+
+ Copyright (c) 2013, Micron Optics, Inc.
+=========================================================================== */
+
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include "Csm500RegShadow.h"
+
+
+/* ===========================================================================
+Csm500RegShadow constructor
+=========================================================================== */
+Csm500RegShadow::Csm500RegShadow()
+{
+  pthread_mutex_init(&Lock, 0);
+  for (uint32_t r=0; r<SM500_SHADOW_NUM_REGS; r++)
+  {
+    Regs[r].Value = 0;
+    Regs[r].Class = SM500_REG_VOLATILE;
+    Regs[r].Valid = 0;
+    Regs[r].Dirty = 0;
+  }
+  NumDirty = 0;
+  Batch = false;
+  memset(&Stats, 0, sizeof(Stats));
+
+  //---------- set by the FPGA image and the driver at probe ----------
+  Regs[SM500_REG_HVER].Class = SM500_REG_CONSTANT;
+  Regs[SM500_REG_NFSBUF].Class = SM500_REG_CONSTANT;
+  Regs[SM500_REG_FSBUFSZ].Class = SM500_REG_CONSTANT;
+  Regs[SM500_REG_NPKBUF].Class = SM500_REG_CONSTANT;
+  Regs[SM500_REG_PKBUFSZ].Class = SM500_REG_CONSTANT;
+  Regs[SM500_REG_TSOFST].Class = SM500_REG_CONSTANT;
+
+  //---------- written by the host only (the driver clears them on release) ----------
+  Regs[SM500_REG_DMACR].Class = SM500_REG_WRITE_THROUGH;
+  Regs[SM500_REG_INTE].Class = SM500_REG_WRITE_THROUGH;
+}
+
+
+/* ===========================================================================
+destructor
+=========================================================================== */
+Csm500RegShadow::~Csm500RegShadow()
+{
+  pthread_mutex_destroy(&Lock);
+}
+
+
+/* ===========================================================================
+Reclassifies a register.  Its cached value is dropped; a staged write is
+kept and still flushed.
+=========================================================================== */
+void Csm500RegShadow::SetClass(uint32_t Reg, sm500_reg_class Class)
+{
+  if (Reg >= SM500_SHADOW_NUM_REGS)
+    throw EINVAL;
+
+  pthread_mutex_lock(&Lock);
+  Regs[Reg].Class = Class;
+  if (!Regs[Reg].Dirty)
+    Regs[Reg].Valid = 0;
+  pthread_mutex_unlock(&Lock);
+}
+
+sm500_reg_class Csm500RegShadow::GetClass(uint32_t Reg)
+{
+  if (Reg >= SM500_SHADOW_NUM_REGS)
+    return SM500_REG_VOLATILE;
+  return (sm500_reg_class)Regs[Reg].Class;
+}
+
+
+/* ===========================================================================
+Returns true, and the value in Value, when a read of Reg can be served
+from the shadow; false when it must go to the card (then Fill() it)
+=========================================================================== */
+bool Csm500RegShadow::Lookup(uint32_t Reg, uint32_t &Value)
+{
+  bool hit = false;
+
+  if (Reg >= SM500_SHADOW_NUM_REGS)
+    return false;
+
+  pthread_mutex_lock(&Lock);
+  reg_entry &e = Regs[Reg];
+  if ((e.Class != SM500_REG_VOLATILE) && e.Valid)
+  {
+    Value = e.Value;
+    hit = true;
+    Stats.Hits++;
+  }
+  else
+    Stats.Misses++;
+  pthread_mutex_unlock(&Lock);
+  return hit;
+}
+
+
+/* ===========================================================================
+Records the value of Reg just read from the card
+=========================================================================== */
+void Csm500RegShadow::Fill(uint32_t Reg, uint32_t Value)
+{
+  if (Reg >= SM500_SHADOW_NUM_REGS)
+    return;
+
+  pthread_mutex_lock(&Lock);
+  reg_entry &e = Regs[Reg];
+  if ((e.Class != SM500_REG_VOLATILE) && !e.Dirty)
+  {
+    e.Value = Value;
+    e.Valid = 1;
+  }
+  pthread_mutex_unlock(&Lock);
+}
+
+
+/* ===========================================================================
+Records a write of Value to Reg.  Returns true when the caller must write
+it to the card now; false when the register already holds Value or the
+write was staged for the batch.
+=========================================================================== */
+bool Csm500RegShadow::Write(uint32_t Reg, uint32_t Value)
+{
+  bool now = true;
+
+  if (Reg >= SM500_SHADOW_NUM_REGS)
+    return true;
+
+  pthread_mutex_lock(&Lock);
+  reg_entry &e = Regs[Reg];
+  switch (e.Class)
+  {
+    case SM500_REG_WRITE_THROUGH:
+      if (e.Valid && !e.Dirty && (e.Value == Value))
+      {
+        Stats.WritesElided++;
+        now = false;
+        break;
+      }
+      if (Batch)
+      {
+        if (!e.Dirty)
+          DirtyRegs[NumDirty++] = Reg;
+        e.Dirty = 1;
+        Stats.WritesStaged++;
+        now = false;
+      }
+      e.Value = Value;
+      e.Valid = 1;
+      break;
+
+    case SM500_REG_CONSTANT:
+      e.Valid = 0;                    //not expected, but the card has the last word
+      break;
+
+    default:
+      break;
+  }
+  pthread_mutex_unlock(&Lock);
+  return now;
+}
+
+
+/* ===========================================================================
+Drops the cached value of Reg
+=========================================================================== */
+void Csm500RegShadow::Forget(uint32_t Reg)
+{
+  if (Reg >= SM500_SHADOW_NUM_REGS)
+    return;
+
+  pthread_mutex_lock(&Lock);
+  if (!Regs[Reg].Dirty)
+    Regs[Reg].Valid = 0;
+  pthread_mutex_unlock(&Lock);
+}
+
+
+/* ===========================================================================
+Batches: the writes to write-through registers are staged (the last value
+of each register wins) until they are taken out with TakeDirty()
+=========================================================================== */
+void Csm500RegShadow::BeginBatch(void)
+{
+  pthread_mutex_lock(&Lock);
+  Batch = true;
+  pthread_mutex_unlock(&Lock);
+}
+
+bool Csm500RegShadow::InBatch(void)
+{
+  return Batch;
+}
+
+
+/* ===========================================================================
+Moves up to MaxRegs staged writes into Regs, in the order the registers
+were first written, and returns their #.  The batch ends when nothing is
+left staged.
+=========================================================================== */
+uint32_t Csm500RegShadow::TakeDirty(struct sm500_ioctl_reg_arg *Regs, uint32_t MaxRegs)
+{
+  uint32_t n;
+
+  pthread_mutex_lock(&Lock);
+  n = (NumDirty < MaxRegs) ? NumDirty : MaxRegs;
+  for (uint32_t i=0; i<n; i++)
+  {
+    reg_entry &e = this->Regs[DirtyRegs[i]];
+    Regs[i].reg = DirtyRegs[i];
+    Regs[i].value = e.Value;
+    e.Dirty = 0;
+  }
+  memmove(DirtyRegs, DirtyRegs + n, (NumDirty - n) * sizeof(DirtyRegs[0]));
+  NumDirty -= n;
+  if ((NumDirty == 0) && Batch)
+  {
+    Batch = false;
+    Stats.Batches++;
+  }
+  pthread_mutex_unlock(&Lock);
+  return n;
+}
+
+
+/* ===========================================================================
+Drops every cached value and staged write
+=========================================================================== */
+void Csm500RegShadow::Invalidate(void)
+{
+  pthread_mutex_lock(&Lock);
+  for (uint32_t r=0; r<SM500_SHADOW_NUM_REGS; r++)
+  {
+    Regs[r].Valid = 0;
+    Regs[r].Dirty = 0;
+  }
+  NumDirty = 0;
+  Batch = false;
+  pthread_mutex_unlock(&Lock);
+}
+
+
+/* ===========================================================================
+Returns the statistics
+=========================================================================== */
+void Csm500RegShadow::GetStats(sm500_reg_shadow_stats &Stats)
+{
+  pthread_mutex_lock(&Lock);
+  Stats = this->Stats;
+  pthread_mutex_unlock(&Lock);
+}
+
+
+
+/* ===========================================================================
+=========================================================================== */
+//----------  ----------
+//----------  ----------
@@ -0,0 +1,110 @@
+/* ===========================================================================
+ Csm500RegShadow.h
+ sm500 register shadow class definition
+
+ A copy of the sm500 register map kept by Csm500DevCtrl, so that reading a
+ register does not always cost an ioctl and an MMIO read.  Each register
+ has a class:
+
+   SM500_REG_CONSTANT       fixed after probe (HDL version, DMA buffer
+                            geometry): read from the card once, then
+                            served from the shadow
+   SM500_REG_WRITE_THROUGH  control registers only the host writes (DMA and
+                            interrupt enables): reads are served from the
+                            last value written or read, writes of the value
+                            already there are dropped, and between
+                            BeginBatch() and TakeDirty() writes are staged
+                            to be flushed together
+   SM500_REG_VOLATILE       everything else (status, flags, S/N): always
+                            read from the card
+
+ The shadow only does the bookkeeping; Csm500DevCtrl does the register
+ I/O.  It is thread safe.
+
+ Jerry Volcy
+
+ Copyright (c) 2013, Micron Optics, Inc.
+=========================================================================== */
+#ifndef CSM500REGSHADOW_H
+#define CSM500REGSHADOW_H
+
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+#include <stdint.h>
+#include <pthread.h>
+#include "sm500_public.h"
+
+/* ===========================================================================
+Constants
+=========================================================================== */
+#define SM500_SHADOW_NUM_REGS   (SM500_REG_INTDR + 1)   //registers 0 to SM500_REG_INTDR are shadowed
+
+enum sm500_reg_class
+{
+  SM500_REG_VOLATILE = 0,
+  SM500_REG_CONSTANT,
+  SM500_REG_WRITE_THROUGH
+};
+
+
+/* ===========================================================================
+Statistics
+=========================================================================== */
+struct sm500_reg_shadow_stats
+{
+  uint64_t Hits;                  //reads served from the shadow
+  uint64_t Misses;                //reads that went to the card
+  uint64_t WritesElided;          //writes of the value already in the register
+  uint64_t WritesStaged;          //writes held for a batch
+  uint64_t Batches;               //batches taken (TakeDirty())
+};
+
+
+/* ===========================================================================
+Csm500RegShadow class definition
+=========================================================================== */
+class Csm500RegShadow
+{
+  public:
+    Csm500RegShadow();                      //constructor: the default classification
+    virtual ~Csm500RegShadow();             //destructor
+    void SetClass(uint32_t Reg, sm500_reg_class Class);   //reclassifies a register (drops its cached value)
+    sm500_reg_class GetClass(uint32_t Reg);
+    bool Lookup(uint32_t Reg, uint32_t &Value);           //true when Value was served from the shadow
+    void Fill(uint32_t Reg, uint32_t Value);              //records a value read from the card
+    bool Write(uint32_t Reg, uint32_t Value);             //true when the write must go to the card now
+    void Forget(uint32_t Reg);                            //drops the cached value of Reg (e.g. after an 8/16 bit write)
+    void BeginBatch(void);                                //stages the writes to write-through registers
+    bool InBatch(void);
+    uint32_t TakeDirty(struct sm500_ioctl_reg_arg *Regs, uint32_t MaxRegs);   //moves out the staged writes, in order; ends the batch once empty
+    void Invalidate(void);                                //drops every cached value and staged write (card reset or closed)
+    void GetStats(sm500_reg_shadow_stats &Stats);
+
+  protected:
+    struct reg_entry
+    {
+      uint32_t Value;
+      uint8_t Class;
+      uint8_t Valid;
+      uint8_t Dirty;
+    };
+
+    pthread_mutex_t Lock;
+    reg_entry Regs[SM500_SHADOW_NUM_REGS];
+    uint16_t DirtyRegs[SM500_SHADOW_NUM_REGS];  //staged registers, in the order of their first write
+    uint32_t NumDirty;
+    bool Batch;
+    sm500_reg_shadow_stats Stats;
+};
+
+#endif // #ifndef CSM500REGSHADOW_H
+
+
+
+/* ===========================================================================
+=========================================================================== */
+//----------  ----------
+//----------  ----------
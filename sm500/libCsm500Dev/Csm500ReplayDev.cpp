@@ -0,0 +1,535 @@
+/* ===========================================================================
+ Csm500ReplayDev.cpp
+ sm500 replay device class implementation
+
+ Jerry Volcy
+
+ Copyright (c) 2013, Micron Optics, Inc.
+=========================================================================== */
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "Csm500ReplayDev.h"
+#include "sm500_common.h"
+
+
+/* ===========================================================================
+Returns a monotonic time in nano-seconds
+=========================================================================== */
+static uint64_t NowNs(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+/* ===========================================================================
+Csm500ReplayDev constructor
+=========================================================================== */
+Csm500ReplayDev::Csm500ReplayDev()
+{
+  pthread_condattr_t attr;
+
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_cond_init(&Cond, &attr);
+  pthread_condattr_destroy(&attr);
+  pthread_mutex_init(&Lock, 0);
+
+  Pacing = SM500_REPLAY_REALTIME;
+  Multiplier = 1.0;
+  Loop = false;
+  Preload = false;
+  CancelGeneration = 0;
+  Unload();
+}
+
+
+/* ===========================================================================
+destructor
+=========================================================================== */
+Csm500ReplayDev::~Csm500ReplayDev()
+{
+  Close();
+  pthread_cond_destroy(&Cond);
+  pthread_mutex_destroy(&Lock);
+}
+
+
+/* ===========================================================================
+A replay has no default device node
+=========================================================================== */
+void Csm500ReplayDev::Init()
+{
+  throw EINVAL;
+}
+
+
+/* ===========================================================================
+Maps the segments of the recording Path (Path_000000.sm500rec onwards) and
+indexes their frames.  Throws the errno of the failure if the first
+segment cannot be opened, and EPROTO if the recording does not hold frames
+of the format this library was built for.
+=========================================================================== */
+void Csm500ReplayDev::Init(const char* Path)
+{
+  Close();
+
+  try
+  {
+    for (uint32_t seg=0; ; seg++)
+    {
+      char suffix[32];
+      snprintf(suffix, sizeof(suffix), "_%06u" SM500_REC_EXTENSION, seg);
+      string name = string(Path) + suffix;
+
+      if ((seg > 0) && (access(name.c_str(), F_OK) != 0))
+        break;
+      LoadSegment(name);
+    }
+
+    //the pass duration, for looping: the span of the longest stream plus one frame period
+    replay_stream *longest = (Peaks.Frames.size() >= Fs.Frames.size()) ? &Peaks : &Fs;
+    uint64_t first = ~0ULL;
+    if (!Peaks.Frames.empty()) first = Peaks.Frames[0].TimeNs;
+    if (!Fs.Frames.empty() && (Fs.Frames[0].TimeNs < first)) first = Fs.Frames[0].TimeNs;
+    EpochRecNs = Peaks.Frames.empty() && Fs.Frames.empty() ? 0 : first;
+    LapNs = 0;
+    if (longest->Frames.size() > 1)
+    {
+      uint64_t span = longest->Frames.back().TimeNs - EpochRecNs;
+      LapNs = span + span / (longest->Frames.size() - 1);
+    }
+
+    DmaPeaksBufferSize = sm500_peaks_format::FrameBytes;
+    DmaFsBufferSize = sm500_fs_format::FrameBytes;
+    ValidateFrameLayout();
+    WorkerPool.Start(SM500_DEFAULT_WORKER_THREADS);
+    PeaksSerial.Reset();
+    FsSerial.Reset();
+    EnterRealTime();
+  }
+  catch (int err)
+  {
+    RealTime.Leave();
+    WorkerPool.Stop();
+    Unload();
+    throw (err);
+  }
+
+  bOpen = true;
+}
+
+
+/* ===========================================================================
+Stops processing and unmaps the recording
+=========================================================================== */
+void Csm500ReplayDev::Close()
+{
+  if (!bOpen) return;
+
+  Recorder.Stop();
+  WorkerPool.Stop();
+  Unload();
+  RealTime.Leave();
+  bOpen = false;
+}
+
+
+/* ===========================================================================
+Maps a segment and appends its frames to the streams.  A segment closed
+cleanly is read up to its footer; the records of a segment without footer
+are checked, up to the first bad one.
+=========================================================================== */
+void Csm500ReplayDev::LoadSegment(const string &Name)
+{
+  struct stat st;
+  int fd = open(Name.c_str(), O_RDONLY);
+
+  if (fd < 0)
+    throw errno;
+  if (fstat(fd, &st) != 0)
+  {
+    int err = errno;
+    close(fd);
+    throw err;
+  }
+  if (st.st_size < SM500_REC_PAGE_BYTES)
+  {
+    close(fd);
+    throw EPROTO;
+  }
+
+  size_t bytes = st.st_size;
+  void *map = mmap(0, bytes, PROT_READ, MAP_PRIVATE | (Preload ? MAP_POPULATE : 0), fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    throw errno;
+  madvise(map, bytes, MADV_SEQUENTIAL);
+
+  replay_segment segment = { map, bytes };
+  Segments.push_back(segment);
+
+  //---------- header ----------
+  const uint8_t *base = (const uint8_t*)map;
+  const sm500_rec_segment_header *h = (const sm500_rec_segment_header*)base;
+  if (!sm500_rec_header_valid(*h))
+  {
+    SM500_DBG( cout<<Name<<": not a recording of this frame format\n"; );
+    throw EPROTO;
+  }
+
+  //---------- footer ----------
+  const sm500_rec_footer *f = (const sm500_rec_footer*)(base + bytes - SM500_REC_PAGE_BYTES);
+  bool closed = sm500_rec_footer_valid(*f, bytes);
+  uint64_t end = closed ? f->DataEnd : bytes;
+
+  //---------- records ----------
+  for (uint64_t offset=SM500_REC_PAGE_BYTES; offset + sizeof(sm500_rec_record) <= end; )
+  {
+    const sm500_rec_record *r = (const sm500_rec_record*)(base + offset);
+    uint64_t size = sm500_rec_record_bytes(r->Bytes);
+
+    if ((r->Magic != SM500_REC_RECORD_MAGIC) || (offset + size > end))
+      break;
+    if (!closed && (sm500_rec_checksum(r + 1, r->Bytes) != r->Checksum))
+      break;      //torn write
+
+    replay_frame frame;
+    frame.Data = r + 1;
+    frame.TimeNs = sm500_rec_time_ns(*r);
+    frame.SerialNumber = r->SerialNumber;
+    if ((r->Type == SM500_REC_PEAKS) && (r->Bytes == sm500_peaks_format::FrameBytes))
+      Peaks.Frames.push_back(frame);
+    else if ((r->Type == SM500_REC_FS) && (r->Bytes == sm500_fs_format::FrameBytes))
+      Fs.Frames.push_back(frame);
+
+    offset += size;
+  }
+}
+
+
+/* ===========================================================================
+Unmaps the segments and forgets the frames
+=========================================================================== */
+void Csm500ReplayDev::Unload(void)
+{
+  for (size_t i=0; i<Segments.size(); i++)
+    munmap(Segments[i].Map, Segments[i].Bytes);
+  Segments.clear();
+
+  Peaks.Frames.clear();
+  Fs.Frames.clear();
+  Peaks.Next = Fs.Next = 0;
+  Peaks.Lap = Fs.Lap = 0;
+  EpochRecNs = 0;
+  EpochWallNs = 0;
+  EpochSet = false;
+  LapNs = 0;
+
+  memset(Regs, 0, sizeof(Regs));
+  Regs[SM500_REG_HVER] = ('R' << 24) | ('P' << 16) | ('L' << 8) | 'Y';
+  Regs[SM500_REG_NPKBUF] = 1;
+  Regs[SM500_REG_PKBUFSZ] = sm500_peaks_format::FrameBytes;
+  Regs[SM500_REG_NFSBUF] = 1;
+  Regs[SM500_REG_FSBUFSZ] = sm500_fs_format::FrameBytes;
+  Regs[SM500_REG_TSOFST] = sm500_header_layout::TimestampOffset32 << 2;
+}
+
+
+/* ===========================================================================
+Pacing settings
+=========================================================================== */
+void Csm500ReplayDev::SetPacing(sm500_replay_pacing Mode, double Multiplier)
+{
+  if ((Mode == SM500_REPLAY_SCALED) && !(Multiplier > 0.0))
+    throw EINVAL;
+
+  pthread_mutex_lock(&Lock);
+  Pacing = Mode;
+  this->Multiplier = (Mode == SM500_REPLAY_SCALED) ? Multiplier : 1.0;
+  EpochSet = false;       //restart the clock with the next frame
+  pthread_mutex_unlock(&Lock);
+}
+
+void Csm500ReplayDev::SetLoop(bool Enable)
+{
+  Loop = Enable;
+}
+
+void Csm500ReplayDev::SetPreload(bool Enable)
+{
+  Preload = Enable;
+}
+
+
+/* ===========================================================================
+Real-time mode: touches every page of the mapped recording
+=========================================================================== */
+void Csm500ReplayDev::PrefaultBuffers(void)
+{
+  for (size_t i=0; i<Segments.size(); i++)
+    RealTime.Prefault(Segments[i].Map, Segments[i].Bytes);
+}
+
+
+/* ===========================================================================
+Returns the number of recorded frames of a type
+=========================================================================== */
+uint64_t Csm500ReplayDev::GetNumFrames(sm500_rec_type Type)
+{
+  return (Type == SM500_REC_PEAKS) ? Peaks.Frames.size() : Fs.Frames.size();
+}
+
+
+/* ===========================================================================
+Returns the release time of the next frame of a stream.  The clock starts
+with the first frame requested, and re-starts, for a stream that loops
+back, from the frame of the same time in the previous pass.
+=========================================================================== */
+uint64_t Csm500ReplayDev::DueNs(const replay_stream &Stream)
+{
+  const replay_frame &f = Stream.Frames[Stream.Next];
+  uint64_t rec = f.TimeNs - EpochRecNs + Stream.Lap * LapNs;
+
+  if (f.TimeNs < EpochRecNs)
+    rec = Stream.Lap * LapNs;     //timestamps out of order: release with the epoch
+  return EpochWallNs + (uint64_t)(rec / Multiplier);
+}
+
+
+/* ===========================================================================
+Waits until the next frame of a stream is due and returns it in Data.
+Returns ENODATA at the end of the recording and ECANCELED when
+CancelReads() is called while waiting (0 otherwise).  A stream looping
+back resyncs Serial: the S/Ns starting over are not a card reset.
+=========================================================================== */
+int Csm500ReplayDev::NextFrame(replay_stream &Stream, Csm500SerialTracker &Serial, const void **Data) noexcept
+{
+  pthread_mutex_lock(&Lock);
+
+  if (Stream.Next == Stream.Frames.size())
+  {
+    if (!Loop || Stream.Frames.empty())
+    {
+      pthread_mutex_unlock(&Lock);
+      return ENODATA;
+    }
+    Stream.Next = 0;
+    Stream.Lap++;
+    Serial.Resync();
+  }
+
+  if (Pacing != SM500_REPLAY_FAST)
+  {
+    uint32_t generation = CancelGeneration;
+
+    if (!EpochSet)
+    {
+      EpochWallNs = NowNs() - (uint64_t)((Stream.Frames[Stream.Next].TimeNs - EpochRecNs + Stream.Lap * LapNs) / Multiplier);
+      EpochSet = true;
+    }
+
+    uint64_t due = DueNs(Stream);
+    struct timespec ts;
+    ts.tv_sec = due / 1000000000ULL;
+    ts.tv_nsec = due % 1000000000ULL;
+
+    while ((generation == CancelGeneration) && (NowNs() < due))
+      pthread_cond_timedwait(&Cond, &Lock, &ts);
+
+    if (generation != CancelGeneration)
+    {
+      pthread_mutex_unlock(&Lock);
+      return ECANCELED;
+    }
+  }
+
+  const replay_frame &f = Stream.Frames[Stream.Next++];
+  Regs[SM500_REG_DMASNLO] = (uint32_t)f.SerialNumber;
+  Regs[SM500_REG_DMASNHI] = (uint32_t)(f.SerialNumber >> 32);
+  pthread_mutex_unlock(&Lock);
+
+  *Data = f.Data;
+  return 0;
+}
+
+
+/* ===========================================================================
+Returns true if the next frame of a stream is due (a call to NextFrame()
+would not block)
+=========================================================================== */
+bool Csm500ReplayDev::FrameReady(replay_stream &Stream)
+{
+  bool ready;
+
+  pthread_mutex_lock(&Lock);
+  if (Stream.Frames.empty())
+    ready = false;
+  else if (Stream.Next == Stream.Frames.size())
+    ready = Loop && (Pacing == SM500_REPLAY_FAST);
+  else
+    ready = (Pacing == SM500_REPLAY_FAST) || !EpochSet || (NowNs() >= DueNs(Stream));
+  pthread_mutex_unlock(&Lock);
+
+  return ready;
+}
+
+
+/* ===========================================================================
+Returns the next recorded buffer when it is due.  The buffers are queued
+for recording when a recording is running, as with the device.
+=========================================================================== */
+const void* Csm500ReplayDev::GetPeaksData(void)
+{
+  sm500_result<const void*> r = Csm500ReplayDev::TryGetPeaksData();
+
+  if (!r.Ok())
+    throw r.Errno;
+  return r.Value;
+}
+
+const void* Csm500ReplayDev::GetFsData(void)
+{
+  sm500_result<const void*> r = Csm500ReplayDev::TryGetFsData();
+
+  if (!r.Ok())
+    throw r.Errno;
+  return r.Value;
+}
+
+sm500_result<const void*> Csm500ReplayDev::TryGetPeaksData(void) noexcept
+{
+  const void *data;
+  int err = NextFrame(Peaks, PeaksSerial, &data);
+
+  if (err)
+    return sm500_result<const void*>::Error(err);
+  PeaksSerial.Check(Csm500PeaksFrame(data).SerialNumber());
+  if (LatencyStats.IsEnabled())
+  {
+    sm500_latency_mark *mark = LatencyStats.FindThreadMark();
+    if (mark)
+      LatencyStats.FrameStart(*mark);     //recorded timestamps: no wakeup stage
+  }
+  if (Recorder.IsRecording())
+    Recorder.RecordPeaks(data);
+  return sm500_result<const void*>::Success(data);
+}
+
+sm500_result<const void*> Csm500ReplayDev::TryGetFsData(void) noexcept
+{
+  const void *data;
+  int err = NextFrame(Fs, FsSerial, &data);
+
+  if (err)
+    return sm500_result<const void*>::Error(err);
+  FsSerial.Check(Csm500FsFrame(data).SerialNumber());
+  if (Recorder.IsRecording())
+    Recorder.RecordFs(data);
+  return sm500_result<const void*>::Success(data);
+}
+
+bool Csm500ReplayDev::PeaksDataReady(void)
+{
+  return FrameReady(Peaks);
+}
+
+bool Csm500ReplayDev::FsDataReady(void)
+{
+  return FrameReady(Fs);
+}
+
+sm500_result<bool> Csm500ReplayDev::TryPeaksDataReady(void) noexcept
+{
+  return sm500_result<bool>::Success(FrameReady(Peaks));
+}
+
+sm500_result<bool> Csm500ReplayDev::TryFsDataReady(void) noexcept
+{
+  return sm500_result<bool>::Success(FrameReady(Fs));
+}
+
+
+/* ===========================================================================
+Releases the readers waiting for a frame
+=========================================================================== */
+void Csm500ReplayDev::CancelReads(void)
+{
+  PeaksSerial.Cancelled();
+  FsSerial.Cancelled();
+  pthread_mutex_lock(&Lock);
+  CancelGeneration++;
+  pthread_cond_broadcast(&Cond);
+  pthread_mutex_unlock(&Lock);
+}
+
+sm500_status Csm500ReplayDev::TryCancelReads(void) noexcept
+{
+  CancelReads();
+  return SM500_OK;
+}
+
+
+/* ===========================================================================
+Emulated registers
+=========================================================================== */
+uint32_t Csm500ReplayDev::ReadReg32(uint32_t reg)
+{
+  if (reg >= SM500_REPLAY_NUM_REGS)
+    throw EINVAL;
+
+  return Regs[reg];
+}
+
+uint16_t Csm500ReplayDev::ReadReg16(uint32_t reg)
+{
+  return (uint16_t)ReadReg32(reg);
+}
+
+uint8_t Csm500ReplayDev::ReadReg8(uint32_t reg)
+{
+  return (uint8_t)ReadReg32(reg);
+}
+
+void Csm500ReplayDev::WriteReg32(uint32_t reg, uint32_t value)
+{
+  if (reg >= SM500_REPLAY_NUM_REGS)
+    throw EINVAL;
+
+  Regs[reg] = value;
+}
+
+void Csm500ReplayDev::WriteReg16(uint32_t reg, uint16_t value)
+{
+  WriteReg32(reg, value);
+}
+
+void Csm500ReplayDev::WriteReg8(uint32_t reg, uint8_t value)
+{
+  WriteReg32(reg, value);
+}
+
+const char* Csm500ReplayDev::GetDriverVersion(void)
+{
+  return "replay";
+}
+
+
+
+/* ===========================================================================
+=========================================================================== */
+//----------  ----------
+//----------  ----------
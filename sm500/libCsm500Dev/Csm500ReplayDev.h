@@ -0,0 +1,147 @@
+/* ===========================================================================
+ Csm500ReplayDev.h
+ sm500 replay device class definition
+
+ A Csm500Dev that serves the frames of a recording (see Csm500Recorder)
+ instead of the DMA buffers of a card.  Init(Path) maps the segments
+ Path_NNNNNN.sm500rec; GetPeaksData() and GetFsData() then return the
+ recorded buffers, in order, straight from the mapping, and everything
+ built on them (GetPeaks(), GetFsSpectrum(), ...) runs the production
+ code unchanged.  The registers are emulated: reads return what was last
+ written, and the buffer size, timestamp offset and S/N registers read as
+ the card would report them.
+
+ Frames are released according to the pacing:
+
+   SM500_REPLAY_REALTIME  at the recorded timestamps
+   SM500_REPLAY_SCALED    at the recorded timestamps sped up by Multiplier
+   SM500_REPLAY_FAST      as fast as they are asked for
+
+ The peaks and FS streams are paced against a common clock, started by the
+ first frame requested.  At the end of the recording GetPeaksData() and
+ GetFsData() throw ENODATA, or start over when looping (the serial numbers
+ then repeat).
+
+ Jerry Volcy
+
+ Copyright (c) 2013, Micron Optics, Inc.
+=========================================================================== */
+
+#ifndef CSM500REPLAYDEV_H
+#define CSM500REPLAYDEV_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+#include <stdint.h>
+#include <pthread.h>
+#include "Csm500Dev.h"
+#include "Csm500Recorder.h"
+
+/* ===========================================================================
+Constants
+=========================================================================== */
+#define SM500_REPLAY_NUM_REGS       0x104     //emulated register file (up to SM500_REG_INTDR)
+
+
+/* ===========================================================================
+Pacing modes
+=========================================================================== */
+enum sm500_replay_pacing
+{
+  SM500_REPLAY_REALTIME = 0,    //honour the recorded timestamps
+  SM500_REPLAY_SCALED,          //recorded timestamps divided by a multiplier
+  SM500_REPLAY_FAST             //no pacing
+};
+
+
+/* ===========================================================================
+Csm500ReplayDev class definition
+=========================================================================== */
+class Csm500ReplayDev:public Csm500Dev
+{
+  public:
+    //----------  ----------
+    Csm500ReplayDev();                      //constructor
+    virtual ~Csm500ReplayDev();             //destructor
+    virtual void Init();                    //not supported: a recording must be named (throws EINVAL)
+    virtual void Init(const char* Path);    //maps the recording Path_NNNNNN.sm500rec
+    virtual void Close();                   //unmaps the recording
+    virtual const void* GetPeaksData(void); //returns the next recorded peaks buffer, when due
+    virtual const void* GetFsData(void);    //returns the next recorded FS buffer, when due
+    virtual bool PeaksDataReady(void);      //true if the next peaks buffer is due
+    virtual bool FsDataReady(void);         //true if the next FS buffer is due
+    virtual void CancelReads(void);         //releases the blocked readers (they throw ECANCELED)
+    virtual sm500_result<const void*> TryGetPeaksData(void) noexcept;
+    virtual sm500_result<const void*> TryGetFsData(void) noexcept;
+    virtual sm500_result<bool> TryPeaksDataReady(void) noexcept;
+    virtual sm500_result<bool> TryFsDataReady(void) noexcept;
+    virtual sm500_status TryCancelReads(void) noexcept;
+    virtual uint8_t ReadReg8(uint32_t reg);
+    virtual uint16_t ReadReg16(uint32_t reg);
+    virtual uint32_t ReadReg32(uint32_t reg);
+    virtual void WriteReg8(uint32_t reg, uint8_t value);
+    virtual void WriteReg16(uint32_t reg, uint16_t value);
+    virtual void WriteReg32(uint32_t reg, uint32_t value);
+    virtual const char* GetDriverVersion(void);
+    void SetPacing(sm500_replay_pacing Mode, double Multiplier = 1.0);
+    void SetLoop(bool Enable);              //starts over at the end of the recording
+    void SetPreload(bool Enable);           //reads the whole recording into memory at Init() (MAP_POPULATE)
+    uint64_t GetNumFrames(sm500_rec_type Type);   //# of recorded frames of a type
+
+  protected:
+    struct replay_frame
+    {
+      const void *Data;
+      uint64_t TimeNs;                      //recorded timestamp
+      uint64_t SerialNumber;
+    };
+
+    struct replay_stream
+    {
+      vector<replay_frame> Frames;
+      size_t Next;
+      uint64_t Lap;                         //# of times the stream has started over
+    };
+
+    struct replay_segment
+    {
+      void *Map;
+      size_t Bytes;
+    };
+
+    void LoadSegment(const string &Name);
+    void Unload(void);
+    virtual void PrefaultBuffers(void);     //touches the pages of the recording
+    int NextFrame(replay_stream &Stream, Csm500SerialTracker &Serial, const void **Data) noexcept;   //0 or ENODATA/ECANCELED
+    bool FrameReady(replay_stream &Stream);
+    uint64_t DueNs(const replay_stream &Stream);   //release time of the next frame; called with the lock held
+
+    vector<replay_segment> Segments;
+    replay_stream Peaks;
+    replay_stream Fs;
+    uint64_t EpochRecNs;                    //first recorded timestamp
+    uint64_t EpochWallNs;                   //monotonic time the first frame was requested
+    bool EpochSet;
+    uint64_t LapNs;                         //duration of one pass over the recording
+    sm500_replay_pacing Pacing;
+    double Multiplier;
+    bool Loop;
+    bool Preload;
+    uint32_t CancelGeneration;
+    uint32_t Regs[SM500_REPLAY_NUM_REGS];
+    pthread_mutex_t Lock;
+    pthread_cond_t Cond;                    //signalled by CancelReads()
+};
+
+#endif // #ifndef CSM500REPLAYDEV_H
+
+
+
+/* ===========================================================================
+=========================================================================== */
+//----------  ----------
+//----------  ----------
@@ -0,0 +1,244 @@
+/* ===========================================================================
+ Csm500SensorMap.cpp
+ sm500 peak-to-sensor assignment class implementation
+
+ Jerry Volcy
+
+ Copyright (c) 2013, Micron Optics, Inc.
+=========================================================================== */
+#include <iostream>
+#include <string>
+#include <algorithm>
+
+using namespace std;
+
+#include <errno.h>
+#include <string.h>
+#include <math.h>
+#include "Csm500SensorMap.h"
+#include "sm500_common.h"
+
+
+/* ===========================================================================
+Csm500SensorMap constructor
+=========================================================================== */
+Csm500SensorMap::Csm500SensorMap()
+{
+  NumSensors = 0;
+  MissingPolicy = SM500_MISSING_NAN;
+  MultiplePolicy = SM500_MULTIPLE_STRONGEST;
+}
+
+
+/* ===========================================================================
+destructor
+=========================================================================== */
+Csm500SensorMap::~Csm500SensorMap()
+{
+}
+
+
+/* ===========================================================================
+Adds a sensor: the window [LowNm, HighNm) on channel ch.  The window must
+not overlap another window of the channel.  Returns the sensor id, which is
+the sensor's index in sm500_sensor_frame (ids are given in order, from 0).
+Must not run concurrently with Assign().
+=========================================================================== */
+uint32_t Csm500SensorMap::AddSensor(uint32_t ch, double LowNm, double HighNm)
+{
+  if ((ch >= SM500_NUM_CHANNELS) || !(HighNm > LowNm) || (NumSensors >= SM500_MAX_SENSORS))
+    throw EINVAL;
+
+  sensor_window w;
+  w.Low = (float)LowNm;
+  w.High = (float)HighNm;
+  w.Center = (float)((LowNm + HighNm) / 2);
+  w.Id = NumSensors;
+
+  //insert in wavelength order, refusing overlaps with the neighbours
+  vector<sensor_window> &table = Windows[ch];
+  size_t pos = 0;
+  while ((pos < table.size()) && (table[pos].Low < w.Low))
+    pos++;
+  if ((pos > 0) && (table[pos-1].High > w.Low))
+    throw EINVAL;
+  if ((pos < table.size()) && (w.High > table[pos].Low))
+    throw EINVAL;
+  table.insert(table.begin() + pos, w);
+
+  SensorChannel[w.Id] = (uint8_t)ch;
+  Last[w.Id] = NAN;
+  return NumSensors++;
+}
+
+
+/* ===========================================================================
+Removes all the sensors
+=========================================================================== */
+void Csm500SensorMap::Clear(void)
+{
+  for (uint32_t ch=0; ch<SM500_NUM_CHANNELS; ch++)
+    Windows[ch].clear();
+  NumSensors = 0;
+}
+
+
+/* ===========================================================================
+Returns the number of sensors
+=========================================================================== */
+uint32_t Csm500SensorMap::GetNumSensors(void)
+{
+  return NumSensors;
+}
+
+
+/* ===========================================================================
+Returns the channel and window of a sensor
+=========================================================================== */
+void Csm500SensorMap::GetSensor(uint32_t Id, uint32_t &ch, double &LowNm, double &HighNm)
+{
+  if (Id >= NumSensors)
+    throw EINVAL;
+
+  ch = SensorChannel[Id];
+  for (size_t i=0; i<Windows[ch].size(); i++)
+    if (Windows[ch][i].Id == Id)
+    {
+      LowNm = Windows[ch][i].Low;
+      HighNm = Windows[ch][i].High;
+    }
+}
+
+
+/* ===========================================================================
+Policies for windows holding no peak, and windows holding several peaks
+=========================================================================== */
+void Csm500SensorMap::SetMissingPolicy(sm500_missing_policy Policy)
+{
+  MissingPolicy = Policy;
+}
+
+void Csm500SensorMap::SetMultiplePolicy(sm500_multiple_policy Policy)
+{
+  MultiplePolicy = Policy;
+}
+
+
+/* ===========================================================================
+Assigns a frame of peaks to the sensors.  Every sensor entry of Sensors is
+written.
+=========================================================================== */
+void Csm500SensorMap::Assign(const sm500_peaks_soa &Peaks, sm500_sensor_frame &Sensors)
+{
+  Sensors.SerialNumber = Peaks.SerialNumber;
+  Sensors.TimestampSec = Peaks.TimestampSec;
+  Sensors.TimestampNsec = Peaks.TimestampNsec;
+  Sensors.NumSensors = NumSensors;
+  Sensors.Missing = 0;
+  Sensors.Extra = 0;
+
+  for (uint32_t ch=0; ch<SM500_NUM_CHANNELS; ch++)
+    AssignChannel(ch, Peaks, Sensors);
+}
+
+
+/* ===========================================================================
+Merges the peaks of a channel against its window table
+=========================================================================== */
+void Csm500SensorMap::AssignChannel(uint32_t ch, const sm500_peaks_soa &Peaks, sm500_sensor_frame &Sensors)
+{
+  const sensor_window *table = Windows[ch].data();
+  const uint32_t num_windows = Windows[ch].size();
+  const uint32_t first = Peaks.ChannelStart[ch];
+  const float *wl = Peaks.Wavelength + first;
+  const float *amp = Peaks.Amplitude + first;
+  uint32_t n = Peaks.ChannelStart[ch + 1] - first;
+  uint32_t m = 0;                           //# of peaks with a wavelength
+  float previous = -INFINITY;
+  bool sorted = true;
+
+  if (n > SM500_MAX_PEAKS_PER_CHANNEL)
+    n = SM500_MAX_PEAKS_PER_CHANNEL;
+
+  //the peaks come in position order, which is wavelength order unless the
+  //sweep runs downwards: sort them only when needed.  NaN wavelengths
+  //(no calibration) match no window; they are left out, so that the sort
+  //compares numbers only, and counted as extra.
+  for (uint32_t k=0; k<n; k++)
+  {
+    if (std::isnan(wl[k]))
+      continue;
+    if (wl[k] < previous)
+      sorted = false;
+    previous = wl[k];
+    Order[m++] = k;
+  }
+  if (!sorted)
+    sort(Order, Order + m, [wl](uint32_t a, uint32_t b) { return wl[a] < wl[b]; });
+
+  uint32_t j = 0;
+  int32_t best = -1;
+  uint8_t flags = SM500_SENSOR_OK;
+  uint32_t extra = n - m;
+
+  for (uint32_t k=0; k<=m; k++)
+  {
+    float x = (k < m) ? wl[Order[k]] : INFINITY;    //the sentinel closes the remaining windows
+
+    //close the windows below this peak
+    while ((j < num_windows) && (x >= table[j].High))
+    {
+      uint32_t id = table[j].Id;
+
+      if (best >= 0)
+      {
+        Sensors.Wavelength[id] = wl[best];
+        Sensors.Amplitude[id] = amp[best];
+        Sensors.Status[id] = flags;
+        Last[id] = wl[best];
+      }
+      else
+      {
+        Sensors.Wavelength[id] = (MissingPolicy == SM500_MISSING_HOLD) ? Last[id] : NAN;
+        Sensors.Amplitude[id] = 0.0f;
+        Sensors.Status[id] = SM500_SENSOR_MISSING;
+        Sensors.Missing++;
+      }
+      best = -1;
+      flags = SM500_SENSOR_OK;
+      j++;
+    }
+
+    if (k == m)
+      break;
+    if ((j == num_windows) || (x < table[j].Low))
+    {
+      extra++;      //between windows or above the last one
+      continue;
+    }
+
+    //the peak falls in window j
+    int32_t p = Order[k];
+    if (best < 0)
+      best = p;
+    else
+    {
+      flags |= SM500_SENSOR_MULTIPLE;
+      extra++;
+      if ((MultiplePolicy == SM500_MULTIPLE_STRONGEST) && (amp[p] > amp[best]))
+        best = p;
+      else if ((MultiplePolicy == SM500_MULTIPLE_NEAREST) &&
+               (fabsf(wl[p] - table[j].Center) < fabsf(wl[best] - table[j].Center)))
+        best = p;
+    }
+  }
+
+  Sensors.Extra += extra;
+}
+
+
+
+/* ===========================================================================
+=========================================================================== */
+//----------  ----------
+//----------  ----------
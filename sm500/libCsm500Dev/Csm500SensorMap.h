@@ -0,0 +1,132 @@
+/* ===========================================================================
+ Csm500SensorMap.h
+ sm500 peak-to-sensor assignment class definition
+
+ The sensor map assigns the decoded peaks of a frame to the configured
+ sensors.  A sensor is a wavelength window on a channel; the windows of a
+ channel must not overlap.  Each channel keeps its windows in a table
+ sorted by wavelength, and the peaks of the channel (also in wavelength
+ order) are merged against it in one linear pass, so the cost grows with
+ peaks + sensors rather than peaks x sensors.
+
+ The result is a dense per-sensor column (sm500_sensor_frame), indexed by
+ the sensor id returned by AddSensor(), ready for the averaging, binning
+ and conversion stages.  Windows holding no peak are flagged missing and
+ report NaN or the last value seen (see SetMissingPolicy()); windows
+ holding several peaks are flagged and keep one of them (see
+ SetMultiplePolicy()); the peaks outside every window, or beyond the one
+ kept in theirs, are counted as extra.
+
+ Jerry Volcy
+
+ Copyright (c) 2013, Micron Optics, Inc.
+=========================================================================== */
+
+#ifndef CSM500SENSORMAP_H
+#define CSM500SENSORMAP_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+#include <stdint.h>
+#include "sm500_data_structures.h"
+#include "sm500_simd.h"
+#include "Csm500PeakDecoder.h"
+
+/* ===========================================================================
+Constants
+=========================================================================== */
+#define SM500_MAX_SENSORS           4096
+
+
+/* ===========================================================================
+Sensor status flags
+=========================================================================== */
+#define SM500_SENSOR_OK             0x00
+#define SM500_SENSOR_MISSING        0x01  //no peak in the window
+#define SM500_SENSOR_MULTIPLE       0x02  //several peaks in the window; one was kept
+
+
+/* ===========================================================================
+Policies
+=========================================================================== */
+enum sm500_missing_policy
+{
+  SM500_MISSING_NAN = 0,        //report NaN
+  SM500_MISSING_HOLD            //report the last wavelength seen (NaN until the first)
+};
+
+enum sm500_multiple_policy
+{
+  SM500_MULTIPLE_STRONGEST = 0, //keep the peak with the largest amplitude
+  SM500_MULTIPLE_NEAREST,       //keep the peak nearest to the window center
+  SM500_MULTIPLE_FIRST          //keep the peak with the shortest wavelength
+};
+
+
+/* ===========================================================================
+Assigned peaks, one entry per sensor (indexed by sensor id)
+=========================================================================== */
+struct sm500_sensor_frame
+{
+  uint64_t SerialNumber;                              //data set S/N
+  uint32_t TimestampSec;                              //driver timestamp
+  uint32_t TimestampNsec;
+  uint32_t NumSensors;
+  uint32_t Missing;                                   //# of sensors without a peak
+  uint32_t Extra;                                     //# of peaks not assigned: outside every window, or surplus in one
+
+  float Wavelength[SM500_MAX_SENSORS] SM500_ALIGN(SM500_SIMD_ALIGN);  //nm
+  float Amplitude[SM500_MAX_SENSORS] SM500_ALIGN(SM500_SIMD_ALIGN);
+  uint8_t Status[SM500_MAX_SENSORS] SM500_ALIGN(SM500_SIMD_ALIGN);    //SM500_SENSOR_xxx flags
+};
+
+
+/* ===========================================================================
+Csm500SensorMap class definition
+=========================================================================== */
+class Csm500SensorMap
+{
+  public:
+    //----------  ----------
+    Csm500SensorMap();                      //constructor
+    virtual ~Csm500SensorMap();             //destructor
+    uint32_t AddSensor(uint32_t ch, double LowNm, double HighNm);   //adds a window [LowNm, HighNm) on a channel; returns the sensor id
+    void Clear(void);                                               //removes all the sensors
+    uint32_t GetNumSensors(void);
+    void GetSensor(uint32_t Id, uint32_t &ch, double &LowNm, double &HighNm);
+    void SetMissingPolicy(sm500_missing_policy Policy);
+    void SetMultiplePolicy(sm500_multiple_policy Policy);
+    void Assign(const sm500_peaks_soa &Peaks, sm500_sensor_frame &Sensors);  //assigns a frame of peaks to the sensors
+
+  protected:
+    struct sensor_window
+    {
+      float Low;
+      float High;
+      float Center;
+      uint32_t Id;
+    };
+
+    void AssignChannel(uint32_t ch, const sm500_peaks_soa &Peaks, sm500_sensor_frame &Sensors);
+
+    vector<sensor_window> Windows[SM500_NUM_CHANNELS];    //sorted by wavelength
+    uint8_t SensorChannel[SM500_MAX_SENSORS];
+    float Last[SM500_MAX_SENSORS];                        //last wavelength seen, for SM500_MISSING_HOLD
+    uint32_t NumSensors;
+    sm500_missing_policy MissingPolicy;
+    sm500_multiple_policy MultiplePolicy;
+    uint32_t Order[SM500_MAX_PEAKS_PER_CHANNEL];          //peaks of a channel in wavelength order
+};
+
+#endif // #ifndef CSM500SENSORMAP_H
+
+
+
+/* ===========================================================================
+=========================================================================== */
+//----------  ----------
+//----------  ----------
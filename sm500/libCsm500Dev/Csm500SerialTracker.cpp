@@ -0,0 +1,163 @@
+/* ===========================================================================
+ Csm500SerialTracker.cpp
+ sm500 frame serial number continuity class implementation
+
+ Jerry Volcy
+
+ Copyright (c) 2013, Micron Optics, Inc.
+=========================================================================== */
+
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+#include <stdio.h>
+#include <string.h>
+#include "Csm500SerialTracker.h"
+
+
+/* ===========================================================================
+Csm500SerialTracker constructor
+=========================================================================== */
+Csm500SerialTracker::Csm500SerialTracker(uint32_t Stream)
+{
+  this->Stream = Stream;
+  bStrict = (Stream == SM500_SN_PEAKS);
+  Callback = 0;
+  Context = 0;
+  Cancels = 0;
+  Reset();
+}
+
+
+/* ===========================================================================
+destructor
+=========================================================================== */
+Csm500SerialTracker::~Csm500SerialTracker()
+{
+}
+
+
+/* ===========================================================================
+Sets the function called for every break in the sequence (0 = none)
+=========================================================================== */
+void Csm500SerialTracker::SetCallback(sn_callback_t Callback, void *Context)
+{
+  this->Callback = Callback;
+  this->Context = Context;
+}
+
+
+/* ===========================================================================
+Forgets the sequence and clears the statistics: the next frame is taken
+as in sequence
+=========================================================================== */
+void Csm500SerialTracker::Reset(void)
+{
+  bSynced = false;
+  bResync = false;
+  ResyncNext = 0;
+  ResyncAt = 0;
+  Next = 0;
+  SeenCancels = Cancels;
+  Frames = 0;
+  Gaps = 0;
+  MissedFrames = 0;
+  Duplicates = 0;
+  Backwards = 0;
+  BreaksAfterCancel = 0;
+}
+
+
+/* ===========================================================================
+Frame out of sequence (or the first one): counts and reports the break.
+After a gap the new sequence is followed.  A duplicate or a single stale
+frame leave the sequence where it was; an S/N going backwards and then
+counting on from there (a card reset) is followed from its second frame.
+The FS stream skips data sets, so there any S/N above the backwards one
+counts on from it.
+=========================================================================== */
+void Csm500SerialTracker::Break(uint64_t SerialNumber)
+{
+  uint64_t next = Next.load(std::memory_order_relaxed);
+  uint32_t cancels = Cancels.load(std::memory_order_relaxed);
+  sm500_sn_event event;
+
+  Count(Frames);
+  if (!bSynced)
+  {
+    bSynced = true;
+    SeenCancels = cancels;
+    Next.store(SerialNumber + 1, std::memory_order_relaxed);
+    return;
+  }
+
+  //---------- the frame after a backwards one continues its sequence: the card was reset ----------
+  if (bResync && (bStrict ? (SerialNumber == ResyncNext) : (SerialNumber >= ResyncNext)) &&
+      (Frames.load(std::memory_order_relaxed) == ResyncAt + 1))
+  {
+    bResync = false;
+    Next.store(SerialNumber + 1, std::memory_order_relaxed);
+    return;
+  }
+  bResync = false;
+
+  event.Stream = Stream;
+  event.Expected = next;
+  event.SerialNumber = SerialNumber;
+  event.NumFrames = 0;
+  event.AfterCancel = (cancels != SeenCancels);
+  SeenCancels = cancels;
+
+  if (SerialNumber > next)                  //peaks stream only
+  {
+    event.Type = SM500_SN_GAP;
+    event.NumFrames = SerialNumber - next;
+    Count(Gaps);
+    Count(MissedFrames, event.NumFrames);
+    Next.store(SerialNumber + 1, std::memory_order_relaxed);
+  }
+  else if (SerialNumber + 1 == next)
+  {
+    event.Type = SM500_SN_DUPLICATE;
+    Count(Duplicates);
+  }
+  else
+  {
+    event.Type = SM500_SN_BACKWARDS;
+    Count(Backwards);
+    bResync = true;                         //a stale buffer, unless the next frame follows it
+    ResyncNext = SerialNumber + 1;
+    ResyncAt = Frames.load(std::memory_order_relaxed);
+  }
+  if (event.AfterCancel)
+    Count(BreaksAfterCancel);
+
+  if (Callback)
+    Callback(Context, event);
+}
+
+
+/* ===========================================================================
+Returns the statistics
+=========================================================================== */
+void Csm500SerialTracker::GetStats(sm500_sn_stats &Stats)
+{
+  uint64_t next = Next.load(std::memory_order_relaxed);
+
+  Stats.Frames = Frames.load(std::memory_order_relaxed);
+  Stats.LastSerialNumber = next ? next - 1 : 0;
+  Stats.Gaps = Gaps.load(std::memory_order_relaxed);
+  Stats.MissedFrames = MissedFrames.load(std::memory_order_relaxed);
+  Stats.Duplicates = Duplicates.load(std::memory_order_relaxed);
+  Stats.Backwards = Backwards.load(std::memory_order_relaxed);
+  Stats.AfterCancel = BreaksAfterCancel.load(std::memory_order_relaxed);
+}
+
+
+
+/* ===========================================================================
+=========================================================================== */
+//----------  ----------
+//----------  ----------
@@ -0,0 +1,151 @@
+/* ===========================================================================
+ Csm500SerialTracker.h
+ sm500 frame serial number continuity class definition
+
+ Every DMA buffer carries the 64-bit data set serial number of the FPGA in
+ its header.  The tracker follows the serial numbers of one stream of
+ buffers and classifies each break in the sequence:
+
+   SM500_SN_GAP         the S/N jumped ahead: frames were skipped (the
+                        reader fell a ring behind, or the driver's read
+                        pointer was moved by CancelReads())
+   SM500_SN_DUPLICATE   the same S/N as the previous frame: a buffer
+                        returned twice
+   SM500_SN_BACKWARDS   an S/N older than the previous one: a stale
+                        buffer, or the card was reset
+
+ The peaks stream is checked for strict continuity (+1 per frame).  The FS
+ buffers are not taken at every data set, so their stream is only checked
+ for duplicates and S/Ns going backwards.
+
+ Check() is inline: a frame in sequence costs a compare and two stores.
+ The breaks go through a slower path that counts them and calls the
+ callback, on the reading thread.  The callback must not throw: it runs
+ inside Csm500Dev::TryGetPeaksData(), which is noexcept, so an exception
+ would end the process.  One thread checks a stream at a time; the
+ statistics can be read from any thread.
+
+ Jerry Volcy
+
+ Copyright (c) 2013, Micron Optics, Inc.
+=========================================================================== */
+
+#ifndef CSM500SERIALTRACKER_H
+#define CSM500SERIALTRACKER_H
+
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+#include <stdint.h>
+#include <atomic>
+
+/* ===========================================================================
+Constants
+=========================================================================== */
+#define SM500_SN_PEAKS      0           //streams
+#define SM500_SN_FS         1
+
+enum sm500_sn_event_type
+{
+  SM500_SN_GAP = 0,
+  SM500_SN_DUPLICATE,
+  SM500_SN_BACKWARDS
+};
+
+
+/* ===========================================================================
+Break in the sequence
+=========================================================================== */
+struct sm500_sn_event
+{
+  uint32_t Stream;                //SM500_SN_PEAKS or SM500_SN_FS
+  sm500_sn_event_type Type;
+  uint64_t Expected;              //S/N expected (previous + 1 on the peaks stream)
+  uint64_t SerialNumber;          //S/N received
+  uint64_t NumFrames;             //gaps: # of frames skipped
+  bool AfterCancel;               //a CancelReads() was issued since the previous break
+};
+
+
+/* ===========================================================================
+Statistics
+=========================================================================== */
+struct sm500_sn_stats
+{
+  uint64_t Frames;                //frames checked
+  uint64_t LastSerialNumber;
+  uint64_t Gaps;
+  uint64_t MissedFrames;          //frames skipped in those gaps
+  uint64_t Duplicates;
+  uint64_t Backwards;
+  uint64_t AfterCancel;           //breaks that followed a CancelReads()
+};
+
+
+/* ===========================================================================
+Csm500SerialTracker class definition
+=========================================================================== */
+class Csm500SerialTracker
+{
+  public:
+    typedef void (*sn_callback_t)(void *Context, const sm500_sn_event &Event);
+
+    Csm500SerialTracker(uint32_t Stream = SM500_SN_PEAKS);    //constructor
+    virtual ~Csm500SerialTracker();         //destructor
+    void SetCallback(sn_callback_t Callback, void *Context);  //called for every break (0 = none); must not throw
+    void Reset(void);                       //forgets the sequence and the statistics (the next frame syncs)
+    void Resync(void) { bSynced = false; bResync = false; }   //forgets the sequence only; on the checking thread
+    void Cancelled(void) { Cancels.fetch_add(1, std::memory_order_relaxed); }  //a CancelReads() was issued
+    void GetStats(sm500_sn_stats &Stats);
+
+    //---------- one call per frame ----------
+    inline void Check(uint64_t SerialNumber)
+    {
+      uint64_t next = Next.load(std::memory_order_relaxed);
+
+      if (__builtin_expect(bSynced && (bStrict ? (SerialNumber == next) : (SerialNumber >= next)), 1))
+      {
+        Next.store(SerialNumber + 1, std::memory_order_relaxed);
+        Frames.store(Frames.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return;
+      }
+      Break(SerialNumber);
+    }
+
+  protected:
+    void Break(uint64_t SerialNumber);      //out of sequence (or first) frame
+    void Count(std::atomic<uint64_t> &Counter, uint64_t n = 1)
+    {
+      Counter.store(Counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    uint32_t Stream;
+    bool bStrict;                           //peaks: +1 per frame; FS: any increase is in sequence
+    bool bSynced;
+    std::atomic<uint64_t> Next;             //last S/N + 1
+    bool bResync;                           //the last frame went backwards
+    uint64_t ResyncNext;                    //the S/N following it
+    uint64_t ResyncAt;                      //Frames when it was checked
+    uint32_t SeenCancels;                   //Cancels at the previous break
+    std::atomic<uint32_t> Cancels;
+    sn_callback_t Callback;
+    void *Context;
+
+    std::atomic<uint64_t> Frames;
+    std::atomic<uint64_t> Gaps;
+    std::atomic<uint64_t> MissedFrames;
+    std::atomic<uint64_t> Duplicates;
+    std::atomic<uint64_t> Backwards;
+    std::atomic<uint64_t> BreaksAfterCancel;
+};
+
+#endif // #ifndef CSM500SERIALTRACKER_H
+
+
+
+/* ===========================================================================
+=========================================================================== */
+//----------  ----------
+//----------  ----------
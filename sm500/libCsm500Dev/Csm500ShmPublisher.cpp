@@ -0,0 +1,275 @@
+/* ===========================================================================
+ Csm500ShmPublisher.cpp
+ sm500 shared memory ring publisher class implementation
+
+ A segment left by a publisher of the same geometry (e.g. one that was
+ restarted) is taken over: its write sequence carries on and the readers
+ attached to it keep reading.  A segment of another geometry is closed
+ (its readers are told) and replaced.
+
+ Jerry Volcy
+
+ Copyright (c) 2013, Micron Optics, Inc.
+=========================================================================== */
+
+#include <iostream>
+#include <string>
+#include <new>
+
+using namespace std;
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "Csm500ShmPublisher.h"
+#include "sm500_common.h"
+
+
+/* ===========================================================================
+Size of the segment
+=========================================================================== */
+static uint32_t SlotStride(uint32_t FrameBytes)
+{
+  return (sizeof(sm500_shm_slot) + FrameBytes + SM500_SHM_SLOT_ALIGN - 1) & ~(SM500_SHM_SLOT_ALIGN - 1);
+}
+
+static size_t SegmentBytes(uint32_t FrameBytes, uint32_t NumSlots)
+{
+  return SM500_SHM_HEADER_BYTES + (size_t)NumSlots * SlotStride(FrameBytes);
+}
+
+
+/* ===========================================================================
+Csm500ShmPublisher constructor
+=========================================================================== */
+Csm500ShmPublisher::Csm500ShmPublisher()
+{
+  Fd = -1;
+  Base = 0;
+  MapBytes = 0;
+  Header = 0;
+  Wakeups = 0;
+}
+
+
+/* ===========================================================================
+destructor
+=========================================================================== */
+Csm500ShmPublisher::~Csm500ShmPublisher()
+{
+  Close();
+}
+
+
+/* ===========================================================================
+Creates the segment Name (e.g. SM500_SHM_PEAKS_NAME) holding NumSlots
+(a power of 2) frames of up to FrameBytes bytes, or takes over the one a
+previous publisher left.  Throws EBUSY when another live process publishes
+on Name.
+=========================================================================== */
+void Csm500ShmPublisher::Open(const char *Name, uint32_t FrameBytes, uint32_t NumSlots)
+{
+  size_t bytes = SegmentBytes(FrameBytes, NumSlots);
+  struct stat st;
+  int err;
+
+  Close();
+  if ((FrameBytes == 0) || (NumSlots < 2) || (NumSlots & (NumSlots - 1)))
+    throw EINVAL;
+
+  //---------- a segment already there ----------
+  Fd = shm_open(Name, O_RDWR | O_CLOEXEC, 0);
+  if (Fd >= 0)
+  {
+    if ((fstat(Fd, &st) == 0) && ((size_t)st.st_size >= sizeof(sm500_shm_header)))
+    {
+      Base = (uint8_t*)mmap(0, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, Fd, 0);
+      if (Base != MAP_FAILED)
+      {
+        Header = (sm500_shm_header*)Base;
+        if ((Header->Magic == SM500_SHM_MAGIC) && (Header->PublisherPid != getpid()) && !Header->Closed &&
+            (kill(Header->PublisherPid, 0) == 0))
+        {
+          munmap(Base, st.st_size);
+          close(Fd);
+          Base = 0;
+          Header = 0;
+          Fd = -1;
+          throw EBUSY;
+        }
+
+        if ((Header->Magic == SM500_SHM_MAGIC) && (Header->Version == SM500_SHM_VERSION) &&
+            (Header->FrameBytes == FrameBytes) && (Header->NumSlots == NumSlots) && ((size_t)st.st_size == bytes))
+        {
+          this->Name = Name;
+          MapBytes = bytes;
+          Header->PublisherPid = getpid();
+          Header->Closed = 0;
+          Wakeups = 0;
+          return;
+        }
+
+        //---------- another geometry: release its readers ----------
+        Header->Closed = 1;
+        Header->Futex++;
+        sm500_futex_wake_all(&Header->Futex);
+        munmap(Base, st.st_size);
+      }
+    }
+    close(Fd);
+    shm_unlink(Name);
+    Base = 0;
+    Header = 0;
+  }
+
+  //---------- a new segment ----------
+  Fd = shm_open(Name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+  if (Fd < 0)
+    throw errno;
+  fchmod(Fd, 0666);                         //readable by the other users' processes, whatever the umask
+  if (ftruncate(Fd, bytes) != 0)
+    goto fail;
+  Base = (uint8_t*)mmap(0, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, Fd, 0);
+  if (Base == MAP_FAILED)
+    goto fail;
+
+  Header = new (Base) sm500_shm_header;
+  Header->Version = SM500_SHM_VERSION;
+  Header->FrameBytes = FrameBytes;
+  Header->SlotStride = SlotStride(FrameBytes);
+  Header->NumSlots = NumSlots;
+  Header->PublisherPid = getpid();
+  Header->Closed = 0;
+  Header->WriteSequence = 0;
+  Header->Futex = 0;
+  Header->Sleepers = 0;
+  for (uint32_t r=0; r<SM500_SHM_MAX_READERS; r++)
+  {
+    Header->Readers[r].Pid = 0;
+    Header->Readers[r].Cursor = 0;
+    Header->Readers[r].Lost = 0;
+  }
+  for (uint32_t i=0; i<NumSlots; i++)
+    new (Base + SM500_SHM_HEADER_BYTES + (size_t)i * Header->SlotStride) sm500_shm_slot();
+  Header->Magic.store(SM500_SHM_MAGIC, std::memory_order_release);
+
+  this->Name = Name;
+  MapBytes = bytes;
+  Wakeups = 0;
+  return;
+
+fail:
+  err = errno;
+  close(Fd);
+  shm_unlink(Name);
+  Fd = -1;
+  Base = 0;
+  Header = 0;
+  throw err;
+}
+
+
+/* ===========================================================================
+Marks the ring closed, wakes the readers up (they read what is left, then
+get ENODATA) and removes the segment
+=========================================================================== */
+void Csm500ShmPublisher::Close(void)
+{
+  if (!Header)
+    return;
+
+  Header->Closed = 1;
+  Header->Futex++;
+  sm500_futex_wake_all(&Header->Futex);
+  munmap(Base, MapBytes);
+  close(Fd);
+  shm_unlink(Name.c_str());
+  Fd = -1;
+  Base = 0;
+  Header = 0;
+  MapBytes = 0;
+}
+
+
+/* ===========================================================================
+Copies a frame into the next slot of the ring
+=========================================================================== */
+void Csm500ShmPublisher::Publish(const void *Frame)
+{
+  if (!Header)
+    throw EINVAL;
+  Publish(Frame, Header->FrameBytes);
+}
+
+void Csm500ShmPublisher::Publish(const void *Frame, uint32_t Bytes)
+{
+  struct timespec ts;
+
+  if (!Header || (Bytes > Header->FrameBytes))
+    throw EINVAL;
+
+  uint64_t n = Header->WriteSequence.load(std::memory_order_relaxed);
+  sm500_shm_slot *slot = (sm500_shm_slot*)(Base + SM500_SHM_HEADER_BYTES +
+                                           (size_t)(n & (Header->NumSlots - 1)) * Header->SlotStride);
+
+  //---------- seqlock: odd while the slot is written ----------
+  slot->Sequence.store(2 * n + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  memcpy((uint8_t*)(slot + 1), Frame, Bytes);
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  slot->SerialNumber = (Bytes >= 8) ? Csm500PeaksFrame(Frame).SerialNumber() : 0;   //same header for FS buffers
+  slot->PublishNs = (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+  slot->Bytes = Bytes;
+  slot->Sequence.store(2 * (n + 1), std::memory_order_release);
+
+  //---------- wake the sleepers up (the order matters: see Csm500ShmReader::Wait()) ----------
+  Header->WriteSequence.store(n + 1);
+  Header->Futex.fetch_add(1);
+  if (Header->Sleepers.load())
+  {
+    sm500_futex_wake_all(&Header->Futex);
+    Wakeups++;
+  }
+}
+
+
+/* ===========================================================================
+Returns the publisher statistics, and the readers' as seen in the segment
+=========================================================================== */
+void Csm500ShmPublisher::GetStats(sm500_shm_publisher_stats &Stats)
+{
+  memset(&Stats, 0, sizeof(Stats));
+  if (!Header)
+    return;
+
+  Stats.Frames = Header->WriteSequence;
+  Stats.Wakeups = Wakeups;
+  for (uint32_t r=0; r<SM500_SHM_MAX_READERS; r++)
+  {
+    sm500_shm_reader &reader = Header->Readers[r];
+    if (reader.Pid == 0)
+      continue;
+
+    uint64_t cursor = reader.Cursor;
+    uint64_t lag = (Stats.Frames > cursor) ? Stats.Frames - cursor : 0;
+    Stats.Readers++;
+    Stats.ReadersLost += reader.Lost;
+    if (lag > Stats.MaxLag)
+      Stats.MaxLag = lag;
+  }
+}
+
+
+
+/* ===========================================================================
+=========================================================================== */
+//----------  ----------
+//----------  ----------
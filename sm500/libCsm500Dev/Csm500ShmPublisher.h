@@ -0,0 +1,173 @@
+/* ===========================================================================
+ Csm500ShmPublisher.h
+ sm500 shared memory ring publisher class definition
+
+ Republishes frames (peaks or FS DMA buffers, one stream per ring) into a
+ POSIX shared memory segment (shm_open()), so that local processes other
+ than the one holding /dev/sm500 get them without a socket: one copy into
+ their own buffer, or none (see Csm500ShmReader).
+
+ The ring holds the last NumSlots frames.  The publisher never waits for
+ the readers; a reader that falls more than NumSlots frames behind loses
+ the oldest ones and is told so.  Every slot is guarded by a sequence
+ number (a seqlock), so a reader can always tell a frame being overwritten
+ from a good one.  The readers register their cursor in the segment,
+ where the publisher (and tools) can see how far behind each one is.
+
+ Readers with nothing to read sleep on a futex in the segment; the
+ publisher only makes the wake-up system call when one is asleep.
+
+ Segment layout (fixed, for readers in other languages; x86-64, little
+ endian, offsets in bytes):
+
+   0       sm500_shm_header             geometry, write sequence, futex
+   4096    slot 0                       sm500_shm_slot (64 bytes), frame
+   4096 + SlotStride                    slot 1 ...
+
+ Slot Sequence is 2 (n + 1) once frame n is complete in the slot, odd
+ while the publisher is writing it.
+
+ Jerry Volcy
+
+ Copyright (c) 2013, Micron Optics, Inc.
+=========================================================================== */
+
+#ifndef CSM500SHMPUBLISHER_H
+#define CSM500SHMPUBLISHER_H
+
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <atomic>
+#include "sm500_data_structures.h"
+
+/* ===========================================================================
+Constants
+=========================================================================== */
+#define SM500_SHM_MAGIC               0x52353053  //"S05R"
+#define SM500_SHM_VERSION             1
+#define SM500_SHM_HEADER_BYTES        4096        //offset of slot 0
+#define SM500_SHM_MAX_READERS         32
+#define SM500_SHM_SLOT_ALIGN          64
+
+
+/* ===========================================================================
+Defaults
+=========================================================================== */
+#define SM500_SHM_PEAKS_NAME          "/sm500_peaks"
+#define SM500_SHM_FS_NAME             "/sm500_fs"
+#define SM500_DEFAULT_SHM_PEAKS_SLOTS 4096        //4 s at 1 kHz
+#define SM500_DEFAULT_SHM_FS_SLOTS    64          //3 s at 20 Hz
+
+
+/* ===========================================================================
+Segment layout
+=========================================================================== */
+struct sm500_shm_reader
+{
+  std::atomic<int32_t> Pid;               //0 = free
+  uint32_t Reserved;
+  std::atomic<uint64_t> Cursor;           //next frame the reader will read
+  std::atomic<uint64_t> Lost;             //frames overwritten before the reader got them
+  uint64_t Pad[5];
+};
+
+struct sm500_shm_header
+{
+  std::atomic<uint32_t> Magic;            //SM500_SHM_MAGIC, written last
+  uint32_t Version;                       //SM500_SHM_VERSION
+  uint32_t FrameBytes;                    //largest frame
+  uint32_t SlotStride;                    //bytes from a slot to the next
+  uint32_t NumSlots;                      //power of 2
+  int32_t PublisherPid;
+  std::atomic<uint32_t> Closed;           //publisher gone: no more frames
+  uint32_t Reserved[9];
+
+  alignas(64) std::atomic<uint64_t> WriteSequence;  //# of frames published
+  alignas(64) std::atomic<uint32_t> Futex;          //bumped by every frame
+  std::atomic<uint32_t> Sleepers;                   //readers waiting on Futex
+
+  alignas(64) sm500_shm_reader Readers[SM500_SHM_MAX_READERS];
+};
+
+struct sm500_shm_slot
+{
+  std::atomic<uint64_t> Sequence;         //2 (n + 1): frame n complete; odd: being written
+  uint64_t SerialNumber;                  //of the frame (DMA header S/N)
+  uint64_t PublishNs;                     //CLOCK_MONOTONIC when published
+  uint32_t Bytes;                         //frame size
+  uint32_t Reserved[9];
+};
+
+static_assert(sizeof(sm500_shm_header) <= SM500_SHM_HEADER_BYTES, "shm header too large");
+static_assert(sizeof(sm500_shm_slot) == SM500_SHM_SLOT_ALIGN, "shm slot header must be 64 bytes");
+
+
+/* ===========================================================================
+Futex on a word of the segment (shared between processes: not
+FUTEX_PRIVATE)
+=========================================================================== */
+static inline int sm500_futex_wait(std::atomic<uint32_t> *Word, uint32_t Value, const struct timespec *Timeout)
+{
+  return syscall(SYS_futex, (uint32_t*)Word, FUTEX_WAIT, Value, Timeout, 0, 0);
+}
+
+static inline int sm500_futex_wake_all(std::atomic<uint32_t> *Word)
+{
+  return syscall(SYS_futex, (uint32_t*)Word, FUTEX_WAKE, INT_MAX, 0, 0, 0);
+}
+
+
+/* ===========================================================================
+Publisher statistics
+=========================================================================== */
+struct sm500_shm_publisher_stats
+{
+  uint64_t Frames;                        //published
+  uint64_t Wakeups;                       //futex wake-up calls
+  uint32_t Readers;                       //registered
+  uint64_t MaxLag;                        //frames behind, slowest reader
+  uint64_t ReadersLost;                   //frames lost by the readers, in total
+};
+
+
+/* ===========================================================================
+Csm500ShmPublisher class definition
+=========================================================================== */
+class Csm500ShmPublisher
+{
+  public:
+    //----------  ----------
+    Csm500ShmPublisher();                   //constructor
+    virtual ~Csm500ShmPublisher();          //destructor
+    void Open(const char *Name, uint32_t FrameBytes, uint32_t NumSlots);  //creates (or takes over) the segment
+    void Close(void);                       //tells the readers and removes the segment
+    void Publish(const void *Frame);        //copies a FrameBytes frame (e.g. from Csm500Dev::GetPeaksData()) into the ring
+    void Publish(const void *Frame, uint32_t Bytes);
+    void GetStats(sm500_shm_publisher_stats &Stats);
+
+  protected:
+    string Name;
+    int Fd;
+    uint8_t *Base;
+    size_t MapBytes;
+    sm500_shm_header *Header;
+    uint64_t Wakeups;
+};
+
+#endif // #ifndef CSM500SHMPUBLISHER_H
+
+
+
+/* ===========================================================================
+=========================================================================== */
+//----------  ----------
+//----------  ----------
@@ -0,0 +1,392 @@
+/* ===========================================================================
+ Csm500ShmReader.cpp
+ sm500 shared memory ring reader class implementation
+
+ Reading a slot is a seqlock read: the slot sequence is checked before and
+ after the frame is read; if it changed, the publisher lapped the reader
+ and the frame is dropped.  A reader about to wait increments the
+ sleeper count before it takes the futex value and checks the write
+ sequence a last time; the publisher bumps the write sequence and the
+ futex before it looks at the sleeper count.  Either the reader sees the
+ new frame, or the publisher sees the sleeper (and the futex value the
+ reader waits on is stale): no wake-up is lost.
+
+ Jerry Volcy
+
+ Copyright (c) 2013, Micron Optics, Inc.
+=========================================================================== */
+
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "Csm500ShmReader.h"
+#include "sm500_common.h"
+
+
+/* ===========================================================================
+CLOCK_MONOTONIC, in ns
+=========================================================================== */
+static uint64_t MonotonicNs(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+
+/* ===========================================================================
+Csm500ShmReader constructor
+=========================================================================== */
+Csm500ShmReader::Csm500ShmReader()
+{
+  Fd = -1;
+  Base = 0;
+  MapBytes = 0;
+  Header = 0;
+  Registration = 0;
+  Cursor = 0;
+  Held = 0;
+  HeldSequence = 0;
+  Timeout = -1;
+  SpinNs = 0;
+  memset(&Stats, 0, sizeof(Stats));
+}
+
+
+/* ===========================================================================
+destructor
+=========================================================================== */
+Csm500ShmReader::~Csm500ShmReader()
+{
+  Close();
+}
+
+
+/* ===========================================================================
+Sets how long a read waits for a frame before throwing ETIMEDOUT (-1 =
+forever)
+=========================================================================== */
+void Csm500ShmReader::SetTimeout(int Milliseconds)
+{
+  Timeout = Milliseconds;
+}
+
+
+/* ===========================================================================
+Sets how long a read polls the ring before going to sleep.  Polling saves
+the wake-up latency (a few microseconds) at the cost of a busy core.
+=========================================================================== */
+void Csm500ShmReader::SetSpin(uint32_t Microseconds)
+{
+  SpinNs = Microseconds * 1000;
+}
+
+
+/* ===========================================================================
+Maps the ring Name and registers the reader in it.  Throws ENOENT when no
+publisher created the ring, EPROTO when it is not an sm500 ring, EBUSY
+when SM500_SHM_MAX_READERS readers are registered.
+=========================================================================== */
+void Csm500ShmReader::Open(const char *Name)
+{
+  struct stat st;
+  int err;
+
+  Close();
+
+  Fd = shm_open(Name, O_RDWR | O_CLOEXEC, 0);
+  if (Fd < 0)
+    throw errno;
+  if (fstat(Fd, &st) != 0)
+    goto fail;
+  if ((size_t)st.st_size < SM500_SHM_HEADER_BYTES)
+  {
+    errno = EPROTO;
+    goto fail;
+  }
+  Base = (uint8_t*)mmap(0, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, Fd, 0);
+  if (Base == MAP_FAILED)
+  {
+    Base = 0;
+    goto fail;
+  }
+  MapBytes = st.st_size;
+  Header = (sm500_shm_header*)Base;
+
+  if ((Header->Magic.load(std::memory_order_acquire) != SM500_SHM_MAGIC) || (Header->Version != SM500_SHM_VERSION) ||
+      (SM500_SHM_HEADER_BYTES + (size_t)Header->NumSlots * Header->SlotStride > MapBytes))
+  {
+    errno = EPROTO;
+    goto fail;
+  }
+
+  //---------- a free entry, or one left by a dead process ----------
+  for (uint32_t r=0; (r<SM500_SHM_MAX_READERS) && !Registration; r++)
+  {
+    int32_t pid = Header->Readers[r].Pid;
+    if (((pid == 0) || ((kill(pid, 0) != 0) && (errno == ESRCH))) &&
+        Header->Readers[r].Pid.compare_exchange_strong(pid, getpid()))
+      Registration = &Header->Readers[r];
+  }
+  if (!Registration)
+  {
+    errno = EBUSY;
+    goto fail;
+  }
+
+  Cursor = Header->WriteSequence;
+  Registration->Cursor = Cursor;
+  Registration->Lost = 0;
+  Held = 0;
+  Copy.resize(Header->FrameBytes);
+  memset(&Stats, 0, sizeof(Stats));
+  return;
+
+fail:
+  err = errno;
+  if (Base)
+    munmap(Base, MapBytes);
+  close(Fd);
+  Fd = -1;
+  Base = 0;
+  Header = 0;
+  MapBytes = 0;
+  throw err;
+}
+
+
+/* ===========================================================================
+Unregisters the reader and unmaps the ring
+=========================================================================== */
+void Csm500ShmReader::Close(void)
+{
+  if (!Header)
+    return;
+
+  if (Registration)
+    Registration->Pid = 0;
+  munmap(Base, MapBytes);
+  close(Fd);
+  Fd = -1;
+  Base = 0;
+  Header = 0;
+  Registration = 0;
+  Held = 0;
+  MapBytes = 0;
+}
+
+
+/* ===========================================================================
+Returns the size of the largest frame of the ring
+=========================================================================== */
+uint32_t Csm500ShmReader::GetFrameBytes(void)
+{
+  if (!Header)
+    throw EINVAL;
+  return Header->FrameBytes;
+}
+
+
+/* ===========================================================================
+Waits for the next frame and copies it into the reader's buffer, valid
+until the next call.  Throws ETIMEDOUT, or ENODATA once the publisher has
+closed the ring and every frame was read.
+=========================================================================== */
+const void* Csm500ShmReader::GetData(sm500_shm_frame_info *Info)
+{
+  if (!Header)
+    throw EINVAL;
+  if (Held)
+    Release();
+
+  for (;;)
+  {
+    Wait();
+    sm500_shm_slot *slot = Slot(Cursor);
+    uint64_t seq = slot->Sequence.load(std::memory_order_acquire);
+    if (seq != 2 * (Cursor + 1))
+      continue;                             //overwritten: Wait() skips ahead
+
+    uint32_t bytes = slot->Bytes;
+    if (bytes > Copy.size())
+      bytes = Copy.size();
+    memcpy(&Copy[0], slot + 1, bytes);
+    if (Info)
+    {
+      Info->Sequence = Cursor;
+      Info->SerialNumber = slot->SerialNumber;
+      Info->PublishNs = slot->PublishNs;
+      Info->Bytes = bytes;
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot->Sequence.load(std::memory_order_relaxed) != seq)
+      continue;
+
+    Advance();
+    Stats.Frames++;
+    return &Copy[0];
+  }
+}
+
+
+/* ===========================================================================
+Waits for the next frame and returns it in place.  Call Release() when
+done with it.
+=========================================================================== */
+const void* Csm500ShmReader::Acquire(sm500_shm_frame_info *Info)
+{
+  if (!Header)
+    throw EINVAL;
+  if (Held)
+    Release();
+
+  for (;;)
+  {
+    Wait();
+    sm500_shm_slot *slot = Slot(Cursor);
+    uint64_t seq = slot->Sequence.load(std::memory_order_acquire);
+    if (seq != 2 * (Cursor + 1))
+      continue;
+
+    if (Info)
+    {
+      Info->Sequence = Cursor;
+      Info->SerialNumber = slot->SerialNumber;
+      Info->PublishNs = slot->PublishNs;
+      Info->Bytes = slot->Bytes;
+    }
+    Held = slot;
+    HeldSequence = seq;
+    return slot + 1;
+  }
+}
+
+
+/* ===========================================================================
+Releases the acquired frame.  Returns false if the publisher overwrote it
+while it was held: what was read from it must be discarded.
+=========================================================================== */
+bool Csm500ShmReader::Release(void)
+{
+  if (!Held)
+    return false;
+
+  std::atomic_thread_fence(std::memory_order_acquire);
+  bool ok = (Held->Sequence.load(std::memory_order_relaxed) == HeldSequence);
+  Held = 0;
+  if (ok)
+    Stats.Frames++;
+  else
+  {
+    Stats.Lost++;
+    Registration->Lost++;
+  }
+  Advance();
+  return ok;
+}
+
+
+/* ===========================================================================
+Returns the reader statistics
+=========================================================================== */
+void Csm500ShmReader::GetStats(sm500_shm_reader_stats &Stats)
+{
+  Stats = this->Stats;
+}
+
+
+/* ===========================================================================
+Waits until the frame at Cursor is published.  When the publisher is a
+full ring ahead (the slot at Cursor is, or is about to be, overwritten)
+Cursor skips to the oldest frame that is safe to read.
+=========================================================================== */
+void Csm500ShmReader::Wait(void)
+{
+  uint64_t start = 0;
+  uint32_t slots = Header->NumSlots;
+
+  for (;;)
+  {
+    uint64_t written = Header->WriteSequence.load(std::memory_order_acquire);
+    if (written > Cursor)
+    {
+      if (written - Cursor >= slots)
+      {
+        uint64_t skip = written - slots + 1 - Cursor;
+        Stats.Lost += skip;
+        Registration->Lost += skip;
+        Cursor += skip;
+        Registration->Cursor.store(Cursor, std::memory_order_relaxed);
+      }
+      return;
+    }
+    if (Header->Closed)
+      throw ENODATA;
+
+    uint64_t now = MonotonicNs();
+    if (!start)
+      start = now;
+    if (now - start < SpinNs)
+      continue;
+
+    //---------- sleep (see the top of the file for the ordering) ----------
+    struct timespec ts, *timeout = 0;
+    if (Timeout >= 0)
+    {
+      uint64_t limit = (uint64_t)Timeout * 1000000;
+      if (now - start >= limit)
+        throw ETIMEDOUT;
+      uint64_t left = limit - (now - start);
+      ts.tv_sec = left / 1000000000;
+      ts.tv_nsec = left % 1000000000;
+      timeout = &ts;
+    }
+
+    Header->Sleepers.fetch_add(1);
+    uint32_t futex = Header->Futex.load();
+    if ((Header->WriteSequence.load() <= Cursor) && !Header->Closed)
+    {
+      sm500_futex_wait(&Header->Futex, futex, timeout);
+      Stats.Sleeps++;
+    }
+    Header->Sleepers.fetch_sub(1);
+  }
+}
+
+
+/* ===========================================================================
+Slot of a frame
+=========================================================================== */
+sm500_shm_slot* Csm500ShmReader::Slot(uint64_t Sequence)
+{
+  return (sm500_shm_slot*)(Base + SM500_SHM_HEADER_BYTES + (size_t)(Sequence & (Header->NumSlots - 1)) * Header->SlotStride);
+}
+
+
+/* ===========================================================================
+Moves to the next frame and publishes the cursor in the segment
+=========================================================================== */
+void Csm500ShmReader::Advance(void)
+{
+  Cursor++;
+  Registration->Cursor.store(Cursor, std::memory_order_relaxed);
+}
+
+
+
+/* ===========================================================================
+=========================================================================== */
+//----------  ----------
+//----------  ----------
@@ -0,0 +1,111 @@
+/* ===========================================================================
+ Csm500ShmReader.h
+ sm500 shared memory ring reader class definition
+
+ Reads the frames a Csm500ShmPublisher puts in a shared memory ring, in
+ order, from the next frame published after Open().  Two ways to read:
+
+   GetData()            copies the frame into the reader's own buffer (one
+                        copy) and returns it; the buffer is valid until the
+                        next call.
+   Acquire()/Release()  returns the frame in place, in the ring (no copy).
+                        The publisher does not wait for the reader: if it
+                        laps the reader while the frame is held, Release()
+                        returns false and what was read must be discarded.
+                        Holding a frame for less than NumSlots frame
+                        periods never fails.
+
+ A reader that falls more than NumSlots frames behind skips to the oldest
+ frame still in the ring; the frames skipped are counted as lost.  Once
+ the publisher closes the ring, the frames left are read and the readers
+ then get ENODATA (reopen to wait for a new publisher).
+
+ A reader is used by one thread.  Several readers, in as many processes,
+ can read a ring (up to SM500_SHM_MAX_READERS).
+
+ Jerry Volcy
+
+ Copyright (c) 2013, Micron Optics, Inc.
+=========================================================================== */
+
+#ifndef CSM500SHMREADER_H
+#define CSM500SHMREADER_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+#include <stdint.h>
+#include "Csm500ShmPublisher.h"
+
+/* ===========================================================================
+Frame information
+=========================================================================== */
+struct sm500_shm_frame_info
+{
+  uint64_t Sequence;                      //frame # in the ring
+  uint64_t SerialNumber;                  //DMA header S/N
+  uint64_t PublishNs;                     //CLOCK_MONOTONIC when published
+  uint32_t Bytes;
+};
+
+
+/* ===========================================================================
+Reader statistics
+=========================================================================== */
+struct sm500_shm_reader_stats
+{
+  uint64_t Frames;                        //read
+  uint64_t Lost;                          //overwritten before they were read
+  uint64_t Sleeps;                        //futex waits
+};
+
+
+/* ===========================================================================
+Csm500ShmReader class definition
+=========================================================================== */
+class Csm500ShmReader
+{
+  public:
+    //----------  ----------
+    Csm500ShmReader();                      //constructor
+    virtual ~Csm500ShmReader();             //destructor
+    void SetTimeout(int Milliseconds);      //waits throw ETIMEDOUT after that long (-1 = forever)
+    void SetSpin(uint32_t Microseconds);    //polls that long before sleeping (lower latency, burns CPU)
+    void Open(const char *Name);            //attaches to a ring (e.g. SM500_SHM_PEAKS_NAME)
+    void Close(void);
+    uint32_t GetFrameBytes(void);           //largest frame of the ring
+    const void* GetData(sm500_shm_frame_info *Info = 0);  //waits for the next frame and copies it
+    const void* Acquire(sm500_shm_frame_info *Info = 0);  //waits for the next frame and returns it in place
+    bool Release(void);                     //done with the acquired frame; false if it was overwritten meanwhile
+    void GetStats(sm500_shm_reader_stats &Stats);
+
+  protected:
+    void Wait(void);                        //until the frame at Cursor is published
+    sm500_shm_slot* Slot(uint64_t Sequence);
+    void Advance(void);                     //moves Cursor to the next frame
+
+    int Fd;
+    uint8_t *Base;
+    size_t MapBytes;
+    sm500_shm_header *Header;
+    sm500_shm_reader *Registration;         //this reader's entry in the segment
+    uint64_t Cursor;                        //next frame
+    sm500_shm_slot *Held;                   //acquired slot
+    uint64_t HeldSequence;
+    int Timeout;
+    uint32_t SpinNs;
+    vector<uint8_t> Copy;                   //GetData() buffer
+    sm500_shm_reader_stats Stats;
+};
+
+#endif // #ifndef CSM500SHMREADER_H
+
+
+
+/* ===========================================================================
+=========================================================================== */
+//----------  ----------
+//----------  ----------
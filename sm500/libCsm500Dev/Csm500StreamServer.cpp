@@ -0,0 +1,896 @@
+/* ===========================================================================
+ Csm500StreamServer.cpp
+ sm500 TCP streaming server class implementation
+
+ Publishers copy the frame into a pooled packet buffer, append it to the
+ inbox and wake the reactor up through an eventfd (only when the inbox was
+ empty, so a burst of frames costs a single wake-up).  The reactor encodes
+ the frames wanted compressed, hands each packet to the queues of the
+ subscribed clients (a reference count tracks the queues holding it) and
+ writes the queues out with sendmsg().
+ A client whose socket is full is left with EPOLLOUT armed and flushed
+ when it drains; the packet buffers go back to the pool once every queue
+ has let go of them.
+
+ Jerry Volcy
+
+ Copyright (c) 2013, Micron Optics, Inc.
+=========================================================================== */
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "Csm500StreamServer.h"
+#include "sm500_common.h"
+
+static const uint32_t FrameCapacity[SM500_NUM_STREAMS] =
+{
+  SM500_STREAM_HEADER_BYTES + (SM500_PEAK_CODEC_MAX_BYTES > sm500_peaks_format::FrameBytes ?
+                               SM500_PEAK_CODEC_MAX_BYTES : sm500_peaks_format::FrameBytes),
+  SM500_STREAM_HEADER_BYTES + (SM500_FS_CODEC_MAX_BYTES > sm500_fs_format::FrameBytes ?
+                               SM500_FS_CODEC_MAX_BYTES : sm500_fs_format::FrameBytes)
+};
+
+static const uint32_t FrameBytes[SM500_NUM_STREAMS] = { sm500_peaks_format::FrameBytes, sm500_fs_format::FrameBytes };
+
+
+/* ===========================================================================
+Writes a packet header
+=========================================================================== */
+static void WriteHeader(uint8_t *Data, uint32_t PayloadBytes, uint8_t Type, uint8_t Status)
+{
+  memcpy(Data, &PayloadBytes, 4);           //little endian, as BitConverter on the command server
+  Data[4] = Type;
+  Data[5] = Status;
+}
+
+
+/* ===========================================================================
+Csm500StreamServer constructor
+=========================================================================== */
+Csm500StreamServer::Csm500StreamServer()
+{
+  MaxClients = SM500_DEFAULT_STREAM_MAX_CLIENTS;
+  QueueBytes = SM500_DEFAULT_STREAM_QUEUE_BYTES;
+
+  ListenFd = -1;
+  EpollFd = -1;
+  EventFd = -1;
+  Port = 0;
+  bRunning = false;
+  bStop = false;
+
+  pthread_mutex_init(&Lock, 0);
+  for (int s=0; s<SM500_NUM_STREAMS; s++)
+  {
+    Subscribers[s] = 0;
+    Compressors[s] = 0;
+    KeyframeWanted[s] = false;
+  }
+
+  Published = 0;
+  Sent = 0;
+  SentBytes = 0;
+  Dropped = 0;
+  ReactorCpuNs = 0;
+  NumClients = 0;
+}
+
+
+/* ===========================================================================
+destructor
+=========================================================================== */
+Csm500StreamServer::~Csm500StreamServer()
+{
+  Stop();
+
+  for (size_t i=0; i<Inbox.size(); i++)     //published while stopping
+  {
+    free(Inbox[i]->Data);
+    delete Inbox[i];
+  }
+  for (int s=0; s<SM500_NUM_STREAMS; s++)
+  {
+    for (size_t i=0; i<FreeFrames[s].size(); i++)
+    {
+      free(FreeFrames[s][i]->Data);
+      delete FreeFrames[s][i];
+    }
+  }
+  pthread_mutex_destroy(&Lock);
+}
+
+
+/* ===========================================================================
+Sets the maximum # of connected clients
+=========================================================================== */
+void Csm500StreamServer::SetMaxClients(uint32_t Clients)
+{
+  MaxClients = Clients;
+}
+
+
+/* ===========================================================================
+Sets the bound of each client's queue, in bytes.  At least one frame is
+always queued.
+=========================================================================== */
+void Csm500StreamServer::SetQueueBytes(uint32_t Bytes)
+{
+  QueueBytes = Bytes;
+}
+
+
+/* ===========================================================================
+Listens on Port (all interfaces) and starts the reactor thread.  Port 0
+picks any free port (see GetPort()).
+=========================================================================== */
+void Csm500StreamServer::Start(uint16_t Port)
+{
+  struct sockaddr_in addr;
+  socklen_t len = sizeof(addr);
+  int one = 1, err;
+
+  Stop();
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(Port);
+
+  ListenFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  EpollFd = epoll_create1(EPOLL_CLOEXEC);
+  EventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if ((ListenFd < 0) || (EpollFd < 0) || (EventFd < 0))
+    goto fail;
+
+  setsockopt(ListenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  if ((bind(ListenFd, (struct sockaddr*)&addr, sizeof(addr)) != 0) || (listen(ListenFd, 64) != 0) ||
+      (getsockname(ListenFd, (struct sockaddr*)&addr, &len) != 0))
+    goto fail;
+  this->Port = ntohs(addr.sin_port);
+
+  {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = &ListenFd;
+    if (epoll_ctl(EpollFd, EPOLL_CTL_ADD, ListenFd, &ev) != 0)
+      goto fail;
+    ev.data.ptr = &EventFd;
+    if (epoll_ctl(EpollFd, EPOLL_CTL_ADD, EventFd, &ev) != 0)
+      goto fail;
+  }
+
+  Published = 0;
+  Sent = 0;
+  SentBytes = 0;
+  Dropped = 0;
+  ReactorCpuNs = 0;
+  bStop = false;
+  if (pthread_create(&Thread, 0, ThreadEntry, this) != 0)
+  {
+    errno = EAGAIN;
+    goto fail;
+  }
+  bRunning = true;
+  return;
+
+fail:
+  err = errno;
+  if (ListenFd >= 0) close(ListenFd);
+  if (EpollFd >= 0) close(EpollFd);
+  if (EventFd >= 0) close(EventFd);
+  ListenFd = EpollFd = EventFd = -1;
+  throw err;
+}
+
+
+/* ===========================================================================
+Stops the reactor thread, disconnects the clients and closes the sockets.
+Frames published after Stop() are ignored.
+=========================================================================== */
+void Csm500StreamServer::Stop(void)
+{
+  uint64_t one = 1;
+
+  if (!bRunning)
+    return;
+
+  pthread_mutex_lock(&Lock);                //no publisher queues or wakes the reactor past this point
+  bRunning = false;
+  pthread_mutex_unlock(&Lock);
+  bStop = true;
+  if (write(EventFd, &one, sizeof(one)) < 0)
+    SM500_DBG(perror("Csm500StreamServer::Stop()"););
+  pthread_join(Thread, 0);
+
+  while (!Clients.empty())
+    Disconnect(Clients.back());
+
+  pthread_mutex_lock(&Lock);
+  for (size_t i=0; i<Inbox.size(); i++)
+    Released.push_back(Inbox[i]);
+  Inbox.clear();
+  pthread_mutex_unlock(&Lock);
+  for (size_t i=0; i<Released.size(); i++)
+    Released[i]->Refs = 0;
+  Recycle();
+
+  close(ListenFd);
+  close(EpollFd);
+  close(EventFd);
+  ListenFd = EpollFd = EventFd = -1;
+}
+
+
+/* ===========================================================================
+Returns the port listened on
+=========================================================================== */
+uint16_t Csm500StreamServer::GetPort(void)
+{
+  return Port;
+}
+
+
+/* ===========================================================================
+Returns the server statistics
+=========================================================================== */
+void Csm500StreamServer::GetStats(sm500_stream_stats &Stats)
+{
+  Stats.Clients = NumClients;
+  Stats.Published = Published;
+  Stats.Sent = Sent;
+  Stats.SentBytes = SentBytes;
+  Stats.Dropped = Dropped;
+  Stats.ReactorCpuNs = ReactorCpuNs;
+}
+
+
+/* ===========================================================================
+Takes a packet buffer from the pool of a stream (Stream -1: a command
+response, not pooled)
+=========================================================================== */
+Csm500StreamServer::stream_frame* Csm500StreamServer::AllocFrame(int Stream, uint32_t Capacity)
+{
+  stream_frame *frame = 0;
+
+  if (Stream >= 0)
+  {
+    pthread_mutex_lock(&Lock);
+    if (!FreeFrames[Stream].empty())
+    {
+      frame = FreeFrames[Stream].back();
+      FreeFrames[Stream].pop_back();
+    }
+    pthread_mutex_unlock(&Lock);
+  }
+
+  if (!frame)
+  {
+    frame = new stream_frame;
+    frame->Data = (uint8_t*)malloc(Capacity);
+    if (!frame->Data)
+    {
+      delete frame;
+      throw ENOMEM;
+    }
+    frame->Capacity = Capacity;
+  }
+
+  frame->Stream = Stream;
+  frame->Bytes = 0;
+  frame->Compressed = false;
+  frame->Keyframe = false;
+  frame->Encode = false;
+  frame->Refs = 0;
+  return frame;
+}
+
+
+/* ===========================================================================
+Drops a reference to a packet; the last one queues it for Recycle()
+=========================================================================== */
+void Csm500StreamServer::Release(stream_frame *Frame)
+{
+  if (--Frame->Refs == 0)
+    Released.push_back(Frame);
+}
+
+
+/* ===========================================================================
+Returns the released packet buffers to the pools (frees the responses)
+=========================================================================== */
+void Csm500StreamServer::Recycle(void)
+{
+  if (Released.empty())
+    return;
+
+  pthread_mutex_lock(&Lock);
+  for (size_t i=0; i<Released.size(); i++)
+  {
+    stream_frame *frame = Released[i];
+    if (frame->Stream >= 0)
+      FreeFrames[frame->Stream].push_back(frame);
+    else
+    {
+      free(frame->Data);
+      delete frame;
+    }
+  }
+  pthread_mutex_unlock(&Lock);
+  Released.clear();
+}
+
+
+/* ===========================================================================
+Publishes a peaks (SM500_STREAM_PEAKS) or FS (SM500_STREAM_FS) DMA buffer:
+queues one copy, for the raw subscribers and for the reactor to encode for
+the compressed subscribers.  A memcpy() of the frame is all the caller
+pays; it never waits for the clients.
+=========================================================================== */
+void Csm500StreamServer::Publish(sm500_stream_type Stream, const void *Frame)
+{
+  stream_frame *raw;
+  uint64_t one = 1;
+
+  if (!bRunning || (Stream < 0) || (Stream >= SM500_NUM_STREAMS))
+    return;
+
+  Published++;
+  bool encode = (Compressors[Stream] > 0);
+  if (!encode)
+    KeyframeWanted[Stream] = true;          //the encoder skips frames: restart it with a keyframe
+  if (!encode && !Subscribers[Stream])
+    return;
+
+  raw = AllocFrame(Stream, FrameCapacity[Stream]);
+  WriteHeader(raw->Data, FrameBytes[Stream], SM500_PACKET_SENSOR_DATA, SM500_STATUS_SUCCESS);
+  memcpy(raw->Data + SM500_STREAM_HEADER_BYTES, Frame, FrameBytes[Stream]);
+  raw->Bytes = SM500_STREAM_HEADER_BYTES + FrameBytes[Stream];
+  raw->Encode = encode;
+
+  //---------- queued and woken under Lock: Stop() may be closing the server ----------
+  pthread_mutex_lock(&Lock);
+  if (!bRunning)
+  {
+    FreeFrames[Stream].push_back(raw);
+    pthread_mutex_unlock(&Lock);
+    return;
+  }
+  bool wake = Inbox.empty();
+  Inbox.push_back(raw);
+  if (wake && (write(EventFd, &one, sizeof(one)) < 0))
+    SM500_DBG(perror("Csm500StreamServer::Publish()"););
+  pthread_mutex_unlock(&Lock);
+}
+
+
+/* ===========================================================================
+Encodes a published frame for the compressed subscribers, on the reactor
+thread (the only user of the encoders).  Returns 0 when no packet buffer
+could be had: the encoder then skips the frame, so its delta chain stays
+whole.
+=========================================================================== */
+Csm500StreamServer::stream_frame* Csm500StreamServer::Encode(const stream_frame *Raw)
+{
+  int s = Raw->Stream;
+  const uint8_t *frame = Raw->Data + SM500_STREAM_HEADER_BYTES;
+  stream_frame *packed;
+
+  try
+  {
+    packed = AllocFrame(s, FrameCapacity[s]);
+  }
+  catch (...)
+  {
+    Dropped++;
+    return 0;
+  }
+
+  uint8_t *payload = packed->Data + SM500_STREAM_HEADER_BYTES;
+  uint32_t bytes;
+
+  if (KeyframeWanted[s].exchange(false))
+  {
+    if (s == SM500_STREAM_PEAKS) PeakEncoder.Reset();
+    else                         FsEncoder.Reset();
+  }
+  if (s == SM500_STREAM_PEAKS)
+  {
+    bytes = PeakEncoder.Encode(frame, payload);
+    packed->Keyframe = Csm500PeakCodec::IsKeyframe(payload);
+  }
+  else
+  {
+    bytes = FsEncoder.Encode(frame, payload);
+    packed->Keyframe = Csm500FsCodec::IsKeyframe(payload);
+  }
+
+  WriteHeader(packed->Data, bytes, SM500_PACKET_SENSOR_DATA, SM500_STATUS_SUCCESS);
+  packed->Bytes = SM500_STREAM_HEADER_BYTES + bytes;
+  packed->Compressed = true;
+  return packed;
+}
+
+
+/* ===========================================================================
+Reactor thread entry point
+=========================================================================== */
+void* Csm500StreamServer::ThreadEntry(void *Arg)
+{
+  ((Csm500StreamServer*)Arg)->ReactorLoop();
+  return 0;
+}
+
+
+/* ===========================================================================
+Reactor: waits for connections, commands, published frames and sockets
+ready for writing, until Stop()
+=========================================================================== */
+void Csm500StreamServer::ReactorLoop(void)
+{
+  struct epoll_event events[64];
+  vector<stream_frame*> inbox;
+  vector<stream_client*> dirty;
+
+  while (!bStop)
+  {
+    int n = epoll_wait(EpollFd, events, 64, -1);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      SM500_DBG(perror("Csm500StreamServer::ReactorLoop()"););
+      break;
+    }
+
+    for (int i=0; i<n; i++)
+    {
+      void *ptr = events[i].data.ptr;
+
+      if (!ptr)
+        continue;
+      if (ptr == &ListenFd)
+        Accept();
+      else if (ptr == &EventFd)
+      {
+        uint64_t count;
+        if (read(EventFd, &count, sizeof(count)) < 0)
+          SM500_DBG(perror("Csm500StreamServer::ReactorLoop()"););
+
+        pthread_mutex_lock(&Lock);
+        inbox.swap(Inbox);
+        pthread_mutex_unlock(&Lock);
+
+        for (size_t f=0; f<inbox.size(); f++)
+        {
+          stream_frame *packed = inbox[f]->Encode ? Encode(inbox[f]) : 0;
+          Deliver(inbox[f]);
+          if (packed)
+            Deliver(packed);
+        }
+        inbox.clear();
+
+        //---------- one batched write per client ----------
+        dirty = Clients;
+        for (size_t c=0; c<dirty.size(); c++)
+          if (!dirty[c]->WantWrite && !dirty[c]->Queue.empty() && !Flush(dirty[c]))
+          {
+            Disconnect(dirty[c]);
+            for (int j=i+1; j<n; j++)
+              if (events[j].data.ptr == dirty[c])
+                events[j].data.ptr = 0;
+          }
+      }
+      else
+      {
+        stream_client *client = (stream_client*)ptr;
+
+        if (!Serve(client, events[i].events))
+        {
+          Disconnect(client);
+          //the client is gone: forget its other events of this batch
+          for (int j=i+1; j<n; j++)
+            if (events[j].data.ptr == client)
+              events[j].data.ptr = 0;
+        }
+      }
+    }
+
+    Recycle();
+
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    ReactorCpuNs = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+  }
+}
+
+
+/* ===========================================================================
+Accepts the pending connections
+=========================================================================== */
+void Csm500StreamServer::Accept(void)
+{
+  for (;;)
+  {
+    int fd = accept4(ListenFd, 0, 0, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0)
+      return;
+
+    if (Clients.size() >= MaxClients)
+    {
+      close(fd);
+      continue;
+    }
+
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    stream_client *client = new stream_client;
+    client->Fd = fd;
+    for (int s=0; s<SM500_NUM_STREAMS; s++)
+    {
+      client->Subscribed[s] = false;
+      client->Compressed[s] = false;
+      client->NeedKeyframe[s] = false;
+    }
+    client->QueueBytes = 0;
+    client->SentOffset = 0;
+    client->WantWrite = false;
+    client->ReadClosed = false;
+    client->Events = EPOLLIN | EPOLLRDHUP;
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = client->Events;
+    ev.data.ptr = client;
+    if (epoll_ctl(EpollFd, EPOLL_CTL_ADD, fd, &ev) != 0)
+    {
+      close(fd);
+      delete client;
+      continue;
+    }
+    Clients.push_back(client);
+    NumClients = Clients.size();
+  }
+}
+
+
+/* ===========================================================================
+Handles the epoll events of a client.  Its input is read before a
+half-close is acted upon: a client sending its commands and then
+shutting down its side (EPOLLRDHUP, then a read() of 0) gets them
+executed and keeps streaming.  Returns false once nothing more can be
+sent to the client: an error or a full hang-up, a failed write, or a
+half-closed client without subscriptions whose queue has been written.
+=========================================================================== */
+bool Csm500StreamServer::Serve(stream_client *Client, uint32_t Events)
+{
+  if (Events & (EPOLLERR | EPOLLHUP))
+    return false;
+  if ((Events & (EPOLLIN | EPOLLRDHUP)) && !Client->ReadClosed && !Receive(Client))
+    return false;
+  if (((Events & EPOLLOUT) || Client->ReadClosed) && !Flush(Client))    //Flush() also stops the reads of a half-closed client
+    return false;
+
+  if (!Client->ReadClosed || !Client->Queue.empty())
+    return true;
+  for (int s=0; s<SM500_NUM_STREAMS; s++)
+    if (Client->Subscribed[s])
+      return true;
+  return false;
+}
+
+
+/* ===========================================================================
+Closes a client and releases its queue
+=========================================================================== */
+void Csm500StreamServer::Disconnect(stream_client *Client)
+{
+  for (int s=0; s<SM500_NUM_STREAMS; s++)
+    SetSubscribed(Client, s, false, false);
+
+  epoll_ctl(EpollFd, EPOLL_CTL_DEL, Client->Fd, 0);
+  close(Client->Fd);
+  for (size_t i=0; i<Client->Queue.size(); i++)
+    Release(Client->Queue[i]);
+
+  for (size_t i=0; i<Clients.size(); i++)
+    if (Clients[i] == Client)
+    {
+      Clients[i] = Clients.back();
+      Clients.pop_back();
+      break;
+    }
+  NumClients = Clients.size();
+  delete Client;
+}
+
+
+/* ===========================================================================
+Changes a client's subscription to a stream, keeping the publishers'
+subscriber counts up to date
+=========================================================================== */
+void Csm500StreamServer::SetSubscribed(stream_client *Client, int Stream, bool Subscribed, bool Compressed)
+{
+  if (Client->Subscribed[Stream])
+  {
+    if (Client->Compressed[Stream]) Compressors[Stream]--;
+    else                            Subscribers[Stream]--;
+  }
+
+  Client->Subscribed[Stream] = Subscribed;
+  Client->Compressed[Stream] = Compressed;
+  Client->NeedKeyframe[Stream] = Compressed;
+  if (Subscribed)
+  {
+    if (Compressed)
+    {
+      Compressors[Stream]++;
+      KeyframeWanted[Stream] = true;
+    }
+    else
+      Subscribers[Stream]++;
+  }
+}
+
+
+/* ===========================================================================
+Queues a published frame for the clients subscribed to it
+=========================================================================== */
+void Csm500StreamServer::Deliver(stream_frame *Frame)
+{
+  Frame->Refs = 1;                          //held until delivered
+
+  for (size_t c=0; c<Clients.size(); c++)
+  {
+    stream_client *client = Clients[c];
+    int s = Frame->Stream;
+
+    if (!client->Subscribed[s] || (client->Compressed[s] != Frame->Compressed))
+      continue;
+
+    if (Frame->Compressed && client->NeedKeyframe[s])
+    {
+      if (!Frame->Keyframe)
+        continue;
+      client->NeedKeyframe[s] = false;
+    }
+
+    if (!client->Queue.empty() && (client->QueueBytes + Frame->Bytes > QueueBytes))
+    {
+      Dropped++;
+      client->NeedKeyframe[s] = Frame->Compressed;    //the delta chain is broken
+      continue;
+    }
+    Enqueue(client, Frame);
+  }
+
+  Release(Frame);
+}
+
+
+/* ===========================================================================
+Appends a packet to a client's queue
+=========================================================================== */
+void Csm500StreamServer::Enqueue(stream_client *Client, stream_frame *Frame)
+{
+  Frame->Refs++;
+  Client->Queue.push_back(Frame);
+  Client->QueueBytes += Frame->Bytes;
+}
+
+
+/* ===========================================================================
+Writes a client's queue out, SM500_STREAM_MAX_IOV packets per sendmsg(),
+until it is empty or the socket is full (EPOLLOUT is then armed)
+=========================================================================== */
+bool Csm500StreamServer::Flush(stream_client *Client)
+{
+  struct iovec iov[SM500_STREAM_MAX_IOV];
+
+  while (!Client->Queue.empty())
+  {
+    uint32_t n = 0;
+    for (; (n < SM500_STREAM_MAX_IOV) && (n < Client->Queue.size()); n++)
+    {
+      stream_frame *frame = Client->Queue[n];
+      uint32_t skip = n ? 0 : Client->SentOffset;
+      iov[n].iov_base = frame->Data + skip;
+      iov[n].iov_len = frame->Bytes - skip;
+    }
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = n;
+    ssize_t written = sendmsg(Client->Fd, &msg, MSG_NOSIGNAL);    //a client gone is an EPIPE, not a SIGPIPE
+    if (written < 0)
+    {
+      if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+        break;
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+
+    //---------- release what was written ----------
+    SentBytes += written;
+    uint64_t left = written;
+    while (left)
+    {
+      stream_frame *frame = Client->Queue.front();
+      uint32_t rest = frame->Bytes - Client->SentOffset;
+      if (left < rest)
+      {
+        Client->SentOffset += left;
+        break;
+      }
+      left -= rest;
+      Client->SentOffset = 0;
+      Client->QueueBytes -= frame->Bytes;
+      Client->Queue.pop_front();
+      if (frame->Stream >= 0)
+        Sent++;
+      Release(frame);
+    }
+  }
+
+  //---------- EPOLLOUT only while there is something left, no input once half-closed ----------
+  bool want = !Client->Queue.empty();
+  uint32_t events = (Client->ReadClosed ? 0 : (uint32_t)(EPOLLIN | EPOLLRDHUP)) | (want ? (uint32_t)EPOLLOUT : 0);
+  if (events != Client->Events)
+  {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.ptr = Client;
+    if (epoll_ctl(EpollFd, EPOLL_CTL_MOD, Client->Fd, &ev) != 0)
+      return false;
+    Client->Events = events;
+  }
+  Client->WantWrite = want;
+  return true;
+}
+
+
+/* ===========================================================================
+Reads a client's commands and executes the complete ones.  At most
+SM500_STREAM_MAX_READS reads per call: the rest waits for the next wakeup
+(epoll is level-triggered), after the other clients.  The end of the
+input (the client half-closed) executes a last unterminated line and sets
+ReadClosed.
+=========================================================================== */
+bool Csm500StreamServer::Receive(stream_client *Client)
+{
+  char buffer[SM500_STREAM_MAX_COMMAND];
+
+  for (uint32_t r=0; r<SM500_STREAM_MAX_READS; r++)
+  {
+    ssize_t n = read(Client->Fd, buffer, sizeof(buffer));
+    if (n == 0)
+    {
+      Client->ReadClosed = true;
+      bool ok = Execute(Client, Client->Command);    //a last line without '\n'
+      Client->Command.clear();
+      return ok;
+    }
+    if (n < 0)
+      return (errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR);
+
+    for (ssize_t i=0; i<n; i++)
+    {
+      if (buffer[i] == '\n')
+      {
+        bool ok = Execute(Client, Client->Command);
+        Client->Command.clear();
+        if (!ok)
+          return false;
+      }
+      else if (Client->Command.size() < SM500_STREAM_MAX_COMMAND)
+        Client->Command += buffer[i];
+    }
+  }
+  return true;
+}
+
+
+/* ===========================================================================
+Executes a command line: #StreamPeaks, #StreamSpectra [raw|compressed],
+#StopStreaming.  Returns false if the response could not be written (the
+client must be closed).
+=========================================================================== */
+bool Csm500StreamServer::Execute(stream_client *Client, const string &Line)
+{
+  vector<string> fields;
+  size_t start = 0;
+
+  //---------- split on ' ', ',' (and '\r' from telnet-style clients) ----------
+  for (size_t i=0; i<=Line.size(); i++)
+    if ((i == Line.size()) || (Line[i] == ' ') || (Line[i] == ',') || (Line[i] == '\r'))
+    {
+      if (i > start)
+        fields.push_back(Line.substr(start, i - start));
+      start = i + 1;
+    }
+  if (fields.empty())
+    return true;
+
+  const char *cmd = fields[0].c_str();
+  int stream = -1;
+
+  if (strcasecmp(cmd, "#StreamPeaks") == 0)
+    stream = SM500_STREAM_PEAKS;
+  else if (strcasecmp(cmd, "#StreamSpectra") == 0)
+    stream = SM500_STREAM_FS;
+  else if (strcasecmp(cmd, "#StopStreaming") == 0)
+  {
+    for (int s=0; s<SM500_NUM_STREAMS; s++)
+      SetSubscribed(Client, s, false, false);
+    return Respond(Client, SM500_STATUS_SUCCESS, "Streaming stopped.");
+  }
+  else
+  {
+    return Respond(Client, SM500_STATUS_INVALID_COMMAND, "Invalid Command");
+  }
+
+  bool compressed = false;
+  if (fields.size() > 2)
+  {
+    return Respond(Client, SM500_STATUS_INVALID_NUMBER_ARGUMENTS, "Invalid number of arguments.");
+  }
+  if (fields.size() == 2)
+  {
+    if (strcasecmp(fields[1].c_str(), "compressed") == 0)
+      compressed = true;
+    else if (strcasecmp(fields[1].c_str(), "raw") != 0)
+    {
+      return Respond(Client, SM500_STATUS_INVALID_ARGUMENT, "Argument is invalid.");
+    }
+  }
+
+  SetSubscribed(Client, stream, true, compressed);
+  return Respond(Client, SM500_STATUS_SUCCESS, "Streaming started.");
+}
+
+
+/* ===========================================================================
+Queues a command response packet for a client and writes it if the socket
+is not backed up.  Returns false if the write failed.
+=========================================================================== */
+bool Csm500StreamServer::Respond(stream_client *Client, uint8_t Status, const char *Message)
+{
+  uint32_t len = strlen(Message);
+  stream_frame *frame = AllocFrame(-1, SM500_STREAM_HEADER_BYTES + len);
+
+  WriteHeader(frame->Data, len, SM500_PACKET_COMMAND_RESPONSE, Status);
+  memcpy(frame->Data + SM500_STREAM_HEADER_BYTES, Message, len);
+  frame->Bytes = SM500_STREAM_HEADER_BYTES + len;
+
+  Enqueue(Client, frame);                   //responses are never dropped
+  if (!Client->WantWrite)
+    return Flush(Client);
+  return true;
+}
+
+
+
+/* ===========================================================================
+=========================================================================== */
+//----------  ----------
+//----------  ----------
@@ -0,0 +1,224 @@
+/* ===========================================================================
+ Csm500StreamServer.h
+ sm500 TCP streaming server class definition
+
+ Pushes every published peaks and FS frame to the TCP clients subscribed
+ to it, instead of having them poll #GetRawPeaks / #GetRawSpectra on the
+ command server.  The packets use the command server's header:
+
+   uint32_t  length of the payload
+   uint8_t   packet type (SM500_PACKET_SENSOR_DATA for frames)
+   uint8_t   status (SM500_STATUS_SUCCESS for frames)
+   payload   the raw DMA buffer (same bytes as #GetRawPeaks/#GetRawSpectra),
+             or the frame encoded by Csm500PeakCodec / Csm500FsCodec
+
+ Clients subscribe with '\n' terminated commands and get a command response
+ packet back:
+
+   #StreamPeaks [raw|compressed]
+   #StreamSpectra [raw|compressed]
+   #StopStreaming
+
+ A compressed subscription starts at the next keyframe (the encoder is
+ asked for one as soon as a client subscribes).
+
+ A single reactor thread (epoll) accepts the clients, reads their commands
+ and writes the frames, several packets per sendmsg().  Publish() only
+ copies the frame, once; the reactor encodes it, once, for the compressed
+ subscribers, so the acquisition thread never pays for the codecs.  The
+ clients share the packets.  Each client has a bounded queue: when a slow
+ client's queue is full its new frames are dropped and counted (a
+ compressed subscription then waits for the next keyframe), and the other
+ clients are not held up.  A client is read at most SM500_STREAM_MAX_READS
+ times per wakeup, so one flooding commands does not starve the others.  A
+ client that half-closes its connection still has the commands it sent
+ executed, and keeps streaming; it is closed once nothing more can be sent
+ to it.
+
+ Jerry Volcy
+
+ Copyright (c) 2013, Micron Optics, Inc.
+=========================================================================== */
+
+#ifndef CSM500STREAMSERVER_H
+#define CSM500STREAMSERVER_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <deque>
+
+using namespace std;
+
+#include <stdint.h>
+#include <pthread.h>
+#include <atomic>
+#include "sm500_data_structures.h"
+#include "Csm500PeakCodec.h"
+#include "Csm500FsCodec.h"
+
+/* ===========================================================================
+Constants
+=========================================================================== */
+#define SM500_STREAM_HEADER_BYTES     6           //length (4), packet type (1), status (1)
+#define SM500_STREAM_MAX_COMMAND      2048        //longest command line
+#define SM500_STREAM_MAX_IOV          64          //packets per sendmsg()
+#define SM500_STREAM_MAX_READS        4           //read()s of a client per wakeup
+
+
+/* ===========================================================================
+Defaults
+=========================================================================== */
+#define SM500_DEFAULT_STREAM_PORT           1854
+#define SM500_DEFAULT_STREAM_MAX_CLIENTS    64
+#define SM500_DEFAULT_STREAM_QUEUE_BYTES    (4 << 20)   //per client
+
+
+/* ===========================================================================
+Packet header fields (PacketType and CommandExitStatus of the command
+server)
+=========================================================================== */
+enum sm500_packet_type
+{
+  SM500_PACKET_COMMAND_RESPONSE = 0,
+  SM500_PACKET_SENSOR_DATA = 1
+};
+
+enum sm500_packet_status
+{
+  SM500_STATUS_SUCCESS = 0,
+  SM500_STATUS_INVALID_COMMAND = 4,
+  SM500_STATUS_INVALID_NUMBER_ARGUMENTS = 5,
+  SM500_STATUS_INVALID_ARGUMENT = 6
+};
+
+
+/* ===========================================================================
+Streams
+=========================================================================== */
+enum sm500_stream_type
+{
+  SM500_STREAM_PEAKS = 0,
+  SM500_STREAM_FS,
+  SM500_NUM_STREAMS
+};
+
+
+/* ===========================================================================
+Server statistics
+=========================================================================== */
+struct sm500_stream_stats
+{
+  uint32_t Clients;               //connected
+  uint64_t Published;             //frames published
+  uint64_t Sent;                  //frames written (one per client)
+  uint64_t SentBytes;
+  uint64_t Dropped;               //frames dropped (client queue full)
+  uint64_t ReactorCpuNs;          //CPU time used by the reactor thread
+};
+
+
+/* ===========================================================================
+Csm500StreamServer class definition
+=========================================================================== */
+class Csm500StreamServer
+{
+  public:
+    //----------  ----------
+    Csm500StreamServer();                   //constructor
+    virtual ~Csm500StreamServer();          //destructor
+    void SetMaxClients(uint32_t Clients);   //connections beyond are refused (applies to the next Start())
+    void SetQueueBytes(uint32_t Bytes);     //per client queue bound
+    void Start(uint16_t Port = SM500_DEFAULT_STREAM_PORT);  //listens on Port (0 = any) and starts the reactor thread
+    void Stop(void);                        //disconnects the clients and joins the reactor thread
+    uint16_t GetPort(void);                 //port listened on
+    void Publish(sm500_stream_type Stream, const void *Frame);  //sends a peaks or FS DMA buffer to its subscribers
+    void GetStats(sm500_stream_stats &Stats);
+
+  protected:
+    struct stream_frame                     //a packet, shared by the clients it is queued for
+    {
+      uint8_t *Data;                        //header and payload
+      uint32_t Bytes;
+      uint32_t Capacity;
+      int Stream;                           //sm500_stream_type; -1 for a command response
+      bool Compressed;
+      bool Keyframe;
+      bool Encode;                          //raw frame the reactor encodes for the compressed subscribers
+      uint32_t Refs;                        //queues holding the frame (reactor thread only)
+    };
+
+    struct stream_client
+    {
+      int Fd;
+      bool Subscribed[SM500_NUM_STREAMS];
+      bool Compressed[SM500_NUM_STREAMS];
+      bool NeedKeyframe[SM500_NUM_STREAMS]; //compressed subscription waiting for a keyframe
+      deque<stream_frame*> Queue;
+      uint64_t QueueBytes;
+      uint32_t SentOffset;                  //bytes of the first queued frame already written
+      bool WantWrite;                       //EPOLLOUT armed
+      bool ReadClosed;                      //the client half-closed: no more commands
+      uint32_t Events;                      //epoll events registered
+      string Command;                       //partial command line
+    };
+
+    static void* ThreadEntry(void *Arg);
+    void ReactorLoop(void);
+    void Accept(void);
+    void Deliver(stream_frame *Frame);      //queues a published frame for its subscribers
+    stream_frame* Encode(const stream_frame *Raw);  //the compressed packet of a raw frame, 0 if none could be had
+    void Enqueue(stream_client *Client, stream_frame *Frame);
+    bool Flush(stream_client *Client);      //writes what is queued; false if the client must be closed
+    bool Receive(stream_client *Client);    //reads and executes commands; false if the client must be closed
+    bool Serve(stream_client *Client, uint32_t Events);   //handles a client's epoll events; false if it must be closed
+    bool Execute(stream_client *Client, const string &Line);    //false if the client must be closed
+    bool Respond(stream_client *Client, uint8_t Status, const char *Message);
+    void Disconnect(stream_client *Client);
+    void SetSubscribed(stream_client *Client, int Stream, bool Subscribed, bool Compressed);
+    stream_frame* AllocFrame(int Stream, uint32_t Capacity);
+    void Release(stream_frame *Frame);      //drops a reference (reactor thread)
+    void Recycle(void);                     //returns the released frames to the pool
+
+    //---------- settings ----------
+    uint32_t MaxClients;
+    uint32_t QueueBytes;
+
+    //---------- sockets and reactor ----------
+    int ListenFd;
+    int EpollFd;
+    int EventFd;                            //wakes the reactor up when frames are published
+    uint16_t Port;
+    pthread_t Thread;
+    std::atomic<bool> bRunning;
+    std::atomic<bool> bStop;
+    vector<stream_client*> Clients;         //reactor thread only
+
+    //---------- publishers ----------
+    pthread_mutex_t Lock;                   //Inbox, FreeFrames
+    vector<stream_frame*> Inbox;            //published, not yet delivered
+    vector<stream_frame*> FreeFrames[SM500_NUM_STREAMS];
+    vector<stream_frame*> Released;         //reactor thread: to be returned to FreeFrames
+    std::atomic<uint32_t> Subscribers[SM500_NUM_STREAMS];     //raw subscriptions
+    std::atomic<uint32_t> Compressors[SM500_NUM_STREAMS];     //compressed subscriptions
+    std::atomic<bool> KeyframeWanted[SM500_NUM_STREAMS];
+    Csm500PeakCodec PeakEncoder;            //reactor thread only
+    Csm500FsCodec FsEncoder;
+
+    //---------- statistics ----------
+    std::atomic<uint64_t> Published;
+    std::atomic<uint64_t> Sent;
+    std::atomic<uint64_t> SentBytes;
+    std::atomic<uint64_t> Dropped;
+    std::atomic<uint64_t> ReactorCpuNs;
+    std::atomic<uint32_t> NumClients;
+};
+
+#endif // #ifndef CSM500STREAMSERVER_H
+
+
+
+/* ===========================================================================
+=========================================================================== */
+//----------  ----------
+//----------  ----------
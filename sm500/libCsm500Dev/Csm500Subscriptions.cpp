@@ -0,0 +1,443 @@
+/* ===========================================================================
+ Csm500Subscriptions.cpp
+ sm500 rate-converting subscription scheduler class implementation
+
+ Jerry Volcy
+
+ Copyright (c) 2013, Micron Optics, Inc.
+=========================================================================== */
+#include <iostream>
+#include <string>
+#include <algorithm>
+
+using namespace std;
+
+#include <errno.h>
+#include <string.h>
+#include <math.h>
+#include "Csm500Subscriptions.h"
+#include "sm500_common.h"
+
+
+/* ===========================================================================
+Csm500Subscriptions constructor
+=========================================================================== */
+Csm500Subscriptions::Csm500Subscriptions()
+{
+  FrameRate = SM500_DEFAULT_FRAME_RATE;
+  Tick = 0;
+  NumColumns = 0;
+  Dirty = true;
+  bDelivering = false;
+  pthread_mutex_init(&Lock, 0);
+  pthread_mutex_init(&PushLock, 0);
+}
+
+
+/* ===========================================================================
+destructor
+=========================================================================== */
+Csm500Subscriptions::~Csm500Subscriptions()
+{
+  FreeNodes(Nodes);
+  pthread_mutex_destroy(&PushLock);
+  pthread_mutex_destroy(&Lock);
+}
+
+
+/* ===========================================================================
+Releases the decimation tree
+=========================================================================== */
+void Csm500Subscriptions::FreeNodes(vector<rate_node> &Nodes)
+{
+  for (size_t i=0; i<Nodes.size(); i++)
+  {
+    delete Nodes[i].Averager;
+    delete [] Nodes[i].Row;
+  }
+  Nodes.clear();
+}
+
+
+/* ===========================================================================
+Sets the rate at which frames are pushed, used to turn subscription rates
+into decimations.  Applies to subsequent subscriptions.
+=========================================================================== */
+void Csm500Subscriptions::SetFrameRate(double Hz)
+{
+  if (!(Hz > 0.0))
+    throw EINVAL;
+
+  FrameRate = Hz;
+}
+
+
+/* ===========================================================================
+Subscribes to NumSensors sensors at RateHz.  The rate is rounded to a whole
+decimation of the frame rate (RateHz >= the frame rate: every frame).
+Callback receives the averaged values at that rate.  Returns the
+subscription id.
+=========================================================================== */
+uint32_t Csm500Subscriptions::Subscribe(const uint32_t *SensorId, uint32_t NumSensors, double RateHz, callback_t Callback, void *Context)
+{
+  if ((NumSensors == 0) || (NumSensors > SM500_MAX_SENSORS) || !(RateHz > 0.0) || (Callback == 0))
+    throw EINVAL;
+
+  for (uint32_t i=0; i<NumSensors; i++)
+    if (SensorId[i] >= SM500_MAX_SENSORS)
+      throw EINVAL;
+
+  subscription s;
+  s.Active = true;
+  s.Decimation = (RateHz >= FrameRate) ? 1 : (uint32_t)lround(FrameRate / RateHz);
+  s.SensorId.assign(SensorId, SensorId + NumSensors);
+  s.Callback = Callback;
+  s.Context = Context;
+
+  pthread_mutex_lock(&Lock);
+  uint32_t id = Subscriptions.size();
+  Subscriptions.push_back(s);
+
+  //an existing rate only needs the new subscriber; a new rate a new node
+  if (!Dirty)
+  {
+    size_t node = 0;
+    while ((node < Nodes.size()) && (Nodes[node].Decimation != s.Decimation))
+      node++;
+    try
+    {
+      if (node == Nodes.size())
+        AddNode(s.Decimation);
+      Nodes[node].Subscribers.push_back(id);
+    }
+    catch (...)
+    {
+      Subscriptions.pop_back();
+      pthread_mutex_unlock(&Lock);
+      throw;
+    }
+  }
+  pthread_mutex_unlock(&Lock);
+
+  return id;
+}
+
+
+/* ===========================================================================
+Ends a subscription.  Its callback is not called after this returns: from
+another thread, this waits for the callbacks of the frame being pushed.
+=========================================================================== */
+void Csm500Subscriptions::Unsubscribe(uint32_t Subscription)
+{
+  bool inside;                              //called from a callback
+
+  pthread_mutex_lock(&Lock);
+  inside = bDelivering && pthread_equal(PushThread, pthread_self());
+  pthread_mutex_unlock(&Lock);
+  if (!inside)
+    pthread_mutex_lock(&PushLock);
+
+  pthread_mutex_lock(&Lock);
+  if ((Subscription >= Subscriptions.size()) || !Subscriptions[Subscription].Active)
+  {
+    pthread_mutex_unlock(&Lock);
+    if (!inside)
+      pthread_mutex_unlock(&PushLock);
+    throw EINVAL;
+  }
+
+  Subscriptions[Subscription].Active = false;
+  for (size_t i=0; i<Nodes.size(); i++)
+  {
+    vector<uint32_t> &subscribers = Nodes[i].Subscribers;
+    subscribers.erase(remove(subscribers.begin(), subscribers.end(), Subscription), subscribers.end());
+  }
+  pthread_mutex_unlock(&Lock);
+  if (!inside)
+    pthread_mutex_unlock(&PushLock);
+}
+
+
+/* ===========================================================================
+Returns the number of distinct rates (nodes of the decimation tree)
+=========================================================================== */
+uint32_t Csm500Subscriptions::GetNumRates(void)
+{
+  uint32_t n;
+
+  pthread_mutex_lock(&Lock);
+  n = Nodes.size();
+  pthread_mutex_unlock(&Lock);
+  return n;
+}
+
+
+/* ===========================================================================
+Rebuilds the decimation tree from the rates of the active subscriptions,
+and schedules every node on the wheel.  The new tree is built aside and
+swapped in: if it cannot be built (throws), the current one is kept.
+Called with the lock held.
+=========================================================================== */
+void Csm500Subscriptions::Rebuild(uint32_t NumColumns)
+{
+  vector<uint32_t> rates(1, 1);   //the input frames always form node 0
+  vector<rate_node> nodes;
+
+  for (size_t i=0; i<Subscriptions.size(); i++)
+    if (Subscriptions[i].Active)
+      rates.push_back(Subscriptions[i].Decimation);
+  sort(rates.begin(), rates.end());
+  rates.erase(unique(rates.begin(), rates.end()), rates.end());
+
+  try
+  {
+    nodes.reserve(rates.size());
+    for (size_t i=0; i<rates.size(); i++)
+    {
+      nodes.push_back(rate_node());
+      rate_node &node = nodes.back();
+      node.Decimation = rates[i];
+      node.Parent = -1;
+      node.Averager = 0;
+      node.Row = 0;
+      node.Ready = false;
+      node.Due = Tick + rates[i];
+
+      //parent: the node with the largest decimation dividing this one
+      for (size_t p=0; p<i; p++)
+        if (rates[i] % rates[p] == 0)
+          node.Parent = p;
+
+      //frames without sensors have nothing to average; the nodes only fire
+      if ((node.Parent >= 0) && (NumColumns > 0))
+      {
+        node.Averager = new Csm500Averager;
+        node.Averager->SetBoxcar(NumColumns, rates[i] / rates[node.Parent], 0);
+        node.Row = new float[NumColumns];
+      }
+      for (size_t s=0; s<Subscriptions.size(); s++)
+        if (Subscriptions[s].Active && (Subscriptions[s].Decimation == rates[i]))
+          node.Subscribers.push_back(s);
+    }
+  }
+  catch (...)
+  {
+    FreeNodes(nodes);
+    throw;
+  }
+
+  FreeNodes(Nodes);
+  Nodes.swap(nodes);
+  for (uint32_t s=0; s<SM500_WHEEL_SLOTS; s++)
+    Wheel[s].clear();
+  for (size_t i=0; i<Nodes.size(); i++)
+    Wheel[Nodes[i].Due % SM500_WHEEL_SLOTS].push_back(i);
+  this->NumColumns = NumColumns;
+  Dirty = false;
+}
+
+
+/* ===========================================================================
+Adds a node of Decimation to the current tree, under the node of the
+largest decimation dividing it.  The node is put in phase with its
+parent: it starts averaging with the parent's next output, and is due when
+its first average completes.  The other nodes are left as they are (a
+node that would now have a closer parent keeps its own until the next
+rebuild).  Called with the lock held; throws and leaves the tree as it was.
+=========================================================================== */
+void Csm500Subscriptions::AddNode(uint32_t Decimation)
+{
+  rate_node node;
+  size_t parent = 0;
+
+  for (size_t p=1; p<Nodes.size(); p++)
+    if ((Decimation % Nodes[p].Decimation == 0) && (Nodes[p].Decimation > Nodes[parent].Decimation))
+      parent = p;
+
+  node.Decimation = Decimation;
+  node.Parent = parent;
+  node.Averager = 0;
+  node.Row = 0;
+  node.Ready = false;
+  node.Due = Nodes[parent].Due + Decimation - Nodes[parent].Decimation;   //the parent's next output is due at its Due
+
+  size_t slot = node.Due % SM500_WHEEL_SLOTS;
+  try
+  {
+    if (NumColumns > 0)
+    {
+      node.Averager = new Csm500Averager;
+      node.Averager->SetBoxcar(NumColumns, Decimation / Nodes[parent].Decimation, 0);
+      node.Row = new float[NumColumns];
+    }
+    Wheel[slot].reserve(Wheel[slot].size() + 1);
+    Nodes.push_back(node);
+  }
+  catch (...)
+  {
+    delete node.Averager;
+    delete [] node.Row;
+    throw;
+  }
+  Wheel[slot].push_back(Nodes.size() - 1);
+}
+
+
+/* ===========================================================================
+Feeds one frame of converted sensor values.  Every node completing an
+average with this frame is updated, and the subscribers of the nodes due
+on the wheel receive their frames, once the lock has been released.
+Throws the errno (or bad_alloc) of a tree that cannot be rebuilt, with
+the frame not taken into account.
+=========================================================================== */
+void Csm500Subscriptions::Push(const sm500_sensor_values &Values)
+{
+  pthread_mutex_lock(&PushLock);
+  pthread_mutex_lock(&Lock);
+
+  if (Dirty || (Values.NumSensors != NumColumns))
+  {
+    try
+    {
+      Rebuild(Values.NumSensors);
+    }
+    catch (...)
+    {
+      pthread_mutex_unlock(&Lock);
+      pthread_mutex_unlock(&PushLock);
+      throw;
+    }
+  }
+  Tick++;
+  Outbox.clear();
+  OutIds.clear();
+  OutValues.clear();
+
+  //---------- decimation tree ----------
+  Nodes[0].Ready = true;
+  for (size_t i=1; i<Nodes.size(); i++)
+  {
+    rate_node &node = Nodes[i];
+    const rate_node &parent = Nodes[node.Parent];
+
+    node.Ready = false;
+    if (parent.Ready && !node.Averager)
+      node.Ready = true;                    //no sensors
+    else if (parent.Ready)
+    {
+      node.Ready = node.Averager->Push((node.Parent == 0) ? Values.Value : parent.Row);
+      if (node.Ready)
+      {
+        const double *out = node.Averager->GetOutput();
+        for (uint32_t c=0; c<NumColumns; c++)
+          node.Row[c] = (float)out[c];
+      }
+    }
+  }
+
+  //---------- timer wheel ----------
+  vector<uint32_t> &slot = Wheel[Tick % SM500_WHEEL_SLOTS];
+  size_t kept = 0;
+  for (size_t k=0; k<slot.size(); k++)
+  {
+    uint32_t i = slot[k];
+
+    if (Nodes[i].Due != Tick)
+    {
+      slot[kept++] = i;     //due on a later turn of the wheel
+      continue;
+    }
+    Fire(i, Values);
+    Nodes[i].Due += Nodes[i].Decimation;
+    if (Nodes[i].Due % SM500_WHEEL_SLOTS == Tick % SM500_WHEEL_SLOTS)
+      slot[kept++] = i;     //same slot, next turn
+    else
+      Wheel[Nodes[i].Due % SM500_WHEEL_SLOTS].push_back(i);
+  }
+  slot.resize(kept);
+
+  PushThread = pthread_self();
+  bDelivering = true;
+  pthread_mutex_unlock(&Lock);
+
+  Deliver(Values);
+
+  pthread_mutex_lock(&Lock);
+  bDelivering = false;
+  pthread_mutex_unlock(&Lock);
+  pthread_mutex_unlock(&PushLock);
+}
+
+
+/* ===========================================================================
+Gathers the sensors of each subscriber of a node into the outbox.  Called
+with the lock held.
+=========================================================================== */
+void Csm500Subscriptions::Fire(uint32_t Node, const sm500_sensor_values &Values)
+{
+  const rate_node &node = Nodes[Node];
+  const float *row = (Node == 0) ? Values.Value : node.Row;
+
+  for (size_t k=0; k<node.Subscribers.size(); k++)
+  {
+    uint32_t id = node.Subscribers[k];
+    const subscription &s = Subscriptions[id];
+    pending_frame frame;
+
+    frame.Subscription = id;
+    frame.Decimation = node.Decimation;
+    frame.First = OutIds.size();
+    frame.NumSensors = s.SensorId.size();
+    OutIds.resize(frame.First + frame.NumSensors);
+    OutValues.resize(frame.First + frame.NumSensors);
+
+    const uint32_t *ids = s.SensorId.data();
+    float *values = OutValues.data() + frame.First;
+    memcpy(OutIds.data() + frame.First, ids, frame.NumSensors * sizeof(uint32_t));
+    for (uint32_t i=0; i<frame.NumSensors; i++)
+      values[i] = (ids[i] < NumColumns) ? row[ids[i]] : NAN;
+    Outbox.push_back(frame);
+  }
+}
+
+
+/* ===========================================================================
+Calls the subscribers of the outbox back, without the lock.  A subscription
+ended by an earlier callback of the same frame is skipped.
+=========================================================================== */
+void Csm500Subscriptions::Deliver(const sm500_sensor_values &Values)
+{
+  for (size_t k=0; k<Outbox.size(); k++)
+  {
+    const pending_frame &pending = Outbox[k];
+    sm500_subscription_frame frame;
+    callback_t callback;
+    void *context;
+
+    pthread_mutex_lock(&Lock);
+    const subscription &s = Subscriptions[pending.Subscription];
+    bool active = s.Active;
+    callback = s.Callback;
+    context = s.Context;
+    pthread_mutex_unlock(&Lock);
+    if (!active)
+      continue;
+
+    frame.Subscription = pending.Subscription;
+    frame.Decimation = pending.Decimation;
+    frame.SerialNumber = Values.SerialNumber;
+    frame.TimestampSec = Values.TimestampSec;
+    frame.TimestampNsec = Values.TimestampNsec;
+    frame.NumSensors = pending.NumSensors;
+    frame.SensorId = OutIds.data() + pending.First;
+    frame.Value = OutValues.data() + pending.First;
+    callback(context, frame);
+  }
+}
+
+
+
+/* ===========================================================================
+=========================================================================== */
+//----------  ----------
+//----------  ----------
@@ -0,0 +1,149 @@
+/* ===========================================================================
+ Csm500Subscriptions.h
+ sm500 rate-converting subscription scheduler class definition
+
+ Clients subscribe to a set of sensors at an output rate (e.g. 1 kHz raw
+ for control, 100 Hz for display, 1 Hz for a historian) and receive
+ averaged frames of those sensors at that rate through a callback.
+
+ Every distinct rate is a node of a decimation tree.  A node block-averages
+ the output of its parent, the node of the largest rate it divides (1 kHz
+ -> 100 Hz -> 10 Hz -> 1 Hz), so every intermediate rate is computed once
+ for all its clients and the low rates cost little more than their
+ parents.  The frames are emitted by a timer wheel indexed by frame count:
+ each node is due every Decimation frames, and firing it hands the node
+ output to each of its subscribers.  A client subscribing at an existing
+ rate only adds the gathering of its sensors at that rate.
+
+ Nodes average every sensor of the frame.  A subscription introducing a
+ new rate adds its node under the largest existing rate it divides, in
+ phase with that parent, so the other nodes keep their averages.  The
+ tree is only rebuilt, restarting them, when the number of sensors of the
+ frames changes.  Callbacks run
+ on the thread calling Push(), after the frame has been processed and
+ without the subscription lock: they may (un)subscribe, but not Push().
+
+ Jerry Volcy
+
+ Copyright (c) 2013, Micron Optics, Inc.
+=========================================================================== */
+
+#ifndef CSM500SUBSCRIPTIONS_H
+#define CSM500SUBSCRIPTIONS_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+#include <stdint.h>
+#include <pthread.h>
+#include "sm500_data_structures.h"
+#include "Csm500Averager.h"
+#include "Csm500UnitConverter.h"
+
+/* ===========================================================================
+Constants
+=========================================================================== */
+#define SM500_WHEEL_SLOTS           256     //timer wheel slots (frames)
+
+
+/* ===========================================================================
+Defaults
+=========================================================================== */
+#define SM500_DEFAULT_FRAME_RATE    1000.0  //Hz, rate at which Push() is called
+
+
+/* ===========================================================================
+Frame handed to a subscriber
+=========================================================================== */
+struct sm500_subscription_frame
+{
+  uint32_t Subscription;                  //id returned by Subscribe()
+  uint32_t Decimation;                    //# of input frames averaged
+  uint64_t SerialNumber;                  //S/N and timestamp of the last input frame
+  uint32_t TimestampSec;
+  uint32_t TimestampNsec;
+  uint32_t NumSensors;
+  const uint32_t *SensorId;               //the subscribed sensors...
+  const float *Value;                     //...and their averaged values
+};
+
+
+/* ===========================================================================
+Csm500Subscriptions class definition
+=========================================================================== */
+class Csm500Subscriptions
+{
+  public:
+    typedef void (*callback_t)(void *Context, const sm500_subscription_frame &Frame);
+
+    //----------  ----------
+    Csm500Subscriptions();                  //constructor
+    virtual ~Csm500Subscriptions();         //destructor
+    void SetFrameRate(double Hz);           //rate at which frames are pushed
+    uint32_t Subscribe(const uint32_t *SensorId, uint32_t NumSensors, double RateHz, callback_t Callback, void *Context);
+    void Unsubscribe(uint32_t Subscription);
+    void Push(const sm500_sensor_values &Values);   //feeds one frame; emits the frames due
+    uint32_t GetNumRates(void);             //# of nodes in the decimation tree
+
+  protected:
+    struct rate_node
+    {
+      uint32_t Decimation;                  //relative to the input frames
+      int32_t Parent;                       //-1: fed by the input frames
+      Csm500Averager *Averager;             //averages Decimation / Parent.Decimation parent rows
+      float *Row;                           //last output, as float
+      bool Ready;                           //an output completed with the current frame
+      uint64_t Due;                         //next frame at which the node fires
+      vector<uint32_t> Subscribers;
+    };
+
+    struct subscription
+    {
+      bool Active;
+      uint32_t Decimation;
+      vector<uint32_t> SensorId;
+      callback_t Callback;
+      void *Context;
+    };
+
+    struct pending_frame                    //a frame due, delivered once the lock is released
+    {
+      uint32_t Subscription;
+      uint32_t Decimation;
+      uint32_t First;                       //index of its sensors in OutIds / OutValues
+      uint32_t NumSensors;
+    };
+
+    void Rebuild(uint32_t NumColumns);      //rebuilds the tree and the wheel
+    void AddNode(uint32_t Decimation);      //adds a rate to the current tree
+    static void FreeNodes(vector<rate_node> &Nodes);
+    void Fire(uint32_t Node, const sm500_sensor_values &Values);   //queues the frames of a node's subscribers
+    void Deliver(const sm500_sensor_values &Values);                //calls the subscribers back
+
+    double FrameRate;
+    vector<rate_node> Nodes;                //parents before children; node 0 is the input (decimation 1)
+    vector<subscription> Subscriptions;
+    vector<uint32_t> Wheel[SM500_WHEEL_SLOTS];
+    uint64_t Tick;                          //# of frames pushed
+    uint32_t NumColumns;
+    bool Dirty;                             //no tree yet: built by the first Push()
+    pthread_mutex_t Lock;                   //subscriptions and tree
+    pthread_mutex_t PushLock;               //one Push() at a time; Unsubscribe() waits for its callbacks
+    pthread_t PushThread;                   //thread delivering, while bDelivering
+    bool bDelivering;
+    vector<pending_frame> Outbox;           //PushLock
+    vector<uint32_t> OutIds;
+    vector<float> OutValues;
+};
+
+#endif // #ifndef CSM500SUBSCRIPTIONS_H
+
+
+
+/* ===========================================================================
+=========================================================================== */
+//----------  ----------
+//----------  ----------
@@ -0,0 +1,457 @@
+/* ===========================================================================
+ Csm500UnitConverter.cpp
+ sm500 engineering unit conversion class implementation
+
+ The kernels are templates on the polynomial order and on the temperature
+ compensation, so the Horner loop is fully unrolled and uncompensated
+ groups carry no compensation code.  Sensor wavelengths (and references)
+ are gathered by sensor id and the values written back by id.
+
+ Jerry Volcy
+
+ Copyright (c) 2013, Micron Optics, Inc.
+=========================================================================== */
+#include <iostream>
+#include <string>
+#include <algorithm>
+
+using namespace std;
+
+#include <errno.h>
+#include <string.h>
+#include <math.h>
+#include <sched.h>
+#include "Csm500UnitConverter.h"
+#include "sm500_common.h"
+
+
+/* ===========================================================================
+Scalar kernel
+=========================================================================== */
+template <int Order, bool Compensated>
+static void ConvertScalarRange(const Csm500UnitConverter::group &Group, const float *Wavelength, float *Value,
+                               uint32_t Begin, uint32_t End)
+{
+  for (uint32_t i=Begin; i<End; i++)
+  {
+    float d = Wavelength[Group.Id[i]] - Group.Lambda0[i];
+    float v = Group.Coef[Order][i];
+
+    for (int k=Order-1; k>=0; k--)
+      v = v * d + Group.Coef[k][i];
+    if (Compensated)
+      v -= Group.K[i] * (Value[Group.RefId[i]] - Group.T0[i]);
+    Value[Group.Id[i]] = v;
+  }
+}
+
+template <int Order, bool Compensated>
+static void ConvertScalar(const Csm500UnitConverter::group &Group, const float *Wavelength, float *Value, uint32_t Count)
+{
+  ConvertScalarRange<Order, Compensated>(Group, Wavelength, Value, 0, Count);
+}
+
+
+#ifdef SM500_HAVE_X86_SIMD
+/* ===========================================================================
+AVX2 kernel (8 sensors per iteration)
+=========================================================================== */
+template <int Order, bool Compensated>
+SM500_TARGET_AVX2
+static void ConvertAvx2(const Csm500UnitConverter::group &Group, const float *Wavelength, float *Value, uint32_t Count)
+{
+  const uint32_t n = Count;
+  const uint32_t *id = Group.Id.data();
+  SM500_ALIGN(32) float out[8];
+  uint32_t i = 0;
+
+  for (; i+8<=n; i+=8)
+  {
+    __m256i idx = _mm256_loadu_si256((const __m256i*)(id + i));
+    __m256 d = _mm256_sub_ps(_mm256_i32gather_ps(Wavelength, idx, 4), _mm256_loadu_ps(Group.Lambda0.data() + i));
+    __m256 v = _mm256_loadu_ps(Group.Coef[Order].data() + i);
+
+    for (int k=Order-1; k>=0; k--)
+      v = _mm256_add_ps(_mm256_mul_ps(v, d), _mm256_loadu_ps(Group.Coef[k].data() + i));
+    if (Compensated)
+    {
+      __m256i ref = _mm256_loadu_si256((const __m256i*)(Group.RefId.data() + i));
+      __m256 t = _mm256_sub_ps(_mm256_i32gather_ps(Value, ref, 4), _mm256_loadu_ps(Group.T0.data() + i));
+      v = _mm256_sub_ps(v, _mm256_mul_ps(_mm256_loadu_ps(Group.K.data() + i), t));
+    }
+
+    _mm256_store_ps(out, v);
+    for (int k=0; k<8; k++)
+      Value[id[i + k]] = out[k];
+  }
+
+  _mm256_zeroupper();    //avoid the AVX to SSE transition penalty in the tail
+  ConvertScalarRange<Order, Compensated>(Group, Wavelength, Value, i, n);
+}
+#endif
+
+
+/* ===========================================================================
+Csm500UnitConverter constructor
+=========================================================================== */
+Csm500UnitConverter::Csm500UnitConverter()
+{
+  for (uint32_t id=0; id<SM500_MAX_SENSORS; id++)
+    ResetSensor(Sensor[id]);
+  for (int s=0; s<SM500_CONV_SLOTS; s++)
+  {
+    Slot[s].MaxRefId = 0;
+    Readers[s] = 0;
+  }
+  Current = 0;
+  pthread_mutex_init(&WriterLock, 0);
+  UpdateDepth = 0;
+
+  //the AVX2 gathers do not beat the scalar kernels on every CPU: scalar unless asked for
+  SetSimdLevel(SM500_SIMD_SCALAR);
+}
+
+
+/* ===========================================================================
+destructor
+=========================================================================== */
+Csm500UnitConverter::~Csm500UnitConverter()
+{
+  pthread_mutex_destroy(&WriterLock);
+}
+
+
+/* ===========================================================================
+Sets a sensor's conversion and recompiles the groups (at EndUpdate() in a
+batch).  A conversion making the references circular (ELOOP), or groups
+that cannot be compiled, put the previous conversion back and throw.
+Called with the writer lock held.
+=========================================================================== */
+void Csm500UnitConverter::Update(uint32_t Id, const sensor_conversion &Conversion)
+{
+  sensor_conversion previous = Sensor[Id];
+  Sensor[Id] = Conversion;
+  try
+  {
+    GetLevel(Id);                           //a new loop goes through Id
+    if (UpdateDepth == 0)
+      Compile();
+  }
+  catch (...)
+  {
+    Sensor[Id] = previous;
+    throw;
+  }
+}
+
+
+/* ===========================================================================
+Batches the setters: the groups are compiled once, when the outermost
+EndUpdate() is reached, rather than by every setter.  Until then Convert()
+keeps using the groups compiled before BeginUpdate().
+=========================================================================== */
+void Csm500UnitConverter::BeginUpdate(void)
+{
+  pthread_mutex_lock(&WriterLock);
+  UpdateDepth++;
+  pthread_mutex_unlock(&WriterLock);
+}
+
+void Csm500UnitConverter::EndUpdate(void)
+{
+  pthread_mutex_lock(&WriterLock);
+  if ((UpdateDepth > 0) && (--UpdateDepth == 0))
+  {
+    try
+    {
+      Compile();
+    }
+    catch (...)
+    {
+      pthread_mutex_unlock(&WriterLock);
+      throw;
+    }
+  }
+  pthread_mutex_unlock(&WriterLock);
+}
+
+
+/* ===========================================================================
+Sets the conversion of a sensor.  Coef holds Order+1 coefficients, constant
+term first, applied to the wavelength shift from Lambda0 (nm).  Keeps the
+sensor's temperature reference.
+=========================================================================== */
+void Csm500UnitConverter::SetSensor(uint32_t Id, sm500_sensor_type Type, double Lambda0, const double *Coef, uint32_t Order)
+{
+  if ((Id >= SM500_MAX_SENSORS) || (Order == 0) || (Order > SM500_CONV_MAX_ORDER))
+    throw EINVAL;
+
+  pthread_mutex_lock(&WriterLock);         //held from the read to the update, so that concurrent setters compose
+  sensor_conversion s = Sensor[Id];
+  s.Type = Type;
+  s.Order = Order;
+  s.Lambda0 = (float)Lambda0;
+  for (uint32_t k=0; k<=SM500_CONV_MAX_ORDER; k++)
+    s.Coef[k] = (k <= Order) ? (float)Coef[k] : 0.0f;
+  try
+  {
+    Update(Id, s);
+  }
+  catch (...)
+  {
+    pthread_mutex_unlock(&WriterLock);
+    throw;
+  }
+  pthread_mutex_unlock(&WriterLock);
+}
+
+
+/* ===========================================================================
+Makes the value of a sensor compensated by the temperature reported by
+sensor RefId: K * (T(RefId) - T0) is subtracted from it.  Throws ELOOP if
+the references would become circular.
+=========================================================================== */
+void Csm500UnitConverter::SetTemperatureReference(uint32_t Id, uint32_t RefId, double K, double T0)
+{
+  if ((Id >= SM500_MAX_SENSORS) || (RefId == Id) || ((RefId >= SM500_MAX_SENSORS) && (RefId != SM500_NO_REFERENCE)))
+    throw EINVAL;
+
+  pthread_mutex_lock(&WriterLock);
+  sensor_conversion s = Sensor[Id];
+  s.RefId = RefId;
+  s.K = (float)K;
+  s.T0 = (float)T0;
+  try
+  {
+    Update(Id, s);
+  }
+  catch (...)
+  {
+    pthread_mutex_unlock(&WriterLock);
+    throw;
+  }
+  pthread_mutex_unlock(&WriterLock);
+}
+
+
+/* ===========================================================================
+Removes the conversion of a sensor, which then reports its wavelength
+=========================================================================== */
+void Csm500UnitConverter::ClearSensor(uint32_t Id)
+{
+  if (Id >= SM500_MAX_SENSORS)
+    throw EINVAL;
+
+  sensor_conversion s;
+  ResetSensor(s);
+  pthread_mutex_lock(&WriterLock);
+  try
+  {
+    Update(Id, s);
+  }
+  catch (...)
+  {
+    pthread_mutex_unlock(&WriterLock);
+    throw;
+  }
+  pthread_mutex_unlock(&WriterLock);
+}
+
+
+/* ===========================================================================
+The conversion of a sensor without settings: its wavelength
+=========================================================================== */
+void Csm500UnitConverter::ResetSensor(sensor_conversion &Sensor)
+{
+  Sensor.Type = SM500_SENSOR_WAVELENGTH;
+  Sensor.Order = 1;
+  Sensor.Lambda0 = 0.0f;
+  memset(Sensor.Coef, 0, sizeof(Sensor.Coef));
+  Sensor.Coef[1] = 1.0f;
+  Sensor.RefId = SM500_NO_REFERENCE;
+  Sensor.K = 0.0f;
+  Sensor.T0 = 0.0f;
+}
+
+
+/* ===========================================================================
+Returns the type (unit) of a sensor
+=========================================================================== */
+sm500_sensor_type Csm500UnitConverter::GetType(uint32_t Id)
+{
+  if (Id >= SM500_MAX_SENSORS)
+    throw EINVAL;
+
+  pthread_mutex_lock(&WriterLock);
+  sm500_sensor_type type = Sensor[Id].Type;
+  pthread_mutex_unlock(&WriterLock);
+  return type;
+}
+
+
+/* ===========================================================================
+Returns the dependency level of a sensor: 0 without reference, 1 + the
+level of its reference otherwise.  Throws ELOOP on circular references.
+=========================================================================== */
+uint32_t Csm500UnitConverter::GetLevel(uint32_t Id)
+{
+  uint32_t level = 0;
+
+  while (Sensor[Id].RefId != SM500_NO_REFERENCE)
+  {
+    Id = Sensor[Id].RefId;
+    if (++level >= SM500_MAX_SENSORS)
+      throw ELOOP;
+  }
+  return level;
+}
+
+
+/* ===========================================================================
+Rebuilds the groups, one per (level, order, compensation) in level order,
+in a slot that is neither current nor in use by Convert(), then publishes
+it.  Called with the writer lock held; the slot is only published once
+complete, so a throw leaves the current groups in place.
+=========================================================================== */
+void Csm500UnitConverter::Compile(void)
+{
+  int slot = -1;
+
+  while (slot < 0)
+  {
+    int current = Current.load();
+    for (int s=0; (s<SM500_CONV_SLOTS) && (slot < 0); s++)
+      if ((s != current) && (Readers[s].load() == 0))
+        slot = s;
+    if (slot < 0)
+      sched_yield();                        //Convert() holds a slot for one frame only
+  }
+
+  vector<group> &Groups = Slot[slot].Groups;
+  Groups.clear();
+  Slot[slot].MaxRefId = 0;
+
+  for (uint32_t id=0; id<SM500_MAX_SENSORS; id++)
+  {
+    const sensor_conversion &s = Sensor[id];
+    bool compensated = (s.RefId != SM500_NO_REFERENCE);
+    uint32_t level = GetLevel(id);
+    size_t g = 0;
+
+    while ((g < Groups.size()) &&
+           ((Groups[g].Level != level) || (Groups[g].Order != s.Order) || (Groups[g].Compensated != compensated)))
+      g++;
+    if (g == Groups.size())
+    {
+      Groups.push_back(group());
+      Groups[g].Level = level;
+      Groups[g].Order = s.Order;
+      Groups[g].Compensated = compensated;
+      Groups[g].Kernel = Kernels[s.Order][compensated];
+    }
+
+    group &grp = Groups[g];
+    if (compensated && (s.RefId + 1 > Slot[slot].MaxRefId))
+      Slot[slot].MaxRefId = s.RefId + 1;
+    grp.Id.push_back(id);
+    grp.RefId.push_back(compensated ? s.RefId : 0);
+    grp.Lambda0.push_back(s.Lambda0);
+    for (uint32_t k=0; k<=SM500_CONV_MAX_ORDER; k++)
+      grp.Coef[k].push_back(s.Coef[k]);
+    grp.K.push_back(s.K);
+    grp.T0.push_back(s.T0);
+  }
+
+  stable_sort(Groups.begin(), Groups.end(), [](const group &a, const group &b) { return a.Level < b.Level; });
+  Current.store(slot);
+}
+
+
+/* ===========================================================================
+Converts the sensors of a frame with the current groups, pinned for the
+time of the frame.  Sensors referencing a sensor beyond the frame's get
+NaN (their reference reads as NaN).
+=========================================================================== */
+void Csm500UnitConverter::Convert(const sm500_sensor_frame &Sensors, sm500_sensor_values &Values)
+{
+  uint32_t n = (Sensors.NumSensors < SM500_MAX_SENSORS) ? Sensors.NumSensors : SM500_MAX_SENSORS;
+  int slot;
+
+  for (;;)
+  {
+    slot = Current.load();
+    Readers[slot].fetch_add(1);
+    if (Current.load() == slot)
+      break;
+    Readers[slot].fetch_sub(1);             //a new compilation was published in between; retry
+  }
+  const compiled &table = Slot[slot];
+
+  Values.SerialNumber = Sensors.SerialNumber;
+  Values.TimestampSec = Sensors.TimestampSec;
+  Values.TimestampNsec = Sensors.TimestampNsec;
+  Values.NumSensors = n;
+  for (uint32_t id=n; id<table.MaxRefId; id++)
+    Values.Value[id] = NAN;
+
+  for (size_t g=0; g<table.Groups.size(); g++)
+  {
+    const group &grp = table.Groups[g];
+    uint32_t count = lower_bound(grp.Id.begin(), grp.Id.end(), n) - grp.Id.begin();
+    if (count)
+      grp.Kernel(grp, Sensors.Wavelength, Values.Value, count);
+  }
+
+  Readers[slot].fetch_sub(1);
+}
+
+
+/* ===========================================================================
+Forces a kernel flavor.  Requests beyond what the CPU supports are clamped
+to the best supported flavor.  There is no SSE2 flavor (the sensors are
+gathered by id); the scalar kernels are used at that level.
+=========================================================================== */
+void Csm500UnitConverter::SetSimdLevel(sm500_simd_level level)
+{
+  sm500_simd_level supported = sm500_detect_simd();
+
+  if (level > supported)
+    level = supported;
+
+  pthread_mutex_lock(&WriterLock);
+  SimdLevel = level;
+  Kernels[0][0] = Kernels[0][1] = 0;    //order 0 is not used
+  switch (level)
+  {
+#ifdef SM500_HAVE_X86_SIMD
+    case SM500_SIMD_AVX2:
+      Kernels[1][0] = ConvertAvx2<1, false>; Kernels[1][1] = ConvertAvx2<1, true>;
+      Kernels[2][0] = ConvertAvx2<2, false>; Kernels[2][1] = ConvertAvx2<2, true>;
+      Kernels[3][0] = ConvertAvx2<3, false>; Kernels[3][1] = ConvertAvx2<3, true>;
+      break;
+#endif
+    default:
+      Kernels[1][0] = ConvertScalar<1, false>; Kernels[1][1] = ConvertScalar<1, true>;
+      Kernels[2][0] = ConvertScalar<2, false>; Kernels[2][1] = ConvertScalar<2, true>;
+      Kernels[3][0] = ConvertScalar<3, false>; Kernels[3][1] = ConvertScalar<3, true>;
+      break;
+  }
+  Compile();
+  pthread_mutex_unlock(&WriterLock);
+}
+
+
+/* ===========================================================================
+Returns the kernel flavor in use
+=========================================================================== */
+sm500_simd_level Csm500UnitConverter::GetSimdLevel(void)
+{
+  return SimdLevel;
+}
+
+
+
+/* ===========================================================================
+=========================================================================== */
+//----------  ----------
+//----------  ----------
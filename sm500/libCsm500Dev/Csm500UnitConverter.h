@@ -0,0 +1,163 @@
+/* ===========================================================================
+ Csm500UnitConverter.h
+ sm500 engineering unit conversion class definition
+
+ The unit converter turns the assigned sensor wavelengths of a frame
+ (sm500_sensor_frame) into engineering units.  Every sensor follows
+
+   d     = Wavelength - Lambda0                       (nm)
+   Value = c0 + c1 d + ... + cN d^N  -  K (Tref - T0)
+
+ where N is the polynomial order (1 to 3) and Tref the converted value of
+ another sensor, the temperature reference of the sensor (if any).  The
+ sensor type (temperature, strain, pressure) only documents the unit of
+ Value; e.g. a temperature sensor is c0 = T0, c1 = 1/sensitivity, and a
+ strain gauge is c1 = 1/(Lambda0 * gauge factor) with K its apparent
+ strain per degree, referenced to a temperature sensor.  Sensors without
+ a conversion report their wavelength.
+
+ The sensors are compiled into groups sharing the same polynomial order,
+ compensation and dependency level: temperature references are converted
+ before the sensors that use them.  Each group is evaluated by one
+ vectorized kernel instantiated for its order, so a frame converts in a
+ single pass over the groups with no per-sensor dispatch.
+
+ The groups are compiled by the setters, into a slot no reader is using,
+ and published by switching the current slot (as Csm500Calibration does),
+ so Convert() neither allocates nor throws.  Setters called between
+ BeginUpdate() and EndUpdate() compile once, at EndUpdate().  A setting
+ that would make the references circular is refused (ELOOP) and leaves
+ the conversion as it was.  Every sensor id is compiled; a frame converts the sensors it
+ holds, and a reference to a sensor beyond them makes the value NaN.
+
+ Jerry Volcy
+
+ Copyright (c) 2013, Micron Optics, Inc.
+=========================================================================== */
+
+#ifndef CSM500UNITCONVERTER_H
+#define CSM500UNITCONVERTER_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+#include <stdint.h>
+#include <pthread.h>
+#include <atomic>
+#include "sm500_data_structures.h"
+#include "sm500_simd.h"
+#include "Csm500SensorMap.h"
+
+/* ===========================================================================
+Constants
+=========================================================================== */
+#define SM500_CONV_MAX_ORDER        3
+#define SM500_NO_REFERENCE          0xFFFFFFFF    //sensor without temperature reference
+#define SM500_CONV_SLOTS            3             //compiled group sets
+
+
+/* ===========================================================================
+Sensor types (unit of the converted value)
+=========================================================================== */
+enum sm500_sensor_type
+{
+  SM500_SENSOR_WAVELENGTH = 0,  //nm (no conversion)
+  SM500_SENSOR_TEMPERATURE,     //degrees C
+  SM500_SENSOR_STRAIN,          //micro-strain
+  SM500_SENSOR_PRESSURE         //as calibrated
+};
+
+
+/* ===========================================================================
+Converted values, one entry per sensor (indexed by sensor id)
+=========================================================================== */
+struct sm500_sensor_values
+{
+  uint64_t SerialNumber;                              //data set S/N
+  uint32_t TimestampSec;                              //driver timestamp
+  uint32_t TimestampNsec;
+  uint32_t NumSensors;
+
+  float Value[SM500_MAX_SENSORS] SM500_ALIGN(SM500_SIMD_ALIGN);   //NaN for missing sensors
+};
+
+
+/* ===========================================================================
+Csm500UnitConverter class definition
+=========================================================================== */
+class Csm500UnitConverter
+{
+  public:
+    //----------  ----------
+    Csm500UnitConverter();                  //constructor
+    virtual ~Csm500UnitConverter();         //destructor
+    void SetSensor(uint32_t Id, sm500_sensor_type Type, double Lambda0, const double *Coef, uint32_t Order);  //Order+1 coefficients, c0 first
+    void SetTemperatureReference(uint32_t Id, uint32_t RefId, double K, double T0);  //RefId = SM500_NO_REFERENCE removes it
+    void ClearSensor(uint32_t Id);          //back to reporting the wavelength
+    void BeginUpdate(void);                 //defers the compilation of the setters that follow...
+    void EndUpdate(void);                   //...to the matching EndUpdate() (calls nest)
+    sm500_sensor_type GetType(uint32_t Id);
+    void Convert(const sm500_sensor_frame &Sensors, sm500_sensor_values &Values);  //converts a frame (never throws)
+    void SetSimdLevel(sm500_simd_level level);  //forces a kernel flavor (clamped to what the CPU supports; scalar by default)
+    sm500_simd_level GetSimdLevel(void);        //returns the kernel flavor in use
+
+    //one group, structure-of-arrays
+    struct group
+    {
+      uint32_t Order;
+      bool Compensated;
+      uint32_t Level;                       //dependency level: references are in lower levels
+      vector<uint32_t> Id;
+      vector<uint32_t> RefId;
+      vector<float> Lambda0;
+      vector<float> Coef[SM500_CONV_MAX_ORDER + 1];
+      vector<float> K;
+      vector<float> T0;
+      void (*Kernel)(const group &Group, const float *Wavelength, float *Value, uint32_t Count);
+    };
+    typedef void (*kernel_t)(const group &Group, const float *Wavelength, float *Value, uint32_t Count);  //the first Count sensors
+
+  protected:
+    struct sensor_conversion
+    {
+      sm500_sensor_type Type;
+      uint32_t Order;
+      float Lambda0;
+      float Coef[SM500_CONV_MAX_ORDER + 1];
+      uint32_t RefId;
+      float K;
+      float T0;
+    };
+
+    struct compiled
+    {
+      vector<group> Groups;                 //in dependency order, sensors by increasing id
+      uint32_t MaxRefId;                    //largest reference id + 1 (0: no references)
+    };
+
+    static void ResetSensor(sensor_conversion &Sensor);
+    void Compile(void);                     //compiles Sensor into a free slot and publishes it; writer lock held
+    void Update(uint32_t Id, const sensor_conversion &Conversion);  //sets a sensor and recompiles, or throws and keeps the old setting; writer lock held
+    uint32_t GetLevel(uint32_t Id);
+
+    sensor_conversion Sensor[SM500_MAX_SENSORS];    //writer lock
+    compiled Slot[SM500_CONV_SLOTS];
+    std::atomic<int> Readers[SM500_CONV_SLOTS];
+    std::atomic<int> Current;
+    pthread_mutex_t WriterLock;
+    uint32_t UpdateDepth;                   //writer lock; BeginUpdate() nesting
+    sm500_simd_level SimdLevel;
+    kernel_t Kernels[SM500_CONV_MAX_ORDER + 1][2];  //[Order][Compensated]
+};
+
+#endif // #ifndef CSM500UNITCONVERTER_H
+
+
+
+/* ===========================================================================
+=========================================================================== */
+//----------  ----------
+//----------  ----------
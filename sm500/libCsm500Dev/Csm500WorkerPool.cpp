@@ -0,0 +1,229 @@
+/* ===========================================================================
+ Csm500WorkerPool.cpp
+ sm500 worker thread pool class implementation
+
+ Jerry Volcy
+
+ Copyright (c) 2013, Micron Optics, Inc.
+=========================================================================== */
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+#include <errno.h>
+#include <unistd.h>
+#include "Csm500WorkerPool.h"
+#include "sm500_common.h"
+
+
+/* ===========================================================================
+Csm500WorkerPool constructor
+=========================================================================== */
+Csm500WorkerPool::Csm500WorkerPool()
+{
+  NumThreads = 0;
+  Generation = 0;
+  bStop = false;
+  Task = 0;
+  Context = 0;
+  NumTasks = 0;
+  NextTask = 0;
+  Remaining = 0;
+
+  pthread_mutex_init(&RunLock, 0);
+  pthread_mutex_init(&Lock, 0);
+  pthread_cond_init(&WorkCond, 0);
+  pthread_cond_init(&DoneCond, 0);
+}
+
+
+/* ===========================================================================
+destructor
+=========================================================================== */
+Csm500WorkerPool::~Csm500WorkerPool()
+{
+  Stop();
+  pthread_cond_destroy(&DoneCond);
+  pthread_cond_destroy(&WorkCond);
+  pthread_mutex_destroy(&Lock);
+  pthread_mutex_destroy(&RunLock);
+}
+
+
+/* ===========================================================================
+Starts the worker threads.  With NumThreads = 0, one thread is started per
+online core, less one for the calling thread (which also does work in Run()).
+=========================================================================== */
+void Csm500WorkerPool::Start(uint32_t NumThreads)
+{
+  Stop();
+
+  if (NumThreads == 0)
+  {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    NumThreads = (cores > 1) ? (uint32_t)(cores - 1) : 0;
+  }
+  if (NumThreads > SM500_MAX_WORKER_THREADS)
+    NumThreads = SM500_MAX_WORKER_THREADS;
+
+  bStop = false;
+  for (uint32_t i=0; i<NumThreads; i++)
+  {
+    int err = pthread_create(&Threads[i], 0, ThreadEntry, this);
+    if (err)
+    {
+      Stop();
+      throw err;
+    }
+    this->NumThreads = i + 1;
+  }
+}
+
+
+/* ===========================================================================
+Stops and joins the worker threads
+=========================================================================== */
+void Csm500WorkerPool::Stop(void)
+{
+  if (NumThreads == 0) return;    //nothing to do
+
+  pthread_mutex_lock(&Lock);
+  bStop = true;
+  pthread_cond_broadcast(&WorkCond);
+  pthread_mutex_unlock(&Lock);
+
+  for (uint32_t i=0; i<NumThreads; i++)
+    pthread_join(Threads[i], 0);
+
+  NumThreads = 0;
+}
+
+
+/* ===========================================================================
+Runs Task(Context, i) for i in [0, NumTasks) across the worker threads and
+the calling thread.  Returns when every task has completed.  Concurrent
+callers are serialized: a batch posted while another runs waits for it.
+=========================================================================== */
+void Csm500WorkerPool::Run(uint32_t NumTasks, task_t Task, void *Context)
+{
+  if (NumTasks == 0) return;
+
+  pthread_mutex_lock(&RunLock);
+  pthread_mutex_lock(&Lock);
+  uint32_t gen = ++Generation;
+  this->Task = Task;
+  this->Context = Context;
+  this->NumTasks = NumTasks;
+  Remaining = NumTasks;
+  NextTask = (uint64_t)gen << 32;
+  if (NumThreads && NumTasks > 1)
+    pthread_cond_broadcast(&WorkCond);
+  pthread_mutex_unlock(&Lock);
+
+  Drain(gen, Task, Context, NumTasks);
+
+  //wait for the tasks picked up by the workers to complete
+  pthread_mutex_lock(&Lock);
+  while (Remaining.load())
+    pthread_cond_wait(&DoneCond, &Lock);
+  pthread_mutex_unlock(&Lock);
+  pthread_mutex_unlock(&RunLock);
+}
+
+
+/* ===========================================================================
+Returns the # of worker threads (not counting the caller of Run())
+=========================================================================== */
+uint32_t Csm500WorkerPool::GetNumThreads(void)
+{
+  return NumThreads;
+}
+
+
+/* ===========================================================================
+Returns the handle of worker thread Index (0 to GetNumThreads()-1), e.g. to
+set its scheduling
+=========================================================================== */
+pthread_t Csm500WorkerPool::GetThread(uint32_t Index)
+{
+  if (Index >= NumThreads)
+    throw EINVAL;
+  return Threads[Index];
+}
+
+
+/* ===========================================================================
+Executes tasks of batch Gen until none are left to hand out.  The batch
+generation is part of NextTask, so a worker that wakes up late can never
+pick up a task of a newer batch with the parameters of an older one.
+=========================================================================== */
+void Csm500WorkerPool::Drain(uint32_t Gen, task_t Task, void *Context, uint32_t NumTasks)
+{
+  uint64_t next = NextTask.load();
+
+  for (;;)
+  {
+    if ((uint32_t)(next >> 32) != Gen || (uint32_t)next >= NumTasks)
+      break;
+    if (!NextTask.compare_exchange_weak(next, next + 1))
+      continue;   //next was reloaded
+
+    Task(Context, (uint32_t)next);
+    if (Remaining.fetch_sub(1) == 1)
+    {
+      pthread_mutex_lock(&Lock);
+      pthread_cond_broadcast(&DoneCond);
+      pthread_mutex_unlock(&Lock);
+    }
+    next = NextTask.load();
+  }
+}
+
+
+/* ===========================================================================
+Worker thread body: wait for a new batch, drain it, repeat
+=========================================================================== */
+void Csm500WorkerPool::WorkerLoop(void)
+{
+  uint32_t seen;
+
+  pthread_mutex_lock(&Lock);
+  seen = Generation;
+  for (;;)
+  {
+    while (!bStop && Generation == seen)
+      pthread_cond_wait(&WorkCond, &Lock);
+
+    if (bStop) break;
+
+    //take a snapshot of the batch while holding the lock
+    seen = Generation;
+    task_t task = Task;
+    void *context = Context;
+    uint32_t num_tasks = NumTasks;
+    pthread_mutex_unlock(&Lock);
+
+    Drain(seen, task, context, num_tasks);
+
+    pthread_mutex_lock(&Lock);
+  }
+  pthread_mutex_unlock(&Lock);
+}
+
+
+/* ===========================================================================
+pthread entry point
+=========================================================================== */
+void* Csm500WorkerPool::ThreadEntry(void *Arg)
+{
+  ((Csm500WorkerPool*)Arg)->WorkerLoop();
+  return 0;
+}
+
+
+
+/* ===========================================================================
+=========================================================================== */
+//----------  ----------
+//----------  ----------
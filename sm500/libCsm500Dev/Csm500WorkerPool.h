@@ -0,0 +1,81 @@
+/* ===========================================================================
+ Csm500WorkerPool.h
+ sm500 worker thread pool class definition
+
+ A small fork/join pool used to spread per-channel (or per-block) data
+ processing across cores.  Run() hands a set of indexed tasks to the
+ worker threads, takes part in the work itself and returns once every
+ task has completed.  A pool with no threads simply runs the tasks on
+ the calling thread.  Several threads may share a pool (e.g. the peaks and
+ the FS threads of Csm500Dev): their batches run one after the other.
+
+ Jerry Volcy
+
+ Copyright (c) 2013, Micron Optics, Inc.
+=========================================================================== */
+
+#ifndef CSM500WORKERPOOL_H
+#define CSM500WORKERPOOL_H
+
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+#include <stdint.h>
+#include <pthread.h>
+#include <atomic>
+
+/* ===========================================================================
+Constants
+=========================================================================== */
+#define SM500_MAX_WORKER_THREADS  16
+
+
+/* ===========================================================================
+Csm500WorkerPool class definition
+=========================================================================== */
+class Csm500WorkerPool
+{
+  public:
+    typedef void (*task_t)(void *Context, uint32_t Index);
+
+    //----------  ----------
+    Csm500WorkerPool();                     //constructor
+    virtual ~Csm500WorkerPool();            //destructor
+    void Start(uint32_t NumThreads);        //starts NumThreads worker threads (0 = one per core, less the caller)
+    void Stop(void);                        //stops and joins the worker threads
+    void Run(uint32_t NumTasks, task_t Task, void *Context);  //runs Task(Context, 0..NumTasks-1) and waits for completion
+    uint32_t GetNumThreads(void);           //returns the # of worker threads (not counting the caller)
+    pthread_t GetThread(uint32_t Index);    //returns the handle of a worker thread
+
+  protected:
+    static void* ThreadEntry(void *Arg);
+    void WorkerLoop(void);
+    void Drain(uint32_t Gen, task_t Task, void *Context, uint32_t NumTasks);  //executes tasks of batch Gen until none are left
+
+    pthread_t Threads[SM500_MAX_WORKER_THREADS];
+    uint32_t NumThreads;
+
+    pthread_mutex_t RunLock;                //one batch at a time
+    pthread_mutex_t Lock;
+    pthread_cond_t WorkCond;                //signalled when a new batch of tasks is posted
+    pthread_cond_t DoneCond;                //signalled when the last task of a batch completes
+    uint32_t Generation;                    //incremented for every batch
+    bool bStop;
+
+    task_t Task;
+    void *Context;
+    uint32_t NumTasks;
+    std::atomic<uint64_t> NextTask;         //batch generation (high DWORD) and index of the next task to hand out
+    std::atomic<uint32_t> Remaining;        //# of tasks not yet completed
+};
+
+#endif // #ifndef CSM500WORKERPOOL_H
+
+
+
+/* ===========================================================================
+=========================================================================== */
+//----------  ----------
+//----------  ----------
@@ -0,0 +1,307 @@
+/* ===========================================================================
+ sm500_capi.cpp
+ C interface to the sm500 device
+
+ The reads go through the non-throwing Try... functions; the other entry
+ points catch what the C++ classes throw (errno codes) and return it.  The
+ frames of a batch are copied straight from the DMA buffers into the
+ caller's buffer; the last one is also kept as the stream's latest
+ snapshot.
+
+ Jerry Volcy
+
+ Copyright (c) 2013, Micron Optics, Inc.
+=========================================================================== */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <new>
+
+using namespace std;
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include "sm500_capi.h"
+#include "Csm500Dev.h"
+#include "Csm500ReplayDev.h"
+#include "sm500_common.h"
+
+static_assert(sizeof(sm500_frame_meta) == 48, "sm500_frame_meta is part of the ABI");
+static_assert(SM500_CAPI_CHANNELS == SM500_NUM_CHANNELS, "SM500_CAPI_CHANNELS must match the hardware");
+
+
+/* ===========================================================================
+Handle
+=========================================================================== */
+struct sm500_handle
+{
+  Csm500Dev *Dev;
+  pthread_mutex_t Lock[SM500_CAPI_NUM_STREAMS];       //latest snapshots
+  vector<uint8_t> Latest[SM500_CAPI_NUM_STREAMS];
+  sm500_frame_meta LatestMeta[SM500_CAPI_NUM_STREAMS];
+  bool HaveLatest[SM500_CAPI_NUM_STREAMS];
+};
+
+
+/* ===========================================================================
+Frame sizes
+=========================================================================== */
+static const uint32_t FrameBytes[SM500_CAPI_NUM_STREAMS] = { sm500_peaks_format::FrameBytes, sm500_fs_format::FrameBytes };
+
+
+/* ===========================================================================
+Allocates a handle over Dev
+=========================================================================== */
+static sm500_handle* NewHandle(Csm500Dev *Dev)
+{
+  sm500_handle *handle = new sm500_handle;
+
+  handle->Dev = Dev;
+  for (int s=0; s<SM500_CAPI_NUM_STREAMS; s++)
+  {
+    pthread_mutex_init(&handle->Lock[s], 0);
+    handle->Latest[s].resize(FrameBytes[s]);
+    memset(&handle->LatestMeta[s], 0, sizeof(sm500_frame_meta));
+    handle->HaveLatest[s] = false;
+  }
+  return handle;
+}
+
+
+/* ===========================================================================
+Fills the metadata of a frame
+=========================================================================== */
+static void FillMeta(int Stream, const void *Frame, sm500_frame_meta &Meta)
+{
+  struct timespec ts;
+  Csm500PeaksFrame header(Frame);           //the header is common to both streams
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  Meta.SerialNumber = header.SerialNumber();
+  Meta.HostNs = (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+  Meta.TimestampSec = header.TimestampSec();
+  Meta.TimestampNsec = header.TimestampNsec();
+  Meta.Status = header.Status();
+  for (uint32_t ch=0; ch<SM500_CAPI_CHANNELS; ch++)
+    Meta.NumPeaks[ch] = (Stream == SM500_CAPI_PEAKS) ? header.NumPeaks(ch) : 0;
+  Meta.Reserved = 0;
+}
+
+
+/* ===========================================================================
+Returns SM500_CAPI_VERSION, for the callers to check they were built
+against this interface
+=========================================================================== */
+int sm500_capi_version(void)
+{
+  return SM500_CAPI_VERSION;
+}
+
+
+/* ===========================================================================
+Opens the card through DevNode (0 = the default node) and starts the data
+acquisition
+=========================================================================== */
+int sm500_open(const char *DevNode, sm500_handle **Handle)
+{
+  Csm500Dev *dev = 0;
+
+  if (!Handle)
+    return EINVAL;
+  *Handle = 0;
+  try
+  {
+    dev = new Csm500Dev;
+    if (DevNode)
+      dev->Init(DevNode);
+    else
+      dev->Init();
+    *Handle = NewHandle(dev);
+    return 0;
+  }
+  catch (int err)
+  {
+    delete dev;
+    return err;
+  }
+  catch (std::bad_alloc&)
+  {
+    delete dev;
+    return ENOMEM;
+  }
+}
+
+
+/* ===========================================================================
+Opens the recording Path (see Csm500Recorder) instead of the card, paced
+at the recorded timestamps (Realtime != 0) or as fast as it is read
+=========================================================================== */
+int sm500_open_replay(const char *Path, int Realtime, sm500_handle **Handle)
+{
+  Csm500ReplayDev *dev = 0;
+
+  if (!Path || !Handle)
+    return EINVAL;
+  *Handle = 0;
+  try
+  {
+    dev = new Csm500ReplayDev;
+    dev->SetPacing(Realtime ? SM500_REPLAY_REALTIME : SM500_REPLAY_FAST);
+    dev->Init(Path);
+    *Handle = NewHandle(dev);
+    return 0;
+  }
+  catch (int err)
+  {
+    delete dev;
+    return err;
+  }
+  catch (std::bad_alloc&)
+  {
+    delete dev;
+    return ENOMEM;
+  }
+}
+
+
+/* ===========================================================================
+Stops the acquisition and frees the handle
+=========================================================================== */
+void sm500_close(sm500_handle *Handle)
+{
+  if (!Handle)
+    return;
+  try
+  {
+    Handle->Dev->Close();
+  }
+  catch (...)
+  {
+  }
+  delete Handle->Dev;
+  for (int s=0; s<SM500_CAPI_NUM_STREAMS; s++)
+    pthread_mutex_destroy(&Handle->Lock[s]);
+  delete Handle;
+}
+
+
+/* ===========================================================================
+Returns the size of a frame of Stream (0 for an unknown stream)
+=========================================================================== */
+uint32_t sm500_frame_bytes(int Stream)
+{
+  if ((Stream < 0) || (Stream >= SM500_CAPI_NUM_STREAMS))
+    return 0;
+  return FrameBytes[Stream];
+}
+
+
+/* ===========================================================================
+Waits for MinFrames frames of Stream, then takes those already available,
+up to MaxFrames in total, and copies them back to back into Buffer (and
+their metadata into Meta, unless 0).  MinFrames 0 never blocks.
+*NumFrames is the # of frames copied, also when an error is returned
+(e.g. ECANCELED part way through a batch).
+=========================================================================== */
+int sm500_read(sm500_handle *Handle, int Stream, void *Buffer, uint32_t BufferBytes,
+               uint32_t MinFrames, uint32_t MaxFrames, sm500_frame_meta *Meta, uint32_t *NumFrames)
+{
+  uint32_t n = 0;
+  int err = 0;
+
+  if (NumFrames)
+    *NumFrames = 0;
+  if (!Handle || !Buffer || !NumFrames || (Stream < 0) || (Stream >= SM500_CAPI_NUM_STREAMS) ||
+      (MaxFrames == 0) || (MinFrames > MaxFrames) || ((uint64_t)MaxFrames * FrameBytes[Stream] > BufferBytes))
+    return EINVAL;
+
+  uint32_t bytes = FrameBytes[Stream];
+  uint8_t *out = (uint8_t*)Buffer;
+  for (n=0; n<MaxFrames; n++)
+  {
+    if (n >= MinFrames)
+    {
+      sm500_result<bool> ready = (Stream == SM500_CAPI_PEAKS) ? Handle->Dev->TryPeaksDataReady() : Handle->Dev->TryFsDataReady();
+      if (!ready.Ok())
+      {
+        err = ready.Errno;
+        break;
+      }
+      if (!ready.Value)
+        break;
+    }
+
+    sm500_result<const void*> frame = (Stream == SM500_CAPI_PEAKS) ? Handle->Dev->TryGetPeaksData() : Handle->Dev->TryGetFsData();
+    if (!frame.Ok())
+    {
+      err = frame.Errno;
+      break;
+    }
+    memcpy(out + (size_t)n * bytes, frame.Value, bytes);
+    if (Meta)
+      FillMeta(Stream, frame.Value, Meta[n]);
+  }
+  *NumFrames = n;
+
+  //---------- latest snapshot ----------
+  if (n)
+  {
+    pthread_mutex_lock(&Handle->Lock[Stream]);
+    memcpy(&Handle->Latest[Stream][0], out + (size_t)(n - 1) * bytes, bytes);
+    if (Meta)
+      Handle->LatestMeta[Stream] = Meta[n - 1];
+    else
+      FillMeta(Stream, out + (size_t)(n - 1) * bytes, Handle->LatestMeta[Stream]);
+    Handle->HaveLatest[Stream] = true;
+    pthread_mutex_unlock(&Handle->Lock[Stream]);
+  }
+  return err;
+}
+
+
+/* ===========================================================================
+Copies the last frame of Stream returned by sm500_read() (from any
+thread) into Buffer.  Does not wait and does not consume a frame: for
+displays and pollers that only want the newest data.  Returns EAGAIN
+until a frame was read.
+=========================================================================== */
+int sm500_get_latest(sm500_handle *Handle, int Stream, void *Buffer, uint32_t BufferBytes, sm500_frame_meta *Meta)
+{
+  if (!Handle || !Buffer || (Stream < 0) || (Stream >= SM500_CAPI_NUM_STREAMS) || (BufferBytes < FrameBytes[Stream]))
+    return EINVAL;
+
+  pthread_mutex_lock(&Handle->Lock[Stream]);
+  if (!Handle->HaveLatest[Stream])
+  {
+    pthread_mutex_unlock(&Handle->Lock[Stream]);
+    return EAGAIN;
+  }
+  memcpy(Buffer, &Handle->Latest[Stream][0], FrameBytes[Stream]);
+  if (Meta)
+    *Meta = Handle->LatestMeta[Stream];
+  pthread_mutex_unlock(&Handle->Lock[Stream]);
+  return 0;
+}
+
+
+/* ===========================================================================
+Releases the threads blocked in sm500_read()
+=========================================================================== */
+int sm500_cancel_reads(sm500_handle *Handle)
+{
+  if (!Handle)
+    return EINVAL;
+  return (Handle->Dev->TryCancelReads() == SM500_OK) ? 0 : EIO;
+}
+
+
+
+/* ===========================================================================
+=========================================================================== */
+//----------  ----------
+//----------  ----------
@@ -0,0 +1,89 @@
+/* ===========================================================================
+ sm500_capi.h
+ C interface to the sm500 device, for P/Invoke and other foreign callers
+
+ A flat extern "C" layer over Csm500Dev (or Csm500ReplayDev), exported by
+ libCsm500Dev.so.  The data calls work on batches: sm500_read() waits for
+ frames and copies up to MaxFrames of them, with their metadata, into
+ buffers the caller provides (pinned managed arrays), so crossing the
+ managed/native boundary costs one call per batch instead of several per
+ frame.
+
+ Every function returns 0 or an errno code (the exceptions of the C++
+ classes never cross this interface).  The structures are blittable: fixed
+ size fields, no pointers, 8 byte aligned.
+
+ From C#:
+
+   [DllImport("libCsm500Dev")] static extern int sm500_open(string DevNode, out IntPtr Handle);
+   [DllImport("libCsm500Dev")] static extern unsafe int sm500_read(IntPtr Handle, int Stream,
+       byte* Buffer, uint BufferBytes, uint MinFrames, uint MaxFrames,
+       sm500_frame_meta* Meta, out uint NumFrames);
+
+ A handle can be read from two threads, one per stream.
+
+ Jerry Volcy
+
+ Copyright (c) 2013, Micron Optics, Inc.
+=========================================================================== */
+#ifndef SM500_CAPI_H
+#define SM500_CAPI_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* ===========================================================================
+Constants
+=========================================================================== */
+#define SM500_CAPI_VERSION            1
+#define SM500_CAPI_PEAKS              0           //streams
+#define SM500_CAPI_FS                 1
+#define SM500_CAPI_NUM_STREAMS        2
+#define SM500_CAPI_CHANNELS           4
+
+
+/* ===========================================================================
+Frame metadata (one per frame copied)
+=========================================================================== */
+typedef struct sm500_frame_meta
+{
+  uint64_t SerialNumber;          //DMA header S/N
+  uint64_t HostNs;                //CLOCK_REALTIME when the frame was read, ns since the epoch
+  uint32_t TimestampSec;          //DMA header timestamp
+  uint32_t TimestampNsec;
+  uint32_t Status;                //DMA header status
+  uint32_t NumPeaks[SM500_CAPI_CHANNELS];   //peaks stream: valid peaks per channel; FS stream: 0
+  uint32_t Reserved;
+} sm500_frame_meta;
+
+typedef struct sm500_handle sm500_handle;
+
+
+/* ===========================================================================
+Functions
+=========================================================================== */
+int sm500_capi_version(void);                                     //SM500_CAPI_VERSION
+int sm500_open(const char *DevNode, sm500_handle **Handle);       //opens the card (DevNode 0 = default node) and starts acquisition
+int sm500_open_replay(const char *Path, int Realtime, sm500_handle **Handle);  //serves a recording instead of the card
+void sm500_close(sm500_handle *Handle);
+uint32_t sm500_frame_bytes(int Stream);                           //size of a frame of the stream
+int sm500_read(sm500_handle *Handle, int Stream, void *Buffer, uint32_t BufferBytes,
+               uint32_t MinFrames, uint32_t MaxFrames, sm500_frame_meta *Meta, uint32_t *NumFrames);
+int sm500_get_latest(sm500_handle *Handle, int Stream, void *Buffer, uint32_t BufferBytes, sm500_frame_meta *Meta);
+int sm500_cancel_reads(sm500_handle *Handle);                     //blocked sm500_read() calls return ECANCELED
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif    //#ifndef SM500_CAPI_H
+
+
+
+/* ===========================================================================
+=========================================================================== */
+//----------  ----------
+//----------  ----------
@@ -1,9 +1,36 @@
 /* ===========================================================================
  sm500_data_structures.h
- 
+
  This file houses data structures that describe the format of the data DMAed
  from the FPGA.
 
+ Both the peaks and the FS DMA buffers start with a 256 DWORD header.  The
+ header fields below are common to both buffer types:
+
+   DWORD     Field
+   -----     -----
+   0         Low DWORD of the data set S/N (same as SM500_REG_DMASNLO)
+   1         High DWORD of the data set S/N (same as SM500_REG_DMASNHI)
+   2         Status
+   4..4+N-1  Peaks buffers only: # of valid peaks for channels 0..N-1
+   16, 17    Timestamp (sec, nsec).  Written by the driver ISR at the
+             offset reported by SM500_REG_TSOFST.
+
+ In the peaks buffer, the header is followed by one fixed-size block of
+ peak words per channel.  In the FS buffer, the header is followed by one
+ fixed-size block of 16-bit samples per channel.
+
+ Peak words are packed as follows:
+
+   bits 31..12  peak position, in 1/16th of an FS sample (20.4 fixed point)
+   bits 11..0   peak amplitude
+
+ The layouts are described by templates specialized on the # of channels
+ and the # of peaks/points per channel.  All offsets are compile-time
+ constants, so the views below compile down to straight loads.  The layout
+ actually reported by the hardware is checked against these constants by
+ Csm500Dev::Init().
+
  Jerry Volcy
 
  Copyright (c) 2013, Micron Optics, Inc.
@@ -13,32 +40,179 @@
 
 #include <stdint.h>
 
-struct dma_peaks_header
-  {
-    uint32_t header_data[256]; //<============== This is a temporary place holder
-  };
+/* ===========================================================================
+Constants
+=========================================================================== */
+#define SM500_NUM_CHANNELS            4       //# of optical channels
+#define SM500_MAX_PEAKS_PER_CHANNEL   128     //size of a channel block in the peaks buffer
+#define SM500_NUM_FS_POINTS           20000   //# of FS samples per channel
+#define SM500_DMA_HEADER_DWORDS       256     //size of the DMA buffer header
+
+//---------- peak word fields ----------
+#define SM500_PEAK_POS_SHIFT          12
+#define SM500_PEAK_POS_FRAC_BITS      4
+#define SM500_PEAK_AMP_MASK           0x00000FFF
+
+
+/* ===========================================================================
+DMA header layout (common to peaks and FS buffers).  Offsets are in DWORDs.
+=========================================================================== */
+struct sm500_header_layout
+{
+  static constexpr uint32_t HeaderDwords = SM500_DMA_HEADER_DWORDS;
+  static constexpr uint32_t SerialLoOffset32 = 0;
+  static constexpr uint32_t SerialHiOffset32 = 1;
+  static constexpr uint32_t StatusOffset32 = 2;
+  static constexpr uint32_t PeakCountOffset32 = 4;
+  static constexpr uint32_t TimestampOffset32 = 16;   //must match SM500_REG_TSOFST >> 2
+};
+
+
+/* ===========================================================================
+Peaks buffer layout
+=========================================================================== */
+template <uint32_t NumChannels, uint32_t MaxPeaks>
+struct sm500_peaks_layout : public sm500_header_layout
+{
+  static_assert(PeakCountOffset32 + NumChannels <= TimestampOffset32, "peak counts overlap the timestamp");
+
+  static constexpr uint32_t Channels = NumChannels;
+  static constexpr uint32_t PeaksPerChannel = MaxPeaks;
+  static constexpr uint32_t DataOffset32 = HeaderDwords;
+  static constexpr uint32_t FrameDwords = DataOffset32 + NumChannels * MaxPeaks;
+  static constexpr uint32_t FrameBytes = FrameDwords * sizeof(uint32_t);
+
+  static constexpr uint32_t ChannelOffset32(uint32_t ch) { return DataOffset32 + ch * MaxPeaks; }
+};
+
+
+/* ===========================================================================
+FS buffer layout
+=========================================================================== */
+template <uint32_t NumChannels, uint32_t NumPoints>
+struct sm500_fs_layout : public sm500_header_layout
+{
+  static constexpr uint32_t Channels = NumChannels;
+  static constexpr uint32_t PointsPerChannel = NumPoints;
+  static constexpr uint32_t DataOffset16 = HeaderDwords * 2;
+  static constexpr uint32_t FrameBytes = (DataOffset16 + NumChannels * NumPoints) * sizeof(uint16_t);
+
+  static constexpr uint32_t ChannelOffset16(uint32_t ch) { return DataOffset16 + ch * NumPoints; }
+};
+
+
+//---------- the sm500 formats ----------
+typedef sm500_peaks_layout<SM500_NUM_CHANNELS, SM500_MAX_PEAKS_PER_CHANNEL> sm500_peaks_format;
+typedef sm500_fs_layout<SM500_NUM_CHANNELS, SM500_NUM_FS_POINTS> sm500_fs_format;
+
+
+/* ===========================================================================
+Peak word decoding (scalar reference)
+=========================================================================== */
+static inline float sm500_peak_position(uint32_t PeakWord)
+{
+  return (float)(PeakWord >> SM500_PEAK_POS_SHIFT) * (1.0f / (1 << SM500_PEAK_POS_FRAC_BITS));
+}
+
+static inline uint32_t sm500_peak_amplitude(uint32_t PeakWord)
+{
+  return PeakWord & SM500_PEAK_AMP_MASK;
+}
+
+
+/* ===========================================================================
+Csm500PeaksView
+A read-only view over a DMAed peaks buffer.  The view holds nothing but
+the buffer pointer; the per-channel iterators are plain pointers.
+=========================================================================== */
+template <class Layout>
+class Csm500PeaksView
+{
+  public:
+    typedef const uint32_t* const_iterator;
+
+    explicit Csm500PeaksView(const void *Buffer) : Data((const uint32_t*)Buffer) {}
+
+    uint64_t SerialNumber(void) const
+    {
+      return ((uint64_t)Data[Layout::SerialHiOffset32] << 32) | Data[Layout::SerialLoOffset32];
+    }
+    uint32_t Status(void) const         { return Data[Layout::StatusOffset32]; }
+    uint32_t TimestampSec(void) const   { return Data[Layout::TimestampOffset32]; }
+    uint32_t TimestampNsec(void) const  { return Data[Layout::TimestampOffset32 + 1]; }
+
+    //# of valid peaks on a channel (clamped to the size of the channel block)
+    uint32_t NumPeaks(uint32_t ch) const
+    {
+      uint32_t n = Data[Layout::PeakCountOffset32 + ch];
+      return n < Layout::PeaksPerChannel ? n : Layout::PeaksPerChannel;
+    }
+
+    const_iterator begin(uint32_t ch) const { return Data + Layout::ChannelOffset32(ch); }
+    const_iterator end(uint32_t ch) const   { return begin(ch) + NumPeaks(ch); }
+
+    //---------- channel-specialized accessors ----------
+    template <uint32_t Ch> uint32_t NumPeaks(void) const
+    {
+      static_assert(Ch < Layout::Channels, "channel out of range");
+      return NumPeaks(Ch);
+    }
+    template <uint32_t Ch> const_iterator begin(void) const
+    {
+      static_assert(Ch < Layout::Channels, "channel out of range");
+      return Data + Layout::ChannelOffset32(Ch);
+    }
+    template <uint32_t Ch> const_iterator end(void) const { return begin<Ch>() + NumPeaks<Ch>(); }
+
+    const uint32_t* Raw(void) const { return Data; }
+
+  private:
+    const uint32_t *Data;
+};
+
+
+/* ===========================================================================
+Csm500FsView
+A read-only view over a DMAed FS buffer.
+=========================================================================== */
+template <class Layout>
+class Csm500FsView
+{
+  public:
+    typedef const uint16_t* const_iterator;
+
+    explicit Csm500FsView(const void *Buffer) : Data((const uint32_t*)Buffer) {}
+
+    uint64_t SerialNumber(void) const
+    {
+      return ((uint64_t)Data[Layout::SerialHiOffset32] << 32) | Data[Layout::SerialLoOffset32];
+    }
+    uint32_t Status(void) const         { return Data[Layout::StatusOffset32]; }
+    uint32_t TimestampSec(void) const   { return Data[Layout::TimestampOffset32]; }
+    uint32_t TimestampNsec(void) const  { return Data[Layout::TimestampOffset32 + 1]; }
+    uint32_t NumPoints(void) const      { return Layout::PointsPerChannel; }
 
+    const_iterator begin(uint32_t ch) const { return (const uint16_t*)Data + Layout::ChannelOffset16(ch); }
+    const_iterator end(uint32_t ch) const   { return begin(ch) + Layout::PointsPerChannel; }
 
-struct dma_peaks_data
-  {
-    struct dma_peaks_header header;
-    //uint32_t *data;
-    uint32_t data[512]; //<============== This is a temporary value
-  };
+    //---------- channel-specialized accessors ----------
+    template <uint32_t Ch> const_iterator begin(void) const
+    {
+      static_assert(Ch < Layout::Channels, "channel out of range");
+      return (const uint16_t*)Data + Layout::ChannelOffset16(Ch);
+    }
+    template <uint32_t Ch> const_iterator end(void) const { return begin<Ch>() + Layout::PointsPerChannel; }
 
+    const uint32_t* Raw(void) const { return Data; }
 
-struct dma_fs_header
-  {
-    uint32_t header_data[256]; //<============== This is a temporary place holder
-  };
+  private:
+    const uint32_t *Data;
+};
 
 
-struct dma_fs_data
-  {
-    struct dma_fs_header header;
-    //uint16_t **data;
-    uint16_t data[4][20000]; //<============== These are temporary values
-  };
+//---------- views over the sm500 formats ----------
+typedef Csm500PeaksView<sm500_peaks_format> Csm500PeaksFrame;
+typedef Csm500FsView<sm500_fs_format> Csm500FsFrame;
 
 
-#endif    //#ifndef SM500_DATA_STRUCTURE_H
\ No newline at end of file
+#endif    //#ifndef SM500_DATA_STRUCTURE_H
@@ -0,0 +1,69 @@
+/* ===========================================================================
+ sm500_simd.h
+
+ Helpers shared by the vectorized data processing kernels.  Each kernel is
+ compiled in scalar, SSE2 and AVX2 flavors (the SIMD flavors through GCC
+ function target attributes, so the library itself does not need to be
+ built with -mavx2).  The flavor is picked once at run time from the
+ capabilities of the CPU.
+
+ Jerry Volcy
+
+ Copyright (c) 2013, Micron Optics, Inc.
+=========================================================================== */
+#ifndef SM500_SIMD_H
+#define SM500_SIMD_H
+
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SM500_HAVE_X86_SIMD
+#include <immintrin.h>
+#define SM500_TARGET_SSE2   __attribute__((target("sse2")))
+#define SM500_TARGET_AVX2   __attribute__((target("avx2")))
+#endif
+
+#define SM500_ALIGN(n)      __attribute__((aligned(n)))
+#define SM500_SIMD_ALIGN    32    //alignment suitable for AVX2 loads/stores
+
+
+/* ===========================================================================
+SIMD levels, in increasing order of capability
+=========================================================================== */
+enum sm500_simd_level
+{
+  SM500_SIMD_SCALAR = 0,
+  SM500_SIMD_SSE2,
+  SM500_SIMD_AVX2
+};
+
+
+/* ===========================================================================
+Returns the best SIMD level supported by the running CPU
+=========================================================================== */
+static inline sm500_simd_level sm500_detect_simd(void)
+{
+#ifdef SM500_HAVE_X86_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) return SM500_SIMD_AVX2;
+  if (__builtin_cpu_supports("sse2")) return SM500_SIMD_SSE2;
+#endif
+  return SM500_SIMD_SCALAR;
+}
+
+
+/* ===========================================================================
+Returns a printable name for a SIMD level
+=========================================================================== */
+static inline const char* sm500_simd_name(sm500_simd_level level)
+{
+  switch (level)
+  {
+    case SM500_SIMD_AVX2: return "avx2";
+    case SM500_SIMD_SSE2: return "sse2";
+    default:              return "scalar";
+  }
+}
+
+
+#endif    //#ifndef SM500_SIMD_H
@@ -0,0 +1,101 @@
+/* ===========================================================================
+ sm500_status.h
+ Status codes and results of the non-throwing (Try...) device functions
+
+ The acquisition path has noexcept counterparts of the functions that
+ throw an errno (TryGetPeaksData() for GetPeaksData(), ...).  They return
+ an sm500_result: a status, the errno it was mapped from, and the value
+ when the status is SM500_OK.  Nothing is allocated and nothing unwinds,
+ so a read cancelled at shutdown returns like any other read.
+
+   sm500_result<const void*> r = Dev.TryGetPeaksData();
+   if (r.Status == SM500_CANCELLED)
+     break;
+   if (r.Ok())
+     Process(r.Value);
+
+ Jerry Volcy
+
+ Copyright (c) 2013, Micron Optics, Inc.
+=========================================================================== */
+#ifndef SM500_STATUS_H
+#define SM500_STATUS_H
+
+#include <stdint.h>
+#include <errno.h>
+
+/* ===========================================================================
+Status codes
+=========================================================================== */
+enum sm500_status
+{
+  SM500_OK = 0,
+  SM500_CANCELLED,                //CancelReads() released the read (ECANCELED)
+  SM500_INTERRUPTED,              //a signal interrupted the wait (EINTR): retry
+  SM500_TIMED_OUT,                //ETIMEDOUT
+  SM500_NO_DATA,                  //end of a recording (ENODATA)
+  SM500_NOT_OPEN,                 //the device is not initialized (EBADF)
+  SM500_INVALID,                  //invalid argument (EINVAL)
+  SM500_FAILED                    //any other error: see Errno
+};
+
+
+/* ===========================================================================
+errno to status mapping
+=========================================================================== */
+static inline sm500_status sm500_status_from_errno(int Errno)
+{
+  switch (Errno)
+  {
+    case 0:         return SM500_OK;
+    case ECANCELED: return SM500_CANCELLED;
+    case EINTR:     return SM500_INTERRUPTED;
+    case ETIMEDOUT: return SM500_TIMED_OUT;
+    case ENODATA:   return SM500_NO_DATA;
+    case EBADF:     return SM500_NOT_OPEN;
+    case EINVAL:    return SM500_INVALID;
+    default:        return SM500_FAILED;
+  }
+}
+
+static inline const char* sm500_status_name(sm500_status Status)
+{
+  switch (Status)
+  {
+    case SM500_OK:          return "ok";
+    case SM500_CANCELLED:   return "cancelled";
+    case SM500_INTERRUPTED: return "interrupted";
+    case SM500_TIMED_OUT:   return "timed out";
+    case SM500_NO_DATA:     return "no data";
+    case SM500_NOT_OPEN:    return "not open";
+    case SM500_INVALID:     return "invalid argument";
+    default:                return "failed";
+  }
+}
+
+
+/* ===========================================================================
+Result of a Try... function
+=========================================================================== */
+template <class T>
+struct sm500_result
+{
+  sm500_status Status;
+  int Errno;                      //0 when Status is SM500_OK
+  T Value;                        //valid when Status is SM500_OK
+
+  bool Ok(void) const { return Status == SM500_OK; }
+
+  static sm500_result Success(T Value)  { sm500_result r = { SM500_OK, 0, Value }; return r; }
+  static sm500_result Error(int Errno)  { sm500_result r = { sm500_status_from_errno(Errno), Errno, T() }; return r; }
+};
+
+
+#endif    //#ifndef SM500_STATUS_H
+
+
+
+/* ===========================================================================
+=========================================================================== */
+//----------  ----------
+//----------  ----------
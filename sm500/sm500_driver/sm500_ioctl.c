@@ -23,12 +23,16 @@ int sm500_ioctl(struct inode *inode, struct file *file, unsigned int cmd,
                 unsigned long arg_)
 {
   int err = 0;
+  uint32_t i;
+  struct sm500_ioctl_regs_arg regs;
+  struct sm500_ioctl_reg_arg reg_list[SM500_IOC_MAX_REGS];
   
 //---------- union of possible argument types ----------
   union
   {
     void *data;
     struct sm500_ioctl_reg_arg  *io;
+    struct sm500_ioctl_regs_arg *regs;
     uint8_t *pdata8;
     uint16_t *pdata16;
     uint32_t *pdata32;
@@ -69,6 +73,27 @@ int sm500_ioctl(struct inode *inode, struct file *file, unsigned int cmd,
        sm500_iowrite32(arg.io->reg, (uint32_t)(arg.io->value));
        break;
        
+    case SM500_IOC_WRITE_REGS32:
+       //copied once: the caller could change them while they are written
+       if (copy_from_user(&regs, arg.regs, sizeof(regs)))
+       {
+         err = -EFAULT;
+         break;
+       }
+       if (regs.count > SM500_IOC_MAX_REGS)
+       {
+         err = -EINVAL;
+         break;
+       }
+       if (copy_from_user(reg_list, regs.regs, regs.count * sizeof(reg_list[0])))
+       {
+         err = -EFAULT;
+         break;
+       }
+       for (i=0; i<regs.count; i++)
+         sm500_iowrite32(reg_list[i].reg, reg_list[i].value);
+       break;
+       
     case SM500_IOC_SET_MMAP_INDEX:
        sm500.mmap_index = arg.data32;
        SM500_DBG( MSG("mmap_index set to %d\n", sm500.mmap_index); )
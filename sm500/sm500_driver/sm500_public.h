@@ -40,6 +40,15 @@ struct sm500_ioctl_reg_arg
 		uint32_t value;
 	};
 
+/* structure for writing several 32-bit registers in one call
+(SM500_IOC_WRITE_REGS32), in order. */
+#define SM500_IOC_MAX_REGS  64
+struct sm500_ioctl_regs_arg
+  {
+    uint32_t count;                     /* <= SM500_IOC_MAX_REGS */
+    struct sm500_ioctl_reg_arg *regs;
+  };
+
 
 /* ===========================================================================
 	IOCTLs
@@ -68,6 +77,8 @@ struct sm500_ioctl_reg_arg
 #define SM500_IOC_CANCEL_READ				_IO(SM500_IOC_MAGIC,SM500_IOC_BASE+12)		//Eventually, use this to cancel both peak and fs reads
 /* Note that,  SM500_IOC_CANCEL_READ simply wakes up readers on both the peaks and fs wait queues. */
 
+#define SM500_IOC_WRITE_REGS32			_IOW(SM500_IOC_MAGIC,SM500_IOC_BASE+13, unsigned long)	//batched SM500_IOC_WRITE_REG32
+
 
 
 /* ===========================================================================
@@ -23,12 +23,17 @@ int main(int argc, char **argv)
   
   /* Test GetPeaksData() */  
   
-  const uint32_t *peaks_data;  
   for (int i=0; i<8; i++)  // 10 acquistion = timestamp should increment by 0.01 second & expect to see ~ 10 interrupts
   {
-    peaks_data = (const uint32_t*)sm500.GetPeaksData();
-    for (int j=0; j<8; j++)
-      cout<<hex<<"Peaks["<<i<<"]["<<j<<"] = "<<peaks_data[j]<<"\n";
+    Csm500PeaksFrame frame = sm500.GetPeaksFrame();
+    cout<<dec<<"Peaks["<<i<<"] S/N = "<<frame.SerialNumber()<<", t = "<<frame.TimestampSec()<<"."<<frame.TimestampNsec()<<"\n";
+    for (uint32_t ch=0; ch<SM500_NUM_CHANNELS; ch++)
+    {
+      cout<<dec<<"  ch"<<ch<<": "<<frame.NumPeaks(ch)<<" peaks";
+      for (Csm500PeaksFrame::const_iterator pk=frame.begin(ch); pk!=frame.end(ch); ++pk)
+        cout<<" "<<sm500_peak_position(*pk);
+      cout<<"\n";
+    }
   }
 
 